@@ -0,0 +1,66 @@
+/** @file AcquisitionClock.cpp */
+#include <algorithm>
+#include <cmath>
+
+// Local
+#include "AcquisitionClock.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+const double SECONDS_PER_DAY = 24 * 3600;
+
+} // namespace
+
+AcquisitionClock::AcquisitionClock(const ScanParameters& params)
+    : start_(params.acquisitionStartSeconds()), spacing_(0),
+      phases_(std::max(params.acquiredYRes, 1)), echoTrainLength_(std::max(params.echoTrainLength, 1u)),
+      slicesPerPass_(1), is3D_(params.is3DAcquisition)
+{
+    unsigned int const slices = std::max(params.numSlices, 1);
+    unsigned int const passes = std::max(params.numAcquisitions, 1);
+    slicesPerPass_ = is3D_ ? 1 : std::max(slices / passes, 1u);
+
+    if (params.repetitionTimeUs > 0) {
+        spacing_ = params.repetitionTimeUs * 1e-6 / slicesPerPass_;
+    }
+
+    // Slices are excited in acquisition order, not in geometric order
+    acquiredOrder_.resize(slices);
+    for (unsigned int n = 0; n < slices; n++) {
+        acquiredOrder_[n] = n;
+    }
+    for (unsigned int acquired = 0; acquired < slices; acquired++) {
+        unsigned int const geometric = params.sliceTable.GeometricSliceNumber(acquired);
+        if (geometric < slices) {
+            acquiredOrder_[geometric] = acquired;
+        }
+    }
+}
+
+uint32_t AcquisitionClock::stamp(uint64_t excitation) const
+{
+    double const seconds = std::fmod(start_ + excitation * spacing_, SECONDS_PER_DAY);
+    return static_cast<uint32_t>(seconds / TIME_STAMP_TICK_SECONDS + 0.5);
+}
+
+uint64_t AcquisitionClock::pfileExcitation(unsigned int slice, unsigned int phase) const
+{
+    // Every echo train one TR; P-files do not tell which lines a train
+    // acquired, so consecutive ones are taken
+    unsigned int const trains = (phases_ + echoTrainLength_ - 1) / echoTrainLength_;
+    unsigned int const train  = phase / echoTrainLength_;
+
+    if (is3D_) {
+        // One partition after the other
+        return uint64_t(slice) * trains + train;
+    }
+
+    unsigned int const position = (slice < acquiredOrder_.size()) ? acquiredOrder_[slice] : slice;
+    unsigned int const pass     = position / slicesPerPass_;
+    unsigned int const inPass   = position % slicesPerPass_;
+    return (uint64_t(pass) * trains + train) * slicesPerPass_ + inPass;
+}
+
+} // namespace GEToIsmrmrd
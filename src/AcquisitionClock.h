@@ -0,0 +1,69 @@
+/** @file AcquisitionClock.h */
+#ifndef ACQUISITION_CLOCK_H
+#define ACQUISITION_CLOCK_H
+
+#include <stdint.h>
+
+#include <vector>
+
+// Local
+#include "ScanParameters.h"
+
+namespace GEToIsmrmrd {
+
+/** Duration of one acquisition_time_stamp tick, the 2.5 ms ISMRMRD consumers assume by default */
+const double TIME_STAMP_TICK_SECONDS = 0.0025;
+
+/**
+ * Acquisition time stamps derived from the sequence timing
+ *
+ * Neither P-files nor ScanArchives carry per-line acquisition times, but
+ * lines are acquired excitation by excitation: every TR excites each slice
+ * of a pass once (a 3D slab once), evenly spread over the TR.  Converters
+ * number the excitations - from the packet order, or from the slice
+ * acquisition order and phase line of a P-file - and the clock turns them
+ * into ticks since midnight, starting at the acquisition time of the scan.
+ * The lines of one excitation (echoes, echo trains, EPI shots) share its
+ * time stamp: a fast spin echo train acquires echoTrainLength phase lines
+ * of a slice after each excitation.
+ *
+ * Without a known TR every stamp is the start of the scan.
+ */
+class AcquisitionClock
+{
+public:
+    explicit AcquisitionClock(const ScanParameters& params);
+
+    /** Time stamp of an excitation, counted from 0 at the start of the scan */
+    uint32_t stamp(uint64_t excitation) const;
+
+    /**
+     * Excitation of a line of the first echo, counted from 0 in acquisition
+     * order: consecutive lines of an echo train share one
+     */
+    uint64_t trainExcitation(uint64_t line) const { return line / echoTrainLength_; }
+
+    /**
+     * Excitation of a P-file line, KSpaceData() order carrying no timing
+     *
+     * @param slice Geometric slice number
+     * @param phase Phase encoding line
+     */
+    uint64_t pfileExcitation(unsigned int slice, unsigned int phase) const;
+
+    /** Whether the stamps follow the sequence timing, rather than all being the start */
+    bool timed() const { return spacing_ > 0; }
+
+private:
+    double start_;          // seconds since midnight
+    double spacing_;        // seconds between excitations
+    unsigned int phases_;
+    unsigned int echoTrainLength_;
+    unsigned int slicesPerPass_;
+    bool is3D_;
+    std::vector<unsigned int> acquiredOrder_;   // geometric slice -> acquisition position
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* ACQUISITION_CLOCK_H */
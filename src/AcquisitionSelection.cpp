@@ -0,0 +1,86 @@
+/** @file AcquisitionSelection.cpp */
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+// Local
+#include "AcquisitionSelection.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Largest range expanded into indices, to catch typos such as "0-4000000000" */
+const unsigned long MAX_SELECTED_INDEX = 1 << 20;
+
+unsigned int parseIndex(const std::string& text, const std::string& spec)
+{
+    char* end = NULL;
+    errno = 0;
+    unsigned long value = strtoul(text.c_str(), &end, 10);
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos ||
+        *end != '\0' || errno != 0 || value > MAX_SELECTED_INDEX) {
+        throw std::runtime_error("Invalid index '" + text + "' in selection " + spec);
+    }
+    return static_cast<unsigned int>(value);
+}
+
+} // namespace
+
+IndexSelection::IndexSelection(const std::string& spec)
+{
+    if (spec.empty() || spec == "all") {
+        return;
+    }
+
+    std::istringstream items(spec);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t dash = item.find('-');
+        unsigned int first = parseIndex(item.substr(0, dash), spec);
+        unsigned int last = (dash == std::string::npos) ? first : parseIndex(item.substr(dash + 1), spec);
+        if (last < first) {
+            throw std::runtime_error("Empty range '" + item + "' in selection " + spec);
+        }
+        for (unsigned int index = first; index <= last; index++) {
+            indices_.push_back(index);
+        }
+    }
+    if (indices_.empty() || spec[spec.size() - 1] == ',') {
+        throw std::runtime_error("Invalid selection " + spec);
+    }
+
+    std::sort(indices_.begin(), indices_.end());
+    indices_.erase(std::unique(indices_.begin(), indices_.end()), indices_.end());
+}
+
+bool IndexSelection::contains(unsigned int index) const
+{
+    return all() || std::binary_search(indices_.begin(), indices_.end(), index);
+}
+
+unsigned int IndexSelection::count(unsigned int total) const
+{
+    if (all()) {
+        return total;
+    }
+    return std::lower_bound(indices_.begin(), indices_.end(), total) - indices_.begin();
+}
+
+std::vector<unsigned int> IndexSelection::indices(unsigned int total) const
+{
+    std::vector<unsigned int> selected;
+    if (all()) {
+        selected.resize(total);
+        for (unsigned int index = 0; index < total; index++) {
+            selected[index] = index;
+        }
+    } else {
+        selected.assign(indices_.begin(), std::lower_bound(indices_.begin(), indices_.end(), total));
+    }
+    return selected;
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,77 @@
+/** @file AcquisitionSelection.h */
+#ifndef ACQUISITION_SELECTION_H
+#define ACQUISITION_SELECTION_H
+
+#include <string>
+#include <vector>
+
+namespace GEToIsmrmrd {
+
+/**
+ * A set of indices - slices, echoes, repetitions or channels - given as a
+ * list of indices and ranges such as "0,2,5-9"
+ *
+ * An empty selection selects every index.
+ */
+class IndexSelection
+{
+public:
+    /** Selects every index */
+    IndexSelection() { }
+
+    /**
+     * Parses a comma separated list of indices and inclusive ranges
+     *
+     * @param spec Selection such as "3" or "0,2,5-9"; empty or "all" selects every index
+     * @throws std::runtime_error if the list is malformed
+     */
+    explicit IndexSelection(const std::string& spec);
+
+    /** Whether every index is selected */
+    bool all() const { return indices_.empty(); }
+
+    bool contains(unsigned int index) const;
+
+    /** Number of selected indices below total */
+    unsigned int count(unsigned int total) const;
+
+    /** Selected indices below total, in increasing order */
+    std::vector<unsigned int> indices(unsigned int total) const;
+
+    /** Largest selected index; only meaningful if not all() */
+    unsigned int last() const { return indices_.back(); }
+
+private:
+    std::vector<unsigned int> indices_;     // sorted, unique
+};
+
+/**
+ * Part of a scan to convert
+ *
+ * Slices are geometric slice numbers and channels receiver channel numbers,
+ * as in the ISMRMRD acquisitions; the converted acquisitions keep their
+ * encoding counters and scan_counter of the full scan.
+ */
+struct AcquisitionSelection
+{
+    IndexSelection slices;
+    IndexSelection echoes;
+    IndexSelection repetitions;
+    IndexSelection channels;
+
+    /** Whether the whole scan is selected */
+    bool all() const
+    {
+        return slices.all() && echoes.all() && repetitions.all() && channels.all();
+    }
+
+    /** Whether acquisitions of a slice, echo and repetition are selected */
+    bool contains(unsigned int slice, unsigned int echo, unsigned int repetition) const
+    {
+        return slices.contains(slice) && echoes.contains(echo) && repetitions.contains(repetition);
+    }
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* ACQUISITION_SELECTION_H */
@@ -0,0 +1,59 @@
+/** @file AcquisitionSink.h */
+#ifndef ACQUISITION_SINK_H
+#define ACQUISITION_SINK_H
+
+#include <vector>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Receives ISMRMRD acquisitions from a SequenceConverter as they are produced,
+ * so a scan can be written out without holding all of its k-space in memory.
+ */
+class AcquisitionSink
+{
+public:
+    AcquisitionSink() { }
+    virtual ~AcquisitionSink() { }
+
+    /**
+     * Accepts the next acquisition, in scan order.
+     *
+     * @param acq Acquisition produced by the converter.  Converters reuse the
+     *            acquisition's storage once this returns, so a sink that keeps
+     *            it must take a copy.
+     */
+    virtual void append(const ISMRMRD::Acquisition& acq) = 0;
+
+    /**
+     * Tells the sink how many acquisitions the converter expects to produce,
+     * before the first append().  The count is an upper bound.
+     *
+     * @param count Expected number of acquisitions
+     */
+    virtual void reserve(size_t count) { }
+};
+
+/**
+ * Sink collecting every acquisition into a vector - used to provide the
+ * vector-returning getAcquisitions() interface on top of the streaming one.
+ */
+class VectorAcquisitionSink : public AcquisitionSink
+{
+public:
+    VectorAcquisitionSink(std::vector<ISMRMRD::Acquisition>& acqs) : acqs_(acqs) { }
+
+    void append(const ISMRMRD::Acquisition& acq) { acqs_.push_back(acq); }
+
+    void reserve(size_t count) { acqs_.reserve(acqs_.size() + count); }
+
+private:
+    std::vector<ISMRMRD::Acquisition>& acqs_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* ACQUISITION_SINK_H */
@@ -0,0 +1,134 @@
+/** @file ArchivePrefetcher.cpp */
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Local
+#include "ArchivePrefetcher.h"
+#include "Profiler.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Bytes requested per readahead call, so the window moves in small steps */
+const uint64_t PREFETCH_STEP = 4 << 20;
+
+} // namespace
+
+ArchivePrefetcher::ArchivePrefetcher(const std::string& path, uint64_t windowBytes)
+    : fd_(-1), size_(0), window_(std::max<uint64_t>(windowBytes, PREFETCH_STEP)),
+      consumed_(0), prefetched_(0), stopping_(false)
+{
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        throw std::runtime_error("Failed to open " + path + " for prefetching: " + strerror(errno));
+    }
+
+    struct stat info;
+    if (fstat(fd_, &info) != 0) {
+        int error = errno;
+        close(fd_);
+        throw std::runtime_error("Failed to stat " + path + ": " + strerror(error));
+    }
+    size_ = info.st_size;
+
+    thread_ = std::thread(&ArchivePrefetcher::run, this);
+}
+
+ArchivePrefetcher::~ArchivePrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    moved_.notify_all();
+    thread_.join();
+    close(fd_);
+}
+
+void ArchivePrefetcher::progress(uint64_t packet, uint64_t packetCount)
+{
+    if (packetCount == 0) {
+        return;
+    }
+
+    uint64_t const position = static_cast<uint64_t>(static_cast<double>(size_) * packet / packetCount);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (position <= consumed_) {
+            return;
+        }
+        consumed_ = position;
+    }
+    moved_.notify_one();
+}
+
+uint64_t ArchivePrefetcher::prefetched() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return prefetched_;
+}
+
+/** End of the window; called holding the mutex */
+uint64_t ArchivePrefetcher::target() const
+{
+    return std::min(size_, consumed_ + window_);
+}
+
+void ArchivePrefetcher::run()
+{
+    std::vector<char> scratch;
+    bool useReadahead = true;
+
+    while (true)
+    {
+        uint64_t offset, length;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            moved_.wait(lock, [this] { return stopping_ || prefetched_ < target(); });
+            if (stopping_) {
+                return;
+            }
+            offset = prefetched_;
+            length = std::min(PREFETCH_STEP, target() - offset);
+        }
+
+        // readahead() fails on files without a page cache mapping (some FUSE
+        // and network file systems); reading into a scratch buffer fills the
+        // cache there too
+        if (useReadahead && readahead(fd_, offset, length) != 0) {
+            useReadahead = false;
+        }
+        if (!useReadahead) {
+            scratch.resize(1 << 20);
+            for (uint64_t done = 0; done < length; ) {
+                ssize_t n = pread(fd_, scratch.data(), std::min<uint64_t>(scratch.size(), length - done),
+                                  offset + done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    // Unreadable or truncated: the conversion will report it
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    prefetched_ = size_;
+                    length = 0;
+                    break;
+                }
+                done += n;
+            }
+        }
+
+        Profiler::instance().count(PROFILE_BYTES_PREFETCHED, length);
+        std::lock_guard<std::mutex> lock(mutex_);
+        prefetched_ = std::max(prefetched_, offset + length);
+    }
+}
+
+} // namespace GEToIsmrmrd
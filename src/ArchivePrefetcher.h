@@ -0,0 +1,79 @@
+/** @file ArchivePrefetcher.h */
+#ifndef ARCHIVE_PREFETCHER_H
+#define ARCHIVE_PREFETCHER_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace GEToIsmrmrd {
+
+/**
+ * Reads a raw file into the page cache ahead of the conversion reading it
+ *
+ * The Orchestra SDK does its own, synchronous, reads of a ScanArchive, so
+ * the prefetcher cannot hand it buffers.  Instead a background thread pulls
+ * the next window of the file into the page cache (readahead(2), or plain
+ * reads where that is not supported) while the current packets are decoded,
+ * so NextFrameControl() and Data() find their bytes already in memory and a
+ * conversion is bound by the slower of I/O and decode instead of their sum.
+ *
+ * How far the SDK got is estimated from the packets read: packet p of n is
+ * taken to be at p / n of the file.  The prefetcher stays at most
+ * windowBytes ahead of that estimate, bounding the page cache it claims.
+ */
+class ArchivePrefetcher
+{
+public:
+    /**
+     * Opens the file and starts prefetching its first window
+     *
+     * @param path Raw file
+     * @param windowBytes Bytes read ahead of the estimated reading position
+     * @throws std::runtime_error if the file cannot be opened
+     */
+    ArchivePrefetcher(const std::string& path, uint64_t windowBytes);
+
+    /** Stops prefetching, waiting for the read in progress */
+    ~ArchivePrefetcher();
+
+    /**
+     * Reports reading progress, moving the window on
+     *
+     * @param packet Packets read so far
+     * @param packetCount Packets of the file
+     */
+    void progress(uint64_t packet, uint64_t packetCount);
+
+    /** Bytes pulled into the page cache so far */
+    uint64_t prefetched() const;
+
+    uint64_t fileSize() const { return size_; }
+
+private:
+    // Non-copyable
+    ArchivePrefetcher(const ArchivePrefetcher& other);
+    ArchivePrefetcher& operator=(const ArchivePrefetcher& other);
+
+    void run();
+    uint64_t target() const;
+
+    int fd_;
+    uint64_t size_;
+    uint64_t window_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable moved_;
+    uint64_t consumed_;     // estimated position of the reader
+    uint64_t prefetched_;   // end of the prefetched part of the file
+    bool stopping_;
+
+    std::thread thread_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* ARCHIVE_PREFETCHER_H */
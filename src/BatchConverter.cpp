@@ -0,0 +1,269 @@
+/** @file BatchConverter.cpp */
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Local
+#include "BatchConverter.h"
+#include "DatasetWriter.h"
+#include "GERawConverter.h"
+#include "Hdf5Lock.h"
+#include "StringUtils.h"
+
+namespace GEToIsmrmrd {
+
+BatchConverter::BatchConverter(const BatchOptions& options)
+   : options_(options), nextInput_(0), failures_(0)
+{
+   if (options_.jobs == 0) {
+      options_.jobs = 1;
+   }
+
+   // One pool for all inputs, so concurrent jobs do not each start 'threads' workers
+   if (!options_.conversion.threadPool && options_.conversion.threads > 1) {
+      options_.conversion.threadPool = std::make_shared<ThreadPool>(options_.conversion.threads);
+   }
+}
+
+unsigned int BatchConverter::run(const std::vector<std::string>& inputs)
+{
+   nextInput_ = 0;
+   failures_ = 0;
+   groups_.clear();
+
+   if (!prepareOutput()) {
+      return inputs.size();
+   }
+
+   unsigned int jobs = std::min<size_t>(options_.jobs, inputs.size());
+   if (jobs <= 1) {
+      convertInputs(inputs);
+   } else {
+      std::vector<std::thread> workers;
+      for (unsigned int n = 0; n < jobs; n++) {
+         workers.push_back(std::thread(&BatchConverter::convertInputs, this, std::cref(inputs)));
+      }
+      for (size_t n = 0; n < workers.size(); n++) {
+         workers[n].join();
+      }
+   }
+
+   std::cout << "Converted " << inputs.size() - failures_ << " of " << inputs.size() << " inputs" << std::endl;
+
+   return failures_;
+}
+
+bool BatchConverter::prepareOutput()
+{
+   if (!options_.grouped && !isDirectory(options_.output)) {
+      if (mkdir(options_.output.c_str(), 0755) != 0) {
+         std::cerr << "Failed to create output directory " << options_.output << std::endl;
+         return false;
+      }
+   }
+   return true;
+}
+
+bool BatchConverter::convert(const std::string& input)
+{
+   std::string destination;
+   try {
+      size_t count = convertInput(input, destination);
+
+      std::lock_guard<std::mutex> lock(reportMutex_);
+      std::cout << input << " -> " << destination << ": " << count << " acquisitions" << std::endl;
+      return true;
+   } catch (const std::exception& e) {
+      std::lock_guard<std::mutex> lock(reportMutex_);
+      std::cerr << "Failed to convert " << input << ": " << e.what() << std::endl;
+      failures_++;
+      return false;
+   }
+}
+
+bool BatchConverter::converted(const std::string& input) const
+{
+   if (options_.grouped) {
+      return false;
+   }
+
+   struct stat inputInfo, outputInfo;
+   if (stat(input.c_str(), &inputInfo) != 0 || stat(outputFilename(input).c_str(), &outputInfo) != 0) {
+      return false;
+   }
+   return outputInfo.st_mtime >= inputInfo.st_mtime;
+}
+
+unsigned int BatchConverter::failures() const
+{
+   std::lock_guard<std::mutex> lock(reportMutex_);
+   return failures_;
+}
+
+void BatchConverter::convertInputs(const std::vector<std::string>& inputs)
+{
+   while (true)
+   {
+      size_t index;
+      {
+         std::lock_guard<std::mutex> lock(reportMutex_);
+         if (nextInput_ >= inputs.size()) {
+            return;
+         }
+         index = nextInput_++;
+      }
+
+      convert(inputs[index]);
+   }
+}
+
+/**
+ * Converts one input of the batch
+ *
+ * @param input Raw file path
+ * @param destination Set to the output file (and group) written
+ * @returns number of acquisitions written
+ * @throws std::runtime_error if the input cannot be converted
+ */
+size_t BatchConverter::convertInput(const std::string& input, std::string& destination)
+{
+   std::unique_ptr<GERawConverter> converter;
+   std::string xml_header;
+   {
+      // Orchestra file opening and the DICOM objects built for the header are
+      // not known to be safe to use concurrently
+      std::lock_guard<std::mutex> lock(openMutex_);
+      std::lock_guard<std::mutex> hdf5Lock(hdf5Mutex());
+
+      converter.reset(new GERawConverter(input, options_.classname, options_.verbose, options_.config));
+      if (options_.stylesheet.size() > 0) {
+         converter->useStylesheetString(options_.stylesheet);
+      }
+      converter->setConversionOptions(options_.conversion);
+      xml_header = converter->getIsmrmrdXMLHeader();
+   }
+
+   if (xml_header.size() == 0) {
+      throw std::runtime_error("Empty ISMRMRD XML header");
+   }
+
+   std::string filename, group;
+   if (options_.grouped) {
+      const ScanParameters& params = converter->getScanParameters();
+      filename = options_.output;
+      group = groupName(params.examNumber, params.seriesNumber);
+   } else {
+      filename = outputFilename(input);
+      group = "dataset";
+   }
+   destination = filename + ":/" + group;
+
+   DatasetWriter writer(filename, group, options_.writer);
+   writer.writeHeader(xml_header);
+   converter->convert(writer);
+   writer.close();
+
+   return writer.count();
+}
+
+/**
+ * @returns path of the ISMRMRD file written for an input: "ismrmrd_<name>.h5"
+ *          in the output directory, where <name> is the input file name
+ *          without its extension
+ */
+std::string BatchConverter::outputFilename(const std::string& input) const
+{
+   std::string name = baseName(input);
+   size_t dot = name.find_last_of('.');
+   if (dot != std::string::npos && dot > 0) {
+      name = name.substr(0, dot);
+   }
+   return options_.output + "/ismrmrd_" + name + ".h5";
+}
+
+/**
+ * @returns unique group name "exam<E>_series<S>" of a series in grouped
+ *          output; repeats of a series get a "_<n>" suffix
+ */
+std::string BatchConverter::groupName(int examNumber, int seriesNumber)
+{
+   std::ostringstream base;
+   base << "exam" << examNumber << "_series" << seriesNumber;
+
+   std::lock_guard<std::mutex> lock(reportMutex_);
+   std::string name = base.str();
+   for (int n = 2; groups_.count(name) > 0; n++) {
+      std::ostringstream suffixed;
+      suffixed << base.str() << "_" << n;
+      name = suffixed.str();
+   }
+   groups_.insert(name);
+   return name;
+}
+
+std::vector<std::string> BatchConverter::collectInputs(const std::vector<std::string>& args,
+                                                       const std::string& listFile)
+{
+   std::vector<std::string> paths;
+
+   if (listFile.size() > 0) {
+      std::ifstream list(listFile.c_str());
+      if (!list) {
+         throw std::runtime_error("Failed to open input list " + listFile);
+      }
+      std::string line;
+      while (std::getline(list, line)) {
+         size_t first = line.find_first_not_of(" \t\r");
+         if (first == std::string::npos || line[first] == '#') {
+            continue;
+         }
+         size_t last = line.find_last_not_of(" \t\r");
+         paths.push_back(line.substr(first, last - first + 1));
+      }
+   }
+   paths.insert(paths.end(), args.begin(), args.end());
+
+   std::vector<std::string> inputs;
+   for (size_t n = 0; n < paths.size(); n++)
+   {
+      if (!isDirectory(paths[n])) {
+         inputs.push_back(paths[n]);
+         continue;
+      }
+
+      DIR* dir = opendir(paths[n].c_str());
+      if (dir == NULL) {
+         throw std::runtime_error("Failed to read input directory " + paths[n]);
+      }
+
+      std::vector<std::string> entries;
+      while (struct dirent* entry = readdir(dir)) {
+         std::string path = paths[n] + "/" + entry->d_name;
+         struct stat info;
+         if (entry->d_name[0] != '.' && stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            entries.push_back(path);
+         }
+      }
+      closedir(dir);
+
+      std::sort(entries.begin(), entries.end());
+      inputs.insert(inputs.end(), entries.begin(), entries.end());
+   }
+
+   return inputs;
+}
+
+bool BatchConverter::isDirectory(const std::string& path)
+{
+   struct stat info;
+   return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+} // namespace GEToIsmrmrd
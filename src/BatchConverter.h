@@ -0,0 +1,115 @@
+/** @file BatchConverter.h */
+#ifndef BATCH_CONVERTER_H
+#define BATCH_CONVERTER_H
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+// Local
+#include "ConversionOptions.h"
+#include "DatasetWriter.h"
+
+namespace GEToIsmrmrd {
+
+/** Settings of a batch conversion */
+struct BatchOptions
+{
+   BatchOptions() : grouped(false), jobs(1), verbose(false) { }
+
+   std::string classname;        /**< Sequence plugin used for every input, "auto" to map each input */
+   std::string config;           /**< Conversion configuration, empty for the installed default */
+   std::string stylesheet;       /**< Overriding stylesheet contents, read once for the batch */
+   std::string output;           /**< Output directory, or output file if grouped */
+   bool grouped;                 /**< Write all inputs into one file, one group per series */
+   unsigned int jobs;            /**< Number of inputs converted at the same time */
+   bool verbose;
+   ConversionOptions conversion; /**< Options given to every converter, with the shared pool */
+   DatasetWriterOptions writer;  /**< Output buffering, chunking and fsync */
+};
+
+/**
+ * Converts many raw files within one process
+ *
+ * Every input is converted by its own GERawConverter, but all of them share
+ * the stylesheet and the packet decoding thread pool.  Output goes either to
+ * one ISMRMRD file per input in the output directory, or - if grouped - to a
+ * single ISMRMRD file holding one dataset group per series.
+ */
+class BatchConverter
+{
+public:
+   BatchConverter(const BatchOptions& options);
+
+   /**
+    * Converts all inputs; a failed input is reported and skipped
+    *
+    * @param inputs Paths of the P-files and ScanArchives to convert
+    * @returns number of inputs that failed to convert
+    */
+   unsigned int run(const std::vector<std::string>& inputs);
+
+   /**
+    * Creates the output directory, unless the output is grouped into one file
+    *
+    * @returns false (after reporting it) if the directory cannot be created
+    */
+   bool prepareOutput();
+
+   /**
+    * Converts one input, reporting the result; may be called by several
+    * threads at once
+    *
+    * @returns false if the input failed to convert
+    */
+   bool convert(const std::string& input);
+
+   /**
+    * @returns true if the input was converted before: its own output file is
+    *          at least as recent as the input.  Always false for grouped
+    *          output, where no file belongs to a single input.
+    */
+   bool converted(const std::string& input) const;
+
+   /** Number of inputs that failed to convert since the last run() */
+   unsigned int failures() const;
+
+   /**
+    * Expands the command line inputs of a batch into raw file paths
+    *
+    * @param args Files or directories; the regular files of a directory are
+    *             taken in name order, not recursing into sub-directories
+    * @param listFile Optional file naming one input per line ('#' comments)
+    * @throws std::runtime_error if a list file or directory cannot be read
+    */
+   static std::vector<std::string> collectInputs(const std::vector<std::string>& args,
+                                                 const std::string& listFile);
+
+   /** @returns true if the path names a directory */
+   static bool isDirectory(const std::string& path);
+
+private:
+   // Non-copyable
+   BatchConverter(const BatchConverter& other);
+   BatchConverter& operator=(const BatchConverter& other);
+
+   void convertInputs(const std::vector<std::string>& inputs);
+   size_t convertInput(const std::string& input, std::string& destination);
+
+   std::string outputFilename(const std::string& input) const;
+   std::string groupName(int examNumber, int seriesNumber);
+
+   BatchOptions options_;
+
+   std::mutex openMutex_;    // Orchestra file opening and XML header generation
+   mutable std::mutex reportMutex_;  // progress output, queue position and failure count
+
+   size_t nextInput_;
+   unsigned int failures_;
+   std::set<std::string> groups_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* BATCH_CONVERTER_H */
@@ -0,0 +1,264 @@
+/** @file CoilCompression.cpp */
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// Local
+#include "CoilCompression.h"
+#include "Profiler.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Jacobi sweeps before giving up; convergence takes well under ten */
+const int MAX_JACOBI_SWEEPS = 100;
+
+} // namespace
+
+void CoilCompression::hermitianEigen(std::vector<std::complex<double> >& a, unsigned int n,
+                                     std::vector<double>& values, std::vector<std::complex<double> >& vectors)
+{
+    vectors.assign(n * n, 0.0);
+    for (unsigned int i = 0; i < n; i++) {
+        vectors[i * n + i] = 1.0;
+    }
+
+    double total = 0.0;
+    for (unsigned int i = 0; i < n * n; i++) {
+        total += std::norm(a[i]);
+    }
+
+    for (int sweep = 0; sweep < MAX_JACOBI_SWEEPS; sweep++) {
+        double off = 0.0;
+        for (unsigned int p = 0; p < n; p++) {
+            for (unsigned int q = p + 1; q < n; q++) {
+                off += std::norm(a[p * n + q]);
+            }
+        }
+        if (off <= 1e-24 * total) {
+            break;
+        }
+
+        for (unsigned int p = 0; p < n; p++) {
+            for (unsigned int q = p + 1; q < n; q++) {
+                double const magnitude = std::abs(a[p * n + q]);
+                if (magnitude <= 1e-300) {
+                    continue;
+                }
+
+                // A phase turns a_pq real, then a real rotation zeroes it:
+                // G = diag(1, conj(e)) * [c s; -s c] on rows / columns p and q
+                std::complex<double> const e = a[p * n + q] / magnitude;
+                double const theta = (a[q * n + q].real() - a[p * n + p].real()) / (2.0 * magnitude);
+                double const t = ((theta >= 0) ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                double const c = 1.0 / std::sqrt(t * t + 1.0);
+                double const s = t * c;
+
+                std::complex<double> const gpp = c;
+                std::complex<double> const gpq = s;
+                std::complex<double> const gqp = -s * std::conj(e);
+                std::complex<double> const gqq = c * std::conj(e);
+
+                // A = A G
+                for (unsigned int k = 0; k < n; k++) {
+                    std::complex<double> const akp = a[k * n + p];
+                    std::complex<double> const akq = a[k * n + q];
+                    a[k * n + p] = akp * gpp + akq * gqp;
+                    a[k * n + q] = akp * gpq + akq * gqq;
+                }
+                // A = G^H A
+                for (unsigned int k = 0; k < n; k++) {
+                    std::complex<double> const apk = a[p * n + k];
+                    std::complex<double> const aqk = a[q * n + k];
+                    a[p * n + k] = std::conj(gpp) * apk + std::conj(gqp) * aqk;
+                    a[q * n + k] = std::conj(gpq) * apk + std::conj(gqq) * aqk;
+                }
+                a[p * n + q] = 0.0;
+                a[q * n + p] = 0.0;
+
+                // V = V G
+                for (unsigned int k = 0; k < n; k++) {
+                    std::complex<double> const vkp = vectors[k * n + p];
+                    std::complex<double> const vkq = vectors[k * n + q];
+                    vectors[k * n + p] = vkp * gpp + vkq * gqp;
+                    vectors[k * n + q] = vkp * gpq + vkq * gqq;
+                }
+            }
+        }
+    }
+
+    // Sort the eigenpairs by decreasing eigenvalue
+    std::vector<std::pair<double, unsigned int> > order(n);
+    for (unsigned int i = 0; i < n; i++) {
+        order[i] = std::make_pair(-a[i * n + i].real(), i);
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<std::complex<double> > sorted(n * n);
+    values.resize(n);
+    for (unsigned int j = 0; j < n; j++) {
+        values[j] = -order[j].first;
+        for (unsigned int k = 0; k < n; k++) {
+            sorted[k * n + j] = vectors[k * n + order[j].second];
+        }
+    }
+    vectors.swap(sorted);
+}
+
+void CoilCompression::learn(const std::vector<ISMRMRD::Acquisition>& acqs, unsigned int virtualChannels)
+{
+    ScopedTimer compressionTimer(PROFILE_COMPRESSION);
+
+    unsigned int channels = 0;
+    for (size_t n = 0; n < acqs.size() && channels == 0; n++) {
+        channels = acqs[n].active_channels();
+    }
+    if (channels == 0 || virtualChannels == 0) {
+        throw std::runtime_error("No acquisitions to learn the coil compression from");
+    }
+    virtualChannels = std::min(virtualChannels, channels);
+
+    // Channel covariance, summed over every sample of the training lines
+    std::vector<std::complex<double> > covariance(channels * channels, 0.0);
+    size_t lines = 0;
+    for (size_t n = 0; n < acqs.size(); n++) {
+        const ISMRMRD::Acquisition& acq = acqs[n];
+        if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_IS_NOISE_MEASUREMENT)) {
+            continue;
+        }
+        if (acq.active_channels() != channels) {
+            throw std::runtime_error("Coil compression training lines differ in their number of channels");
+        }
+
+        unsigned int const samples = acq.number_of_samples();
+        for (unsigned int i = 0; i < channels; i++) {
+            const complex_float_t* xi = &acq.data(0, i);
+            for (unsigned int j = i; j < channels; j++) {
+                const complex_float_t* xj = &acq.data(0, j);
+                double re = 0.0, im = 0.0;
+                for (unsigned int s = 0; s < samples; s++) {
+                    // xi * conj(xj)
+                    re += (double)xi[s].real() * xj[s].real() + (double)xi[s].imag() * xj[s].imag();
+                    im += (double)xi[s].imag() * xj[s].real() - (double)xi[s].real() * xj[s].imag();
+                }
+                covariance[i * channels + j] += std::complex<double>(re, im);
+            }
+        }
+        lines++;
+    }
+    if (lines == 0) {
+        throw std::runtime_error("No imaging lines to learn the coil compression from");
+    }
+    for (unsigned int i = 0; i < channels; i++) {
+        for (unsigned int j = 0; j < i; j++) {
+            covariance[i * channels + j] = std::conj(covariance[j * channels + i]);
+        }
+    }
+
+    std::vector<double> values;
+    std::vector<std::complex<double> > vectors;
+    hermitianEigen(covariance, channels, values, vectors);
+
+    // Virtual channel k = eigenvector k ^H * channels
+    matrix_.resize(virtualChannels * channels);
+    for (unsigned int k = 0; k < virtualChannels; k++) {
+        for (unsigned int c = 0; c < channels; c++) {
+            matrix_[k * channels + c] = std::complex<float>(std::conj(vectors[c * channels + k]));
+        }
+    }
+
+    double kept = 0.0, total = 0.0;
+    for (unsigned int k = 0; k < channels; k++) {
+        total += std::max(values[k], 0.0);
+        if (k < virtualChannels) {
+            kept += std::max(values[k], 0.0);
+        }
+    }
+    retainedEnergy_ = (total > 0.0) ? kept / total : 1.0;
+
+    channels_ = channels;
+    virtualChannels_ = virtualChannels;
+}
+
+void CoilCompression::apply(const ISMRMRD::Acquisition& in, ISMRMRD::Acquisition& out) const
+{
+    ScopedTimer compressionTimer(PROFILE_COMPRESSION);
+
+    if (in.active_channels() != channels_) {
+        throw std::runtime_error("Acquisition channels differ from those the coil compression was learnt from");
+    }
+
+    unsigned int const samples = in.number_of_samples();
+
+    out.setHead(in.getHead());
+    out.resize(samples, virtualChannels_, in.trajectory_dimensions());
+    if (in.trajectory_dimensions() > 0) {
+        memcpy(out.getTrajPtr(), in.getTrajPtr(), sizeof(float) * samples * in.trajectory_dimensions());
+    }
+    out.available_channels() = virtualChannels_;
+    out.setAllChannelsNotActive();
+    for (unsigned int k = 0; k < virtualChannels_; k++) {
+        out.setChannelActive(k);
+    }
+
+    // Spelled out complex arithmetic: std::complex operator* is not inlined
+    // without -ffast-math, and this loop touches every sample of the scan
+    for (unsigned int k = 0; k < virtualChannels_; k++) {
+        float* y = reinterpret_cast<float*>(&out.data(0, k));
+        std::fill(y, y + 2 * samples, 0.0f);
+        for (unsigned int c = 0; c < channels_; c++) {
+            float const wr = matrix_[k * channels_ + c].real();
+            float const wi = matrix_[k * channels_ + c].imag();
+            const float* x = reinterpret_cast<const float*>(&in.data(0, c));
+            for (unsigned int s = 0; s < samples; s++) {
+                float const xr = x[2 * s];
+                float const xi = x[2 * s + 1];
+                y[2 * s]     += wr * xr - wi * xi;
+                y[2 * s + 1] += wr * xi + wi * xr;
+            }
+        }
+    }
+}
+
+CoilCompressionSink::CoilCompressionSink(AcquisitionSink& target, unsigned int virtualChannels,
+                                         unsigned int trainingLines)
+    : target_(target), virtualChannels_(virtualChannels), trainingLines_(std::max(trainingLines, 1u))
+{
+    training_.reserve(trainingLines_);
+}
+
+void CoilCompressionSink::append(const ISMRMRD::Acquisition& acq)
+{
+    if (!compression_.learnt()) {
+        training_.push_back(acq);
+        if (training_.size() >= trainingLines_) {
+            learn();
+        }
+        return;
+    }
+
+    compression_.apply(acq, compressed_);
+    target_.append(compressed_);
+}
+
+void CoilCompressionSink::finish()
+{
+    if (!compression_.learnt() && !training_.empty()) {
+        learn();
+    }
+}
+
+void CoilCompressionSink::learn()
+{
+    compression_.learn(training_, virtualChannels_);
+
+    for (size_t n = 0; n < training_.size(); n++) {
+        compression_.apply(training_[n], compressed_);
+        target_.append(compressed_);
+    }
+    std::vector<ISMRMRD::Acquisition>().swap(training_);
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,115 @@
+/** @file CoilCompression.h */
+#ifndef COIL_COMPRESSION_H
+#define COIL_COMPRESSION_H
+
+#include <complex>
+#include <vector>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// Local
+#include "AcquisitionSink.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * PCA coil compression: projects the receiver channels of every acquisition
+ * onto the principal components of the channel covariance
+ *
+ * The row-major virtualChannels x channels matrix holds the conjugated
+ * eigenvectors of the largest eigenvalues, so virtual channel 0 carries the
+ * most signal.
+ */
+class CoilCompression
+{
+public:
+    CoilCompression() : channels_(0), virtualChannels_(0), retainedEnergy_(1.0) { }
+
+    /**
+     * Learns the compression from the channel covariance of some acquisitions
+     *
+     * @param acqs Training acquisitions, all with the same number of channels;
+     *        noise measurements are left out
+     * @param virtualChannels Channels kept, at most those of the acquisitions
+     * @throws std::runtime_error if there is nothing to learn from
+     */
+    void learn(const std::vector<ISMRMRD::Acquisition>& acqs, unsigned int virtualChannels);
+
+    bool learnt() const { return virtualChannels_ > 0; }
+
+    unsigned int channels() const { return channels_; }
+    unsigned int virtualChannels() const { return virtualChannels_; }
+
+    /** Compression matrix, virtualChannels() rows of channels() weights */
+    const std::vector<std::complex<float> >& matrix() const { return matrix_; }
+
+    /** Fraction of the training energy kept by the virtual channels */
+    double retainedEnergy() const { return retainedEnergy_; }
+
+    /**
+     * Writes the compressed acquisition to out, which gets the header and
+     * trajectory of in
+     *
+     * @throws std::runtime_error if in does not have channels() channels
+     */
+    void apply(const ISMRMRD::Acquisition& in, ISMRMRD::Acquisition& out) const;
+
+    /**
+     * Eigen decomposition of a Hermitian matrix, by cyclic Jacobi rotations
+     *
+     * @param a Row-major n x n matrix, destroyed
+     * @param n Order of the matrix
+     * @param values Eigenvalues, in decreasing order
+     * @param vectors Row-major matrix whose columns are the matching eigenvectors
+     */
+    static void hermitianEigen(std::vector<std::complex<double> >& a, unsigned int n,
+                               std::vector<double>& values, std::vector<std::complex<double> >& vectors);
+
+private:
+    unsigned int channels_;
+    unsigned int virtualChannels_;
+    std::vector<std::complex<float> > matrix_;
+    double retainedEnergy_;
+};
+
+/**
+ * Sink compressing the channels of every acquisition before handing it on
+ *
+ * The first trainingLines acquisitions are held back to learn the
+ * compression, then forwarded compressed; later acquisitions are compressed
+ * as they arrive, so full-channel data is never written out.
+ */
+class CoilCompressionSink : public AcquisitionSink
+{
+public:
+    /**
+     * @param target Receiver of the compressed acquisitions
+     * @param virtualChannels Channels kept
+     * @param trainingLines Acquisitions the compression is learnt from
+     */
+    CoilCompressionSink(AcquisitionSink& target, unsigned int virtualChannels, unsigned int trainingLines);
+
+    void append(const ISMRMRD::Acquisition& acq);
+
+    void reserve(size_t count) { target_.reserve(count); }
+
+    /** Forwards the acquisitions still held for training; call once the conversion is done */
+    void finish();
+
+    const CoilCompression& compression() const { return compression_; }
+
+private:
+    void learn();
+
+    AcquisitionSink& target_;
+    unsigned int virtualChannels_;
+    unsigned int trainingLines_;
+    std::vector<ISMRMRD::Acquisition> training_;
+    CoilCompression compression_;
+    ISMRMRD::Acquisition compressed_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* COIL_COMPRESSION_H */
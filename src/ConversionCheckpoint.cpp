@@ -0,0 +1,124 @@
+/** @file ConversionCheckpoint.cpp */
+#include <fstream>
+
+// Local
+#include "ConversionCheckpoint.h"
+#include "SidecarFile.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+// Sidecar layout, in host byte order:
+//   magic, version, archive path length + path, settings length + settings,
+//   start extent, committed extent (acquisitions, samples), then the
+//   ReaderPosition fields in declaration order
+const char     SIDECAR_MAGIC[SIDECAR_MAGIC_LENGTH] = { 'G', '2', 'I', 'C', 'K', 'P', 'T', '\0' };
+const uint32_t SIDECAR_VERSION  = 1;
+
+/** Longest path or settings string read from a sidecar */
+const uint32_t MAX_STRING_LENGTH = 64 * 1024;
+
+} // namespace
+
+ConversionCheckpoint::ConversionCheckpoint(const std::string& outputPath, const std::string& archivePath,
+                                           const std::string& settings, DatasetWriter& writer,
+                                           double intervalSeconds)
+    : outputPath_(outputPath), archivePath_(archivePath), settings_(settings), writer_(writer),
+      interval_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(intervalSeconds))),
+      loaded_(false)
+{
+    if (intervalSeconds <= 0) {
+        interval_ = std::chrono::steady_clock::duration::max();
+    }
+}
+
+bool ConversionCheckpoint::load()
+{
+    loaded_ = false;
+
+    std::ifstream in(sidecarPath(outputPath_).c_str(), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    std::string archivePath, settings;
+    if (!readSidecarHeader(in, SIDECAR_MAGIC, SIDECAR_VERSION) ||
+        !readSidecarString(in, archivePath, MAX_STRING_LENGTH) || !readSidecarString(in, settings, MAX_STRING_LENGTH)) {
+        return false;
+    }
+    if (archivePath != archivePath_ || settings != settings_) {
+        return false;
+    }
+
+    DatasetExtent start, committed;
+    ReaderPosition position;
+    if (!readSidecarValue(in, start.acquisitions) || !readSidecarValue(in, start.samples) ||
+        !readSidecarValue(in, committed.acquisitions) || !readSidecarValue(in, committed.samples) ||
+        !readSidecarValue(in, position.packets) || !readSidecarValue(in, position.dataIndex) ||
+        !readSidecarValue(in, position.excitations) || !readSidecarValue(in, position.viewsPerPacket)) {
+        return false;
+    }
+
+    start_     = start;
+    committed_ = committed;
+    position_  = position;
+    reported_  = position;
+    loaded_    = true;
+    return true;
+}
+
+void ConversionCheckpoint::begin()
+{
+    if (loaded_) {
+        writer_.truncate(committed_);
+    } else {
+        start_     = writer_.extent();
+        committed_ = start_;
+        position_  = ReaderPosition();
+        reported_  = position_;
+        save();
+    }
+    lastSave_ = std::chrono::steady_clock::now();
+}
+
+void ConversionCheckpoint::packetWritten(const ReaderPosition& next)
+{
+    reported_ = next;
+
+    if (std::chrono::steady_clock::now() - lastSave_ < interval_) {
+        return;
+    }
+
+    writer_.commit();
+    committed_ = writer_.extent();
+    position_  = reported_;
+    save();
+    lastSave_ = std::chrono::steady_clock::now();
+}
+
+void ConversionCheckpoint::finish()
+{
+    removeSidecar(sidecarPath(outputPath_));
+}
+
+/** Writes the sidecar, aside and renamed, so a crash never leaves a partial one */
+void ConversionCheckpoint::save()
+{
+    saveSidecar(sidecarPath(outputPath_), "checkpoint", [this](std::ostream& out) {
+        writeSidecarHeader(out, SIDECAR_MAGIC, SIDECAR_VERSION);
+        writeSidecarString(out, archivePath_);
+        writeSidecarString(out, settings_);
+        writeSidecarValue(out, start_.acquisitions);
+        writeSidecarValue(out, start_.samples);
+        writeSidecarValue(out, committed_.acquisitions);
+        writeSidecarValue(out, committed_.samples);
+        writeSidecarValue(out, position_.packets);
+        writeSidecarValue(out, position_.dataIndex);
+        writeSidecarValue(out, position_.excitations);
+        writeSidecarValue(out, position_.viewsPerPacket);
+    });
+}
+
+} // namespace GEToIsmrmrd
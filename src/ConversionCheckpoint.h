@@ -0,0 +1,124 @@
+/** @file ConversionCheckpoint.h */
+#ifndef CONVERSION_CHECKPOINT_H
+#define CONVERSION_CHECKPOINT_H
+
+#include <stdint.h>
+
+#include <chrono>
+#include <string>
+
+// Local
+#include "DatasetWriter.h"
+
+namespace GEToIsmrmrd {
+
+/** Where the packet reader of a ScanArchive conversion is, as needed to carry on from there */
+struct ReaderPosition
+{
+    ReaderPosition() : packets(0), dataIndex(0), excitations(0), viewsPerPacket(0) { }
+
+    uint64_t packets;           /**< Control packets read; the next one is the first not converted */
+    int64_t  dataIndex;         /**< scan_counter of the next image line */
+    uint64_t excitations;       /**< Lines of the first echo counted so far, for the time stamps */
+    int32_t  viewsPerPacket;    /**< Lines per packet, 0 if not learnt yet */
+};
+
+/**
+ * Checkpoint of a ScanArchive conversion into an ISMRMRD file, so an
+ * interrupted conversion can be resumed instead of started over
+ *
+ * While converting, the sequence converter reports the reader position of
+ * every packet whose acquisitions went to the writer.  Every interval the
+ * checkpoint commits the writer - flushing its batch and HDF5's metadata -
+ * and records the last reported position together with the extent of the
+ * data sets it was committed with, in a sidecar next to the output.
+ *
+ * Resuming loads the sidecar, cuts the data sets back to the recorded
+ * extent (dropping whatever was written after the checkpoint) and has the
+ * converter skip the packets read before it without parsing them.  The
+ * sidecar names the archive and the conversion settings it was written
+ * for; it is not tied to the archive's size, so a conversion of an archive
+ * that was still being written can be resumed once more of it landed.
+ *
+ * All calls are made from one thread: the one writing the acquisitions.
+ */
+class ConversionCheckpoint
+{
+public:
+    /**
+     * @param outputPath ISMRMRD file written
+     * @param archivePath ScanArchive converted
+     * @param settings Conversion settings the output depends on (selection,
+     *                 plugin, sample encoding, stylesheet, configuration); a
+     *                 checkpoint only resumes a conversion with the same settings
+     * @param writer Writer of outputPath, which must outlive the checkpoint
+     * @param intervalSeconds Seconds between checkpoints; 0 only records the
+     *                        start of the conversion
+     */
+    ConversionCheckpoint(const std::string& outputPath, const std::string& archivePath,
+                         const std::string& settings, DatasetWriter& writer, double intervalSeconds);
+
+    /** Sidecar file of an output */
+    static std::string sidecarPath(const std::string& outputPath) { return outputPath + ".g2ickpt"; }
+
+    /**
+     * Reads the sidecar of the output
+     *
+     * @returns false if there is none, or it was written for another archive
+     *          or other settings
+     */
+    bool load();
+
+    /**
+     * Prepares the writer before the first acquisition: rewinds it to the
+     * loaded checkpoint, or records where the conversion starts and saves
+     * that as its first checkpoint
+     *
+     * @throws std::runtime_error if the output is shorter than the checkpoint
+     */
+    void begin();
+
+    /** Whether begin() rewound the output to a loaded checkpoint */
+    bool resuming() const { return loaded_; }
+
+    /** Position the converter starts reading at: the first packet after the checkpoint */
+    const ReaderPosition& position() const { return position_; }
+
+    /** Acquisitions of this conversion committed with the checkpoint */
+    uint64_t acquisitions() const { return committed_.acquisitions - start_.acquisitions; }
+
+    /**
+     * Reports that the acquisitions of every packet before 'next' were
+     * appended to the writer, saving a checkpoint if the interval is over
+     *
+     * @throws std::runtime_error if the writer cannot be committed
+     */
+    void packetWritten(const ReaderPosition& next);
+
+    /** Removes the sidecar once the conversion completed */
+    void finish();
+
+private:
+    // Non-copyable
+    ConversionCheckpoint(const ConversionCheckpoint& other);
+    ConversionCheckpoint& operator=(const ConversionCheckpoint& other);
+
+    void save();
+
+    std::string outputPath_;
+    std::string archivePath_;
+    std::string settings_;
+    DatasetWriter& writer_;
+    std::chrono::steady_clock::duration interval_;
+    std::chrono::steady_clock::time_point lastSave_;
+
+    bool loaded_;
+    DatasetExtent start_;         // output before the conversion
+    DatasetExtent committed_;     // output at the last checkpoint
+    ReaderPosition position_;     // reader at the last checkpoint
+    ReaderPosition reported_;     // reader after the last packet written
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* CONVERSION_CHECKPOINT_H */
@@ -0,0 +1,61 @@
+/** @file ConversionOptions.h */
+#ifndef CONVERSION_OPTIONS_H
+#define CONVERSION_OPTIONS_H
+
+#include <stdint.h>
+
+#include <memory>
+
+// Local
+#include "AcquisitionSelection.h"
+#include "ThreadPool.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Run-time settings of a conversion that do not depend on the scan itself
+ */
+struct ConversionOptions
+{
+    ConversionOptions()
+        : threads(1), queueDepth(16), packetIndex(false), virtualChannels(0), compressionLines(256),
+          prefetchBytes(64 << 20), maxMemoryBytes(0) { }
+
+    /** Number of threads decoding packets; 1 converts on the calling thread */
+    unsigned int threads;
+
+    /** Number of packets that may be in flight between reader and writer */
+    unsigned int queueDepth;
+
+    /** Pool shared between conversions; when empty each conversion
+     *  starts its own pool of 'threads' workers */
+    std::shared_ptr<ThreadPool> threadPool;
+
+    /** Slices, echoes, repetitions and channels to convert; all by default.
+     *  Packets outside the selection are skipped before being decoded. */
+    AcquisitionSelection selection;
+
+    /** Use, and build on the first conversion, the packet index sidecar of
+     *  ScanArchives (see PacketIndex) */
+    bool packetIndex;
+
+    /** Virtual channels of the PCA coil compression (see CoilCompression);
+     *  0, or at least the converted channels, writes the receiver channels */
+    unsigned int virtualChannels;
+
+    /** Acquisitions the coil compression is learnt from */
+    unsigned int compressionLines;
+
+    /** Bytes of a ScanArchive read into the page cache ahead of the
+     *  packets being decoded (see ArchivePrefetcher); 0 disables it */
+    uint64_t prefetchBytes;
+
+    /** Bytes the acquisitions and decoded packets in flight between reader
+     *  and writer may hold; the reader waits for the writer above it.  0
+     *  leaves them bounded by queueDepth only */
+    uint64_t maxMemoryBytes;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* CONVERSION_OPTIONS_H */
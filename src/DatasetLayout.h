@@ -0,0 +1,213 @@
+/** @file DatasetLayout.h */
+#ifndef DATASET_LAYOUT_H
+#define DATASET_LAYOUT_H
+
+#include <cstddef>
+#include <string>
+
+// HDF5
+#include <hdf5.h>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// Local
+#include "SampleEncoding.h"
+
+namespace GEToIsmrmrd {
+
+/** In-memory acquisition record, the type of which is acquisitionRecordType() */
+struct AcquisitionRecord
+{
+    ISMRMRD_AcquisitionHeader head;
+    hvl_t traj;
+    hvl_t data;
+};
+
+/**
+ * Data set next to "data" holding the samples of every acquisition, when
+ * they are not stored inline: one dimension of real values, acquisition
+ * after acquisition, in the order of the acquisition records
+ */
+const char* const SAMPLES_DATASET = "g2i_samples";
+
+/**
+ * Data set next to "data" holding one SampleShape per acquisition record,
+ * when the samples are not inline.  The records themselves then claim no
+ * samples, so that ISMRMRD readers see consistent, empty acquisitions.
+ */
+const char* const SAMPLE_SHAPES_DATASET = "g2i_sample_shapes";
+
+/** String attribute of the samples data set naming its SampleEncoding */
+const char* const SAMPLE_ENCODING_ATTRIBUTE = "g2i_sample_encoding";
+
+/** Real sample values per HDF5 chunk of the samples data set */
+const hsize_t SAMPLES_CHUNK_SIZE = 1 << 18;
+
+namespace detail {
+
+/** Adds a one dimensional array member of 'length' base values to a compound type */
+inline void insertArray(hid_t compound, const char* name, size_t offset, hid_t base, hsize_t length)
+{
+    hsize_t dims[1] = { length };
+    hid_t type = H5Tarray_create2(base, 1, dims);
+    H5Tinsert(compound, name, offset, type);
+    H5Tclose(type);
+}
+
+/** Adds a variable length float member to a compound type */
+inline void insertFloatSequence(hid_t compound, const char* name, size_t offset)
+{
+    hid_t type = H5Tvlen_create(H5T_NATIVE_FLOAT);
+    H5Tinsert(compound, name, offset, type);
+    H5Tclose(type);
+}
+
+} // namespace detail
+
+/** HDF5 type of ISMRMRD_EncodingCounters, member for member as libismrmrd defines it; to be closed by the caller */
+inline hid_t encodingCountersType()
+{
+    typedef ISMRMRD_EncodingCounters C;
+    hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(C));
+    H5Tinsert(type, "kspace_encode_step_1", HOFFSET(C, kspace_encode_step_1), H5T_NATIVE_UINT16);
+    H5Tinsert(type, "kspace_encode_step_2", HOFFSET(C, kspace_encode_step_2), H5T_NATIVE_UINT16);
+    H5Tinsert(type, "average",              HOFFSET(C, average),              H5T_NATIVE_UINT16);
+    H5Tinsert(type, "slice",                HOFFSET(C, slice),                H5T_NATIVE_UINT16);
+    H5Tinsert(type, "contrast",             HOFFSET(C, contrast),             H5T_NATIVE_UINT16);
+    H5Tinsert(type, "phase",                HOFFSET(C, phase),                H5T_NATIVE_UINT16);
+    H5Tinsert(type, "repetition",           HOFFSET(C, repetition),           H5T_NATIVE_UINT16);
+    H5Tinsert(type, "set",                  HOFFSET(C, set),                  H5T_NATIVE_UINT16);
+    H5Tinsert(type, "segment",              HOFFSET(C, segment),              H5T_NATIVE_UINT16);
+    detail::insertArray(type, "user",       HOFFSET(C, user),                 H5T_NATIVE_UINT16, ISMRMRD_USER_INTS);
+    return type;
+}
+
+/** HDF5 type of ISMRMRD_AcquisitionHeader, member for member as libismrmrd defines it; to be closed by the caller */
+inline hid_t acquisitionHeaderType()
+{
+    typedef ISMRMRD_AcquisitionHeader H;
+    hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(H));
+    H5Tinsert(type, "version",                HOFFSET(H, version),                H5T_NATIVE_UINT16);
+    H5Tinsert(type, "flags",                  HOFFSET(H, flags),                  H5T_NATIVE_UINT64);
+    H5Tinsert(type, "measurement_uid",        HOFFSET(H, measurement_uid),        H5T_NATIVE_UINT32);
+    H5Tinsert(type, "scan_counter",           HOFFSET(H, scan_counter),           H5T_NATIVE_UINT32);
+    H5Tinsert(type, "acquisition_time_stamp", HOFFSET(H, acquisition_time_stamp), H5T_NATIVE_UINT32);
+    detail::insertArray(type, "physiology_time_stamp", HOFFSET(H, physiology_time_stamp), H5T_NATIVE_UINT32,
+                        ISMRMRD_PHYS_STAMPS);
+    H5Tinsert(type, "number_of_samples",      HOFFSET(H, number_of_samples),      H5T_NATIVE_UINT16);
+    H5Tinsert(type, "available_channels",     HOFFSET(H, available_channels),     H5T_NATIVE_UINT16);
+    H5Tinsert(type, "active_channels",        HOFFSET(H, active_channels),        H5T_NATIVE_UINT16);
+    detail::insertArray(type, "channel_mask", HOFFSET(H, channel_mask), H5T_NATIVE_UINT64, ISMRMRD_CHANNEL_MASKS);
+    H5Tinsert(type, "discard_pre",            HOFFSET(H, discard_pre),            H5T_NATIVE_UINT16);
+    H5Tinsert(type, "discard_post",           HOFFSET(H, discard_post),           H5T_NATIVE_UINT16);
+    H5Tinsert(type, "center_sample",          HOFFSET(H, center_sample),          H5T_NATIVE_UINT16);
+    H5Tinsert(type, "encoding_space_ref",     HOFFSET(H, encoding_space_ref),     H5T_NATIVE_UINT16);
+    H5Tinsert(type, "trajectory_dimensions",  HOFFSET(H, trajectory_dimensions),  H5T_NATIVE_UINT16);
+    H5Tinsert(type, "sample_time_us",         HOFFSET(H, sample_time_us),         H5T_NATIVE_FLOAT);
+    detail::insertArray(type, "position",     HOFFSET(H, position),     H5T_NATIVE_FLOAT, ISMRMRD_POSITION_LENGTH);
+    detail::insertArray(type, "read_dir",     HOFFSET(H, read_dir),     H5T_NATIVE_FLOAT, ISMRMRD_DIRECTION_LENGTH);
+    detail::insertArray(type, "phase_dir",    HOFFSET(H, phase_dir),    H5T_NATIVE_FLOAT, ISMRMRD_DIRECTION_LENGTH);
+    detail::insertArray(type, "slice_dir",    HOFFSET(H, slice_dir),    H5T_NATIVE_FLOAT, ISMRMRD_DIRECTION_LENGTH);
+    detail::insertArray(type, "patient_table_position", HOFFSET(H, patient_table_position), H5T_NATIVE_FLOAT,
+                        ISMRMRD_POSITION_LENGTH);
+
+    hid_t idx = encodingCountersType();
+    H5Tinsert(type, "idx", HOFFSET(H, idx), idx);
+    H5Tclose(idx);
+
+    detail::insertArray(type, "user_int",     HOFFSET(H, user_int),     H5T_NATIVE_INT32, ISMRMRD_USER_INTS);
+    detail::insertArray(type, "user_float",   HOFFSET(H, user_float),   H5T_NATIVE_FLOAT, ISMRMRD_USER_FLOATS);
+    return type;
+}
+
+/**
+ * HDF5 type of an acquisition record, built the way libismrmrd builds the
+ * type of its "data" data sets - the header, then the trajectory and the
+ * samples (as interleaved real values) as variable length float arrays - and
+ * laid out in memory as an AcquisitionRecord; to be closed by the caller
+ */
+inline hid_t acquisitionRecordType()
+{
+    hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(AcquisitionRecord));
+
+    hid_t head = acquisitionHeaderType();
+    H5Tinsert(type, "head", HOFFSET(AcquisitionRecord, head), head);
+    H5Tclose(head);
+
+    detail::insertFloatSequence(type, "traj", HOFFSET(AcquisitionRecord, traj));
+    detail::insertFloatSequence(type, "data", HOFFSET(AcquisitionRecord, data));
+    return type;
+}
+
+/** HDF5 type of SampleShape, to be closed by the caller */
+inline hid_t sampleShapeType()
+{
+    hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(SampleShape));
+    H5Tinsert(type, "number_of_samples", HOFFSET(SampleShape, number_of_samples), H5T_NATIVE_UINT16);
+    H5Tinsert(type, "active_channels",   HOFFSET(SampleShape, active_channels),   H5T_NATIVE_UINT16);
+    H5Tinsert(type, "scale",             HOFFSET(SampleShape, scale),             H5T_NATIVE_FLOAT);
+    return type;
+}
+
+/** @returns a fixed length string attribute, empty if there is none */
+inline std::string readStringAttribute(hid_t object, const char* name)
+{
+    std::string value;
+    if (H5Aexists(object, name) <= 0) {
+        return value;
+    }
+
+    hid_t attribute = H5Aopen(object, name, H5P_DEFAULT);
+    if (attribute < 0) {
+        return value;
+    }
+    hid_t type = H5Aget_type(attribute);
+    if (H5Tget_class(type) == H5T_STRING && !H5Tis_variable_str(type)) {
+        value.resize(H5Tget_size(type));
+        hid_t memtype = H5Tcopy(H5T_C_S1);
+        H5Tset_size(memtype, value.size());
+        if (H5Aread(attribute, memtype, &value[0]) < 0) {
+            value.clear();
+        }
+        H5Tclose(memtype);
+    }
+    H5Tclose(type);
+    H5Aclose(attribute);
+    return value.c_str();
+}
+
+/** IEEE binary16 in the byte order of a 32 bit float type, to be closed by the caller */
+inline hid_t halfType(hid_t floatType)
+{
+    hid_t type = H5Tcopy(floatType);
+    H5Tset_fields(type, 15, 10, 5, 0, 10);
+    H5Tset_precision(type, 16);
+    H5Tset_size(type, 2);
+    H5Tset_ebias(type, 15);
+    return type;
+}
+
+/** HDF5 type of the values of a samples data set, to be closed by the caller */
+inline hid_t sampleFileType(SampleEncoding encoding)
+{
+    switch (encoding) {
+    case SAMPLES_FLOAT16: return halfType(H5T_IEEE_F32LE);
+    case SAMPLES_INT16:   return H5Tcopy(H5T_STD_I16LE);
+    default:              return H5Tcopy(H5T_IEEE_F32LE);
+    }
+}
+
+/** Type sample values are encoded to in memory, to be closed by the caller */
+inline hid_t sampleMemoryType(SampleEncoding encoding)
+{
+    switch (encoding) {
+    case SAMPLES_FLOAT16: return halfType(H5T_NATIVE_FLOAT);
+    case SAMPLES_INT16:   return H5Tcopy(H5T_NATIVE_INT16);
+    default:              return H5Tcopy(H5T_NATIVE_FLOAT);
+    }
+}
+
+} // namespace GEToIsmrmrd
+
+#endif /* DATASET_LAYOUT_H */
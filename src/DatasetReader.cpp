@@ -0,0 +1,307 @@
+/** @file DatasetReader.cpp */
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+// Local
+#include "DatasetLayout.h"
+#include "DatasetReader.h"
+#include "Hdf5Lock.h"
+#include "Profiler.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Copies a libismrmrd acquisition into an ISMRMRD::Acquisition */
+void copyAcquisition(const ISMRMRD_Acquisition& c_acq, ISMRMRD::Acquisition& acq)
+{
+    ISMRMRD::AcquisitionHeader head;
+    static_cast<ISMRMRD_AcquisitionHeader&>(head) = c_acq.head;
+    acq.setHead(head);
+
+    size_t const samples = head.number_of_samples;
+    if (head.trajectory_dimensions > 0 && c_acq.traj != NULL) {
+        memcpy(acq.getTrajPtr(), c_acq.traj, sizeof(float) * samples * head.trajectory_dimensions);
+    }
+    if (c_acq.data != NULL) {
+        memcpy(acq.getDataPtr(), c_acq.data, sizeof(complex_float_t) * samples * head.active_channels);
+    }
+}
+
+} // namespace
+
+DatasetReader::DatasetReader(const std::string& filename, const std::string& groupname, size_t blockSize)
+    : path_(filename), blockSize_(std::max<size_t>(blockSize, 1)), open_(false), encoding_(SAMPLES_INLINE),
+      dataset_(-1), type_(-1), samples_(-1), sampleType_(-1), shapes_(-1), shapeType_(-1),
+      count_(0), next_(0), sampleOffset_(0), blockStart_(0)
+{
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    if (ismrmrd_init_dataset(&dset_, filename.c_str(), groupname.c_str()) != ISMRMRD_NOERROR ||
+        ismrmrd_open_dataset(&dset_, false) != ISMRMRD_NOERROR) {
+        throw std::runtime_error("Failed to open ISMRMRD file " + filename);
+    }
+    open_ = true;
+
+    std::string samplesPath = groupname + "/" + SAMPLES_DATASET;
+    if (H5Lexists(dset_.fileid, groupname.c_str(), H5P_DEFAULT) > 0 &&
+        H5Lexists(dset_.fileid, samplesPath.c_str(), H5P_DEFAULT) > 0) {
+        try {
+            openEncoded();
+        } catch (const std::exception&) {
+            closeFile();
+            throw;
+        }
+    } else {
+        count_ = ismrmrd_get_number_of_acquisitions(&dset_);
+    }
+}
+
+DatasetReader::~DatasetReader()
+{
+    try {
+        close();
+    } catch (const std::exception&) {
+        // Errors were reported by HDF5; a destructor cannot do more
+    }
+}
+
+/** Opens the records, sample shapes and samples data sets of a file with encoded samples; called holding the lock */
+void DatasetReader::openEncoded()
+{
+    std::string group(dset_.groupname);
+
+    samples_ = H5Dopen2(dset_.fileid, (group + "/" + SAMPLES_DATASET).c_str(), H5P_DEFAULT);
+    if (samples_ < 0) {
+        throw std::runtime_error("Failed to open the sample data set of " + path_);
+    }
+    std::string name = readStringAttribute(samples_, SAMPLE_ENCODING_ATTRIBUTE);
+    encoding_ = parseSampleEncoding(name);
+    if (encoding_ == SAMPLES_INLINE) {
+        throw std::runtime_error("Sample data set of " + path_ + " claims inline samples");
+    }
+    sampleType_ = sampleMemoryType(encoding_);
+
+    dataset_ = H5Dopen2(dset_.fileid, (group + "/data").c_str(), H5P_DEFAULT);
+    if (dataset_ < 0) {
+        throw std::runtime_error("Failed to open the acquisition data set of " + path_);
+    }
+    // HDF5 converts the records of the file, member by member, to the ones
+    // libismrmrd defines
+    type_ = acquisitionRecordType();
+
+    hid_t space = H5Dget_space(dataset_);
+    hsize_t dims[1] = { 0 };
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    H5Sclose(space);
+    count_ = dims[0];
+
+    std::string shapesPath = group + "/" + SAMPLE_SHAPES_DATASET;
+    shapes_ = (H5Lexists(dset_.fileid, shapesPath.c_str(), H5P_DEFAULT) > 0) ?
+              H5Dopen2(dset_.fileid, shapesPath.c_str(), H5P_DEFAULT) : -1;
+    if (shapes_ < 0) {
+        throw std::runtime_error("Failed to open the sample shape data set of " + path_);
+    }
+    shapeType_ = sampleShapeType();
+
+    space = H5Dget_space(shapes_);
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    H5Sclose(space);
+    if (dims[0] != count_) {
+        throw std::runtime_error("Sample shapes of " + path_ + " do not match its acquisitions");
+    }
+}
+
+void DatasetReader::close()
+{
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    closeFile();
+}
+
+void DatasetReader::closeFile()
+{
+    if (!open_) {
+        return;
+    }
+
+    if (dataset_ >= 0) {
+        H5Dclose(dataset_);
+        dataset_ = -1;
+    }
+    if (type_ >= 0) {
+        H5Tclose(type_);
+        type_ = -1;
+    }
+    if (samples_ >= 0) {
+        H5Dclose(samples_);
+        samples_ = -1;
+    }
+    if (sampleType_ >= 0) {
+        H5Tclose(sampleType_);
+        sampleType_ = -1;
+    }
+    if (shapes_ >= 0) {
+        H5Dclose(shapes_);
+        shapes_ = -1;
+    }
+    if (shapeType_ >= 0) {
+        H5Tclose(shapeType_);
+        shapeType_ = -1;
+    }
+
+    open_ = false;
+    if (ismrmrd_close_dataset(&dset_) != ISMRMRD_NOERROR) {
+        throw std::runtime_error("Failed to close ISMRMRD file " + path_);
+    }
+}
+
+std::string DatasetReader::readHeader()
+{
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    std::string xml;
+    char* header = ismrmrd_read_header(&dset_);
+    if (header != NULL) {
+        xml = header;
+        free(header);
+    }
+    return xml;
+}
+
+bool DatasetReader::next(ISMRMRD::Acquisition& acq)
+{
+    if (next_ >= count_) {
+        return false;
+    }
+
+    if (samples_ < 0) {
+        std::lock_guard<std::mutex> lock(hdf5Mutex());
+        ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+        ISMRMRD_Acquisition c_acq;
+        ismrmrd_init_acquisition(&c_acq);
+        if (ismrmrd_read_acquisition(&dset_, next_, &c_acq) != ISMRMRD_NOERROR) {
+            ismrmrd_cleanup_acquisition(&c_acq);
+            throw std::runtime_error("Failed to read an acquisition of " + path_);
+        }
+        copyAcquisition(c_acq, acq);
+        ismrmrd_cleanup_acquisition(&c_acq);
+    } else {
+        if (next_ >= blockStart_ + block_.size()) {
+            readBlock();
+        }
+        acq = block_[next_ - blockStart_];
+    }
+
+    next_++;
+    return true;
+}
+
+/**
+ * Reads the records, shapes and samples of the blockSize acquisitions from
+ * next_ with one H5Dread each, then decodes the samples outside the lock
+ */
+void DatasetReader::readBlock()
+{
+    size_t const n = std::min(blockSize_, count_ - next_);
+    std::vector<AcquisitionRecord> records(n);
+    std::vector<SampleShape> shapes(n);
+    std::vector<char> encoded;
+
+    block_.resize(n);
+    blockStart_ = next_;
+
+    {
+        std::lock_guard<std::mutex> lock(hdf5Mutex());
+        ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+        hsize_t start[1] = { next_ };
+        hsize_t count[1] = { n };
+        hid_t filespace = H5Dget_space(dataset_);
+        hid_t memspace  = H5Screate_simple(1, count, NULL);
+        H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL);
+        herr_t status = H5Dread(dataset_, type_, memspace, filespace, H5P_DEFAULT, &records[0]);
+        H5Sclose(filespace);
+        if (status < 0) {
+            H5Sclose(memspace);
+            throw std::runtime_error("Failed to read the acquisition records of " + path_);
+        }
+
+        filespace = H5Dget_space(shapes_);
+        H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL);
+        status = H5Dread(shapes_, shapeType_, memspace, filespace, H5P_DEFAULT, &shapes[0]);
+        H5Sclose(filespace);
+        if (status < 0) {
+            H5Dvlen_reclaim(type_, memspace, H5P_DEFAULT, &records[0]);
+            H5Sclose(memspace);
+            throw std::runtime_error("Failed to read the sample shapes of " + path_);
+        }
+
+        hsize_t values = 0;
+        for (size_t i = 0; i < n; i++) {
+            ISMRMRD_AcquisitionHeader& head = records[i].head;
+            head.number_of_samples = shapes[i].number_of_samples;
+            head.active_channels   = shapes[i].active_channels;
+
+            ISMRMRD_Acquisition c_acq;
+            c_acq.head = head;
+            c_acq.traj = (records[i].traj.len == (size_t)head.number_of_samples * head.trajectory_dimensions) ?
+                         static_cast<float*>(records[i].traj.p) : NULL;
+            c_acq.data = NULL;
+            copyAcquisition(c_acq, block_[i]);
+            values += 2 * (hsize_t)head.number_of_samples * head.active_channels;
+        }
+        H5Dvlen_reclaim(type_, memspace, H5P_DEFAULT, &records[0]);
+        H5Sclose(memspace);
+
+        filespace = H5Dget_space(samples_);
+        hsize_t dims[1] = { 0 };
+        H5Sget_simple_extent_dims(filespace, dims, NULL);
+        if (sampleOffset_ + values > dims[0]) {
+            H5Sclose(filespace);
+            throw std::runtime_error("Sample data set of " + path_ + " is shorter than its acquisitions");
+        }
+
+        encoded.resize(values * sampleEncodingBytes(encoding_));
+        if (values > 0) {
+            start[0] = sampleOffset_;
+            count[0] = values;
+            memspace = H5Screate_simple(1, count, NULL);
+            H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL);
+            status = H5Dread(samples_, sampleType_, memspace, filespace, H5P_DEFAULT, encoded.data());
+            H5Sclose(memspace);
+        }
+        H5Sclose(filespace);
+        if (status < 0) {
+            throw std::runtime_error("Failed to read the samples of " + path_);
+        }
+        sampleOffset_ += values;
+    }
+
+    const char* in = encoded.data();
+    for (size_t i = 0; i < n; i++) {
+        float* dst = reinterpret_cast<float*>(block_[i].getDataPtr());
+        size_t const count = 2 * block_[i].getNumberOfDataElements();
+
+        switch (encoding_) {
+        case SAMPLES_FLOAT16:
+            halfToFloat(dst, reinterpret_cast<const uint16_t*>(in), count);
+            break;
+        case SAMPLES_INT16:
+            int16ToFloat(dst, reinterpret_cast<const int16_t*>(in), count, shapes[i].scale);
+            break;
+        default:
+            memcpy(dst, in, count * sizeof(float));
+            break;
+        }
+        in += count * sampleEncodingBytes(encoding_);
+    }
+}
+
+} // namespace GEToIsmrmrd
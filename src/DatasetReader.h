@@ -0,0 +1,94 @@
+/** @file DatasetReader.h */
+#ifndef DATASET_READER_H
+#define DATASET_READER_H
+
+#include <string>
+#include <vector>
+
+// HDF5
+#include <hdf5.h>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+
+// Local
+#include "SampleEncoding.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Reads the acquisitions of an ISMRMRD file in order, whatever the
+ * SampleEncoding a DatasetWriter stored them with
+ *
+ * Files with inline samples are read through libismrmrd.  Otherwise records
+ * records, sample shapes and samples are read blockSize acquisitions at a
+ * time, the shapes put back into the headers and the samples decoded back
+ * to 32 bit floats.
+ * All HDF5 calls are made holding hdf5Mutex().
+ */
+class DatasetReader
+{
+public:
+    /**
+     * @param filename ISMRMRD file
+     * @param groupname Group holding the header and acquisitions
+     * @param blockSize Acquisitions read per HDF5 read of an encoded file
+     * @throws std::runtime_error if the file or its acquisitions cannot be opened
+     */
+    DatasetReader(const std::string& filename, const std::string& groupname, size_t blockSize = 1024);
+    ~DatasetReader();
+
+    /** @returns the XML header, empty if the file has none */
+    std::string readHeader();
+
+    size_t count() const { return count_; }
+
+    SampleEncoding encoding() const { return encoding_; }
+
+    /**
+     * Reads the next acquisition
+     *
+     * @returns false once all acquisitions were read
+     * @throws std::runtime_error if the file cannot be read
+     */
+    bool next(ISMRMRD::Acquisition& acq);
+
+    /** Closes the file */
+    void close();
+
+private:
+    // Non-copyable
+    DatasetReader(const DatasetReader& other);
+    DatasetReader& operator=(const DatasetReader& other);
+
+    void openEncoded();
+    void closeFile();
+    void readBlock();
+
+    std::string path_;
+    size_t blockSize_;
+
+    ISMRMRD_Dataset dset_;
+    bool open_;
+
+    SampleEncoding encoding_;
+    hid_t dataset_;
+    hid_t type_;
+    hid_t samples_;
+    hid_t sampleType_;
+    hid_t shapes_;
+    hid_t shapeType_;
+
+    size_t count_;
+    size_t next_;          // index of the next acquisition returned
+    hsize_t sampleOffset_; // first sample value of the next block
+
+    // Current block of an encoded file
+    std::vector<ISMRMRD::Acquisition> block_;
+    size_t blockStart_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* DATASET_READER_H */
@@ -0,0 +1,625 @@
+/** @file DatasetWriter.cpp */
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+// Local
+#include "DatasetLayout.h"
+#include "DatasetWriter.h"
+#include "Hdf5Lock.h"
+#include "Profiler.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Writes a scalar string attribute */
+bool writeStringAttribute(hid_t object, const char* name, const std::string& value)
+{
+    hid_t type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(type, value.size());
+    hid_t space = H5Screate(H5S_SCALAR);
+    hid_t attribute = H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+    herr_t status = (attribute >= 0) ? H5Awrite(attribute, type, value.data()) : -1;
+    if (attribute >= 0) {
+        H5Aclose(attribute);
+    }
+    H5Sclose(space);
+    H5Tclose(type);
+    return status >= 0;
+}
+
+/** Length of a one dimensional data set */
+hsize_t datasetLength(hid_t dataset)
+{
+    hid_t space = H5Dget_space(dataset);
+    hsize_t dims[1] = { 0 };
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    H5Sclose(space);
+    return dims[0];
+}
+
+/** Fills the C struct libismrmrd appends from, without copying the samples */
+ISMRMRD_Acquisition borrowAcquisition(const ISMRMRD::Acquisition& acq)
+{
+    ISMRMRD_Acquisition c_acq;
+    c_acq.head = acq.getHead();
+    c_acq.traj = const_cast<float*>(acq.getTrajPtr());
+    c_acq.data = const_cast<complex_float_t*>(acq.getDataPtr());
+    return c_acq;
+}
+
+} // namespace
+
+DatasetWriter::DatasetWriter(const std::string& filename, const std::string& groupname,
+                             const DatasetWriterOptions& options)
+    : options_(options), groupname_(groupname), open_(false),
+      dataset_(-1), type_(-1), bulk_(true), samples_(-1), sampleType_(-1), samplesWritten_(0),
+      shapes_(-1), shapeType_(-1), buffered_(0), bufferedBytes_(0), written_(0), count_(0)
+{
+    if (options_.batchSize == 0) {
+        options_.batchSize = 1;
+    }
+    if (options_.chunkSize == 0) {
+        options_.chunkSize = 1;
+    }
+    batch_.resize(options_.batchSize);
+
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    if (ismrmrd_init_dataset(&dset_, filename.c_str(), groupname.c_str()) != ISMRMRD_NOERROR ||
+        ismrmrd_open_dataset(&dset_, true) != ISMRMRD_NOERROR) {
+        throw std::runtime_error("Failed to open ISMRMRD file " + filename);
+    }
+    open_ = true;
+}
+
+DatasetWriter::~DatasetWriter()
+{
+    try {
+        close();
+    } catch (const std::exception&) {
+        // Errors were reported by HDF5; a destructor cannot do more
+    }
+}
+
+void DatasetWriter::writeHeader(const std::string& xml)
+{
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    if (ismrmrd_write_header(&dset_, xml.c_str()) != ISMRMRD_NOERROR) {
+        throw std::runtime_error("Failed to write ISMRMRD header");
+    }
+}
+
+void DatasetWriter::append(const ISMRMRD::Acquisition& acq)
+{
+    batch_[buffered_++] = acq;
+    count_++;
+    bufferedBytes_ += acq.getNumberOfDataElements() * sizeof(complex_float_t);
+
+    // Only the slots filled before a flush keep their buffers, so the byte
+    // limit also bounds the memory the batch holds on to
+    if (buffered_ == batch_.size() || (options_.maxBatchBytes > 0 && bufferedBytes_ >= options_.maxBatchBytes)) {
+        flush();
+    }
+}
+
+void DatasetWriter::flush()
+{
+    if (buffered_ == 0) {
+        return;
+    }
+
+    if (options_.encoding != SAMPLES_INLINE) {
+        encodeBatch();
+    }
+
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    if (bulk_ && dataset_ < 0) {
+        try {
+            createDataset();
+        } catch (const std::exception&) {
+            // Nothing is written to a data set that could not be set up
+            closeDatasets();
+            bulk_ = true;
+            throw;
+        }
+    }
+
+    if (bulk_) {
+        writeBatch();
+    } else {
+        for (size_t n = 0; n < buffered_; n++) {
+            appendUnbuffered(batch_[n]);
+        }
+    }
+    buffered_ = 0;
+    bufferedBytes_ = 0;
+
+    if (options_.fsync == FSYNC_BATCH) {
+        syncFile();
+    }
+}
+
+void DatasetWriter::close()
+{
+    if (!open_) {
+        return;
+    }
+
+    // Marked closed first, so a batch that failed to flush is not retried
+    // (by the destructor, say) once the file is half closed
+    open_ = false;
+    std::exception_ptr error;
+    try {
+        flush();
+    } catch (const std::exception&) {
+        error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    closeDatasets();
+
+    if (!error && options_.fsync != FSYNC_NEVER) {
+        syncFile();
+    }
+
+    if (ismrmrd_close_dataset(&dset_) != ISMRMRD_NOERROR && !error) {
+        throw std::runtime_error("Failed to close ISMRMRD file");
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void DatasetWriter::commit()
+{
+    flush();
+
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    if (options_.fsync == FSYNC_NEVER) {
+        H5Fflush(dset_.fileid, H5F_SCOPE_GLOBAL);
+    } else {
+        syncFile();
+    }
+}
+
+DatasetExtent DatasetWriter::extent()
+{
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    DatasetExtent extent;
+    extent.acquisitions = storedLength(dataset_, groupname_ + "/data");
+    extent.samples      = storedLength(samples_, groupname_ + "/" + SAMPLES_DATASET);
+    return extent;
+}
+
+void DatasetWriter::truncate(const DatasetExtent& extent)
+{
+    // The data sets are opened with the first batch, so none is open yet
+    if (count_ > 0) {
+        throw std::runtime_error("Cannot truncate an ISMRMRD file acquisitions were appended to");
+    }
+
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+
+    truncateDataset(groupname_ + "/data", extent.acquisitions);
+    truncateDataset(groupname_ + "/" + SAMPLES_DATASET, extent.samples);
+
+    // Encoded samples have one shape per record
+    std::string shapesPath = groupname_ + "/" + SAMPLE_SHAPES_DATASET;
+    if (H5Lexists(dset_.fileid, groupname_.c_str(), H5P_DEFAULT) > 0 &&
+        H5Lexists(dset_.fileid, shapesPath.c_str(), H5P_DEFAULT) > 0) {
+        truncateDataset(shapesPath, extent.acquisitions);
+    }
+}
+
+/** Length of a data set: the open one, or else the one at path; 0 if there is none */
+hsize_t DatasetWriter::storedLength(hid_t dataset, const std::string& path)
+{
+    if (dataset >= 0) {
+        return datasetLength(dataset);
+    }
+    if (H5Lexists(dset_.fileid, groupname_.c_str(), H5P_DEFAULT) <= 0 ||
+        H5Lexists(dset_.fileid, path.c_str(), H5P_DEFAULT) <= 0) {
+        return 0;
+    }
+
+    dataset = H5Dopen2(dset_.fileid, path.c_str(), H5P_DEFAULT);
+    if (dataset < 0) {
+        return 0;
+    }
+    hsize_t const length = datasetLength(dataset);
+    H5Dclose(dataset);
+    return length;
+}
+
+/** Cuts the data set at path back to length; called holding the lock */
+void DatasetWriter::truncateDataset(const std::string& path, hsize_t length)
+{
+    hsize_t const stored = storedLength(-1, path);
+    if (stored < length) {
+        std::ostringstream message;
+        message << "ISMRMRD data set " << path << " holds " << stored << " entries, " << length << " expected";
+        throw std::runtime_error(message.str());
+    }
+    if (stored == length) {
+        return;
+    }
+
+    hid_t dataset = H5Dopen2(dset_.fileid, path.c_str(), H5P_DEFAULT);
+    hsize_t extent[1] = { length };
+    herr_t status = (dataset >= 0) ? H5Dset_extent(dataset, extent) : -1;
+    if (dataset >= 0) {
+        H5Dclose(dataset);
+    }
+    if (status < 0) {
+        throw std::runtime_error("Failed to truncate ISMRMRD data set " + path);
+    }
+}
+
+void DatasetWriter::closeDatasets()
+{
+    if (dataset_ >= 0) {
+        H5Dclose(dataset_);
+        dataset_ = -1;
+    }
+    if (type_ >= 0) {
+        H5Tclose(type_);
+        type_ = -1;
+    }
+    if (samples_ >= 0) {
+        H5Dclose(samples_);
+        samples_ = -1;
+    }
+    if (sampleType_ >= 0) {
+        H5Tclose(sampleType_);
+        sampleType_ = -1;
+    }
+    if (shapes_ >= 0) {
+        H5Dclose(shapes_);
+        shapes_ = -1;
+    }
+    if (shapeType_ >= 0) {
+        H5Tclose(shapeType_);
+        shapeType_ = -1;
+    }
+}
+
+/**
+ * Opens or creates the acquisition data set, called with the first batch
+ *
+ * Records are written as acquisitionRecordType(), the type libismrmrd gives
+ * its data sets.  A file written before keeps its data set; should that have
+ * another record type, the writer falls back to appending through
+ * libismrmrd, one acquisition at a time - which only stores inline samples.
+ */
+void DatasetWriter::createDataset()
+{
+    std::string path = groupname_ + "/data";
+    type_ = acquisitionRecordType();
+
+    if (H5Lexists(dset_.fileid, path.c_str(), H5P_DEFAULT) > 0) {
+        // Appending to a file written before: keep its data set and settings
+        hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+        H5Pset_chunk_cache(dapl, H5D_CHUNK_CACHE_NSLOTS_DEFAULT, options_.chunkCacheBytes, H5D_CHUNK_CACHE_W0_DEFAULT);
+        dataset_ = H5Dopen2(dset_.fileid, path.c_str(), dapl);
+        H5Pclose(dapl);
+        if (dataset_ < 0) {
+            throw std::runtime_error("Failed to open ISMRMRD acquisition data set");
+        }
+
+        hid_t fileType = H5Dget_type(dataset_);
+        bulk_ = H5Tequal(fileType, type_) > 0;
+        H5Tclose(fileType);
+        written_ = datasetLength(dataset_);
+
+        openSamplesDataset();
+        return;
+    }
+
+    if (H5Lexists(dset_.fileid, ("/" + groupname_).c_str(), H5P_DEFAULT) <= 0) {
+        hid_t group = H5Gcreate2(dset_.fileid, ("/" + groupname_).c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if (group < 0) {
+            throw std::runtime_error("Failed to create ISMRMRD group " + groupname_);
+        }
+        H5Gclose(group);
+    }
+
+    dataset_ = createAppendableDataset(path, type_, options_.chunkSize);
+    if (dataset_ < 0) {
+        throw std::runtime_error("Failed to create ISMRMRD acquisition data set");
+    }
+
+    if (options_.encoding != SAMPLES_INLINE) {
+        createSamplesDataset();
+    }
+}
+
+/** Opens the samples data set of a file appended to, which must have the encoding of the options */
+void DatasetWriter::openSamplesDataset()
+{
+    std::string path = groupname_ + "/" + SAMPLES_DATASET;
+
+    bool const encoded = H5Lexists(dset_.fileid, path.c_str(), H5P_DEFAULT) > 0;
+    if (!encoded) {
+        if (options_.encoding != SAMPLES_INLINE) {
+            throw std::runtime_error("ISMRMRD file has inline samples, cannot append " +
+                                     std::string(sampleEncodingName(options_.encoding)) + " samples");
+        }
+        return;
+    }
+    if (!bulk_) {
+        throw std::runtime_error("ISMRMRD record layout not supported, cannot append encoded samples");
+    }
+
+    samples_ = H5Dopen2(dset_.fileid, path.c_str(), H5P_DEFAULT);
+    if (samples_ < 0) {
+        throw std::runtime_error("Failed to open sample data set " + path);
+    }
+
+    std::string name = readStringAttribute(samples_, SAMPLE_ENCODING_ATTRIBUTE);
+    if (name != sampleEncodingName(options_.encoding)) {
+        throw std::runtime_error("ISMRMRD file has " + (name.empty() ? std::string("unknown") : name) +
+                                 " samples, cannot append " + sampleEncodingName(options_.encoding) + " samples");
+    }
+
+    samplesWritten_ = datasetLength(samples_);
+
+    sampleType_ = sampleMemoryType(options_.encoding);
+
+    path = groupname_ + "/" + SAMPLE_SHAPES_DATASET;
+    shapes_ = (H5Lexists(dset_.fileid, path.c_str(), H5P_DEFAULT) > 0) ?
+              H5Dopen2(dset_.fileid, path.c_str(), H5P_DEFAULT) : -1;
+    if (shapes_ < 0) {
+        throw std::runtime_error("Failed to open sample shape data set " + path);
+    }
+    if (datasetLength(shapes_) != written_) {
+        throw std::runtime_error("Sample shape data set " + path + " does not match the acquisitions");
+    }
+    shapeType_ = sampleShapeType();
+}
+
+/**
+ * Creates an empty, chunked and extendible data set at path, with the
+ * filters and chunk cache of the options; called holding the lock
+ *
+ * @returns the data set, negative on failure
+ */
+hid_t DatasetWriter::createAppendableDataset(const std::string& path, hid_t type, hsize_t chunkSize)
+{
+    hsize_t dims[1] = { 0 };
+    hsize_t maxdims[1] = { H5S_UNLIMITED };
+    hsize_t chunk[1] = { chunkSize };
+    hid_t space = H5Screate_simple(1, dims, maxdims);
+
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, 1, chunk);
+    if (options_.shuffle) {
+        H5Pset_shuffle(dcpl);
+    }
+    if (options_.deflateLevel > 0) {
+        H5Pset_deflate(dcpl, options_.deflateLevel);
+    }
+
+    hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+    H5Pset_chunk_cache(dapl, H5D_CHUNK_CACHE_NSLOTS_DEFAULT, options_.chunkCacheBytes, H5D_CHUNK_CACHE_W0_DEFAULT);
+
+    hid_t dataset = H5Dcreate2(dset_.fileid, path.c_str(), type, space, H5P_DEFAULT, dcpl, dapl);
+
+    H5Pclose(dapl);
+    H5Pclose(dcpl);
+    H5Sclose(space);
+    return dataset;
+}
+
+void DatasetWriter::createSamplesDataset()
+{
+    std::string path = groupname_ + "/" + SAMPLES_DATASET;
+
+    hid_t fileType = sampleFileType(options_.encoding);
+    samples_ = createAppendableDataset(path, fileType, SAMPLES_CHUNK_SIZE);
+    H5Tclose(fileType);
+
+    if (samples_ < 0 ||
+        !writeStringAttribute(samples_, SAMPLE_ENCODING_ATTRIBUTE, sampleEncodingName(options_.encoding))) {
+        throw std::runtime_error("Failed to create sample data set " + path);
+    }
+    sampleType_ = sampleMemoryType(options_.encoding);
+
+    path = groupname_ + "/" + SAMPLE_SHAPES_DATASET;
+    shapeType_ = sampleShapeType();
+    shapes_ = createAppendableDataset(path, shapeType_, options_.chunkSize);
+    if (shapes_ < 0) {
+        throw std::runtime_error("Failed to create sample shape data set " + path);
+    }
+}
+
+/**
+ * Encodes the samples of the buffered acquisitions into encoded_, before
+ * the lock is taken: the conversions do not touch HDF5
+ */
+void DatasetWriter::encodeBatch()
+{
+    ScopedTimer encodeTimer(PROFILE_ENCODE);
+
+    size_t values = 0;
+    for (size_t n = 0; n < buffered_; n++) {
+        values += 2 * batch_[n].getNumberOfDataElements();
+    }
+    encoded_.resize(values * sampleEncodingBytes(options_.encoding));
+    encodedShapes_.resize(buffered_);
+
+    char* out = encoded_.data();
+    for (size_t n = 0; n < buffered_; n++) {
+        const float* src = reinterpret_cast<const float*>(batch_[n].getDataPtr());
+        size_t const count = 2 * batch_[n].getNumberOfDataElements();
+
+        SampleShape& shape = encodedShapes_[n];
+        shape.number_of_samples = batch_[n].getHead().number_of_samples;
+        shape.active_channels   = batch_[n].getHead().active_channels;
+        shape.scale             = 1.0f;
+
+        switch (options_.encoding) {
+        case SAMPLES_FLOAT16:
+            floatToHalf(reinterpret_cast<uint16_t*>(out), src, count);
+            break;
+        case SAMPLES_INT16:
+            shape.scale = int16Scale(src, count);
+            floatToInt16(reinterpret_cast<int16_t*>(out), src, count, shape.scale);
+            break;
+        default:
+            memcpy(out, src, count * sizeof(float));
+            break;
+        }
+        out += count * sampleEncodingBytes(options_.encoding);
+    }
+}
+
+/** Writes the buffered acquisitions with a single extend and H5Dwrite */
+void DatasetWriter::writeBatch()
+{
+    std::vector<AcquisitionRecord> records(buffered_);
+    for (size_t n = 0; n < buffered_; n++) {
+        const ISMRMRD::Acquisition& acq = batch_[n];
+        const ISMRMRD_AcquisitionHeader& head = acq.getHead();
+
+        records[n].head     = head;
+        records[n].traj.len = head.number_of_samples * head.trajectory_dimensions;
+        records[n].traj.p   = const_cast<float*>(acq.getTrajPtr());
+        records[n].data.len = 2 * head.number_of_samples * head.active_channels;
+        records[n].data.p   = const_cast<complex_float_t*>(acq.getDataPtr());
+
+        if (samples_ >= 0) {
+            // The shape goes to the sample shapes; the trajectory stays,
+            // which ISMRMRD readers skip along with the samples
+            records[n].head.number_of_samples = 0;
+            records[n].head.active_channels   = 0;
+            records[n].data.len = 0;
+            records[n].data.p   = NULL;
+        }
+    }
+
+    // Samples first: records are only counted once their samples are there
+    if (samples_ >= 0) {
+        writeSamples();
+        writeShapes();
+    }
+
+    hsize_t extent[1] = { written_ + buffered_ };
+    hsize_t start[1]  = { written_ };
+    hsize_t count[1]  = { buffered_ };
+
+    if (H5Dset_extent(dataset_, extent) < 0) {
+        throw std::runtime_error("Failed to extend ISMRMRD acquisition data set");
+    }
+
+    hid_t filespace = H5Dget_space(dataset_);
+    hid_t memspace  = H5Screate_simple(1, count, NULL);
+    H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL);
+
+    herr_t status = H5Dwrite(dataset_, type_, memspace, filespace, H5P_DEFAULT, &records[0]);
+
+    H5Sclose(memspace);
+    H5Sclose(filespace);
+
+    if (status < 0) {
+        throw std::runtime_error("Failed to write ISMRMRD acquisitions");
+    }
+    written_ += buffered_;
+}
+
+/** Appends encoded_ to the samples data set */
+void DatasetWriter::writeSamples()
+{
+    hsize_t const values = encoded_.size() / sampleEncodingBytes(options_.encoding);
+    if (values == 0) {
+        return;
+    }
+
+    hsize_t extent[1] = { samplesWritten_ + values };
+    hsize_t start[1]  = { samplesWritten_ };
+    hsize_t count[1]  = { values };
+
+    if (H5Dset_extent(samples_, extent) < 0) {
+        throw std::runtime_error("Failed to extend sample data set");
+    }
+
+    hid_t filespace = H5Dget_space(samples_);
+    hid_t memspace  = H5Screate_simple(1, count, NULL);
+    H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL);
+
+    herr_t status = H5Dwrite(samples_, sampleType_, memspace, filespace, H5P_DEFAULT, encoded_.data());
+
+    H5Sclose(memspace);
+    H5Sclose(filespace);
+
+    if (status < 0) {
+        throw std::runtime_error("Failed to write encoded samples");
+    }
+    samplesWritten_ += values;
+}
+
+/** Writes the shapes of the buffered acquisitions, at the records they belong to */
+void DatasetWriter::writeShapes()
+{
+    hsize_t extent[1] = { written_ + buffered_ };
+    hsize_t start[1]  = { written_ };
+    hsize_t count[1]  = { buffered_ };
+
+    if (H5Dset_extent(shapes_, extent) < 0) {
+        throw std::runtime_error("Failed to extend sample shape data set");
+    }
+
+    hid_t filespace = H5Dget_space(shapes_);
+    hid_t memspace  = H5Screate_simple(1, count, NULL);
+    H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL);
+
+    herr_t status = H5Dwrite(shapes_, shapeType_, memspace, filespace, H5P_DEFAULT, &encodedShapes_[0]);
+
+    H5Sclose(memspace);
+    H5Sclose(filespace);
+
+    if (status < 0) {
+        throw std::runtime_error("Failed to write sample shapes");
+    }
+}
+
+void DatasetWriter::appendUnbuffered(const ISMRMRD::Acquisition& acq)
+{
+    ISMRMRD_Acquisition c_acq = borrowAcquisition(acq);
+    if (ismrmrd_append_acquisition(&dset_, &c_acq) != ISMRMRD_NOERROR) {
+        throw std::runtime_error("Failed to append ISMRMRD acquisition");
+    }
+}
+
+/**
+ * Flushes HDF5's buffers and fsyncs the file - only possible with a file
+ * driver exposing a POSIX descriptor, such as the default sec2 driver
+ */
+void DatasetWriter::syncFile()
+{
+    H5Fflush(dset_.fileid, H5F_SCOPE_GLOBAL);
+
+    void* handle = NULL;
+    if (H5Fget_vfd_handle(dset_.fileid, H5P_DEFAULT, &handle) >= 0 && handle != NULL) {
+        fsync(*static_cast<int*>(handle));
+    }
+}
+
+} // namespace GEToIsmrmrd
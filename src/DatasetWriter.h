@@ -0,0 +1,175 @@
+/** @file DatasetWriter.h */
+#ifndef DATASET_WRITER_H
+#define DATASET_WRITER_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// HDF5
+#include <hdf5.h>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+
+// Local
+#include "AcquisitionSink.h"
+#include "SampleEncoding.h"
+
+namespace GEToIsmrmrd {
+
+/** When the writer forces written data to stable storage */
+enum FsyncPolicy
+{
+    FSYNC_NEVER = 0,    /**< Leave it to the operating system */
+    FSYNC_CLOSE = 1,    /**< Once, when the file is closed */
+    FSYNC_BATCH = 2     /**< After every batch written */
+};
+
+/** Settings of a DatasetWriter */
+struct DatasetWriterOptions
+{
+    DatasetWriterOptions()
+        : batchSize(1024), maxBatchBytes(0), chunkSize(1024), chunkCacheBytes(16 << 20),
+          deflateLevel(0), shuffle(false), fsync(FSYNC_NEVER), encoding(SAMPLES_INLINE) { }
+
+    size_t batchSize;        /**< Acquisitions buffered before each HDF5 write */
+    size_t maxBatchBytes;    /**< Sample bytes buffered before each HDF5 write, 0 for no limit */
+    size_t chunkSize;        /**< Acquisitions per HDF5 chunk of the data set */
+    size_t chunkCacheBytes;  /**< Size of the HDF5 chunk cache of the data set */
+    int deflateLevel;        /**< gzip level 1-9 of the data sets, 0 to disable; headers only with inline samples */
+    bool shuffle;            /**< Apply the shuffle filter before deflate */
+    FsyncPolicy fsync;
+    SampleEncoding encoding; /**< Storage of the k-space samples */
+};
+
+/** Lengths of the data sets of an ISMRMRD file written by a DatasetWriter */
+struct DatasetExtent
+{
+    DatasetExtent() : acquisitions(0), samples(0) { }
+
+    uint64_t acquisitions;   /**< Records of the acquisition data set */
+    uint64_t samples;        /**< Real values of the samples data set, 0 with inline samples */
+};
+
+/**
+ * Sink writing acquisitions to an ISMRMRD file in large batches
+ *
+ * ISMRMRD::Dataset::appendAcquisition() extends the data set and writes a
+ * single record per call.  This writer copies acquisitions into a buffer and
+ * writes batchSize of them with one extend and one H5Dwrite, to a data set
+ * created with its own chunk size, chunk cache and filters.  The file layout
+ * is the one ISMRMRD uses, so the output reads back with ISMRMRD::Dataset.
+ * All HDF5 calls are made holding hdf5Mutex().
+ *
+ * Note the samples of an ISMRMRD acquisition are variable length data, which
+ * HDF5 keeps in the global heap: the filters compress the headers and heap
+ * references stored in the chunks, not the k-space samples themselves.
+ *
+ * With any other encoding than SAMPLES_INLINE the records are written
+ * without samples, which go encoded to a chunked SAMPLES_DATASET next to
+ * them instead, through the same filters.  The records then claim none
+ * (number_of_samples and active_channels are 0), so ISMRMRD readers see valid
+ * acquisitions without data; their real shape, and the scale of int16
+ * samples, are kept in SAMPLE_SHAPES_DATASET.  Such files are read back with
+ * DatasetReader (or unpacked to plain ISMRMRD by g2i_unpack).
+ */
+class DatasetWriter : public AcquisitionSink
+{
+public:
+    /**
+     * Opens (or creates) the output file
+     *
+     * @param filename ISMRMRD file
+     * @param groupname Group holding the header and acquisitions
+     * @param options Batching, chunking, fsync and sample encoding settings
+     * @throws std::runtime_error if the file cannot be opened
+     */
+    DatasetWriter(const std::string& filename, const std::string& groupname,
+                  const DatasetWriterOptions& options = DatasetWriterOptions());
+    ~DatasetWriter();
+
+    void writeHeader(const std::string& xml);
+
+    void append(const ISMRMRD::Acquisition& acq);
+
+    /** Writes out the buffered acquisitions */
+    void flush();
+
+    /**
+     * Flushes, then has HDF5 write out its metadata - and fsyncs the file
+     * unless the policy is FSYNC_NEVER - so what was appended so far is in
+     * the file even if the process dies
+     */
+    void commit();
+
+    /** Lengths of the data sets in the file, not counting buffered acquisitions */
+    DatasetExtent extent();
+
+    /**
+     * Cuts the data sets back, before anything is appended: resuming a
+     * conversion drops what was written after its checkpoint
+     *
+     * @throws std::runtime_error if the file holds less than extent
+     */
+    void truncate(const DatasetExtent& extent);
+
+    /** Flushes, applies the fsync policy and closes the file */
+    void close();
+
+    size_t count() const { return count_; }
+
+    /** Sample bytes of the acquisitions buffered, not written yet */
+    size_t bufferedBytes() const { return bufferedBytes_; }
+
+private:
+    // Non-copyable
+    DatasetWriter(const DatasetWriter& other);
+    DatasetWriter& operator=(const DatasetWriter& other);
+
+    void createDataset();
+    void closeDatasets();
+    hsize_t storedLength(hid_t dataset, const std::string& path);
+    void truncateDataset(const std::string& path, hsize_t length);
+    void openSamplesDataset();
+    void createSamplesDataset();
+    hid_t createAppendableDataset(const std::string& path, hid_t type, hsize_t chunkSize);
+    void encodeBatch();
+    void writeBatch();
+    void writeSamples();
+    void writeShapes();
+    void appendUnbuffered(const ISMRMRD::Acquisition& acq);
+    void syncFile();
+
+    DatasetWriterOptions options_;
+    std::string groupname_;
+
+    ISMRMRD_Dataset dset_;
+    bool open_;
+    hid_t dataset_;
+    hid_t type_;
+    bool bulk_;       // false if the ISMRMRD record layout could not be matched
+
+    // Samples data set, when not inline
+    hid_t samples_;
+    hid_t sampleType_;
+    hsize_t samplesWritten_;
+    std::vector<char> encoded_;
+
+    // Sample shapes data set, alongside the samples one
+    hid_t shapes_;
+    hid_t shapeType_;
+    std::vector<SampleShape> encodedShapes_;
+
+    std::vector<ISMRMRD::Acquisition> batch_;
+    size_t buffered_;
+    size_t bufferedBytes_;
+    size_t written_;
+    size_t count_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* DATASET_WRITER_H */
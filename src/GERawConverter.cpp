@@ -1,14 +1,22 @@
 /** @file GERawConverter.cpp */
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 
+#include <sys/resource.h>
+
 #include <libxml/xmlschemas.h>
 #include <libxslt/xslt.h>
 #include <libxslt/transform.h>
 #include <libxslt/xsltutils.h>
 
 // Local
+#include "ArchivePrefetcher.h"
+#include "CoilCompression.h"
 #include "GERawConverter.h"
+#include "PluginLoader.h"
+#include "Profiler.h"
+#include "StylesheetCache.h"
 #include "XMLWriter.h"
 #include "ge_tools_path.h"
 
@@ -40,17 +48,53 @@ const std::string g_schema = "\
     </xs:complexType>                                                       \
 </xs:schema>";
 
+/**
+ * Orchestra does not expose the PSD name of a scan, so the psdname of a
+ * sequence mapping is matched against this sequence family instead
+ */
+static std::string sequenceFamily(GERecon::Legacy::LxDownloadDataPointer lxData)
+{
+   if (lxData->IsEpi())       return "epi";
+   if (lxData->IsPropeller()) return "propeller";
+   if (lxData->IsSpiral())    return "spiral";
+   if (lxData->IsRadial3D())  return "radial3d";
+   return "generic";
+}
+
+/** Text content of an XML element, without surrounding white space */
+static std::string elementText(xmlNodePtr node)
+{
+   xmlChar* content = xmlNodeGetContent(node);
+   std::string text = (content != NULL) ? std::string((char*)content) : std::string();
+   xmlFree(content);
+
+   size_t first = text.find_first_not_of(" \t\r\n");
+   if (first == std::string::npos) {
+      return "";
+   }
+   return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+}
+
 /**
  * Creates a GERawConverter from an ifstream of the raw data file header
  *
- * @param fp raw FILE pointer to raw data file
- * @throws std::runtime_error if raw data file cannot be read
+ * The sequence plugin, stylesheet and Gadgetron configuration come from the
+ * first sequence mapping of the conversion configuration matching the scan,
+ * or naming classname if one was given.
+ *
+ * @param rawFilePath Raw data file
+ * @param classname Sequence plugin class, empty or "auto" to map the scan
+ * @param logging Enable verbose output
+ * @param configFile Conversion configuration; the installed default if empty
+ * @param headerOnly Only read what the XML header needs: the plugin is mapped,
+ *        for its stylesheet, but not loaded, so nothing can be converted
+ * @throws std::runtime_error if raw data file cannot be read, or no plugin found
  */
-GERawConverter::GERawConverter(const std::string& rawFilePath, const std::string& classname, bool logging)
-    : log_(logging)
+GERawConverter::GERawConverter(const std::string& rawFilePath, const std::string& classname, bool logging,
+                               const std::string& configFile, bool headerOnly)
+    : rawFilePath_(rawFilePath), headerOnly_(headerOnly), log_(logging)
 {
-   psdname_ = ""; // TODO: find PSD Name in Orchestra Pfile class
-   log_ << "PSDName: " << psdname_ << std::endl;
+   ScopedTimer orchestraTimer(PROFILE_ORCHESTRA);
 
    // Use Orchestra to figure out if P-File or ScanArchive
    if (GERecon::ScanArchive::IsArchiveFilePath(rawFilePath))
@@ -75,23 +119,31 @@ GERawConverter::GERawConverter(const std::string& rawFilePath, const std::string
       rawObjectType_ = PFILE_RAW_TYPE;
    }
 
-   if (!classname.compare("GenericConverter"))
-   {
-      converter_ = std::shared_ptr<SequenceConverter>(new GenericConverter());
-   }
-   else if (!classname.compare("NIH2dfastConverter"))
-   {
-      converter_ = std::shared_ptr<SequenceConverter>(new NIH2dfastConverter());
-   }
-   else if (!classname.compare("NIHepiConverter"))
+   params_ = std::make_shared<ScanParameters>(lxData_, processingControl_);
+   orchestraTimer.stop();
+
+   psdname_ = sequenceFamily(lxData_);
+   log_ << "PSDName: " << psdname_ << std::endl;
+
+   classname_ = (classname == "auto") ? "" : classname;
+   if (!useConfigFile(configFile))
    {
-      converter_ = std::shared_ptr<SequenceConverter>(new NIHepiConverter());
+      if (classname_.size() == 0) {
+         classname_ = "GenericConverter";
+      }
+      if (!PluginLoader::isBuiltin(classname_)) {
+         throw std::runtime_error("Plugin class name: " + classname_ + " not implemented");
+      }
+      if (!headerOnly_) {
+         converter_ = PluginLoader::create("", classname_);
+      }
    }
-   else
-   {
-      std::cerr << "Plugin class name: " << classname << " not implemented. Exiting..." << std::endl;
 
-      exit(EXIT_FAILURE);
+   if (stylesheet_.size() == 0) {
+      std::ifstream stream((get_ge_tools_home() + "share/ge-tools/config/default.xsl").c_str(), std::ios::binary);
+      if (stream) {
+         useStylesheetStream(stream);
+      }
    }
 
    // Testing dumping of raw file header as XML.
@@ -99,6 +151,146 @@ GERawConverter::GERawConverter(const std::string& rawFilePath, const std::string
                                                     // an incomplete file written.
 }
 
+/**
+ * Picks the sequence plugin from a conversion configuration
+ *
+ * @param configFile Configuration file; the installed default if empty, in
+ *        which case a missing file is not an error
+ * @returns true if a sequence mapping matched
+ * @throws std::runtime_error if the configuration is invalid, or its plugin cannot be loaded
+ */
+bool GERawConverter::useConfigFile(const std::string& configFile)
+{
+    std::string path = configFile;
+    if (path.size() == 0) {
+        path = get_ge_tools_home() + "share/ge-tools/config/default.xml";
+    }
+
+    std::ifstream probe(path.c_str());
+    if (!probe) {
+        if (configFile.size() > 0) {
+            throw std::runtime_error("Failed to open configuration " + configFile);
+        }
+        log_ << "No conversion configuration at " << path << std::endl;
+        return false;
+    }
+    probe.close();
+
+    log_ << "Loading configuration: " << path << std::endl;
+    std::shared_ptr<xmlDoc> doc(xmlReadFile(path.c_str(), NULL, XML_PARSE_NONET), xmlFreeDoc);
+    if (!doc) {
+        throw std::runtime_error("Failed to parse configuration " + path);
+    }
+    if (!validateConfig(doc)) {
+        throw std::runtime_error("Configuration " + path + " does not follow the geismrmrd schema");
+    }
+
+    size_t slash = path.find_last_of('/');
+    config_dir_ = (slash == std::string::npos) ? "" : path.substr(0, slash + 1);
+
+    for (xmlNodePtr node = xmlDocGetRootElement(doc.get())->children; node != NULL; node = node->next)
+    {
+        if (node->type == XML_ELEMENT_NODE && xmlStrEqual(node->name, BAD_CAST "sequenceMapping")) {
+            if (trySequenceMapping(doc, node)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Validates a conversion configuration against the geismrmrd schema
+ *
+ * @param config_doc Parsed configuration
+ * @returns true if the configuration is valid
+ */
+bool GERawConverter::validateConfig(std::shared_ptr<xmlDoc> config_doc)
+{
+    std::shared_ptr<xmlDoc> schema_doc(xmlReadMemory(g_schema.c_str(), g_schema.size(), NULL, NULL, 0), xmlFreeDoc);
+    if (!schema_doc) {
+        throw std::runtime_error("Failed to parse the configuration schema");
+    }
+
+    std::shared_ptr<xmlSchemaParserCtxt> parser_ctxt(xmlSchemaNewDocParserCtxt(schema_doc.get()), xmlSchemaFreeParserCtxt);
+    if (!parser_ctxt) {
+        throw std::runtime_error("Failed to create the configuration schema parser");
+    }
+
+    std::shared_ptr<xmlSchema> schema(xmlSchemaParse(parser_ctxt.get()), xmlSchemaFree);
+    if (!schema) {
+        throw std::runtime_error("Failed to load the configuration schema");
+    }
+
+    std::shared_ptr<xmlSchemaValidCtxt> valid_ctxt(xmlSchemaNewValidCtxt(schema.get()), xmlSchemaFreeValidCtxt);
+    if (!valid_ctxt) {
+        throw std::runtime_error("Failed to create the configuration validator");
+    }
+
+    return xmlSchemaValidateDoc(valid_ctxt.get(), config_doc.get()) == 0;
+}
+
+/**
+ * Uses a sequence mapping if it matches the scan: by className if a plugin
+ * class was asked for, else by psdname ("*" matches any scan)
+ *
+ * @param doc Configuration holding the mapping
+ * @param mapping sequenceMapping element
+ * @returns true if the mapping matched and its plugin was created (or, header
+ *          only, would have been)
+ * @throws std::runtime_error if the plugin or stylesheet cannot be loaded
+ */
+bool GERawConverter::trySequenceMapping(std::shared_ptr<xmlDoc> doc, xmlNodePtr mapping)
+{
+    std::string psdname, libraryPath, className, stylesheet, reconConfigName;
+
+    for (xmlNodePtr node = mapping->children; node != NULL; node = node->next)
+    {
+        if (node->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        std::string name((const char*)node->name);
+        if (name == "psdname")              psdname         = elementText(node);
+        else if (name == "libraryPath")     libraryPath     = elementText(node);
+        else if (name == "className")       className       = elementText(node);
+        else if (name == "stylesheet")      stylesheet      = elementText(node);
+        else if (name == "reconConfigName") reconConfigName = elementText(node);
+    }
+
+    bool const matches = (classname_.size() > 0) ? (className == classname_)
+                                                 : (psdname == "*" || psdname == psdname_);
+    if (!matches) {
+        return false;
+    }
+
+    log_ << "Using " << className << " from " << (libraryPath.size() > 0 ? libraryPath : "libg2i")
+         << " for " << psdname_ << std::endl;
+    if (!headerOnly_) {
+        converter_ = PluginLoader::create(libraryPath, className);
+    }
+    classname_ = className;
+    recon_config_ = reconConfigName;
+
+    if (stylesheet.size() > 0) {
+        std::string sheetPath = (stylesheet[0] == '/') ? stylesheet : config_dir_ + stylesheet;
+        std::ifstream stream(sheetPath.c_str(), std::ios::binary);
+        if (!stream) {
+            throw std::runtime_error("Failed to open stylesheet " + sheetPath);
+        }
+        log_ << "Loading stylesheet: " << sheetPath << std::endl;
+        useStylesheetStream(stream);
+    }
+    return true;
+}
+
+/**
+ * Sequence plugin converting this raw file; none if only the header is read
+ */
+std::shared_ptr<SequenceConverter> GERawConverter::getConverter()
+{
+    return converter_;
+}
+
 void GERawConverter::useStylesheetFilename(const std::string& filename)
 {
     log_ << "Loading stylesheet: " << filename << std::endl;
@@ -132,31 +324,12 @@ std::string GERawConverter::getIsmrmrdXMLHeader()
         throw std::runtime_error("No stylesheet configured");
     }
 
-    std::string ge_raw_file_header(ge_header_to_xml(lxData_, processingControl_));
-
-    // DEBUG: std::cout << "Converted header as XML string is: " << ge_raw_file_header << std::endl;
+    ScopedTimer headerTimer(PROFILE_HEADER);
 
-    xmlSubstituteEntitiesDefault(1);
-    xmlLoadExtDtdDefaultValue = 1;
+    std::shared_ptr<xsltStylesheet> sheet = StylesheetCache::get(stylesheet_);
 
-    // Normal pointer here because the xsltStylesheet takes ownership
-    xmlDocPtr stylesheet_doc = xmlParseMemory(stylesheet_.c_str(), stylesheet_.size());
-    if (NULL == stylesheet_doc) {
-        throw std::runtime_error("Failed to parse stylesheet");
-    }
-
-    std::shared_ptr<xsltStylesheet> sheet = std::shared_ptr<xsltStylesheet>(
-            xsltParseStylesheetDoc(stylesheet_doc), xsltFreeStylesheet);
-    if (!sheet) {
-        xmlFreeDoc(stylesheet_doc);
-        throw std::runtime_error("Failed to parse stylesheet");
-    }
-
-    std::shared_ptr<xmlDoc> pfile_doc = std::shared_ptr<xmlDoc>(
-            xmlParseMemory(ge_raw_file_header.c_str(), ge_raw_file_header.size()), xmlFreeDoc);
-    if (!pfile_doc) {
-        throw std::runtime_error("Failed to parse P-File XML");
-    }
+    // The GE header is built as a document tree and transformed directly
+    std::shared_ptr<xmlDoc> pfile_doc = ge_header_to_doc(lxData_, *params_);
 
     log_ << "Applying stylesheet" << std::endl;
     const char *params[1] = { NULL };
@@ -179,24 +352,202 @@ std::string GERawConverter::getIsmrmrdXMLHeader()
 
 
 /**
- * Gets the acquisitions corresponding to a view in memory.
+ * Sets the threading, buffering and selection options of the sequence plugin.
  *
- * @param view_num View number to get
- * @param vacq Vector of acquisitions
- * @throws std::runtime_error { if plugin fails to copy the data }
+ * @param options Options used by later calls to convert() and getIsmrmrdXMLHeader()
+ * @throws std::runtime_error { if a selected slice, echo or channel is not in the scan }
  */
-std::vector<ISMRMRD::Acquisition> GERawConverter::getAcquisitions(unsigned int view_num)
+void GERawConverter::setConversionOptions(const ConversionOptions& options)
+{
+   const AcquisitionSelection& selection = options.selection;
+   checkSelection(selection.slices,   params_->numSlices,   "slices");
+   checkSelection(selection.echoes,   params_->numEchoes,   "echoes");
+   checkSelection(selection.channels, params_->numChannels, "channels");
+
+   // The header depends on the selected and virtual channels, the plugin on the rest
+   options_ = options;
+   if (headerOnly_) {
+      return;
+   }
+   converter_->setOptions(options);
+
+   // The sidecar is read once; later conversions share the in-memory index
+   if (options.packetIndex && rawObjectType_ == SCAN_ARCHIVE_RAW_TYPE && !packetIndex_) {
+      packetIndex_ = std::make_shared<PacketIndex>();
+      if (packetIndex_->load(rawFilePath_)) {
+         log_ << "Using packet index " << PacketIndex::sidecarPath(rawFilePath_) << std::endl;
+      } else {
+         log_ << "Building packet index " << PacketIndex::sidecarPath(rawFilePath_) << std::endl;
+      }
+   }
+   converter_->setPacketIndex(options.packetIndex ? packetIndex_ : std::shared_ptr<PacketIndex>());
+}
+
+/**
+ * Throws if a selection names indices at or beyond the count of the scan
+ */
+void GERawConverter::checkSelection(const IndexSelection& selection, unsigned int count, const std::string& what)
+{
+   if (!selection.all() && selection.last() >= count) {
+      std::ostringstream message;
+      message << "Selected " << what << " go up to " << selection.last() << ", but the scan has "
+              << count << " " << what;
+      throw std::runtime_error(message.str());
+   }
+}
+
+/**
+ * Converts the whole raw file, streaming each acquisition to the sink as the
+ * plugin produces it.  With coil compression, acquisitions are compressed on
+ * their way to the sink.
+ *
+ * @param sink Receiver of the converted acquisitions
+ * @throws std::runtime_error { if plugin fails to copy the data, or only the header was read }
+ */
+void GERawConverter::convert(AcquisitionSink& sink)
+{
+   if (headerOnly_) {
+      throw std::runtime_error("Only the header of " + rawFilePath_ + " was read");
+   }
+
+   if (outputChannels(params_->numChannels) == options_.selection.channels.count(params_->numChannels))
+   {
+      convertRaw(sink);
+   }
+   else
+   {
+      CoilCompressionSink compressor(sink, options_.virtualChannels, options_.compressionLines);
+      convertRaw(compressor);
+      compressor.finish();
+
+      log_ << "Coil compression to " << compressor.compression().virtualChannels() << " channels keeps "
+           << 100.0 * compressor.compression().retainedEnergy() << "% of the signal energy" << std::endl;
+   }
+
+   logPeakMemory();
+}
+
+/**
+ * Whether conversions can be checkpointed and resumed: those of ScanArchives
+ * by a plugin that supports it, without coil compression (which is learnt
+ * from the first acquisitions of a conversion)
+ */
+bool GERawConverter::checkpointable() const
+{
+   return rawObjectType_ == SCAN_ARCHIVE_RAW_TYPE && converter_ && converter_->resumable() &&
+          outputChannels(params_->numChannels) == options_.selection.channels.count(params_->numChannels);
+}
+
+/**
+ * Sets the checkpoint later conversions start from and report to; only
+ * valid if checkpointable()
+ *
+ * @param checkpoint Checkpoint begun on the sink of the conversions, or an empty pointer
+ * @throws std::runtime_error { if the conversion cannot be checkpointed }
+ */
+void GERawConverter::setCheckpoint(const std::shared_ptr<ConversionCheckpoint>& checkpoint)
+{
+   if (checkpoint && !checkpointable()) {
+      throw std::runtime_error("Conversions of " + rawFilePath_ + " by " + classname_ + " cannot be checkpointed");
+   }
+   if (converter_) {
+      converter_->setCheckpoint(checkpoint);
+   }
+}
+
+/**
+ * Logs the peak resident memory of the process, against the memory budget
+ * of the conversion if there is one
+ */
+void GERawConverter::logPeakMemory()
+{
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) != 0) {
+      return;
+   }
+
+   // ru_maxrss is in KiB on Linux
+   log_ << "Peak resident memory of the process: " << (usage.ru_maxrss >> 10) << " MiB";
+   if (options_.maxMemoryBytes > 0) {
+      log_ << " (packets in flight limited to " << (options_.maxMemoryBytes >> 20) << " MiB)";
+   }
+   log_ << std::endl;
+}
+
+/**
+ * Number of channels of the converted acquisitions
+ *
+ * @param scanChannels Receiver channels of the scan
+ */
+unsigned int GERawConverter::outputChannels(unsigned int scanChannels) const
+{
+   unsigned int channels = options_.selection.channels.count(scanChannels);
+   if (options_.virtualChannels > 0 && options_.virtualChannels < channels) {
+      channels = options_.virtualChannels;
+   }
+   return channels;
+}
+
+void GERawConverter::convertRaw(AcquisitionSink& sink)
 {
    if (rawObjectType_ == SCAN_ARCHIVE_RAW_TYPE)
    {
-      return converter_->getAcquisitions(scanArchive_, view_num);
+      // Started before the plugin, so it also overlaps the files the plugin
+      // loads ahead of its packet loop
+      std::shared_ptr<ArchivePrefetcher> prefetcher;
+      if (options_.prefetchBytes > 0) {
+         try {
+            prefetcher = std::make_shared<ArchivePrefetcher>(rawFilePath_, options_.prefetchBytes);
+         } catch (const std::exception& e) {
+            log_ << "Not prefetching: " << e.what() << std::endl;
+         }
+      }
+      converter_->setPrefetcher(prefetcher);
+
+      converter_->convert(scanArchive_, *params_, sink);
+      converter_->setPrefetcher(std::shared_ptr<ArchivePrefetcher>());
+      savePacketIndex();
    }
    else
    {
-      return converter_->getAcquisitions(pfile_, view_num);
+      converter_->convert(pfile_, *params_, sink);
    }
 }
 
+/**
+ * Writes the packet index sidecar once a conversion has rebuilt the index.
+ * The sidecar is only an accelerator, so failing to write it - next to a
+ * read-only archive, say - does not fail the conversion.
+ */
+void GERawConverter::savePacketIndex()
+{
+   if (!packetIndex_ || !packetIndex_->modified() || !packetIndex_->complete()) {
+      return;
+   }
+
+   try {
+      packetIndex_->save(rawFilePath_);
+      log_ << "Wrote packet index " << PacketIndex::sidecarPath(rawFilePath_) << std::endl;
+   } catch (const std::exception& e) {
+      std::cerr << "Packet index not saved: " << e.what() << std::endl;
+   }
+}
+
+/**
+ * Gets the acquisitions corresponding to a view in memory.
+ *
+ * @param view_num View number to get
+ * @param vacq Vector of acquisitions
+ * @throws std::runtime_error { if plugin fails to copy the data }
+ */
+std::vector<ISMRMRD::Acquisition> GERawConverter::getAcquisitions(unsigned int view_num)
+{
+   std::vector<ISMRMRD::Acquisition> acqs;
+   VectorAcquisitionSink sink(acqs);
+   convert(sink);
+   return acqs;
+}
+
 /**
  * Gets the extra field "reconConfig" from the
  * ge-ismrmrd XML configuration. This can be used to
@@ -210,7 +561,38 @@ std::string GERawConverter::getReconConfigName(void)
 std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPointer lxData,
                                              GERecon::Control::ProcessingControlPointer processingControl)
 {
-    // DEBUG: std::cerr << "Starting conversion of raw file header to XML string" << std::endl;
+    return ge_header_to_xml(lxData, ScanParameters(lxData, processingControl));
+}
+
+std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPointer lxData,
+                                             const ScanParameters& params)
+{
+    std::shared_ptr<xmlDoc> doc = ge_header_to_doc(lxData, params);
+
+    xmlChar* output = NULL;
+    int len = 0;
+    xmlDocDumpFormatMemory(doc.get(), &output, &len, 1);
+    if (output == NULL) {
+        throw std::runtime_error("Failed to save GE header to string");
+    }
+
+    std::string ge_raw_file_header((char*)output, len);
+    xmlFree(output);
+    return ge_raw_file_header;
+}
+
+/**
+ * Builds the XML document of the raw file header that the stylesheet maps
+ * onto the ISMRMRD header
+ *
+ * @param lxData Download data of the scan
+ * @param params Processing control values of the scan
+ * @returns document, owned by the caller
+ */
+std::shared_ptr<xmlDoc> GERawConverter::ge_header_to_doc(GERecon::Legacy::LxDownloadDataPointer lxData,
+                                                         const ScanParameters& params)
+{
+    // DEBUG: std::cerr << "Starting conversion of raw file header to XML document" << std::endl;
 
     XMLWriter writer;
 
@@ -218,10 +600,10 @@ std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPoin
 
     writer.startElement("Header");
 
-    writer.addBooleanElement("is3DAcquisition",    processingControl->Value<bool>("Is3DAcquisition"));
+    writer.addBooleanElement("is3DAcquisition",    params.is3DAcquisition);
     writer.addBooleanElement("isCalibration",      lxData->IsCalibration());
-    writer.addBooleanElement("isAssetCalibration", processingControl->Value<bool>("AssetCalibration"));
-    writer.addBooleanElement("isPureCalibration",  processingControl->Value<bool>("PureCalibration"));
+    writer.addBooleanElement("isAssetCalibration", params.isAssetCalibration);
+    writer.addBooleanElement("isPureCalibration",  params.isPureCalibration);
     writer.addBooleanElement("isArc",              lxData->IsArc());
     writer.addBooleanElement("isEpi",              lxData->IsEpi());
     writer.addBooleanElement("isFMRI",             lxData->IsFunctionalMri());
@@ -229,242 +611,218 @@ std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPoin
     writer.addBooleanElement("isEpiTopDown",       lxData->IsTopDownEpi());
     writer.addBooleanElement("isEpiRefScan",       lxData->IsEpiRefScan());
     writer.addBooleanElement("isEpiRefless",       lxData->IsReflessEPI());
-    writer.addBooleanElement("isEpiRampsampled",   processingControl->Value<bool>("RampSamplingEnabled"));
+    writer.addBooleanElement("isEpiRampsampled",   params.isEpiRampsampled);
     writer.addBooleanElement("isEpiDiffusion",     lxData->IsDiffusionEpi());
     writer.addBooleanElement("isEpiMultiPhase",    lxData->IsMultiPhaseEpi());
     writer.addBooleanElement("isPropeller",        lxData->IsPropeller());
     writer.addBooleanElement("isRadial3D",         lxData->IsRadial3D());
     writer.addBooleanElement("isSpiral",           lxData->IsSpiral());
     // writer.addBooleanElement("isCine",             lxData->IsCine());
-    writer.addBooleanElement("isCine",             processingControl->Value<bool>("CineData"));
-    writer.addBooleanElement("isShimData",         processingControl->Value<bool>("ShimData"));
-    writer.addBooleanElement("isGrassData",        processingControl->Value<bool>("GrassData"));
+    writer.addBooleanElement("isCine",             params.isCine);
+    writer.addBooleanElement("isShimData",         params.isShimData);
+    writer.addBooleanElement("isGrassData",        params.isGrassData);
     // writer.addBooleanElement("is3DASL",            processingControl->Value<bool>("Is3DASL"));
 
-    writer.formatElement("SliceCount", "%d",       processingControl->Value<int>("NumSlices"));
-    writer.formatElement("ChannelCount", "%d",     processingControl->Value<int>("NumChannels"));
+    writer.formatElement("SliceCount", "%d",       params.numSlices);
+    // Only the selected, or virtual, channels are written
+    writer.formatElement("ChannelCount", "%d",     outputChannels(params.numChannels));
     writer.formatElement("OtherUID", "%s",         GEDicom::UID::Create(GEDicom::UID::OtherUID).c_str());
 
-    GERecon::Legacy::DicomSeries legacySeries(lxData);
-    GEDicom::SeriesPointer series = legacySeries.Series();
-    GEDicom::SeriesModulePointer seriesModule = series->GeneralModule();
+    const ScanParameters::DicomValues& dicom = params.dicomValues();
+
     writer.startElement("Series");
     // writer.formatElement("Number", "%d",           lxData->SeriesNumber());
-    writer.formatElement("Number", "%d",           processingControl->Value<int>("SeriesNumber"));
-    writer.formatElement("UID", "%s",              seriesModule->UID().c_str());
-    writer.formatElement("Description", "%s",      seriesModule->SeriesDescription().c_str());
+    writer.formatElement("Number", "%d",           params.seriesNumber);
+    writer.formatElement("UID", "%s",              dicom.series.uid.c_str());
+    writer.formatElement("Description", "%s",      dicom.series.description.c_str());
     // writer.formatElement("Modality", "%s",         seriesModule->Modality());
-    writer.formatElement("Laterality", "%s",       seriesModule->Laterality().c_str());
-    writer.formatElement("Date", "%s",             seriesModule->Date().c_str());
-    writer.formatElement("Time", "%s",             seriesModule->Time().c_str());
-    writer.formatElement("ProtocolName", "%s",     seriesModule->ProtocolName().c_str());
-    writer.formatElement("OperatorName", "%s",     seriesModule->OperatorName().c_str());
-    writer.formatElement("PpsDescription", "%s",   seriesModule->PpsDescription().c_str());
+    writer.formatElement("Laterality", "%s",       dicom.series.laterality.c_str());
+    writer.formatElement("Date", "%s",             dicom.series.date.c_str());
+    writer.formatElement("Time", "%s",             dicom.series.time.c_str());
+    writer.formatElement("ProtocolName", "%s",     dicom.series.protocolName.c_str());
+    writer.formatElement("OperatorName", "%s",     dicom.series.operatorName.c_str());
+    writer.formatElement("PpsDescription", "%s",   dicom.series.ppsDescription.c_str());
     // writer.formatElement("PatientEntry", "%s",     seriesModule->Entry());
     // writer.formatElement("PatientOrientation", "%s", seriesModule->Orientation());
     writer.endElement();
 
-    GEDicom::StudyPointer study = series->Study();
-    GEDicom::StudyModulePointer studyModule = study->GeneralModule();
     writer.startElement("Study");
     // writer.formatElement("Number", "%d",           studyModule->StudyNumber());
     // writer.formatElement("Number", "%d",           lxData->ExamNumber()); // seems to be lxData equivalent
-    writer.formatElement("Number", "%u",           processingControl->Value<int>("ExamNumber"));
-    writer.formatElement("UID", "%s",              studyModule->UID().c_str());
-    writer.formatElement("Description", "%s",      studyModule->StudyDescription().c_str());
-    writer.formatElement("Date", "%s",             studyModule->Date().c_str());
-    writer.formatElement("Time", "%s",             studyModule->Time().c_str());
-    writer.formatElement("ReferringPhysician", "%s",  studyModule->ReferringPhysician().c_str());
-    writer.formatElement("AccessionNumber", "%s",  studyModule->AccessionNumber().c_str());
-    writer.formatElement("ReadingPhysician", "%s", studyModule->ReadingPhysician().c_str());
+    writer.formatElement("Number", "%u",           params.examNumber);
+    writer.formatElement("UID", "%s",              dicom.study.uid.c_str());
+    writer.formatElement("Description", "%s",      dicom.study.description.c_str());
+    writer.formatElement("Date", "%s",             dicom.study.date.c_str());
+    writer.formatElement("Time", "%s",             dicom.study.time.c_str());
+    writer.formatElement("ReferringPhysician", "%s",  dicom.study.referringPhysician.c_str());
+    writer.formatElement("AccessionNumber", "%s",  dicom.study.accessionNumber.c_str());
+    writer.formatElement("ReadingPhysician", "%s", dicom.study.readingPhysician.c_str());
     writer.endElement();
 
-    GEDicom::PatientStudyModulePointer patientStudyModule = study->PatientStudyModule();
-    GEDicom::PatientPointer patient = study->Patient();
-    GEDicom::PatientModulePointer patientModule = patient->GeneralModule();
     writer.startElement("Patient");
-    writer.formatElement("Name", "%s",             patientModule->Name().c_str());
-    writer.formatElement("ID", "%s",               patientModule->ID().c_str());
-    writer.formatElement("Birthdate", "%s",        patientModule->Birthdate().c_str());
-    writer.formatElement("Gender", "%s",           patientModule->Gender().c_str());
-    writer.formatElement("Age", "%s",              patientStudyModule->Age().c_str());
-    writer.formatElement("Weight", "%s",           patientStudyModule->Weight().c_str());
-    writer.formatElement("History", "%s",          patientStudyModule->History().c_str());
+    writer.formatElement("Name", "%s",             dicom.patient.name.c_str());
+    writer.formatElement("ID", "%s",               dicom.patient.id.c_str());
+    writer.formatElement("Birthdate", "%s",        dicom.patient.birthdate.c_str());
+    writer.formatElement("Gender", "%s",           dicom.patient.gender.c_str());
+    writer.formatElement("Age", "%s",              dicom.patient.age.c_str());
+    writer.formatElement("Weight", "%s",           dicom.patient.weight.c_str());
+    writer.formatElement("History", "%s",          dicom.patient.history.c_str());
     writer.endElement();
 
-    GEDicom::EquipmentPointer equipment = series->Equipment();
-    GEDicom::EquipmentModulePointer equipmentModule = equipment->GeneralModule();
     writer.startElement("Equipment");
-    writer.formatElement("Manufacturer", "%s",     equipmentModule->Manufacturer().c_str());
-    writer.formatElement("Institution", "%s",      equipmentModule->Institution().c_str());
-    writer.formatElement("Station", "%s",          equipmentModule->Station().c_str());
-    writer.formatElement("ManufacturerModel", "%s",   equipmentModule->ManufacturerModel().c_str());
-    writer.formatElement("DeviceSerialNumber", "%s",  equipmentModule->DeviceSerialNumber().c_str());
+    writer.formatElement("Manufacturer", "%s",     dicom.equipment.manufacturer.c_str());
+    writer.formatElement("Institution", "%s",      dicom.equipment.institution.c_str());
+    writer.formatElement("Station", "%s",          dicom.equipment.station.c_str());
+    writer.formatElement("ManufacturerModel", "%s",   dicom.equipment.manufacturerModel.c_str());
+    writer.formatElement("DeviceSerialNumber", "%s",  dicom.equipment.deviceSerialNumber.c_str());
     writer.formatElement("UID", "%s",              GEDicom::UID::Create(GEDicom::UID::Equipment).c_str());
-    writer.formatElement("SoftwareVersion", "%s",  equipmentModule->SoftwareVersion().c_str());
-    writer.formatElement("PpsPerformedStation", "%s", equipmentModule->PpsPerformedStation().c_str());
-    writer.formatElement("PpsPerformedLocation", "%s",equipmentModule->PpsPerformedLocation().c_str());
+    writer.formatElement("SoftwareVersion", "%s",  dicom.equipment.softwareVersion.c_str());
+    writer.formatElement("PpsPerformedStation", "%s", dicom.equipment.ppsPerformedStation.c_str());
+    writer.formatElement("PpsPerformedLocation", "%s",dicom.equipment.ppsPerformedLocation.c_str());
     writer.endElement();
 
-    writer.formatElement("AcquiredXRes", "%d",     processingControl->Value<int>("AcquiredXRes"));
-    writer.formatElement("AcquiredYRes", "%d",     processingControl->Value<int>("AcquiredYRes"));
-    writer.formatElement("AcquiredZRes", "%d",     processingControl->Value<int>("AcquiredZRes"));
-
-    writer.addBooleanElement("EvenEchoFrequencyFlip", processingControl->Value<bool>("EvenEchoFrequencyFlip"));
-    writer.addBooleanElement("OddEchoFrequencyFlip",  processingControl->Value<bool>("OddEchoFrequencyFlip"));
-    writer.addBooleanElement("EvenEchoPhaseFlip",  processingControl->Value<bool>("EvenEchoPhaseFlip"));
-    writer.addBooleanElement("OddEchoPhaseFlip",   processingControl->Value<bool>("OddEchoPhaseFlip"));
-    writer.addBooleanElement("ChoppedData",        processingControl->Value<bool>("ChoppedData"));
-    writer.addBooleanElement("HalfEcho",           processingControl->Value<bool>("HalfEcho"));
-    writer.formatElement("RawNex", "%u",           processingControl->Value<unsigned int>("RawNex"));
-    writer.addBooleanElement("HalfNex",            processingControl->Value<bool>("HalfNex"));
-    writer.addBooleanElement("ThreeQuarterNexData",   processingControl->Value<bool>("ThreeQuarterNexData"));
-    writer.addBooleanElement("NoFrequencyWrapData",   processingControl->Value<bool>("NoFrequencyWrapData"));
-    writer.addBooleanElement("NoPhaseWrapData",    processingControl->Value<bool>("NoPhaseWrapData"));
-    writer.addBooleanElement("OverscanData",       processingControl->Value<bool>("OverscanData"));
+    writer.formatElement("AcquiredXRes", "%d",     params.acquiredXRes);
+    writer.formatElement("AcquiredYRes", "%d",     params.acquiredYRes);
+    writer.formatElement("AcquiredZRes", "%d",     params.acquiredZRes);
+
+    writer.addBooleanElement("EvenEchoFrequencyFlip", params.evenEchoFrequencyFlip);
+    writer.addBooleanElement("OddEchoFrequencyFlip",  params.oddEchoFrequencyFlip);
+    writer.addBooleanElement("EvenEchoPhaseFlip",  params.evenEchoPhaseFlip);
+    writer.addBooleanElement("OddEchoPhaseFlip",   params.oddEchoPhaseFlip);
+    writer.addBooleanElement("ChoppedData",        params.choppedData);
+    writer.addBooleanElement("HalfEcho",           params.halfEcho);
+    writer.formatElement("RawNex", "%u",           params.rawNex);
+    writer.addBooleanElement("HalfNex",            params.halfNex);
+    writer.addBooleanElement("ThreeQuarterNexData",   params.threeQuarterNexData);
+    writer.addBooleanElement("NoFrequencyWrapData",   params.noFrequencyWrapData);
+    writer.addBooleanElement("NoPhaseWrapData",    params.noPhaseWrapData);
+    writer.addBooleanElement("OverscanData",       params.overscanData);
 
     writer.formatElement("sequenceNumber",  "%d",  lxData->SequenceNumber());
     writer.formatElement("seriesPulseSeq",  "%d",  lxData->SeriesPulseSequence());
     writer.formatElement("scanType",        "%s",  lxData->ScanType().c_str());
     writer.formatElement("seriesDscrption", "%s",  lxData->SeriesDescription().c_str());
 
-    std::cout << "Coverting series with description: " <<   lxData->SeriesDescription().c_str() << std::endl;
-    std::cout << "Patient entry: "    << processingControl->Value<int>("PatientEntry")    << std::endl;
-    std::cout << "Patient position: " << processingControl->Value<int>("PatientPosition") << std::endl;
+    log_ << "Converting series with description: " << lxData->SeriesDescription() << std::endl;
+    log_ << "Patient entry: "    << params.patientEntry    << std::endl;
+    log_ << "Patient position: " << params.patientPosition << std::endl;
 
-    writer.formatElement("NumBaselineViews", "%d", processingControl->Value<int>("NumBaselineViews"));
-    writer.formatElement("NumVolumes", "%d",       processingControl->Value<int>("NumVolumes"));
-    writer.formatElement("NumEchoes", "%d",        processingControl->Value<int>("NumEchoes"));
-    writer.formatElement("NumAcquisitions", "%d",  processingControl->Value<int>("NumAcquisitions"));
-    writer.formatElement("DataSampleSize", "%d",   processingControl->Value<int>("DataSampleSize")); // in bytes
+    writer.formatElement("NumBaselineViews", "%d", params.numBaselineViews);
+    writer.formatElement("NumVolumes", "%d",       params.numVolumes);
+    writer.formatElement("NumEchoes", "%d",        params.numEchoes);
+    writer.formatElement("NumAcquisitions", "%d",  params.numAcquisitions);
+    writer.formatElement("DataSampleSize", "%d",   params.dataSampleSize); // in bytes
                                                                                                      // nacq_points = ncoils * frame_size
 
     // std::string patientPosition = GERecon::PatientPositionAsString(static_cast<GERecon::PatientPosition>(processingControl->Value<int>("PatientPosition")));
     // writer.formatElement("PatientPositionStr", "%s",  patientPosition.c_str());
-    writer.formatElement("PatientPosition", "%d",  static_cast<GERecon::PatientPosition>(processingControl->Value<int>("PatientPosition")));
-    writer.formatElement("PatientEntry", "%d",     processingControl->Value<int>("PatientEntry"));
+    writer.formatElement("PatientPosition", "%d",  static_cast<GERecon::PatientPosition>(params.patientPosition));
+    writer.formatElement("PatientEntry", "%d",     params.patientEntry);
 
-    writer.formatElement("ScanCenter", "%f",       processingControl->Value<float>("ScanCenter"));
-    writer.formatElement("Landmark", "%f",         processingControl->Value<float>("Landmark"));
-    writer.formatElement("CoilConfigUID", "%u",    processingControl->Value<unsigned int>("CoilConfigUID"));
-    writer.formatElement("RawPassSize", "%llu",    processingControl->Value<int>("RawPassSize"));
+    writer.formatElement("ScanCenter", "%f",       params.scanCenter);
+    writer.formatElement("Landmark", "%f",         params.landmark);
+    writer.formatElement("CoilConfigUID", "%u",    params.coilConfigUID);
+    writer.formatElement("RawPassSize", "%llu",    params.rawPassSize);
 
     // ReconstructionParameters
-    writer.addBooleanElement("CreateMagnitudeImages", processingControl->Value<bool>("CreateMagnitudeImages"));
-    writer.addBooleanElement("CreatePhaseImages",  processingControl->Value<bool>("CreatePhaseImages"));
+    writer.addBooleanElement("CreateMagnitudeImages", params.createMagnitudeImages);
+    writer.addBooleanElement("CreatePhaseImages",  params.createPhaseImages);
 
-    writer.formatElement("TransformXRes", "%d",    processingControl->Value<int>("TransformXRes"));
-    writer.formatElement("TransformYRes", "%d",    processingControl->Value<int>("TransformYRes"));
-    writer.formatElement("TransformZRes", "%d",    processingControl->Value<int>("TransformZRes"));
+    writer.formatElement("TransformXRes", "%d",    params.transformXRes);
+    writer.formatElement("TransformYRes", "%d",    params.transformYRes);
+    writer.formatElement("TransformZRes", "%d",    params.transformZRes);
 
-    writer.addBooleanElement("ChopX",              processingControl->Value<bool>("ChopX"));
-    writer.addBooleanElement("ChopY",              processingControl->Value<bool>("ChopY"));
-    writer.addBooleanElement("ChopZ",              processingControl->Value<bool>("ChopZ"));
+    writer.addBooleanElement("ChopX",              params.chopX);
+    writer.addBooleanElement("ChopY",              params.chopY);
+    writer.addBooleanElement("ChopZ",              params.chopZ);
 
     // GERecon::PrepData prepData(lxData);
     // GERecon::ArchiveHeader archiveHeader("ScanArchive", prepData);
     // DEBUG: archiveHeader.Print(std::cout); // Does not seem to currently work as expected
 
-    const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
-
-    auto imageCorners = GERecon::ImageCorners(sliceTable.AcquiredSliceCorners(0),
-					      sliceTable.SliceOrientation(0));
-    auto grayscaleImage = GEDicom::GrayscaleImage(128, 128);
-    auto dicomImage = GERecon::Legacy::DicomImage(grayscaleImage, 0, imageCorners, series, *lxData);
-    auto imageModule = dicomImage.ImageModule();
-    // auto privateIdentityModule = dicomImage.PrivateIdentityModule();
-
     writer.startElement("Image");
-    writer.formatElement("EchoTime", "%s",         imageModule->EchoTime().c_str());
-    writer.formatElement("RepetitionTime", "%s",   imageModule->RepetitionTime().c_str());
-    writer.formatElement("InversionTime", "%s",    imageModule->InversionTime().c_str());
-    writer.formatElement("ImageType", "%s",        imageModule->ImageType().c_str());
-    writer.formatElement("ScanSequence", "%s",     imageModule->ScanSequence().c_str());
-    writer.formatElement("SequenceVariant", "%s",  imageModule->SequenceVariant().c_str());
-    writer.formatElement("ScanOptions", "%s",      imageModule->ScanOptions().c_str());
-    writer.formatElement("AcquisitionType", "%d",  imageModule->AcqType());
-    writer.formatElement("PhaseEncodeDirection", "%d",   imageModule->PhaseEncodeDirection());
-    writer.formatElement("ImagingFrequency", "%s", imageModule->ImagingFrequency().c_str());
-    writer.formatElement("MagneticFieldStrength", "%s",  imageModule->MagneticFieldStrength().c_str());
-    writer.formatElement("SliceSpacing", "%s",     imageModule->SliceSpacing().c_str());
-    writer.formatElement("FlipAngle", "%s",        imageModule->FlipAngle().c_str());
-    writer.formatElement("EchoTrainLength", "%s",  imageModule->EchoTrainLength().c_str());
+    writer.formatElement("EchoTime", "%s",         params.image.echoTime.c_str());
+    writer.formatElement("RepetitionTime", "%s",   params.image.repetitionTime.c_str());
+    writer.formatElement("InversionTime", "%s",    params.image.inversionTime.c_str());
+    writer.formatElement("ImageType", "%s",        dicom.image.imageType.c_str());
+    writer.formatElement("ScanSequence", "%s",     dicom.image.scanSequence.c_str());
+    writer.formatElement("SequenceVariant", "%s",  dicom.image.sequenceVariant.c_str());
+    writer.formatElement("ScanOptions", "%s",      dicom.image.scanOptions.c_str());
+    writer.formatElement("AcquisitionType", "%d",  dicom.image.acquisitionType);
+    writer.formatElement("PhaseEncodeDirection", "%d",   dicom.image.phaseEncodeDirection);
+    writer.formatElement("ImagingFrequency", "%s", params.image.imagingFrequency.c_str());
+    writer.formatElement("MagneticFieldStrength", "%s",  params.image.magneticFieldStrength.c_str());
+    writer.formatElement("SliceSpacing", "%s",     params.image.sliceSpacing.c_str());
+    writer.formatElement("FlipAngle", "%s",        params.image.flipAngle.c_str());
+    writer.formatElement("EchoTrainLength", "%s",  params.image.echoTrainLength.c_str());
     // TODO: map SliceOrder to a string
     // std::string sliceOrder = GERecon::SliceOrderAsString(processingControl->ReconstructionParameters::SliceOrder());
     // writer.formatElement("SliceOrder", "%s",       sliceOrder.c_str());
 
     // Image Parameters
-    writer.formatElement("ImageXRes", "%d",        processingControl->Value<int>("ImageXRes"));
-    writer.formatElement("ImageYRes", "%d",        processingControl->Value<int>("ImageYRes"));
-
-    auto imageModuleBase = dicomImage.ImageModuleBase();
-    writer.formatElement("AcquisitionDate", "%s",  imageModuleBase->AcquisitionDate().c_str());
-    writer.formatElement("AcquisitionTime", "%s",  imageModuleBase->AcquisitionTime().c_str());
-    writer.formatElement("ImageDate", "%s",        imageModuleBase->ImageDate().c_str());
-    writer.formatElement("ImageTime", "%s",        imageModuleBase->ImageTime().c_str());
-
-    auto imagePlaneModule = dicomImage.ImagePlaneModule();
-    writer.formatElement("ImageOrientation", "%s", imagePlaneModule->ImageOrientation().c_str());
-    writer.formatElement("ImagePosition", "%s",    imagePlaneModule->ImagePosition().c_str());
-    writer.formatElement("SliceThickness", "%f",   imagePlaneModule->SliceThickness());
-    writer.formatElement("SliceLocation", "%f",    imagePlaneModule->SliceLocation());
-    writer.formatElement("PixelSizeX", "%f",       imagePlaneModule->PixelSizeX());
-    writer.formatElement("PixelSizeY", "%f",       imagePlaneModule->PixelSizeY());
-
-    auto privateAcquisitionModule = dicomImage.PrivateAcquisitionModule();
-    writer.formatElement("SecondEcho", "%s",       privateAcquisitionModule->SecondEcho().c_str());
+    writer.formatElement("ImageXRes", "%d",        params.imageXRes);
+    writer.formatElement("ImageYRes", "%d",        params.imageYRes);
+
+    writer.formatElement("AcquisitionDate", "%s",  dicom.image.acquisitionDate.c_str());
+    writer.formatElement("AcquisitionTime", "%s",  dicom.image.acquisitionTime.c_str());
+    writer.formatElement("ImageDate", "%s",        dicom.image.imageDate.c_str());
+    writer.formatElement("ImageTime", "%s",        dicom.image.imageTime.c_str());
+
+    writer.formatElement("ImageOrientation", "%s", dicom.image.imageOrientation.c_str());
+    writer.formatElement("ImagePosition", "%s",    dicom.image.imagePosition.c_str());
+    writer.formatElement("SliceThickness", "%f",   params.image.sliceThickness);
+    writer.formatElement("SliceLocation", "%f",    dicom.image.sliceLocation);
+    writer.formatElement("PixelSizeX", "%f",       params.image.pixelSizeX);
+    writer.formatElement("PixelSizeY", "%f",       params.image.pixelSizeY);
+
+    writer.formatElement("SecondEcho", "%s",       params.image.secondEcho.c_str());
 
     // std::cout << "Table position: " << privateAcquisitionModule->TableDelta() << std::endl; // always seems to be 0.000 - so not sure if useful
 
     writer.endElement();
 
     writer.startElement("UserVariables");
-    writer.formatElement("rdb_hdr_user0",  "%d",   processingControl->Value<int>("UserValue0"));
-    writer.formatElement("rdb_hdr_user1",  "%d",   processingControl->Value<int>("UserValue1"));
-    writer.formatElement("rdb_hdr_user2",  "%d",   processingControl->Value<int>("UserValue2"));
-    writer.formatElement("rdb_hdr_user3",  "%d",   processingControl->Value<int>("UserValue3"));
-    writer.formatElement("rdb_hdr_user4",  "%d",   processingControl->Value<int>("UserValue4"));
-    writer.formatElement("rdb_hdr_user5",  "%d",   processingControl->Value<int>("UserValue5"));
-    writer.formatElement("rdb_hdr_user6",  "%d",   processingControl->Value<int>("UserValue6"));
-    writer.formatElement("rdb_hdr_user7",  "%d",   processingControl->Value<int>("UserValue7"));
-    writer.formatElement("rdb_hdr_user8",  "%d",   processingControl->Value<int>("UserValue8"));
-    writer.formatElement("rdb_hdr_user9",  "%d",   processingControl->Value<int>("UserValue9"));
-    writer.formatElement("rdb_hdr_user10", "%d",   processingControl->Value<int>("UserValue10"));
-    writer.formatElement("rdb_hdr_user11", "%d",   processingControl->Value<int>("UserValue11"));
-    writer.formatElement("rdb_hdr_user12", "%d",   processingControl->Value<int>("UserValue12"));
-    writer.formatElement("rdb_hdr_user13", "%d",   processingControl->Value<int>("UserValue13"));
-    writer.formatElement("rdb_hdr_user14", "%d",   processingControl->Value<int>("UserValue14"));
-    writer.formatElement("rdb_hdr_user15", "%d",   processingControl->Value<int>("UserValue15"));
-    writer.formatElement("rdb_hdr_user16", "%d",   processingControl->Value<int>("UserValue16"));
-    writer.formatElement("rdb_hdr_user17", "%d",   processingControl->Value<int>("UserValue17"));
-    writer.formatElement("rdb_hdr_user18", "%d",   processingControl->Value<int>("UserValue18"));
-    writer.formatElement("rdb_hdr_user19", "%d",   processingControl->Value<int>("UserValue19"));
+    writer.formatElement("rdb_hdr_user0",  "%d",   params.userValues[0]);
+    writer.formatElement("rdb_hdr_user1",  "%d",   params.userValues[1]);
+    writer.formatElement("rdb_hdr_user2",  "%d",   params.userValues[2]);
+    writer.formatElement("rdb_hdr_user3",  "%d",   params.userValues[3]);
+    writer.formatElement("rdb_hdr_user4",  "%d",   params.userValues[4]);
+    writer.formatElement("rdb_hdr_user5",  "%d",   params.userValues[5]);
+    writer.formatElement("rdb_hdr_user6",  "%d",   params.userValues[6]);
+    writer.formatElement("rdb_hdr_user7",  "%d",   params.userValues[7]);
+    writer.formatElement("rdb_hdr_user8",  "%d",   params.userValues[8]);
+    writer.formatElement("rdb_hdr_user9",  "%d",   params.userValues[9]);
+    writer.formatElement("rdb_hdr_user10", "%d",   params.userValues[10]);
+    writer.formatElement("rdb_hdr_user11", "%d",   params.userValues[11]);
+    writer.formatElement("rdb_hdr_user12", "%d",   params.userValues[12]);
+    writer.formatElement("rdb_hdr_user13", "%d",   params.userValues[13]);
+    writer.formatElement("rdb_hdr_user14", "%d",   params.userValues[14]);
+    writer.formatElement("rdb_hdr_user15", "%d",   params.userValues[15]);
+    writer.formatElement("rdb_hdr_user16", "%d",   params.userValues[16]);
+    writer.formatElement("rdb_hdr_user17", "%d",   params.userValues[17]);
+    writer.formatElement("rdb_hdr_user18", "%d",   params.userValues[18]);
+    writer.formatElement("rdb_hdr_user19", "%d",   params.userValues[19]);
     writer.endElement();
 
-    if (lxData->IsEpi())
+    if (params.isEpi)
     {
-        // Create EPI processing control object, so all relevant varaibles within that object are
-        // avaliable and accessible.
-
-        boost::shared_ptr<GERecon::Epi::LxControlSource> const controlSource = boost::make_shared<GERecon::Epi::LxControlSource>(lxData);
-        GERecon::Control::ProcessingControlPointer               procCtrlEPI = controlSource->CreateOrchestraProcessingControl();
         GERecon::Acquisition::ArchiveStoragePointer      archive_storage_ptr = GERecon::Acquisition::ArchiveStorage::Create(scanArchive_);
 
-        int ref_views                                        = procCtrlEPI->Value<int>("ExtraFramesTop") + procCtrlEPI->Value<int>("ExtraFramesBottom");
+        int ref_views                                        = params.epi.extraFramesTop + params.epi.extraFramesBottom;
 
         // In EPI ScanArchive files, the number of acquisitions == (number of slices per volume + 1 (control packet)) * number of volumes.
         //
         // So to recover number of volumes / repetitions, just invert this relationship.  This may be fragile, if other types of packets,
         // with different OpCodes - start getting included in the ScanArvhive.
         int num_volumes                                      = archive_storage_ptr->AvailableControlCount() /
-                                                               (processingControl->Value<int>("NumSlices") + 1);
+                                                               (params.numSlices + 1);
 
         writer.startElement("epiParameters");
-          writer.addBooleanElement("isEpiRefScanIntegrated",   procCtrlEPI->Value<bool>("IntegratedReferenceScan"));
-          writer.addBooleanElement("MultibandEnabled",         procCtrlEPI->ValueStrict<bool>("MultibandEnabled"));
-          writer.formatElement("ExtraFramesTop", "%d",         procCtrlEPI->Value<int>("ExtraFramesTop"));
-          writer.formatElement("AcquiredYRes", "%d",           procCtrlEPI->Value<int>("AcquiredYRes"));
-          writer.formatElement("ExtraFramesBottom", "%d",      procCtrlEPI->Value<int>("ExtraFramesBottom"));
+          writer.addBooleanElement("isEpiRefScanIntegrated",   params.epi.isEpiRefScanIntegrated);
+          writer.addBooleanElement("MultibandEnabled",         params.epi.multibandEnabled);
+          writer.formatElement("ExtraFramesTop", "%d",         params.epi.extraFramesTop);
+          writer.formatElement("AcquiredYRes", "%d",           params.epi.acquiredYRes);
+          writer.formatElement("ExtraFramesBottom", "%d",      params.epi.extraFramesBottom);
           // writer.formatElement("NumRefViews", "%d",            procCtrlEPI->Value<int>("NumRefViews")); // not found at run time up to Orchestra 1.10.1
           writer.formatElement("NumRefViews", "%d",            ref_views);
           writer.formatElement("num_volumes", "%d",            num_volumes);
@@ -479,7 +837,7 @@ std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPoin
 
     // DEBUG: std::cerr << "XML stream from GE is: " << writer.getXML().c_str() << std::endl;
 
-    return writer.getXML();
+    return writer.getDocument();
 }
 
 } // namespace GEToIsmrmrd
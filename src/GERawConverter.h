@@ -10,8 +10,6 @@
 // Local
 #include "SequenceConverter.h"
 #include "GenericConverter.h"
-#include "NIHPlugins/2dfastConverter.h"
-#include "NIHPlugins/epiConverter.h"
 
 // Libxml2 forward declarations
 struct _xmlDoc;
@@ -31,7 +29,7 @@ logstream& operator<<(logstream& s, T const& v)
     return s;
 }
 
-logstream& operator<<(logstream& s, std::ostream& (*f)(std::ostream&))
+inline logstream& operator<<(logstream& s, std::ostream& (*f)(std::ostream&))
 {
     if (s.enabled) { f(std::clog); }
     return s;
@@ -48,7 +46,8 @@ enum GE_RAW_TYPES
 class GERawConverter
 {
 public:
-    GERawConverter(const std::string& pfilepath, const std::string& classname, bool logging=false);
+    GERawConverter(const std::string& pfilepath, const std::string& classname, bool logging=false,
+                   const std::string& configFile="", bool headerOnly=false);
 
     std::shared_ptr<SequenceConverter> getConverter();
 
@@ -58,21 +57,46 @@ public:
 
     std::string getIsmrmrdXMLHeader();
 
+    void setConversionOptions(const ConversionOptions& options);
+
+    const ScanParameters& getScanParameters() const { return *params_; }
+
+    void convert(AcquisitionSink& sink);
+
+    bool checkpointable() const;
+    void setCheckpoint(const std::shared_ptr<ConversionCheckpoint>& checkpoint);
+
     std::vector<ISMRMRD::Acquisition> getAcquisitions(unsigned int view_num);
 
     std::string getReconConfigName(void);
 
     std::string ge_header_to_xml(GERecon::Legacy::LxDownloadDataPointer lxData,
                                  GERecon::Control::ProcessingControlPointer processingControl);
+
+    std::string ge_header_to_xml(GERecon::Legacy::LxDownloadDataPointer lxData,
+                                 const ScanParameters& params);
 private:
     // Non-copyable
     GERawConverter(const GERawConverter& other);
     GERawConverter& operator=(const GERawConverter& other);
 
+    std::shared_ptr<struct _xmlDoc> ge_header_to_doc(GERecon::Legacy::LxDownloadDataPointer lxData,
+                                                     const ScanParameters& params);
+
+    bool useConfigFile(const std::string& configFile);
     bool validateConfig(std::shared_ptr<struct _xmlDoc> config_doc);
     bool trySequenceMapping(std::shared_ptr<struct _xmlDoc> doc, struct _xmlNode* mapping);
 
+    void convertRaw(AcquisitionSink& sink);
+    void savePacketIndex();
+    void logPeakMemory();
+    unsigned int outputChannels(unsigned int scanChannels) const;
+
+    static void checkSelection(const IndexSelection& selection, unsigned int count, const std::string& what);
+
     std::string psdname_;
+    std::string classname_;
+    std::string config_dir_;
     std::string recon_config_;
     std::string stylesheet_;
 
@@ -81,8 +105,13 @@ private:
     GERecon::ScanArchivePointer scanArchive_;
     GERecon::Legacy::LxDownloadDataPointer lxData_;
     GERecon::Control::ProcessingControlPointer processingControl_;
+    std::shared_ptr<const ScanParameters> params_;
     int rawObjectType_; // to allow reference to a P-File or ScanArchive object
     std::shared_ptr<GEToIsmrmrd::SequenceConverter> converter_;
+    ConversionOptions options_;
+    std::string rawFilePath_;
+    std::shared_ptr<PacketIndex> packetIndex_;
+    bool headerOnly_;   // no plugin: only the header is read
 
     logstream log_;
 };
@@ -0,0 +1,324 @@
+/** @file GadgetronSink.cpp */
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Local
+#include "GadgetronSink.h"
+#include "Hdf5Lock.h"
+#include "Profiler.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Length of the configuration file name of a GADGET_MESSAGE_CONFIG_FILE */
+const size_t CONFIG_FILE_NAME_LENGTH = 1024;
+
+/** Outgoing acquisitions are sent once this many bytes are buffered */
+const size_t SEND_BUFFER_BYTES = 1 << 20;
+
+/**
+ * Largest text, image attributes and image data accepted from the server:
+ * sizes are read from the socket and checked before anything is allocated
+ */
+const uint64_t MAX_TEXT_LENGTH      = 1 << 20;
+const uint64_t MAX_ATTRIBUTE_LENGTH = 16 << 20;
+const uint64_t MAX_IMAGE_BYTES      = 1ull << 32;
+
+int connectTo(const std::string& host, const std::string& port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* addresses = NULL;
+    int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+    if (status != 0) {
+        throw std::runtime_error("Failed to resolve " + host + ": " + gai_strerror(status));
+    }
+
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address != NULL; address = address->ai_next) {
+        fd = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+
+    if (fd < 0) {
+        throw std::runtime_error("Failed to connect to Gadgetron at " + host + ":" + port);
+    }
+    return fd;
+}
+
+/** @returns size in bytes of one sample of an ISMRMRD image data type, 0 if unknown */
+size_t imageSampleSize(uint16_t dataType)
+{
+    switch (dataType) {
+        case ISMRMRD_USHORT:   return sizeof(uint16_t);
+        case ISMRMRD_SHORT:    return sizeof(int16_t);
+        case ISMRMRD_UINT:     return sizeof(uint32_t);
+        case ISMRMRD_INT:      return sizeof(int32_t);
+        case ISMRMRD_FLOAT:    return sizeof(float);
+        case ISMRMRD_DOUBLE:   return sizeof(double);
+        case ISMRMRD_CXFLOAT:  return sizeof(complex_float_t);
+        case ISMRMRD_CXDOUBLE: return sizeof(complex_double_t);
+        default:               return 0;
+    }
+}
+
+} // namespace
+
+GadgetronSink::GadgetronSink(const std::string& host, const std::string& port, const std::string& config,
+                             const std::string& xmlHeader, const std::string& imageFile)
+    : socket_(-1), open_(false), count_(0), imageFile_(imageFile), images_(0)
+{
+    if (config.size() >= CONFIG_FILE_NAME_LENGTH) {
+        throw std::runtime_error("Gadgetron configuration name too long: " + config);
+    }
+
+    socket_ = connectTo(host, port);
+    open_ = true;
+
+    // Reconstruction chain, by configuration file name on the server
+    char configName[CONFIG_FILE_NAME_LENGTH];
+    memset(configName, 0, sizeof(configName));
+    strncpy(configName, config.c_str(), sizeof(configName) - 1);
+    writeMessageId(GADGET_MESSAGE_CONFIG_FILE);
+    write(configName, sizeof(configName));
+
+    // ISMRMRD XML header, sent with its terminating null
+    uint32_t length = xmlHeader.size() + 1;
+    writeMessageId(GADGET_MESSAGE_PARAMETER_SCRIPT);
+    write(&length, sizeof(length));
+    write(xmlHeader.c_str(), length);
+    flush();
+
+    reader_ = std::thread(&GadgetronSink::readMessages, this);
+}
+
+GadgetronSink::~GadgetronSink()
+{
+    if (open_) {
+        // Abandoned without close(): make the reader return, then drop the connection
+        shutdown(socket_, SHUT_RDWR);
+    }
+    if (reader_.joinable()) {
+        reader_.join();
+    }
+    if (socket_ >= 0) {
+        ::close(socket_);
+    }
+
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+    imageDataset_.reset();
+}
+
+void GadgetronSink::append(const ISMRMRD::Acquisition& acq)
+{
+    const ISMRMRD_AcquisitionHeader& head = acq.getHead();
+
+    writeMessageId(GADGET_MESSAGE_ISMRMRD_ACQUISITION);
+    write(&head, sizeof(head));
+    write(acq.getTrajPtr(), sizeof(float) * head.number_of_samples * head.trajectory_dimensions);
+    write(acq.getDataPtr(), sizeof(complex_float_t) * head.number_of_samples * head.active_channels);
+    count_++;
+
+    // Let the server start on a slice as soon as it is complete
+    if (buffer_.size() >= SEND_BUFFER_BYTES || acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE)) {
+        flush();
+    }
+}
+
+void GadgetronSink::close()
+{
+    if (!open_) {
+        return;
+    }
+
+    writeMessageId(GADGET_MESSAGE_CLOSE);
+    flush();
+    open_ = false;
+
+    // The server closes the stream after the last image
+    reader_.join();
+
+    if (readError_) {
+        std::rethrow_exception(readError_);
+    }
+}
+
+void GadgetronSink::writeMessageId(uint16_t id)
+{
+    write(&id, sizeof(id));
+}
+
+void GadgetronSink::write(const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    buffer_.insert(buffer_.end(), bytes, bytes + size);
+}
+
+void GadgetronSink::flush()
+{
+    size_t sent = 0;
+    while (sent < buffer_.size()) {
+        ssize_t n = send(socket_, &buffer_[sent], buffer_.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("Failed to send to Gadgetron: ") + strerror(errno));
+        }
+        sent += n;
+    }
+    buffer_.clear();
+}
+
+/** Runs on the reader thread until the server closes the connection */
+void GadgetronSink::readMessages()
+{
+    try {
+        while (true) {
+            uint16_t id = 0;
+            readExactly(&id, sizeof(id));
+
+            if (id == GADGET_MESSAGE_CLOSE) {
+                return;
+            } else if (id == GADGET_MESSAGE_ISMRMRD_IMAGE) {
+                readImage();
+            } else if (id == GADGET_MESSAGE_TEXT) {
+                uint32_t length = 0;
+                readExactly(&length, sizeof(length));
+                std::cerr << "Gadgetron: " << readText(length, MAX_TEXT_LENGTH) << std::endl;
+            } else if (id == GADGET_MESSAGE_ERROR) {
+                uint64_t length = 0;
+                readExactly(&length, sizeof(length));
+                throw std::runtime_error("Gadgetron error: " + readText(length, MAX_TEXT_LENGTH));
+            } else {
+                // Messages are not length prefixed, so one of unknown layout
+                // cannot be skipped
+                std::ostringstream message;
+                message << "Unsupported Gadgetron message id " << id;
+                throw std::runtime_error(message.str());
+            }
+        }
+    } catch (...) {
+        readError_ = std::current_exception();
+    }
+}
+
+void GadgetronSink::readExactly(void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    size_t received = 0;
+    while (received < size) {
+        ssize_t n = recv(socket_, bytes + received, size - received, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error("Gadgetron connection closed while receiving");
+        }
+        received += n;
+    }
+}
+
+/** Reads a string of the server, after its length has been checked */
+std::string GadgetronSink::readText(uint64_t length, uint64_t maxLength)
+{
+    if (length > maxLength) {
+        std::ostringstream message;
+        message << "Gadgetron sent a " << length << " byte string, more than the " << maxLength << " accepted";
+        throw std::runtime_error(message.str());
+    }
+    std::string text(length, '\0');
+    if (length > 0) {
+        readExactly(&text[0], length);
+    }
+    return text;
+}
+
+void GadgetronSink::readImage()
+{
+    ISMRMRD::ImageHeader head;
+    readExactly(&head, sizeof(ISMRMRD_ImageHeader));
+
+    uint64_t attributeLength = 0;
+    readExactly(&attributeLength, sizeof(attributeLength));
+    std::string const attributes = readText(attributeLength, MAX_ATTRIBUTE_LENGTH);
+
+    size_t sampleSize = imageSampleSize(head.data_type);
+    if (sampleSize == 0) {
+        throw std::runtime_error("Unsupported data type of image received from Gadgetron");
+    }
+    // Checked after each 16 bit factor, so the product cannot overflow
+    uint16_t const dimensions[4] = { head.matrix_size[0], head.matrix_size[1], head.matrix_size[2], head.channels };
+    uint64_t bytes = sampleSize;
+    for (size_t n = 0; n < 4 && bytes <= MAX_IMAGE_BYTES; n++) {
+        bytes *= dimensions[n];
+    }
+    if (bytes > MAX_IMAGE_BYTES) {
+        std::ostringstream message;
+        message << "Gadgetron sent an image of more than the " << MAX_IMAGE_BYTES << " bytes accepted";
+        throw std::runtime_error(message.str());
+    }
+    std::vector<char> data(bytes);
+    if (data.size() > 0) {
+        readExactly(&data[0], data.size());
+    }
+    images_++;
+
+    if (imageFile_.size() == 0) {
+        return;
+    }
+
+    switch (head.data_type) {
+        case ISMRMRD_USHORT:   storeImage<uint16_t>(head, attributes, data); break;
+        case ISMRMRD_SHORT:    storeImage<int16_t>(head, attributes, data); break;
+        case ISMRMRD_UINT:     storeImage<uint32_t>(head, attributes, data); break;
+        case ISMRMRD_INT:      storeImage<int32_t>(head, attributes, data); break;
+        case ISMRMRD_FLOAT:    storeImage<float>(head, attributes, data); break;
+        case ISMRMRD_DOUBLE:   storeImage<double>(head, attributes, data); break;
+        case ISMRMRD_CXFLOAT:  storeImage<complex_float_t>(head, attributes, data); break;
+        case ISMRMRD_CXDOUBLE: storeImage<complex_double_t>(head, attributes, data); break;
+    }
+}
+
+template <typename T>
+void GadgetronSink::storeImage(const ISMRMRD::ImageHeader& head, const std::string& attributes,
+                               const std::vector<char>& data)
+{
+    ISMRMRD::Image<T> image;
+    image.setHead(head);
+    image.setAttributeString(attributes);
+    memcpy(image.getDataPtr(), &data[0], data.size());
+
+    std::ostringstream name;
+    name << "image_" << head.image_series_index;
+
+    std::lock_guard<std::mutex> lock(hdf5Mutex());
+    ScopedTimer hdf5Timer(PROFILE_HDF5);
+    if (!imageDataset_) {
+        imageDataset_.reset(new ISMRMRD::Dataset(imageFile_.c_str(), "dataset", true));
+    }
+    imageDataset_->appendImage(name.str(), image);
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,106 @@
+/** @file GadgetronSink.h */
+#ifndef GADGETRON_SINK_H
+#define GADGETRON_SINK_H
+
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+
+// Local
+#include "AcquisitionSink.h"
+
+namespace GEToIsmrmrd {
+
+/** Message identifiers of the Gadgetron ISMRMRD wire protocol */
+enum GadgetronMessageId
+{
+    GADGET_MESSAGE_CONFIG_FILE         = 1,
+    GADGET_MESSAGE_CONFIG_SCRIPT       = 2,
+    GADGET_MESSAGE_PARAMETER_SCRIPT    = 3,
+    GADGET_MESSAGE_CLOSE               = 4,
+    GADGET_MESSAGE_TEXT                = 5,
+    GADGET_MESSAGE_ERROR               = 8,
+    GADGET_MESSAGE_ISMRMRD_ACQUISITION = 1008,
+    GADGET_MESSAGE_ISMRMRD_IMAGE       = 1022
+};
+
+/**
+ * Sink streaming acquisitions to a Gadgetron server while the scan is being
+ * converted
+ *
+ * The constructor connects and sends the reconstruction configuration name
+ * and the ISMRMRD XML header, so reconstruction can start on the first
+ * acquisitions appended.  A background thread receives the images sent back
+ * and, if an image file was given, stores them in it as ISMRMRD images
+ * "image_<series index>" of the group "dataset".  Text messages of the
+ * server are written to std::cerr; an error message ends the stream.
+ */
+class GadgetronSink : public AcquisitionSink
+{
+public:
+    /**
+     * @param host Gadgetron server name or address
+     * @param port Gadgetron server port
+     * @param config Name of the reconstruction chain configuration on the server
+     * @param xmlHeader ISMRMRD XML header of the scan
+     * @param imageFile ISMRMRD file receiving the reconstructed images, or empty
+     * @throws std::runtime_error if the server cannot be reached
+     */
+    GadgetronSink(const std::string& host, const std::string& port, const std::string& config,
+                  const std::string& xmlHeader, const std::string& imageFile);
+    ~GadgetronSink();
+
+    void append(const ISMRMRD::Acquisition& acq);
+
+    /**
+     * Sends the end of stream and waits until the server has returned all
+     * images and closed the connection
+     *
+     * @throws std::runtime_error if sending or receiving failed
+     */
+    void close();
+
+    size_t count() const { return count_; }
+
+    size_t imageCount() const { return images_; }
+
+private:
+    // Non-copyable
+    GadgetronSink(const GadgetronSink& other);
+    GadgetronSink& operator=(const GadgetronSink& other);
+
+    void writeMessageId(uint16_t id);
+    void write(const void* data, size_t size);
+    void flush();
+
+    void readMessages();
+    void readExactly(void* data, size_t size);
+    void readImage();
+    std::string readText(uint64_t length, uint64_t maxLength);
+
+    template <typename T>
+    void storeImage(const ISMRMRD::ImageHeader& head, const std::string& attributes,
+                    const std::vector<char>& data);
+
+    int socket_;
+    bool open_;
+    std::vector<char> buffer_;
+    size_t count_;
+
+    std::string imageFile_;
+    std::unique_ptr<ISMRMRD::Dataset> imageDataset_;
+    size_t images_;
+    std::thread reader_;
+    std::exception_ptr readError_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* GADGETRON_SINK_H */
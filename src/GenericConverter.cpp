@@ -1,11 +1,18 @@
 
 /** @file GenericConverter.cpp */
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <stdexcept>
 #include <string>
 #include <sstream>
 
+#include "AcquisitionClock.h"
 #include "GenericConverter.h"
+#include "Hdf5Lock.h"
+#include "PacketPipeline.h"
+#include "Profiler.h"
+#include "ViewLayout.h"
 
 struct LOADTEST {
    LOADTEST() { std::cerr << __FILE__ << ": shared object loaded"   << std::endl; }
@@ -14,7 +21,7 @@ struct LOADTEST {
 
 namespace GEToIsmrmrd {
 
-int GenericConverter::get_view_idx(GERecon::Control::ProcessingControlPointer processingControl,
+int GenericConverter::get_view_idx(const ScanParameters &params,
                                    unsigned int view_num, ISMRMRD::EncodingCounters &idx)
 {
     // set all the ones we don't care about to zero
@@ -28,8 +35,8 @@ int GenericConverter::get_view_idx(GERecon::Control::ProcessingControlPointer pr
         idx.user[n] = 0;
     }
 
-    unsigned int nframes   = processingControl->Value<int>("AcquiredYRes");
-    unsigned int numSlices = processingControl->Value<int>("NumSlices");
+    unsigned int nframes   = params.acquiredYRes;
+    unsigned int numSlices = params.numSlices;
 
     idx.repetition = view_num / (numSlices * (1 + nframes));
 
@@ -43,253 +50,511 @@ int GenericConverter::get_view_idx(GERecon::Control::ProcessingControlPointer pr
 
 
 
-std::vector<ISMRMRD::Acquisition> GenericConverter::getAcquisitions(GERecon::Legacy::PfilePointer &pfile,
-                                                                    unsigned int acqMode)
+void GenericConverter::convert(GERecon::Legacy::PfilePointer &pfile, const ScanParameters &params,
+                               AcquisitionSink &sink)
 {
-    std::vector<ISMRMRD::Acquisition> acqs;
+    unsigned int nPhases   = params.acquiredYRes;
+    unsigned int nEchoes   = params.numEchoes;
+    unsigned int nChannels = params.numChannels;
+    unsigned int numSlices = params.numSlices;
+    bool             chopY = params.chopY;
 
-    const GERecon::Control::ProcessingControlPointer processingControl(pfile->CreateOrchestraProcessingControl());
-    unsigned int nPhases   = processingControl->Value<int>("AcquiredYRes");
-    unsigned int nEchoes   = processingControl->Value<int>("NumEchoes");
-    unsigned int nChannels = processingControl->Value<int>("NumChannels");
-    unsigned int numSlices = processingControl->Value<int>("NumSlices");
-
-    // Make number of acquisitions to be converted
-    acqs.resize(numSlices * nEchoes * nPhases);
-
-    unsigned int acq_num = 0;
+    // Only the selected blocks and channels are read from the P-file
+    const AcquisitionSelection& selection = options_.selection;
+    const std::vector<unsigned int> channels = selection.channels.indices(nChannels);
+    unsigned int const nOutChannels = channels.size();
 
     // Orchestra API provides size in bytes.
     // frame_size is the number of complex points in a single channel
-    size_t frame_size = processingControl->Value<int>("AcquiredXRes");
+    size_t frame_size = params.acquiredXRes;
+
+    const geRawDataSliceGeometry_t sliceGeometry = buildSliceGeometry(params);
+
+    const std::vector<ISMRMRD::AcquisitionHeader> headerTemplates =
+        buildHeaderTemplates(params, sliceGeometry, frame_size, channels);
+    const AcquisitionClock clock(params);
+
+    // Odd phase lines are un-chopped when the data was not chopped in Y
+    const ViewCopyFunction copyLines = selectViewCopy(SequenceLayout(chopY ? CHOP_NONE : CHOP_ODD_LINES, false, false));
+
+    // A P-file holds a single repetition
+    ISMRMRD::EncodingCounters repetitionIdx;
+    get_view_idx(params, 0, repetitionIdx);
+    if (!selection.repetitions.contains(repetitionIdx.repetition)) {
+        return;
+    }
+
+    sink.reserve(selection.slices.count(numSlices) * selection.echoes.count(nEchoes) * nPhases);
+
+    // Orchestra's P-file reader is not known to be safe to use concurrently:
+    // the k-space reads are serialised, the header and copy work is not
+    std::mutex pfileMutex;
 
-    for (int sliceCount = 0 ; sliceCount < numSlices ; sliceCount++)
+    // Reader: the selected slice / echo blocks, in scan order.  The line
+    // numbers of a block follow from its position in the full scan.
+    int sliceCount = 0, echoCount = 0;
+    auto readBlock = [&](PfileBlockJob &job) -> bool
     {
-        for (int echoCount = 0 ; echoCount < nEchoes ; echoCount++)
+        for ( ; sliceCount < numSlices ; sliceCount++, echoCount = 0)
         {
-            for (int phaseCount = 0 ; phaseCount < nPhases ; phaseCount++)
+            if (!selection.slices.contains(sliceCount)) {
+                continue;
+            }
+
+            for ( ; echoCount < nEchoes ; echoCount++)
             {
-                // Grab a reference to the acquisition
-                ISMRMRD::Acquisition& acq = acqs.at(acq_num);
+                if (!selection.echoes.contains(echoCount)) {
+                    continue;
+                }
 
-                // Set size of this data frame to receive raw data
-                acq.resize(frame_size, nChannels, 0);
-                acq.clearAllFlags();
+                job.slice       = sliceCount;
+                job.echo        = echoCount;
+                job.scanCounter = (sliceCount * nEchoes + echoCount) * nPhases;
+                echoCount++;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Transform: builds the phase lines of one block.  Each channel's k-space
+    // matrix is read once and scattered across all lines of the block, instead
+    // of being re-read for every line.  Runs on the worker threads, so it may
+    // only touch the job.
+    auto transformBlock = [&](PfileBlockJob &job)
+    {
+        // Slots are reused, so a job keeps its acquisitions' buffers
+        job.acqs.resize(nPhases);
+        std::vector<complex_float_t*> lines(nPhases);
 
-                // Initialize the encoding counters for this acquisition.
-                ISMRMRD::EncodingCounters idx;
-                get_view_idx(processingControl, 0, idx);
+        for (int phaseCount = 0 ; phaseCount < nPhases ; phaseCount++)
+        {
+            ISMRMRD::Acquisition& acq = job.acqs[phaseCount];
 
-                idx.slice = sliceCount;
-                idx.contrast  = echoCount;
-                idx.kspace_encode_step_1 = phaseCount;
+            // Sizes, channels and geometry come with the template;
+            // setHead() only reallocates the samples when their size changes
+            acq.setHead(headerTemplates[job.slice * nEchoes + job.echo]);
 
-                acq.idx() = idx;
+            ISMRMRD::EncodingCounters& idx = acq.idx();
+            idx.kspace_encode_step_1 = phaseCount;
 
-                // Fill in the rest of the header
-                // acq.measurement_uid() = pfile->RunNumber();
-                acq.scan_counter() = acq_num;
-                acq.acquisition_time_stamp() = time(NULL); // TODO: can we get a timestamp?
-                for (int p=0; p<ISMRMRD::ISMRMRD_PHYS_STAMPS; p++) {
-                    acq.physiology_time_stamp()[p] = 0;
-                }
-                acq.available_channels() = nChannels;
-                acq.discard_pre() = 0;
-                acq.discard_post() = 0;;
-                acq.center_sample() = frame_size/2;
-                acq.encoding_space_ref() = 0;
-                //acq.sample_time_us() = pfile->sample_time * 1e6;
-
-                for (int ch = 0 ; ch < nChannels ; ch++) {
-                    acq.setChannelActive(ch);
-                }
+            // acq.measurement_uid() = pfile->RunNumber();
+            acq.scan_counter() = job.scanCounter + phaseCount;
+            acq.acquisition_time_stamp() = clock.stamp(clock.pfileExcitation(job.slice, phaseCount));
 
-                setISMRMRDSliceVectors(processingControl, acq);
-
-                // Set first acquisition flag
-                if (idx.kspace_encode_step_1 == 0)
-                    acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
-
-                // Set last acquisition flag
-                if (idx.kspace_encode_step_1 == nPhases - 1)
-                    acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
-
-                // Get data from P-file using KSpaceData object, and copy
-                // into ISMRMRD space.
-                for (int channelID = 0 ; channelID < nChannels ; channelID++)
-                {
-                    // VR + JAD - 2016.01.15 - looking at various schemes to stride and read in
-                    // K-space data.
-                    //
-                    // ViewData - will read in "acquisitions", including baselines, starting at
-                    //            index 0, going up to slices * echo * (view + baselines)
-                    //
-                    // KSpaceData (slice, echo, channel, phase = 0) - reads in data, assuming "GE
-                    //            native" data order in P-file, gives one slice / image worth of
-                    //            K-space data, with baseline views automagically excluded.
-                    //
-                    // KSpaceData can return different numerical data types.  Picked float to
-                    // be consistent with ISMRMRD data type.  This implementation of KSpaceData
-                    // is used for data acquired in the "native" GE order.
-
-                    auto kData = pfile->KSpaceData<float>(sliceCount, echoCount, channelID);
-
-                    if (processingControl->Value<bool>("ChopY") == 0) {
-                       if (idx.kspace_encode_step_1 % 2 == 1) {
-                          kData *= -1.0f;
-                       }
-                    }
-
-                    for (int i = 0 ; i < frame_size ; i++)
-                    {
-                       acq.data(i, channelID) = kData(i, phaseCount);
-                    }
-                }
+            // Set first acquisition flag
+            if (idx.kspace_encode_step_1 == 0)
+                acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
+
+            // Set last acquisition flag
+            if (idx.kspace_encode_step_1 == nPhases - 1)
+                acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+        } // end of phaseCount loop
+
+        // Get data from P-file using KSpaceData object, and copy
+        // into ISMRMRD space.
+        for (int n = 0 ; n < nOutChannels ; n++)
+        {
+            unsigned int const channelID = channels[n];
+
+            // VR + JAD - 2016.01.15 - looking at various schemes to stride and read in
+            // K-space data.
+            //
+            // ViewData - will read in "acquisitions", including baselines, starting at
+            //            index 0, going up to slices * echo * (view + baselines)
+            //
+            // KSpaceData (slice, echo, channel, phase = 0) - reads in data, assuming "GE
+            //            native" data order in P-file, gives one slice / image worth of
+            //            K-space data, with baseline views automagically excluded.
+            //
+            // KSpaceData can return different numerical data types.  Picked float to
+            // be consistent with ISMRMRD data type.  This implementation of KSpaceData
+            // is used for data acquired in the "native" GE order.
+
+            std::unique_lock<std::mutex> pfileLock(pfileMutex);
+            ScopedTimer decodeTimer(PROFILE_DECODE);
+            auto kData = pfile->KSpaceData<float>(job.slice, job.echo, channelID);
+            decodeTimer.stop();
+            pfileLock.unlock();
+
+            ScopedTimer copyTimer(PROFILE_COPY);
+            for (int phaseCount = 0 ; phaseCount < nPhases ; phaseCount++) {
+                lines[phaseCount] = &job.acqs[phaseCount].data(0, n);
+            }
 
-                acq_num++;
-            } // end of phaseCount loop
-        } // end of echoCount loop
-    } // end of sliceCount loop
+            // The matrix holds a single channel, one phase line per column
+            static const unsigned int matrixChannel = 0;
+            ViewSource source;
+            source.data         = &kData(0, 0);
+            source.sampleStride = kData.stride(0);
+            source.viewStride   = kData.stride(1);
+            source.samples      = frame_size;
+            source.views        = nPhases;
+            source.channels     = &matrixChannel;
+            source.channelCount = 1;
+            copyLines(source, lines.data());
+            copyTimer.stop();
+            Profiler::instance().count(PROFILE_BYTES_COPIED, nPhases * frame_size * sizeof(complex_float_t));
+        }
+    };
+
+    // Writer: hands the blocks to the sink in scan order
+    auto writeBlock = [&](PfileBlockJob &job)
+    {
+        for (int phaseCount = 0 ; phaseCount < nPhases ; phaseCount++)
+        {
+            sink.append(job.acqs[phaseCount]);
+        }
+        Profiler::instance().count(PROFILE_ACQUISITIONS_EMITTED, nPhases);
+    };
 
-    return acqs;
+    // A block holds its phase lines, and one channel's k-space matrix while transformed
+    auto blockBytes = [&](const PfileBlockJob &) -> uint64_t
+    {
+        return uint64_t(nPhases) * frame_size * (nOutChannels + 1) * sizeof(complex_float_t);
+    };
+
+    std::shared_ptr<ThreadPool> pool = conversionPool();
+    PacketPipeline<PfileBlockJob> pipeline(pool.get(), options_.queueDepth);
+    pipeline.limitMemory(options_.maxMemoryBytes, blockBytes);
+    pipeline.run(readBlock, transformBlock, writeBlock);
+    Profiler::instance().peak(PROFILE_PEAK_BYTES_IN_FLIGHT, pipeline.peakBytes());
 }
 
 
 
-std::vector<ISMRMRD::Acquisition> GenericConverter::getAcquisitions(GERecon::ScanArchivePointer &scanArchivePtr,
-                                                                    unsigned int acqMode)
+void GenericConverter::convert(GERecon::ScanArchivePointer &scanArchivePtr, const ScanParameters &params,
+                               AcquisitionSink &sink)
 {
-   std::vector<ISMRMRD::Acquisition> acqs;
-
+   // The archive is read through libhdf5, which other threads may be using
+   std::unique_lock<std::mutex> hdf5Lock(hdf5Mutex());
+   ScopedTimer orchestraTimer(PROFILE_ORCHESTRA);
    GERecon::Acquisition::ArchiveStoragePointer archiveStoragePointer = GERecon::Acquisition::ArchiveStorage::Create(scanArchivePtr);
-   GERecon::Legacy::LxDownloadDataPointer lxData = boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(scanArchivePtr->LoadDownloadData());
-   boost::shared_ptr<GERecon::Legacy::LxControlSource> const controlSource = boost::make_shared<GERecon::Legacy::LxControlSource>(lxData);
-   GERecon::Control::ProcessingControlPointer processingControl = controlSource->CreateOrchestraProcessingControl();
 
    int const   packetQuantity = archiveStoragePointer->AvailableControlCount();
+   orchestraTimer.stop();
+   hdf5Lock.unlock();
 
    int            packetCount = 0;
    int              dataIndex = 0;
-   int                acqType = 0;
-   unsigned int       nPhases = processingControl->Value<int>("AcquiredYRes");
-   unsigned int       nEchoes = processingControl->Value<int>("NumEchoes");
-   unsigned int     nChannels = processingControl->Value<int>("NumChannels");
-   unsigned int     numSlices = processingControl->Value<int>("NumSlices");
-   size_t          frame_size = processingControl->Value<int>("AcquiredXRes");
-
-   while (packetCount < packetQuantity)
+   int         viewsPerPacket = 0;   // learnt from the first image packet
+   unsigned int       nPhases = params.acquiredYRes;
+   unsigned int       nEchoes = params.numEchoes;
+   unsigned int     nChannels = params.numChannels;
+   unsigned int     numSlices = params.numSlices;
+   size_t          frame_size = params.acquiredXRes;
+   const GERecon::SliceInfoTable& sliceTable = params.sliceTable;
+
+   const AcquisitionSelection& selection = options_.selection;
+   const std::vector<unsigned int> channels = selection.channels.indices(nChannels);
+   unsigned int const nOutChannels = channels.size();
+
+   const geRawDataSliceGeometry_t sliceGeometry = buildSliceGeometry(params);
+
+   const std::vector<ISMRMRD::AcquisitionHeader> headerTemplates =
+      buildHeaderTemplates(params, sliceGeometry, frame_size, channels);
+
+   // Odd phase lines are un-chopped when the data was not chopped in Y
+   const ViewCopyFunction copyLines = selectViewCopy(SequenceLayout(params.chopY ? CHOP_NONE : CHOP_ODD_LINES,
+                                                                    false, false));
+
+   // Packets are skipped through a usable index, else it is rebuilt while reading
+   PacketIndex* const index = packetIndex_.get();
+   ArchivePrefetcher* const prefetcher = prefetcher_.get();
+   // A resumed conversion starts reading after the packets of its checkpoint
+   ConversionCheckpoint* const checkpoint = checkpoint_.get();
+   const ReaderPosition resume = (checkpoint != NULL) ? checkpoint->position() : ReaderPosition();
+   if (resume.packets > static_cast<uint64_t>(packetQuantity)) {
+      std::ostringstream message;
+      message << "Checkpoint is at packet " << resume.packets << ", but the ScanArchive has "
+              << packetQuantity << " packets";
+      throw std::runtime_error(message.str());
+   }
+   // Entries hold the views of multi-line packets since "generic-lines"
+   bool const indexed  = (index != NULL) && index->usable("generic-lines", packetQuantity);
+   bool const indexing = (index != NULL) && !indexed && resume.packets == 0;
+   if (indexing) {
+      index->begin("generic-lines", packetQuantity);
+   }
+   int const lastPacket = indexed ? index->end(selection) : packetQuantity;
+
+   // Every packet other than a scan control packet carries at least one image
+   // line, so without an index the packet count is a first estimate.
+   sink.reserve(indexed ? index->acquisitionCount(selection) : packetQuantity);
+
+   // Every packet of the first echo but the scan control ones is a line of
+   // an echo train, baselines included; the later echoes of a line come in
+   // packets of their own
+   const AcquisitionClock clock(params);
+   uint64_t excitations = resume.excitations;   // lines, echoTrainLength per excitation
+   auto countExcitation = [&](const PacketIndexEntry &entry) -> uint64_t
    {
-      // encoding IDs to fill ISMRMRD headers.
-      unsigned int   sliceID = 0;
-      unsigned int    viewID = 0;
-
-      GERecon::Acquisition::FrameControlPointer const thisPacket = archiveStoragePointer->NextFrameControl();
+      if (entry.opcode != static_cast<int32_t>(GERecon::Acquisition::ScanControlOpcode) && entry.echo == 0) {
+         excitations++;
+      }
+      return clock.trainExcitation((excitations > 0) ? excitations - 1 : 0);
+   };
 
-      // Need to identify opcode(s) here that will mark acquisition / reference / control
-      if (thisPacket->Control().Opcode() != GERecon::Acquisition::ScanControlOpcode)
-      {
-         GERecon::Acquisition::ProgrammableControlPacket const packetContents = thisPacket->Control().Packet().As<GERecon::Acquisition::ProgrammableControlPacket>();
+   // The packets before the checkpoint are stepped over without parsing them
+   if (resume.packets > 0)
+   {
+      std::lock_guard<std::mutex> lock(hdf5Mutex());
+      ScopedTimer orchestraTimer(PROFILE_ORCHESTRA);
+      while (static_cast<uint64_t>(packetCount) < resume.packets) {
+         archiveStoragePointer->NextFrameControl();
+         packetCount++;
+      }
+      dataIndex      = resume.dataIndex;
+      viewsPerPacket = resume.viewsPerPacket;
+      Profiler::instance().count(PROFILE_PACKETS_RESUMED, resume.packets);
+      if (prefetcher != NULL) {
+         prefetcher->progress(packetCount, packetQuantity);
+      }
+   }
 
-         const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
+   // Lines from viewID on, viewSkip views apart, until either end of the
+   // encoded range; lines past it are not image data
+   auto linesInRange = [nPhases](int viewID, int viewSkip) -> int
+   {
+      return (viewSkip > 0) ? (static_cast<int>(nPhases) - viewID) / viewSkip + 1
+                            : (viewID - 1) / -viewSkip + 1;
+   };
 
-         viewID  = GERecon::Acquisition::GetPacketValue(packetContents.viewNumH,  packetContents.viewNumL);
-         // Convert acquired slice index to spatial / geometric slice index
-         sliceID = sliceTable.GeometricSliceNumber(GERecon::Acquisition::GetPacketValue(packetContents.sliceNumH, packetContents.sliceNumL));
+   // Reader: walks the control stream, skipping control and baseline packets,
+   // and numbers the image frames and excitations in acquisition order.
+   // Frames outside the selection are numbered too, but never decoded.
+   auto readPacket = [&](ArchivePacketJob &job) -> bool
+   {
+      while (packetCount < lastPacket)
+      {
+         GERecon::Acquisition::FrameControlPointer thisPacket;
+         {
+            std::lock_guard<std::mutex> lock(hdf5Mutex());
+            ScopedTimer orchestraTimer(PROFILE_ORCHESTRA);
+            thisPacket = archiveStoragePointer->NextFrameControl();
+         }
+         int const packetNumber = packetCount++;
+         Profiler::instance().count(PROFILE_PACKETS_READ);
+         if (prefetcher != NULL) {
+            prefetcher->progress(packetCount, packetQuantity);
+         }
 
-         if ((viewID < 1) || (viewID > nPhases))
+         PacketIndexEntry entry;
+         uint64_t excitation;
+         if (indexed)
          {
-            acqType = GERecon::Acquisition::BaselineFrame;
-            // nothing else to be done here for basic 2D case
+            entry = (*index)[packetNumber];
+            excitation = countExcitation(entry);
          }
          else
          {
-            acqType = GERecon::Acquisition::ImageFrame;
+            entry.opcode = static_cast<int32_t>(thisPacket->Control().Opcode());
 
-            acqs.resize(dataIndex + 1);
+            // Need to identify opcode(s) here that will mark acquisition / reference / control
+            if (thisPacket->Control().Opcode() == GERecon::Acquisition::ScanControlOpcode)
+            {
+               if (indexing) {
+                  index->add(entry);
+               }
+               continue;
+            }
 
-            auto kData = thisPacket->Data();
+            GERecon::Acquisition::ProgrammableControlPacket const packetContents = thisPacket->Control().Packet().As<GERecon::Acquisition::ProgrammableControlPacket>();
 
-            // Grab a reference to the acquisition
-            ISMRMRD::Acquisition& acq = acqs.at(dataIndex);
+            unsigned int viewID = GERecon::Acquisition::GetPacketValue(packetContents.viewNumH,  packetContents.viewNumL);
+            entry.view = viewID;
+            entry.echo = packetContents.echoNum;
+            excitation = countExcitation(entry);
 
-            // Set size of this data frame to receive raw data
-            acq.resize(frame_size, nChannels, 0);
-            acq.clearAllFlags();
+            if ((viewID < 1) || (viewID > nPhases))
+            {
+               // GERecon::Acquisition::BaselineFrame - nothing else to be done here for basic 2D case
+               Profiler::instance().count(PROFILE_BASELINE_FRAMES_SKIPPED);
+               if (indexing) {
+                  index->add(entry);
+               }
+               continue;
+            }
 
-            // Initialize the encoding counters for this acquisition.
             ISMRMRD::EncodingCounters idx;
-            get_view_idx(processingControl, viewID, idx);
+            get_view_idx(params, viewID, idx);
 
-            idx.slice                  = sliceID;
-            idx.contrast               = packetContents.echoNum;
-            idx.kspace_encode_step_1   = viewID - 1;
-
-            acq.idx() = idx;
-
-            // Fill in the rest of the header
-            // acq.measurement_uid() = pfile->RunNumber();
-            acq.scan_counter() = dataIndex;
-            acq.acquisition_time_stamp() = time(NULL);
-            for (int p=0; p<ISMRMRD::ISMRMRD_PHYS_STAMPS; p++) {
-               acq.physiology_time_stamp()[p] = 0;
+            // A packet may carry several lines, viewSkip views apart.  All
+            // packets of a scan have the same shape, so it is read only once.
+            short const viewSkip = static_cast<short>(GERecon::Acquisition::GetPacketValue(packetContents.viewSkipH,
+                                                                                           packetContents.viewSkipL));
+            if (viewsPerPacket == 0)
+            {
+               std::lock_guard<std::mutex> lock(hdf5Mutex());
+               ScopedTimer orchestraTimer(PROFILE_ORCHESTRA);
+               viewsPerPacket = std::max(1, static_cast<int>(thisPacket->Data().extent(2)));
             }
-            acq.available_channels()   = nChannels;
-            acq.discard_pre()          = 0;
-            acq.discard_post()         = 0;
-            acq.center_sample()        = frame_size/2;
-            acq.encoding_space_ref()   = 0;
-            // acq.sample_time_us()       = pfile->sample_time * 1e6;
-
-            for (int ch = 0 ; ch < nChannels ; ch++) {
-               acq.setChannelActive(ch);
+            entry.viewSkip = (viewSkip == 0) ? 1 : viewSkip;
+
+            // Convert acquired slice index to spatial / geometric slice index
+            entry.slice        = sliceTable.GeometricSliceNumber(GERecon::Acquisition::GetPacketValue(packetContents.sliceNumH, packetContents.sliceNumL));
+            entry.repetition   = idx.repetition;
+            entry.dataIndex    = dataIndex;
+            entry.acquisitions = std::min(viewsPerPacket, linesInRange(viewID, entry.viewSkip));
+            dataIndex         += entry.acquisitions;
+            if (indexing) {
+               index->add(entry);
             }
+         }
 
-            setISMRMRDSliceVectors(processingControl, acq);
+         if (!PacketIndex::selected(entry, selection))
+         {
+            if (entry.acquisitions > 0) {
+               Profiler::instance().count(PROFILE_PACKETS_UNSELECTED);
+            }
+            continue;
+         }
 
-            // Set first acquisition flag
-            if (idx.kspace_encode_step_1 == 0)
-               acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
+         job.frame     = thisPacket;
+         job.viewID    = entry.view;
+         job.viewSkip  = entry.viewSkip;
+         job.views     = entry.acquisitions;
+         job.repetition = entry.repetition;
+         job.sliceID   = entry.slice;
+         job.echo      = entry.echo;
+         job.dataIndex = entry.dataIndex;
+         job.timeStamp = clock.stamp(excitation);
+
+         job.next.packets        = packetCount;
+         job.next.dataIndex      = indexed ? entry.dataIndex + entry.acquisitions : dataIndex;
+         job.next.excitations    = excitations;
+         job.next.viewsPerPacket = viewsPerPacket;
+         return true;
+      }
 
-            // Set last acquisition flag
-            if (idx.kspace_encode_step_1 == nPhases - 1)
-               acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+      if (indexing) {
+         index->finish();
+      }
+      return false;
+   };
 
-            if (processingControl->Value<bool>("ChopY") == 0) {
-               if (idx.kspace_encode_step_1 % 2 == 1) {
-                  kData *= -1.0f;
-               }
-            }
+   // Transform: decodes a GERecon::Acquisition::ImageFrame and builds all of
+   // its acquisitions from the one decoded block.  Runs on the worker threads,
+   // so it may only touch the job.
+   auto transformPacket = [&](ArchivePacketJob &job)
+   {
+      // Data() may read the samples from the archive, see Hdf5Lock.h
+      std::unique_lock<std::mutex> hdf5Lock(hdf5Mutex());
+      ScopedTimer decodeTimer(PROFILE_DECODE);
+      auto kData = job.frame->Data();
+      decodeTimer.stop();
+      hdf5Lock.unlock();
+
+      // kData is laid out as (sample, channel, view in the packet).  The line
+      // count was learnt from the first packet; a packet with more or fewer
+      // lines in the encoded range would lose some or overrun.
+      int const packetLines = std::min(static_cast<int>(kData.extent(2)), linesInRange(job.viewID, job.viewSkip));
+      if (packetLines != static_cast<int>(job.views)) {
+         std::ostringstream message;
+         message << "ScanArchive packet of view " << job.viewID << " carries " << packetLines
+                 << " lines, " << job.views << " expected: packets of varying size are not supported";
+         throw std::runtime_error(message.str());
+      }
 
-            for (int channelID = 0 ; channelID < nChannels ; channelID++)
-            {
-               for (int i = 0 ; i < frame_size ; i++)
-               {
-                  // The last dimension here in kData denotes the view
-                  // index in the control packet that one must stride
-                  // through to get data.  TODO - figure out if this
-                  // can be programatically determined, and if so, use
-                  // it. Will be needed for cases where multiple lines
-                  // of data are contained in a single packet.
-		  acq.data(i, channelID) = kData(i, channelID, 0);
-               }
-            }
+      job.acqs.resize(job.views);
+      std::vector<complex_float_t*> lines(job.views);
+      const ISMRMRD::AcquisitionHeader& head = headerTemplates.at(job.sliceID * nEchoes + job.echo);
+
+      for (unsigned int view = 0 ; view < job.views ; view++)
+      {
+         ISMRMRD::Acquisition &acq = job.acqs[view];
+         unsigned int const viewID = job.viewID + view * job.viewSkip;
+
+         // Sizes, channels and geometry come with the template
+         acq.setHead(head);
+
+         ISMRMRD::EncodingCounters &idx = acq.idx();
+         idx.kspace_encode_step_1   = viewID - 1;
+         idx.repetition             = job.repetition;
+
+         // acq.measurement_uid() = pfile->RunNumber();
+         acq.scan_counter() = job.dataIndex + view;
+         acq.acquisition_time_stamp() = job.timeStamp;
 
-            dataIndex++;
+         // Set first acquisition flag
+         if (idx.kspace_encode_step_1 == 0)
+            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
+
+         // Set last acquisition flag
+         if (idx.kspace_encode_step_1 == nPhases - 1)
+            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+
+         lines[view] = acq.getDataPtr();
+      }
+
+      ScopedTimer copyTimer(PROFILE_COPY);
+
+      ViewSource source;
+      source.data          = &kData(0, 0, 0);
+      source.sampleStride  = kData.stride(0);
+      source.channelStride = kData.stride(1);
+      source.viewStride    = kData.stride(2);
+      source.samples       = frame_size;
+      source.channels      = channels.data();
+      source.channelCount  = nOutChannels;
+
+      if (job.viewSkip == 1)
+      {
+         // Consecutive lines: the whole packet in one pass
+         source.views     = job.views;
+         source.firstLine = job.viewID - 1;
+         copyLines(source, lines.data());
+      }
+      else
+      {
+         // The chop parity of interleaved lines does not follow the packet order
+         source.views = 1;
+         for (unsigned int view = 0 ; view < job.views ; view++)
+         {
+            source.data      = &kData(0, 0, view);
+            source.firstLine = job.acqs[view].idx().kspace_encode_step_1;
+            copyLines(source, &lines[view]);
          }
       }
+      copyTimer.stop();
+      Profiler::instance().count(PROFILE_BYTES_COPIED, job.views * nOutChannels * frame_size * sizeof(complex_float_t));
 
-      packetCount++;
-   }
+      // Release the packet as soon as it has been copied
+      job.frame.reset();
+   };
+
+   // Writer: hands the acquisitions to the sink in scan_counter order
+   auto writePacket = [&](ArchivePacketJob &job)
+   {
+      for (size_t n = 0; n < job.acqs.size(); n++) {
+         sink.append(job.acqs[n]);
+      }
+      Profiler::instance().count(PROFILE_ACQUISITIONS_EMITTED, job.acqs.size());
+      if (checkpoint != NULL) {
+         checkpoint->packetWritten(job.next);
+      }
+   };
+
+   // A packet holds its acquisitions, and the decoded packet of every channel while transformed
+   auto packetBytes = [&](const ArchivePacketJob &job) -> uint64_t
+   {
+      return uint64_t(job.views) * frame_size * (nOutChannels + nChannels) * sizeof(complex_float_t);
+   };
 
-   return acqs;
+   std::shared_ptr<ThreadPool> pool = conversionPool();
+   PacketPipeline<ArchivePacketJob> pipeline(pool.get(), options_.queueDepth);
+   pipeline.limitMemory(options_.maxMemoryBytes, packetBytes);
+   pipeline.run(readPacket, transformPacket, writePacket);
+   Profiler::instance().peak(PROFILE_PEAK_BYTES_IN_FLIGHT, pipeline.peakBytes());
 }
 
 
 
-int GenericConverter::setISMRMRDSliceVectors(GERecon::Control::ProcessingControlPointer processingControl,
+int GenericConverter::setISMRMRDSliceVectors(const geRawDataSliceGeometry_t& geometry,
                                              ISMRMRD::Acquisition& acq)
 {
-   static geRawDataSliceVectors_t sliceVectors;
+   ScopedTimer geometryTimer(PROFILE_GEOMETRY);
+   const geRawDataSliceVectors_t& sliceVectors = geometry.at(acq.idx().slice);
 
    // Patient table off-center
    // TODO: fix the patient table position
@@ -297,8 +562,6 @@ int GenericConverter::setISMRMRDSliceVectors(GERecon::Control::ProcessingControl
    acq.patient_table_position()[1] = 0.0;
    acq.patient_table_position()[2] = 0.0;
 
-   getSliceVectors(processingControl, acq.idx().slice, &sliceVectors);
-
    acq.read_dir()[0]  = sliceVectors.read_dir.x;
    acq.read_dir()[1]  = sliceVectors.read_dir.y;
    acq.read_dir()[2]  = sliceVectors.read_dir.z;
@@ -317,14 +580,115 @@ int GenericConverter::setISMRMRDSliceVectors(GERecon::Control::ProcessingControl
 
 
 
+/**
+ * Computes the slice vectors of every slice in the scan
+ *
+ * Geometry is identical for every line of a slice, so it is computed once
+ * per scan: the slice table and patient orientation are read once, and the
+ * returned table is shared by all acquisitions (and threads) of a conversion.
+ *
+ * @param params Scan parameters holding the slice table and patient orientation
+ * @returns slice vectors indexed by geometric slice number
+ */
+geRawDataSliceGeometry_t GenericConverter::buildSliceGeometry(const ScanParameters &params)
+{
+   ScopedTimer geometryTimer(PROFILE_GEOMETRY);
+   geRawDataSliceGeometry_t geometry(params.numSlices);
+
+   for (unsigned int sliceNumber = 0 ; sliceNumber < params.numSlices ; sliceNumber++)
+   {
+      getSliceVectors(params.sliceTable, params.patientEntry, params.patientPosition,
+                      sliceNumber, &geometry[sliceNumber]);
+   }
+
+   return geometry;
+}
+
+
+
+/**
+ * Builds the header fields shared by every line of each slice and echo
+ *
+ * Lines copy their template with setHead() and only fill in their encoding
+ * step, repetition, scan counter, time stamp and flags.
+ *
+ * @param params Scan parameters, for the slice and echo counts and receiver channels
+ * @param geometry Slice vectors from buildSliceGeometry()
+ * @param samples Samples per line and channel
+ * @param channels Receiver channels written, in output order
+ * @returns headers indexed by slice * numEchoes + echo
+ */
+std::vector<ISMRMRD::AcquisitionHeader> GenericConverter::buildHeaderTemplates(const ScanParameters &params,
+                                                                               const geRawDataSliceGeometry_t& geometry,
+                                                                               size_t samples,
+                                                                               const std::vector<unsigned int>& channels)
+{
+   ScopedTimer geometryTimer(PROFILE_GEOMETRY);
+
+   // The counters, user fields and physiology stamps start out zeroed
+   ISMRMRD::AcquisitionHeader head;
+   head.number_of_samples      = samples;
+   head.available_channels     = params.numChannels;
+   head.active_channels        = channels.size();
+   head.center_sample          = samples/2;
+   // head.sample_time_us         = pfile->sample_time * 1e6;
+   for (size_t n = 0 ; n < channels.size() ; n++) {
+      head.setChannelActive(channels[n]);
+   }
+
+   std::vector<ISMRMRD::AcquisitionHeader> templates(geometry.size() * params.numEchoes, head);
+   for (unsigned int slice = 0 ; slice < geometry.size() ; slice++)
+   {
+      const geRawDataSliceVectors_t& sliceVectors = geometry[slice];
+
+      for (unsigned int echo = 0 ; echo < params.numEchoes ; echo++)
+      {
+         ISMRMRD::AcquisitionHeader& t = templates[slice * params.numEchoes + echo];
+         t.idx.slice    = slice;
+         t.idx.contrast = echo;
+
+         // The patient table position is left at 0
+         // TODO: fix the patient table position
+         t.read_dir[0]  = sliceVectors.read_dir.x;
+         t.read_dir[1]  = sliceVectors.read_dir.y;
+         t.read_dir[2]  = sliceVectors.read_dir.z;
+         t.phase_dir[0] = sliceVectors.phase_dir.x;
+         t.phase_dir[1] = sliceVectors.phase_dir.y;
+         t.phase_dir[2] = sliceVectors.phase_dir.z;
+         t.slice_dir[0] = sliceVectors.slice_dir.x;
+         t.slice_dir[1] = sliceVectors.slice_dir.y;
+         t.slice_dir[2] = sliceVectors.slice_dir.z;
+         t.position[0]  = sliceVectors.center.x;
+         t.position[1]  = sliceVectors.center.y;
+         t.position[2]  = sliceVectors.center.z;
+      }
+   }
+
+   return templates;
+}
+
+
+
 int GenericConverter::getSliceVectors(GERecon::Control::ProcessingControlPointer processingControl,
                                       unsigned int sliceNumber, geRawDataSliceVectors_t* vecs)
+{
+   const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
+
+   return getSliceVectors(sliceTable,
+                          processingControl->Value<int>("PatientEntry"),
+                          processingControl->Value<int>("PatientPosition"),
+                          sliceNumber, vecs);
+}
+
+
+
+int GenericConverter::getSliceVectors(const GERecon::SliceInfoTable& sliceTable,
+                                      int patientEntry, int patientPosition,
+                                      unsigned int sliceNumber, geRawDataSliceVectors_t* vecs)
 {
    float gwp1[3],   gwp2[3],   gwp3[3];
    float gwp1_0[3], gwp2_0[3], gwp3_0[3];
 
-   const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
-
    // const GERecon::ImageCorners imageCorners = GERecon::ImageCorners(sliceTable.AcquiredSliceCorners(sliceNumber),
                                                                     // sliceTable.SliceOrientation(sliceNumber));
 
@@ -362,37 +726,34 @@ int GenericConverter::getSliceVectors(GERecon::Control::ProcessingControlPointer
 
     */
 
-   int patientEntry, patientPosition;
-
-   // std::cout << "Patient entry: "    << processingControl->Value<int>("PatientEntry")    << std::endl;
-   // std::cout << "Patient position: " << processingControl->Value<int>("PatientPosition") << std::endl;
+   int entry, position;
 
-   switch (processingControl->Value<int>("PatientEntry"))
+   switch (patientEntry)
    {
       case 2 :
-         patientEntry = 1;      /* Feet first */
+         entry = 1;      /* Feet first */
          break;
 
       default :
-         patientEntry = 0;      /* Head first */
+         entry = 0;      /* Head first */
    }
 
-   switch (processingControl->Value<int>("PatientPosition"))
+   switch (patientPosition)
    {
       case 2 :
-         patientPosition = 1;   /* Prone */
+         position = 1;   /* Prone */
          break;
 
       case 4 :
-         patientPosition = 2;   /* Left Decubitus */
+         position = 2;   /* Left Decubitus */
          break;
 
       case 8 :
-         patientPosition = 3;   /* Right Decubitus */
+         position = 3;   /* Right Decubitus */
          break;
 
       default :
-         patientPosition = 0;   /* Supine */
+         position = 0;   /* Supine */
    }
 
    gwp1_0[0] = sliceCorners.UpperLeft().X_mm();
@@ -409,9 +770,9 @@ int GenericConverter::getSliceVectors(GERecon::Control::ProcessingControlPointer
 
    // rotate each coordinate according to the patient's position
    // this also puts the coordinates into DICOM/patient coordinate space
-   rotateVectorOnPatient(patientEntry, patientPosition, gwp1_0, gwp1);
-   rotateVectorOnPatient(patientEntry, patientPosition, gwp2_0, gwp2);
-   rotateVectorOnPatient(patientEntry, patientPosition, gwp3_0, gwp3);
+   rotateVectorOnPatient(entry, position, gwp1_0, gwp1);
+   rotateVectorOnPatient(entry, position, gwp2_0, gwp2);
+   rotateVectorOnPatient(entry, position, gwp3_0, gwp3);
 
    // // Add the Z table offset back to each coordinate
    // // table_offset_z = image_hdr->ctr_S - (gwp3[2] + gwp2[2]) / 2;
@@ -462,16 +823,16 @@ int GenericConverter::rotateVectorOnPatient(unsigned int entry, unsigned int pos
       return -1;
    }
 
-   float rot_hfs[3][3] = {{-1, 0, 0}, {0, -1, 0}, {0, 0, 1}};
-   float rot_hfp[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
-   float rot_hfdl[3][3] = {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}};
-   float rot_hfdr[3][3] = {{0, 1, 0}, {-1, 0, 0}, {0, 0, 1}};
-   float rot_ffs[3][3] = {{1, 0, 0}, {0, -1, 0}, {0, 0, -1}};
-   float rot_ffp[3][3] = {{-1, 0, 0}, {0, 1, 0}, {0, 0, -1}};
-   float rot_ffdl[3][3] = {{0, -1, 0}, {-1, 0, 0}, {0, 0, -1}};
-   float rot_ffdr[3][3] = {{0, 1, 0}, {1, 0, 0}, {0, 0, -1}};
+   static const float rot_hfs[3][3] = {{-1, 0, 0}, {0, -1, 0}, {0, 0, 1}};
+   static const float rot_hfp[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+   static const float rot_hfdl[3][3] = {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}};
+   static const float rot_hfdr[3][3] = {{0, 1, 0}, {-1, 0, 0}, {0, 0, 1}};
+   static const float rot_ffs[3][3] = {{1, 0, 0}, {0, -1, 0}, {0, 0, -1}};
+   static const float rot_ffp[3][3] = {{-1, 0, 0}, {0, 1, 0}, {0, 0, -1}};
+   static const float rot_ffdl[3][3] = {{0, -1, 0}, {-1, 0, 0}, {0, 0, -1}};
+   static const float rot_ffdr[3][3] = {{0, 1, 0}, {1, 0, 0}, {0, 0, -1}};
 
-   typedef float (*rot_mat_type)[3];
+   typedef const float (*rot_mat_type)[3];
    rot_mat_type patient_rotations[2][4] = {
       { rot_hfs, rot_hfp, rot_hfdl, rot_hfdr },
       { rot_ffs, rot_ffp, rot_ffdl, rot_ffdr }
@@ -22,21 +22,64 @@ struct geRawDataSliceVectors {
 };
 typedef struct geRawDataSliceVectors geRawDataSliceVectors_t;
 
+/** Slice vectors of every slice in a scan, indexed by geometric slice number */
+typedef std::vector<geRawDataSliceVectors_t> geRawDataSliceGeometry_t;
+
 namespace GEToIsmrmrd {
 
+/** One ScanArchive image packet on its way through the conversion pipeline */
+struct ArchivePacketJob
+{
+    ArchivePacketJob()
+        : sliceID(0), viewID(0), viewSkip(1), views(1), echo(0), repetition(0), dataIndex(0), timeStamp(0) { }
+
+    GERecon::Acquisition::FrameControlPointer frame;  /**< Packet read from the archive */
+    unsigned int sliceID;                             /**< Geometric slice number */
+    unsigned int viewID;                              /**< First view number in the packet */
+    int          viewSkip;                            /**< View increment, negative when flipped in Y */
+    unsigned int views;                               /**< Lines converted from the packet */
+    unsigned int echo;                                /**< Echo number */
+    unsigned int repetition;                          /**< Repetition number */
+    int          dataIndex;                           /**< scan_counter of the first acquisition */
+    uint32_t     timeStamp;                           /**< acquisition_time_stamp of the packet's excitation */
+    ReaderPosition next;                              /**< Reader after the packet, for the checkpoint */
+    std::vector<ISMRMRD::Acquisition> acqs;           /**< Acquisitions built from the packet */
+};
+
+/** One slice / echo block of a P-file on its way through the conversion pipeline */
+struct PfileBlockJob
+{
+    PfileBlockJob() : slice(0), echo(0), scanCounter(0) { }
+
+    unsigned int slice;                               /**< Geometric slice number */
+    unsigned int echo;                                /**< Echo number */
+    unsigned int scanCounter;                         /**< scan_counter of the first line of the block */
+    std::vector<ISMRMRD::Acquisition> acqs;           /**< Phase lines of the block */
+};
+
 class GenericConverter: public SequenceConverter
 {
 public:
-    std::vector<ISMRMRD::Acquisition> getAcquisitions (GERecon::Legacy::PfilePointer &pfile,
-                                                       unsigned int view_num);
+    void                                      convert (GERecon::Legacy::PfilePointer &pfile,
+                                                       const ScanParameters &params, AcquisitionSink &sink);
+
+    void                                      convert (GERecon::ScanArchivePointer &scanArchivePtr,
+                                                       const ScanParameters &params, AcquisitionSink &sink);
 
-    std::vector<ISMRMRD::Acquisition> getAcquisitions (GERecon::ScanArchivePointer &scanArchivePtr,
-                                                       unsigned int view_num);
+    /** ScanArchive conversions resume from a checkpoint */
+    bool                                    resumable () const { return true; }
 
 
-    int                        setISMRMRDSliceVectors (GERecon::Control::ProcessingControlPointer processingControl,
+    int                        setISMRMRDSliceVectors (const geRawDataSliceGeometry_t& geometry,
                                                        ISMRMRD::Acquisition& acq);
 
+    geRawDataSliceGeometry_t        buildSliceGeometry (const ScanParameters &params);
+
+    std::vector<ISMRMRD::AcquisitionHeader> buildHeaderTemplates (const ScanParameters &params,
+                                                                   const geRawDataSliceGeometry_t& geometry,
+                                                                   size_t samples,
+                                                                   const std::vector<unsigned int>& channels);
+
     int                               getSliceVectors (GERecon::Control::ProcessingControlPointer processingControl,
                                                        unsigned int sliceNumber, geRawDataSliceVectors_t* vecs);
 
@@ -47,7 +90,11 @@ public:
                                                        float read_dir[3], float phase_dir[3], float slice_dir[3]);
 
 protected:
-    int                                  get_view_idx (GERecon::Control::ProcessingControlPointer processingControl,
+    int                               getSliceVectors (const GERecon::SliceInfoTable& sliceTable,
+                                                       int patientEntry, int patientPosition,
+                                                       unsigned int sliceNumber, geRawDataSliceVectors_t* vecs);
+
+    int                                  get_view_idx (const ScanParameters &params,
                                                        unsigned int view_num, ISMRMRD::EncodingCounters &idx);
 };
 
@@ -0,0 +1,12 @@
+/** @file Hdf5Lock.cpp */
+#include "Hdf5Lock.h"
+
+namespace GEToIsmrmrd {
+
+std::mutex& hdf5Mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+} // namespace GEToIsmrmrd
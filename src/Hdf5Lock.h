@@ -0,0 +1,27 @@
+/** @file Hdf5Lock.h */
+#ifndef HDF5_LOCK_H
+#define HDF5_LOCK_H
+
+#include <mutex>
+
+namespace GEToIsmrmrd {
+
+/**
+ * Mutex serialising the HDF5 calls of the process
+ *
+ * libhdf5 is usually built without thread safety, and ScanArchives are read
+ * by the Orchestra SDK through the same library that writes the ISMRMRD
+ * output.  So the ISMRMRD and HDF5 calls of the writers and readers hold
+ * this mutex, and so do the SDK calls reading the archive file: opening it
+ * (ArchiveStorage::Create(), LoadSavedFiles()) and NextFrameControl(), made
+ * by the single reader thread of a conversion.  FrameControl::Data() holds
+ * it too: the SDK does not document whether it decodes a packet already in
+ * memory or reads its samples from the archive then, so the decoding of the
+ * workers is serialised with the reads and writes.  Only the copies,
+ * geometry and encoding of the packets after Data() run in parallel.
+ */
+std::mutex& hdf5Mutex();
+
+} // namespace GEToIsmrmrd
+
+#endif /* HDF5_LOCK_H */
@@ -3,3 +3,4 @@
 
 #include "2dfastConverter.h"
 
+SEQUENCE_CONVERTER_FACTORY_DECLARE(NIH2dfastConverter)
@@ -1,46 +1,128 @@
 
 /** @file NIHepiConverter.cpp */
 
+#include <stdexcept>
+
 #include "epiConverter.h"
+#include "AcquisitionClock.h"
+#include "Hdf5Lock.h"
+#include "PacketPipeline.h"
+#include "Profiler.h"
+#include "ViewLayout.h"
 
+namespace {
 
-std::vector<ISMRMRD::Acquisition> NIHepiConverter::getAcquisitions(GERecon::Legacy::PfilePointer &pfile,
-                                                                   unsigned int acqMode)
+/** EPI packet job - carries the row flip state of its pipeline slot */
+struct EpiPacketJob : public GEToIsmrmrd::ArchivePacketJob
+{
+   boost::shared_ptr<RowFlipPlugin> rowFlipPlugin;
+};
+
+/**
+ * Per-view effect of RowFlipPlugin::ApplyImageDataRowFlip
+ *
+ * Learnt once per scan, so that packets can be row flipped while being
+ * copied into the acquisitions instead of through an intermediate cube.
+ */
+struct RowFlipTable
+{
+   RowFlipTable() : valid(false) { }
+
+   bool               valid;    // false if the flip is not a per-view reversal and/or negation
+   std::vector<char>  reverse;  // view is reversed along x
+   std::vector<char>  negate;   // view changes sign
+};
+
+/**
+ * Flips a probe matrix of distinct samples and records, for every view,
+ * whether the plugin reversed and/or negated it.
+ *
+ * @param plugin Row flip plugin of the scan
+ * @param xRes Samples per view
+ * @param nViews Views per packet
+ */
+RowFlipTable calibrateRowFlip(RowFlipPlugin &plugin, int xRes, int nViews)
 {
-   std::cerr << "Currently, conversion of EPI P-files is __NOT__ supported." << std::endl;
+   ComplexFloatMatrix probe(xRes, nViews);
+   for (int view = 0; view < nViews; view++) {
+      for (int x = 0; x < xRes; x++) {
+         probe(x, view) = std::complex<float>(x + 1, view + 1);
+      }
+   }
+
+   plugin.ApplyImageDataRowFlip(probe);
+
+   RowFlipTable table;
+   table.reverse.resize(nViews);
+   table.negate.resize(nViews);
+
+   for (int view = 0; view < nViews; view++)
+   {
+      bool same = true, negated = true, reversed = true, reversedNegated = true;
+      for (int x = 0; x < xRes; x++) {
+         std::complex<float> const forward(x + 1, view + 1);
+         std::complex<float> const backward(xRes - x, view + 1);
+         same            &= (probe(x, view) == forward);
+         negated         &= (probe(x, view) == -forward);
+         reversed        &= (probe(x, view) == backward);
+         reversedNegated &= (probe(x, view) == -backward);
+      }
 
-   exit (EXIT_FAILURE);
+      if (!(same || negated || reversed || reversedNegated)) {
+         return RowFlipTable();
+      }
+      table.reverse[view] = !(same || negated);
+      table.negate[view]  = (negated || reversedNegated);
+   }
+
+   table.valid = true;
+   return table;
+}
+
+} // namespace
+
+
+void NIHepiConverter::convert(GERecon::Legacy::PfilePointer &pfile, const GEToIsmrmrd::ScanParameters &params,
+                              GEToIsmrmrd::AcquisitionSink &sink)
+{
+   throw std::runtime_error("Currently, conversion of EPI P-files is not supported");
 }
 
 
 
-std::vector<ISMRMRD::Acquisition> NIHepiConverter::getAcquisitions(GERecon::ScanArchivePointer &scanArchivePtr,
-                                                                   unsigned int acqMode)
+void NIHepiConverter::convert(GERecon::ScanArchivePointer &scanArchivePtr, const GEToIsmrmrd::ScanParameters &params,
+                              GEToIsmrmrd::AcquisitionSink &sink)
 {
    std::cerr << "Using NIHepi ScanArchive converter." << std::endl;
 
+   // The archive is read through libhdf5, which other threads may be using
+   std::unique_lock<std::mutex> hdf5Lock(GEToIsmrmrd::hdf5Mutex());
+   GEToIsmrmrd::ScopedTimer orchestraTimer(GEToIsmrmrd::PROFILE_ORCHESTRA);
+
    GERecon::Acquisition::ArchiveStoragePointer archiveStoragePointer    = GERecon::Acquisition::ArchiveStorage::Create(scanArchivePtr);
    GERecon::Legacy::LxDownloadDataPointer lxData                        = boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(scanArchivePtr->LoadDownloadData());
    boost::shared_ptr<GERecon::Epi::LxControlSource> const controlSource = boost::make_shared<GERecon::Epi::LxControlSource>(lxData);
+   // Only needed to set up the row flip plugin - per-line values come from params
    GERecon::Control::ProcessingControlPointer processingControl         = controlSource->CreateOrchestraProcessingControl();
 
    scanArchivePtr->LoadSavedFiles();
 
    int const    packetQuantity = archiveStoragePointer->AvailableControlCount();
-
-   int                 acqType = 0;
-   unsigned int        nEchoes = processingControl->Value<int>("NumEchoes");
-   unsigned int      nChannels = processingControl->Value<int>("NumChannels");
-   unsigned int      numSlices = processingControl->Value<int>("NumSlices");
-   size_t           frame_size = processingControl->Value<int>("AcquiredXRes");
-   int const          topViews = processingControl->Value<int>("ExtraFramesTop");
-   int const              yAcq = processingControl->Value<int>("AcquiredYRes");
-   int const       bottomViews = processingControl->Value<int>("ExtraFramesBottom");
+   orchestraTimer.stop();
+   hdf5Lock.unlock();
+
+   unsigned int        nEchoes = params.numEchoes;
+   unsigned int      nChannels = params.numChannels;
+   unsigned int      numSlices = params.numSlices;
+   size_t           frame_size = params.epi.acquiredXRes;
+   int const          topViews = params.epi.extraFramesTop;
+   int const              yAcq = params.epi.acquiredYRes;
+   int const       bottomViews = params.epi.extraFramesBottom;
    // unsigned int     nRefViews = processingControl->Value<int>("NumRefViews"); // Variable not found at run time
    unsigned int      nRefViews = topViews + bottomViews;
 
-   bool isEpiRefScanIntegrated = processingControl->Value<bool>("IntegratedReferenceScan");
-   bool     isMultiBandEnabled = processingControl->Value<bool>("MultibandEnabled");
+   bool isEpiRefScanIntegrated = params.epi.isEpiRefScanIntegrated;
+   bool     isMultiBandEnabled = params.epi.multibandEnabled;
  
    // Commented out for now, as these don't seem to hold necessary values for EPI.
    // int                nVolumes = processingControl->Value<int>("NumAcquisitions");
@@ -48,10 +130,6 @@ std::vector<ISMRMRD::Acquisition> NIHepiConverter::getAcquisitions(GERecon::Scan
    // float         acqSampleTime = processingControl->Value<float>("A2DSampleTime"); // does not exist in the Epi::LxControlSource object
 
    const RowFlipParametersPointer rowFlipper = boost::make_shared<RowFlipParameters>(yAcq + nRefViews);
-   RowFlipPlugin rowFlipPlugin(rowFlipper, *processingControl);
-
-   int dataIndex = 0;
-   std::vector<ISMRMRD::Acquisition> acqs;
 
    Range refViewsRange;
    int   refViewsStart, refViewsEnd;
@@ -79,136 +157,314 @@ std::vector<ISMRMRD::Acquisition> NIHepiConverter::getAcquisitions(GERecon::Scan
       std::cout << "yAcq: " << yAcq << ", topViews: " << topViews << ", bottomViews: " << bottomViews << std::endl;
    }
 
-   for (int packetCount=0; packetCount < packetQuantity; packetCount++)
+   const geRawDataSliceGeometry_t sliceGeometry = buildSliceGeometry(params);
+   const GERecon::SliceInfoTable&    sliceTable = params.sliceTable;
+
+   // Each volume holds one control packet plus one packet of (reference + image)
+   // views per slice - see the num_volumes calculation in GERawConverter.
+   int const       totalViews = topViews + yAcq + bottomViews;
+   int const       numVolumes = packetQuantity / (numSlices + 1);
+
+   const GEToIsmrmrd::AcquisitionSelection& selection = options_.selection;
+   const std::vector<unsigned int> channels = selection.channels.indices(nChannels);
+   unsigned int const nOutChannels = channels.size();
+
+   const std::vector<ISMRMRD::AcquisitionHeader> headerTemplates =
+      buildHeaderTemplates(params, sliceGeometry, frame_size, channels);
+
+   // Every EPI shot is one excitation - one packet per slice and volume -
+   // whose views share its time stamp
+   const GEToIsmrmrd::AcquisitionClock clock(params);
+   uint64_t excitations = 0;
+
+   // Packets are skipped through a usable index, else it is rebuilt while reading
+   GEToIsmrmrd::PacketIndex* const index = packetIndex_.get();
+   GEToIsmrmrd::ArchivePrefetcher* const prefetcher = prefetcher_.get();
+   bool const indexed  = (index != NULL) && index->usable("epi", packetQuantity);
+   bool const indexing = (index != NULL) && !indexed;
+   if (indexing) {
+      index->begin("epi", packetQuantity);
+   }
+   int const lastPacket = indexed ? index->end(selection) : packetQuantity;
+
+   sink.reserve(indexed ? index->acquisitionCount(selection) : (packetQuantity - numVolumes) * totalViews);
+
+   // Row flip, RF unchop and the Y flip reduce to a per-view reversal and
+   // sign, applied while copying each view straight into its acquisition.
+   RowFlipTable rowFlipTable;
    {
-      GERecon::Acquisition::FrameControlPointer const thisPacket = archiveStoragePointer->NextFrameControl();
+      RowFlipPlugin calibrationPlugin(rowFlipper, *processingControl);
+      rowFlipTable = calibrateRowFlip(calibrationPlugin, frame_size, totalViews);
+   }
+   if (!rowFlipTable.valid) {
+      std::cerr << "Row flip is not a per-view reversal; using the cube based EPI transform." << std::endl;
+   }
 
-      // Need to identify opcode(s) here that will mark acquisition / reference / control
-      if (thisPacket->Control().Opcode() != GERecon::Acquisition::ScanControlOpcode)
+   // RF unchop negates every other view, starting with the first.  The fused
+   // copy also applies the row flip, and the Y flip of packets with a negative
+   // view skip; the cube based transform has done both before copying.
+   GEToIsmrmrd::ViewCopyFunction const copyFused        = GEToIsmrmrd::selectViewCopy(
+      GEToIsmrmrd::SequenceLayout(GEToIsmrmrd::CHOP_EVEN_LINES, true, false));
+   GEToIsmrmrd::ViewCopyFunction const copyFusedFlipped = GEToIsmrmrd::selectViewCopy(
+      GEToIsmrmrd::SequenceLayout(GEToIsmrmrd::CHOP_EVEN_LINES, true, true));
+   GEToIsmrmrd::ViewCopyFunction const copyCube         = GEToIsmrmrd::selectViewCopy(
+      GEToIsmrmrd::SequenceLayout(GEToIsmrmrd::CHOP_EVEN_LINES, false, false));
+
+   int packetCount = 0;
+   int   dataIndex = 0;
+
+   // Reader: walks the control stream, skipping scan control packets and those
+   // outside the selection.  Views of one packet are re-sorted (reference views
+   // first) before being handed to the sink, so each job only holds a single
+   // packet's worth of acquisitions.
+   auto readPacket = [&](EpiPacketJob &job) -> bool
+   {
+      while (packetCount < lastPacket)
       {
-         // For EPI scans, packets are now HyperFrameControl type
-         GERecon::Acquisition::HyperFrameControlPacket const packetContents = thisPacket->Control().Packet().As<GERecon::Acquisition::HyperFrameControlPacket>();
+         GERecon::Acquisition::FrameControlPointer thisPacket;
+         {
+            std::lock_guard<std::mutex> lock(GEToIsmrmrd::hdf5Mutex());
+            GEToIsmrmrd::ScopedTimer orchestraTimer(GEToIsmrmrd::PROFILE_ORCHESTRA);
+            thisPacket = archiveStoragePointer->NextFrameControl();
+         }
+         int const packetNumber = packetCount++;
+         GEToIsmrmrd::Profiler::instance().count(GEToIsmrmrd::PROFILE_PACKETS_READ);
+         if (prefetcher != NULL) {
+            prefetcher->progress(packetCount, packetQuantity);
+         }
 
-         const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
+         GEToIsmrmrd::PacketIndexEntry entry;
+         if (indexed)
+         {
+            entry = (*index)[packetNumber];
+            if (entry.acquisitions > 0 && entry.echo == 0) {
+               excitations++;
+            }
+         }
+         else
+         {
+            entry.opcode = static_cast<int32_t>(thisPacket->Control().Opcode());
 
-         int viewSkip = static_cast<short>(Acquisition::GetPacketValue(packetContents.viewSkipH, packetContents.viewSkipL));
+            // Need to identify opcode(s) here that will mark acquisition / reference / control
+            if (thisPacket->Control().Opcode() == GERecon::Acquisition::ScanControlOpcode)
+            {
+               if (indexing) {
+                  index->add(entry);
+               }
+               continue;
+            }
 
-         acqType = GERecon::Acquisition::ImageFrame;
-         auto pktData = thisPacket->Data();
+            // For EPI scans, packets are now HyperFrameControl type
+            GERecon::Acquisition::HyperFrameControlPacket const packetContents = thisPacket->Control().Packet().As<GERecon::Acquisition::HyperFrameControlPacket>();
+
+            entry.viewSkip     = static_cast<short>(Acquisition::GetPacketValue(packetContents.viewSkipH, packetContents.viewSkipL));
+            entry.slice        = sliceTable.GeometricSliceNumber(GERecon::Acquisition::GetPacketValue(packetContents.sliceNumH,
+                                                                                                       packetContents.sliceNumL));
+            entry.echo         = packetContents.echoNum;
+            if (entry.echo == 0) {
+               excitations++;
+            }
+            entry.repetition   = dataIndex / (numSlices * totalViews);
+            entry.dataIndex    = dataIndex;
+            entry.acquisitions = totalViews;
+            dataIndex         += totalViews;
+            if (indexing) {
+               index->add(entry);
+            }
+         }
+
+         if (!GEToIsmrmrd::PacketIndex::selected(entry, selection))
+         {
+            if (entry.acquisitions > 0) {
+               GEToIsmrmrd::Profiler::instance().count(GEToIsmrmrd::PROFILE_PACKETS_UNSELECTED);
+            }
+            continue;
+         }
+
+         job.frame     = thisPacket;
+         job.viewSkip  = entry.viewSkip;
+         job.sliceID   = entry.slice;
+         job.echo      = entry.echo;
+         job.dataIndex = entry.dataIndex;
+         job.timeStamp = clock.stamp((excitations > 0) ? excitations - 1 : 0);
+
+         // The row flip plugin of the cube based transform keeps working buffers,
+         // so every pipeline slot gets its own.  Created here as the reader runs
+         // on a single thread.
+         if (job.acqs.empty()) {
+            job.rowFlipPlugin = boost::make_shared<RowFlipPlugin>(rowFlipper, *processingControl);
+            job.acqs.resize(totalViews);
+         }
+         return true;
+      }
+
+      if (indexing) {
+         index->finish();
+      }
+      return false;
+   };
+
+   // Transform: decodes the packet and builds its acquisitions.  Runs on the
+   // worker threads, so it may only touch the job.
+   auto transformPacket = [&](EpiPacketJob &job)
+   {
+      // Data() may read the samples from the archive, see Hdf5Lock.h
+      std::unique_lock<std::mutex> hdf5Lock(GEToIsmrmrd::hdf5Mutex());
+      GEToIsmrmrd::ScopedTimer decodeTimer(GEToIsmrmrd::PROFILE_DECODE);
+      auto pktData = job.frame->Data();
+      decodeTimer.stop();
+      hdf5Lock.unlock();
+
+      // The fused path reads straight from the packet, laid out as (x, channel, view)
+      bool const fused = rowFlipTable.valid && pktData.extent(0) == frame_size &&
+                         pktData.extent(1) == nChannels && pktData.extent(2) == totalViews;
+
+      ComplexFloatCube kData;
+      if (!fused)
+      {
+         GEToIsmrmrd::ScopedTimer copyTimer(GEToIsmrmrd::PROFILE_COPY);
 
          // Transpose the pktData - swapping channel (2) and phase (1) dimensions. This does not move data around in
          // memory - this just manipulates the strides.
          pktData.transposeSelf( 0, 2, 1 );
 
          // Flip Y dimension (for all x samples and all channels)
-         if (viewSkip < 0) {
+         if (job.viewSkip < 0) {
             pktData.reverseSelf(1);
             // std::cout << "Data was FLIPPED alonig y-axis using reverseSelf()\n";
          }
 
          // Copy (and sort) the packet data into a new array, kdata.
-         ComplexFloatCube kData( pktData.shape() );
+         kData.resize( pktData.shape() );
          kData = pktData;
 
-         // Do the row-flipping.
+         // Do the row-flipping of the selected channels.
          //
          // Note: Using ApplyImageDataRowFlip seems to work for all
          // rows (image and reference)
-         for (int channelID = 0 ; channelID < nChannels ; channelID++)
+         for (int n = 0 ; n < nOutChannels ; n++)
          {
-           ComplexFloatMatrix tempData = kData(Range::all(), Range::all(), channelID);
-           rowFlipPlugin.ApplyImageDataRowFlip(tempData);
+           ComplexFloatMatrix tempData = kData(Range::all(), Range::all(), channels[n]);
+           job.rowFlipPlugin->ApplyImageDataRowFlip(tempData);
          }
 
-         // Unchop RF-chopped data
-         kData(Range::all(), Range(fromStart, toEnd, 2), Range::all()) *= -1.0f;
+         // RF-chopped data is unchopped while copying the views out
+      }
 
-         // Copy data out of ScanArchive into ISMRMRD object
-         int totalViews = topViews + yAcq + bottomViews;
+      int ref_count = 0;
+      int pe1_index = 0;
 
-         // Pre-allocate memory for incoming views
-         acqs.resize(dataIndex + totalViews);
+      // Destination of every view of the packet, in packet order
+      std::vector<complex_float_t*> lines(totalViews);
+      const ISMRMRD::AcquisitionHeader& head = headerTemplates.at(job.sliceID * nEchoes + job.echo);
 
-         int ref_count = 0;
-         int pe1_index = 0;
+      for (int view = 0; view < totalViews; ++view)
+      {
+         // Figure out where to put this view (i.e. effectively
+         // re-sorting the views in the packet so that the reference
+         // data comes first.
 
-         for (int view = 0; view < totalViews; ++view)
-         {
-            // Figure out where to put this view (i.e. effectively
-            // re-sorting the views in the packet so that the reference
-            // data comes first.
+         int acq_index = 0;
 
-            int acq_index = 0;
+         if ((nRefViews > 0) && (view >= refViewsStart) && (view <= refViewsEnd)) {
+            // This view contains reference scan data
+            pe1_index = yAcq/2;
+            acq_index = ref_count++;
+         }
+         else {
+            // This view constains (k-space) image data
+            pe1_index = view - topViews;
+            acq_index = nRefViews + pe1_index;
+         }
 
-            if ((nRefViews > 0) && (view >= refViewsStart) && (view <= refViewsEnd)) {
-               // This view contains reference scan data
-               pe1_index = yAcq/2;
-               acq_index = dataIndex + ref_count++;
-            }
-            else {
-               // This view constains (k-space) image data
-               pe1_index = view - topViews;
-               acq_index = dataIndex + nRefViews + pe1_index;
-            }
+         // Grab a reference to the acquisition
+         ISMRMRD::Acquisition &acq = job.acqs.at(acq_index);
 
-            // Grab a reference to the acquisition
-            ISMRMRD::Acquisition &acq = acqs.at(acq_index);
+         // Sizes, channels and geometry come with the template
+         acq.setHead(head);
 
-            // Set size of this data frame to receive raw data
-            acq.resize(frame_size, nChannels, 0);
-            acq.clearAllFlags();
+         ISMRMRD::EncodingCounters &idx = acq.idx();
 
-            // Initialize the encoding counters for this acquisition.
-            ISMRMRD::EncodingCounters &idx = acq.idx();
+         idx.kspace_encode_step_1   = pe1_index;
+         idx.repetition             = (int) (job.dataIndex / (numSlices * totalViews));
 
-            idx.kspace_encode_step_1   = pe1_index;
-            idx.slice                  = sliceTable.GeometricSliceNumber(GERecon::Acquisition::GetPacketValue(packetContents.sliceNumH,
-                                                                                                              packetContents.sliceNumL));
-            idx.repetition             = (int) (dataIndex / (numSlices * totalViews));
-            idx.contrast               = packetContents.echoNum;
+         // acq.measurement_uid() = pfile->RunNumber();
+         acq.scan_counter()         = job.dataIndex + view;
+         acq.acquisition_time_stamp() = job.timeStamp;
 
-            // acq.measurement_uid() = pfile->RunNumber();
-            acq.scan_counter()         = dataIndex + view;
-            acq.acquisition_time_stamp() = time(NULL);
-            for (int p=0; p<ISMRMRD::ISMRMRD_PHYS_STAMPS; p++) {
-               acq.physiology_time_stamp()[p] = 0;
-            }
-            acq.available_channels()   = nChannels;
-            acq.center_sample()        = frame_size/2;
-            // acq.sample_time_us()       = pfile->sample_time * 1e6;
+         // Set first acquisition flag
+         if (view == 0)
+            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
 
-            // Set first acquisition flag
-            if (view == 0)
-               acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
+         // Set last acquisition flag
+         if (view == totalViews - 1)
+            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
 
-            // Set last acquisition flag
-            if (view == totalViews - 1)
-               acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+         // Label reference scan data
+         // if (view < topViews || view >= topViews + yAcq)
+         if ((nRefViews > 0) && (view >= refViewsStart) && (view <= refViewsEnd))
+         {
+            // std::cout << "Setting view: " << view << " as phase correction line." << std::endl;
 
-            // Label reference scan data
-            // if (view < topViews || view >= topViews + yAcq)
-            if ((nRefViews > 0) && (view >= refViewsStart) && (view <= refViewsEnd))
-            {
-               // std::cout << "Setting view: " << view << " as phase correction line." << std::endl;
+            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_IS_PHASECORR_DATA);
+         }
 
-               acq.setFlag(ISMRMRD::ISMRMRD_ACQ_IS_PHASECORR_DATA);
-            }
+         lines[view] = acq.getDataPtr();
+      }
 
-            // Copy view data to ISMRMRD Acq data packet
-            for (int channelID = 0 ; channelID < nChannels ; channelID++)
-            {
-               for (int x = 0 ; x < frame_size ; x++)
-               {
-                  acq.data(x, channelID) = kData(x, view, channelID);
-               }
-               acq.setChannelActive(channelID);
-            }
+      // Copy view data to ISMRMRD Acq data packets
+      GEToIsmrmrd::ScopedTimer copyTimer(GEToIsmrmrd::PROFILE_COPY);
+      GEToIsmrmrd::ViewSource source;
+      source.samples      = frame_size;
+      source.views        = totalViews;
+      source.channels     = channels.data();
+      source.channelCount = nOutChannels;
+      if (fused)
+      {
+         source.data          = &pktData(0, 0, 0);
+         source.sampleStride  = pktData.stride(0);
+         source.channelStride = pktData.stride(1);
+         source.viewStride    = pktData.stride(2);
+         source.reverse       = rowFlipTable.reverse.data();
+         source.negate        = rowFlipTable.negate.data();
+         (job.viewSkip < 0 ? copyFusedFlipped : copyFused)(source, lines.data());
+      }
+      else
+      {
+         source.data          = &kData(0, 0, 0);
+         source.sampleStride  = kData.stride(0);
+         source.channelStride = kData.stride(2);
+         source.viewStride    = kData.stride(1);
+         copyCube(source, lines.data());
+      }
+      copyTimer.stop();
+      GEToIsmrmrd::Profiler::instance().count(GEToIsmrmrd::PROFILE_BYTES_COPIED,
+                                              totalViews * nOutChannels * frame_size * sizeof(complex_float_t));
 
-            setISMRMRDSliceVectors(processingControl, acq);
-         }
-         dataIndex += totalViews;
+      // Release the packet as soon as it has been copied
+      job.frame.reset();
+   };
+
+   // Writer: hands the acquisitions to the sink in packet order
+   auto writePacket = [&](EpiPacketJob &job)
+   {
+      for (int n = 0; n < totalViews; ++n)
+      {
+         sink.append(job.acqs.at(n));
       }
-   }
-   return acqs;
+      GEToIsmrmrd::Profiler::instance().count(GEToIsmrmrd::PROFILE_ACQUISITIONS_EMITTED, totalViews);
+   };
+
+   // A packet holds its acquisitions, and the decoded packet while transformed -
+   // twice over, packet and cube, without the fused copy
+   uint64_t const packetBytes = uint64_t(totalViews) * frame_size *
+                                (nOutChannels + nChannels * (rowFlipTable.valid ? 1 : 2)) * sizeof(complex_float_t);
+
+   std::shared_ptr<GEToIsmrmrd::ThreadPool> pool = conversionPool();
+   GEToIsmrmrd::PacketPipeline<EpiPacketJob> pipeline(pool.get(), options_.queueDepth);
+   pipeline.limitMemory(options_.maxMemoryBytes, [packetBytes](const EpiPacketJob &) { return packetBytes; });
+   pipeline.run(readPacket, transformPacket, writePacket);
+   GEToIsmrmrd::Profiler::instance().peak(GEToIsmrmrd::PROFILE_PEAK_BYTES_IN_FLIGHT, pipeline.peakBytes());
 }
 
+SEQUENCE_CONVERTER_FACTORY_DECLARE(NIHepiConverter)
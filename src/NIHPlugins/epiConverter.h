@@ -11,11 +11,16 @@ class NIHepiConverter: public GEToIsmrmrd::GenericConverter
 {
 public:
 
-   std::vector<ISMRMRD::Acquisition> getAcquisitions (GERecon::Legacy::PfilePointer &pfile,
-                                                      unsigned int view_num);
+   void                                     convert (GERecon::Legacy::PfilePointer &pfile,
+                                                     const GEToIsmrmrd::ScanParameters &params,
+                                                     GEToIsmrmrd::AcquisitionSink &sink);
 
-   std::vector<ISMRMRD::Acquisition> getAcquisitions (GERecon::ScanArchivePointer &scanArchive,
-                                                      unsigned int view_num);
+   void                                     convert (GERecon::ScanArchivePointer &scanArchive,
+                                                     const GEToIsmrmrd::ScanParameters &params,
+                                                     GEToIsmrmrd::AcquisitionSink &sink);
+
+   /** The phase correction state of the reader is not checkpointed */
+   bool                                   resumable () const { return false; }
 };
 
 #endif /* NIH_EPI_CONVERTER_H */
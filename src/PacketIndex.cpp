@@ -0,0 +1,167 @@
+/** @file PacketIndex.cpp */
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+// Local
+#include "PacketIndex.h"
+#include "SidecarFile.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+// Sidecar layout, in host byte order:
+//   magic, version, layout length + layout, archive size, archive mtime (s, ns),
+//   packet count, then per packet the PacketIndexEntry fields in declaration order
+const char     SIDECAR_MAGIC[SIDECAR_MAGIC_LENGTH] = { 'G', '2', 'I', 'D', 'X', '\0', '\0', '\0' };
+const uint32_t SIDECAR_VERSION  = 1;
+
+/** Largest layout name read from a sidecar */
+const uint32_t MAX_LAYOUT_LENGTH = 256;
+
+/** Size and modification time identifying a version of the archive */
+struct ArchiveStamp
+{
+    uint64_t size;
+    int64_t  seconds;
+    int64_t  nanoseconds;
+};
+
+bool archiveStamp(const std::string& archivePath, ArchiveStamp& stamp)
+{
+    struct stat info;
+    if (stat(archivePath.c_str(), &info) != 0) {
+        return false;
+    }
+    stamp.size        = info.st_size;
+    stamp.seconds     = info.st_mtim.tv_sec;
+    stamp.nanoseconds = info.st_mtim.tv_nsec;
+    return true;
+}
+
+} // namespace
+
+void PacketIndex::begin(const std::string& layout, size_t packetCount)
+{
+    layout_ = layout;
+    entries_.clear();
+    entries_.reserve(packetCount);
+    expected_ = packetCount;
+    complete_ = false;
+    modified_ = true;
+}
+
+void PacketIndex::finish()
+{
+    complete_ = (entries_.size() == expected_);
+}
+
+size_t PacketIndex::acquisitionCount(const AcquisitionSelection& selection) const
+{
+    size_t count = 0;
+    for (size_t n = 0; n < entries_.size(); n++) {
+        if (selected(entries_[n], selection)) {
+            count += entries_[n].acquisitions;
+        }
+    }
+    return count;
+}
+
+size_t PacketIndex::end(const AcquisitionSelection& selection) const
+{
+    for (size_t n = entries_.size(); n > 0; n--) {
+        if (selected(entries_[n - 1], selection)) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+bool PacketIndex::load(const std::string& archivePath)
+{
+    layout_.clear();
+    entries_.clear();
+    expected_ = 0;
+    complete_ = false;
+    modified_ = false;
+
+    ArchiveStamp archive;
+    if (!archiveStamp(archivePath, archive)) {
+        return false;
+    }
+
+    std::ifstream in(sidecarPath(archivePath).c_str(), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    std::string layout;
+    ArchiveStamp stamp;
+    uint64_t count = 0;
+    if (!readSidecarHeader(in, SIDECAR_MAGIC, SIDECAR_VERSION) ||
+        !readSidecarString(in, layout, MAX_LAYOUT_LENGTH) ||
+        !readSidecarValue(in, stamp.size) || !readSidecarValue(in, stamp.seconds) || !readSidecarValue(in, stamp.nanoseconds) ||
+        !readSidecarValue(in, count)) {
+        return false;
+    }
+    if (stamp.size != archive.size || stamp.seconds != archive.seconds || stamp.nanoseconds != archive.nanoseconds) {
+        return false;
+    }
+
+    std::vector<PacketIndexEntry> entries;
+    entries.reserve(std::min<uint64_t>(count, 1 << 20));
+    for (uint64_t n = 0; n < count; n++) {
+        PacketIndexEntry entry;
+        if (!readSidecarValue(in, entry.opcode) || !readSidecarValue(in, entry.slice) || !readSidecarValue(in, entry.echo) ||
+            !readSidecarValue(in, entry.view) || !readSidecarValue(in, entry.repetition) || !readSidecarValue(in, entry.viewSkip) ||
+            !readSidecarValue(in, entry.dataIndex) || !readSidecarValue(in, entry.acquisitions)) {
+            return false;
+        }
+        entries.push_back(entry);
+    }
+
+    layout_ = layout;
+    entries_.swap(entries);
+    expected_ = entries_.size();
+    complete_ = true;
+    return true;
+}
+
+void PacketIndex::save(const std::string& archivePath)
+{
+    if (!complete_) {
+        throw std::runtime_error("Packet index of " + archivePath + " is incomplete");
+    }
+
+    ArchiveStamp archive;
+    if (!archiveStamp(archivePath, archive)) {
+        throw std::runtime_error("Failed to stat " + archivePath);
+    }
+
+    // Written aside and renamed, so a reader never sees a partial sidecar
+    saveSidecar(sidecarPath(archivePath), "packet index", [&](std::ostream& out) {
+        writeSidecarHeader(out, SIDECAR_MAGIC, SIDECAR_VERSION);
+        writeSidecarString(out, layout_);
+        writeSidecarValue(out, archive.size);
+        writeSidecarValue(out, archive.seconds);
+        writeSidecarValue(out, archive.nanoseconds);
+        writeSidecarValue(out, static_cast<uint64_t>(entries_.size()));
+        for (size_t n = 0; n < entries_.size(); n++) {
+            const PacketIndexEntry& entry = entries_[n];
+            writeSidecarValue(out, entry.opcode);
+            writeSidecarValue(out, entry.slice);
+            writeSidecarValue(out, entry.echo);
+            writeSidecarValue(out, entry.view);
+            writeSidecarValue(out, entry.repetition);
+            writeSidecarValue(out, entry.viewSkip);
+            writeSidecarValue(out, entry.dataIndex);
+            writeSidecarValue(out, entry.acquisitions);
+        }
+    });
+    modified_ = false;
+}
+
+} // namespace GEToIsmrmrd
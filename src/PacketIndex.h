@@ -0,0 +1,121 @@
+/** @file PacketIndex.h */
+#ifndef PACKET_INDEX_H
+#define PACKET_INDEX_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Local
+#include "AcquisitionSelection.h"
+
+namespace GEToIsmrmrd {
+
+/** What a sequence converter found in one ScanArchive control packet */
+struct PacketIndexEntry
+{
+    PacketIndexEntry()
+        : opcode(0), slice(0), echo(0), view(0), repetition(0), viewSkip(1), dataIndex(0), acquisitions(0) { }
+
+    int32_t  opcode;          /**< Control packet opcode */
+    uint32_t slice;           /**< Geometric slice number */
+    uint32_t echo;            /**< Echo number */
+    uint32_t view;            /**< First view number in the packet */
+    uint32_t repetition;      /**< Repetition of the acquisitions */
+    int32_t  viewSkip;        /**< View increment, negative when flipped in Y */
+    int64_t  dataIndex;       /**< scan_counter of the first acquisition */
+    uint32_t acquisitions;    /**< Acquisitions built from the packet; 0 if it is skipped */
+};
+
+/**
+ * Packet number to slice / echo / view / data offset map of a ScanArchive
+ *
+ * Orchestra only reads control packets in sequence, so finding the packets
+ * of a partial conversion means walking the whole control stream.  Sequence
+ * converters fill the index on their first pass; later conversions use it
+ * to reserve exactly the acquisitions produced, to skip unselected packets
+ * without parsing them and to stop after the last selected one.  While no
+ * usable() index exists, the converter parses every control packet and
+ * rebuilds the index as it reads.
+ *
+ * Entries are interpreted by the converter that built them, named by the
+ * layout.  The index is kept next to the archive in a sidecar file, which
+ * is ignored once the archive changes.
+ */
+class PacketIndex
+{
+public:
+    PacketIndex() : expected_(0), complete_(false), modified_(false) { }
+
+    /** Sidecar file of an archive */
+    static std::string sidecarPath(const std::string& archivePath) { return archivePath + ".g2idx"; }
+
+    /**
+     * Whether the index describes every packet of a conversion
+     *
+     * @param layout Converter specific interpretation of the entries
+     * @param packetCount AvailableControlCount() of the archive
+     */
+    bool usable(const std::string& layout, size_t packetCount) const
+    {
+        return complete_ && layout_ == layout && entries_.size() == packetCount;
+    }
+
+    /** Clears the index before a converter records packetCount packets */
+    void begin(const std::string& layout, size_t packetCount);
+
+    /** Records the next packet */
+    void add(const PacketIndexEntry& entry) { entries_.push_back(entry); }
+
+    /** Ends recording; the index is complete if every packet was recorded */
+    void finish();
+
+    /** Whether every packet of the archive was recorded */
+    bool complete() const { return complete_; }
+
+    const std::string& layout() const { return layout_; }
+    size_t size() const { return entries_.size(); }
+    const PacketIndexEntry& operator[](size_t packet) const { return entries_[packet]; }
+
+    /** Whether a packet carries acquisitions of the selection */
+    static bool selected(const PacketIndexEntry& entry, const AcquisitionSelection& selection)
+    {
+        return entry.acquisitions > 0 && selection.contains(entry.slice, entry.echo, entry.repetition);
+    }
+
+    /** Number of acquisitions built from the selected packets */
+    size_t acquisitionCount(const AcquisitionSelection& selection) const;
+
+    /** One past the last packet carrying acquisitions of the selection */
+    size_t end(const AcquisitionSelection& selection) const;
+
+    /** Whether the index was rebuilt since it was loaded */
+    bool modified() const { return modified_; }
+
+    /**
+     * Reads the sidecar of an archive
+     *
+     * @returns false, leaving the index empty, if there is no sidecar or it
+     *          was written for a different version of the archive
+     */
+    bool load(const std::string& archivePath);
+
+    /**
+     * Writes the sidecar of an archive, replacing an existing one
+     *
+     * @throws std::runtime_error if the index is incomplete or cannot be written
+     */
+    void save(const std::string& archivePath);
+
+private:
+    std::string layout_;
+    std::vector<PacketIndexEntry> entries_;
+    size_t expected_;
+    bool complete_;
+    bool modified_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* PACKET_INDEX_H */
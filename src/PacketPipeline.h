@@ -0,0 +1,278 @@
+/** @file PacketPipeline.h */
+#ifndef PACKET_PIPELINE_H
+#define PACKET_PIPELINE_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Local
+#include "ThreadPool.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Three stage read / transform / write pipeline with ordered output
+ *
+ * One reader thread fills jobs in sequence, the transforms run on a thread
+ * pool, and the calling thread writes the jobs back out in read order.  Jobs
+ * live in a ring of queueDepth slots that are reused, which bounds both the
+ * memory held and how far the reader can run ahead of the writer.
+ *
+ * Without a pool every job is read, transformed and written on the calling
+ * thread, one after the other.
+ *
+ * With a memory limit, the reader also waits until the jobs held by the
+ * other slots - in flight, or kept for reuse - take less than the limit, and
+ * slots are emptied once written while the held total is at the limit.  The
+ * bytes a job holds are told by a cost function, called after each read.
+ */
+template <typename Job>
+class PacketPipeline
+{
+public:
+    /** Fills the next job; returns false once there is nothing more to read */
+    typedef std::function<bool (Job&)> ReadFunction;
+
+    /** Processes one job; may run concurrently with other transforms */
+    typedef std::function<void (Job&)> TransformFunction;
+
+    /** Consumes one transformed job; always called in read order */
+    typedef std::function<void (Job&)> WriteFunction;
+
+    /** Bytes a read job will hold once transformed, buffers it needs while transformed included */
+    typedef std::function<uint64_t (const Job&)> CostFunction;
+
+    PacketPipeline(ThreadPool* pool, size_t queueDepth)
+        : pool_(pool), queueDepth_(queueDepth > 0 ? queueDepth : 1), maxBytes_(0), peakBytes_(0) { }
+
+    /**
+     * Bounds the memory held by the jobs of the pipeline
+     *
+     * A single job larger than the limit is still converted, on its own.
+     *
+     * @param maxBytes Limit; 0 for none
+     * @param cost Bytes held by a job
+     */
+    void limitMemory(uint64_t maxBytes, const CostFunction& cost)
+    {
+        maxBytes_ = maxBytes;
+        cost_ = cost;
+    }
+
+    /** Most bytes held by the jobs at any one time during run(); 0 without a cost function */
+    uint64_t peakBytes() const { return peakBytes_; }
+
+    /**
+     * Runs the pipeline until the reader is exhausted
+     *
+     * @throws the first exception raised by any stage, once all stages stopped
+     */
+    void run(const ReadFunction& read, const TransformFunction& transform, const WriteFunction& write)
+    {
+        peakBytes_ = 0;
+        if (pool_ == NULL) {
+            Job job;
+            while (read(job)) {
+                if (cost_) {
+                    peakBytes_ = std::max(peakBytes_, cost_(job));
+                }
+                transform(job);
+                write(job);
+            }
+            return;
+        }
+
+        std::vector<Slot> slots(queueDepth_);
+        State state;
+
+        std::thread reader([&] { readJobs(slots, state, read, transform); });
+
+        size_t next = 0;
+        while (true)
+        {
+            Slot& slot = slots[next % slots.size()];
+            {
+                std::unique_lock<std::mutex> lock(state.mutex);
+                state.cond.wait(lock, [&] {
+                    return state.aborted || slot.status == SLOT_READY ||
+                           (state.readDone && next >= state.total);
+                });
+                if (state.aborted || slot.status != SLOT_READY) {
+                    break;
+                }
+            }
+
+            std::exception_ptr error = slot.error;
+            if (!error) {
+                try {
+                    write(slot.job);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }
+
+            if (!error && maxBytes_ > 0)
+            {
+                bool release;
+                {
+                    std::lock_guard<std::mutex> lock(state.mutex);
+                    release = (state.held >= maxBytes_);
+                    if (release) {
+                        state.held -= slot.bytes;
+                        slot.bytes = 0;
+                    }
+                }
+                // The slot is not free yet, so no other stage touches it
+                if (release) {
+                    slot.job = Job();
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (error) {
+                fail(state, error);
+                break;
+            }
+            slot.status = SLOT_FREE;
+            next++;
+            state.cond.notify_all();
+        }
+
+        reader.join();
+
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.cond.wait(lock, [&] { return state.pending == 0; });
+
+        peakBytes_ = state.peak;
+        if (state.failure) {
+            std::rethrow_exception(state.failure);
+        }
+    }
+
+private:
+    enum SlotStatus { SLOT_FREE, SLOT_PENDING, SLOT_READY };
+
+    struct Slot
+    {
+        Slot() : status(SLOT_FREE), bytes(0) { }
+
+        Job job;
+        SlotStatus status;
+        std::exception_ptr error;
+        uint64_t bytes;     // held by job, as told by the cost function
+    };
+
+    struct State
+    {
+        State() : readDone(false), aborted(false), total(0), pending(0), held(0), peak(0) { }
+
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool readDone;
+        bool aborted;
+        size_t total;
+        size_t pending;
+        uint64_t held;      // bytes held by all slots
+        uint64_t peak;
+        std::exception_ptr failure;
+    };
+
+    // Called with the state mutex held
+    static void fail(State& state, std::exception_ptr error)
+    {
+        if (!state.failure) {
+            state.failure = error;
+        }
+        state.aborted = true;
+        state.cond.notify_all();
+    }
+
+    // Whether the memory limit lets the reader refill slot; called with the state mutex held
+    bool admits(const State& state, const Slot& slot) const
+    {
+        uint64_t const others = state.held - slot.bytes;
+        return maxBytes_ == 0 || others < maxBytes_;
+    }
+
+    void readJobs(std::vector<Slot>& slots, State& state,
+                  const ReadFunction& read, const TransformFunction& transform)
+    {
+        for (size_t seq = 0; ; seq++)
+        {
+            Slot& slot = slots[seq % slots.size()];
+            {
+                std::unique_lock<std::mutex> lock(state.mutex);
+                state.cond.wait(lock, [&] {
+                    return state.aborted || (slot.status == SLOT_FREE && admits(state, slot));
+                });
+                if (state.aborted) {
+                    return;
+                }
+            }
+
+            bool more = false;
+            uint64_t bytes = 0;
+            try {
+                more = read(slot.job);
+                if (more && cost_) {
+                    bytes = cost_(slot.job);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                fail(state, std::current_exception());
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (!more) {
+                    state.readDone = true;
+                    state.total = seq;
+                    state.cond.notify_all();
+                    return;
+                }
+                slot.status = SLOT_PENDING;
+                slot.error = std::exception_ptr();
+                state.pending++;
+                if (cost_) {
+                    state.held += bytes - slot.bytes;
+                    slot.bytes = bytes;
+                    state.peak = std::max(state.peak, state.held);
+                }
+            }
+
+            pool_->submit([&slots, &state, &transform, seq] {
+                Slot& s = slots[seq % slots.size()];
+                std::exception_ptr error;
+                try {
+                    transform(s.job);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(state.mutex);
+                s.error = error;
+                s.status = SLOT_READY;
+                state.pending--;
+                state.cond.notify_all();
+            });
+        }
+    }
+
+    ThreadPool* pool_;
+    size_t queueDepth_;
+    uint64_t maxBytes_;
+    CostFunction cost_;
+    uint64_t peakBytes_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* PACKET_PIPELINE_H */
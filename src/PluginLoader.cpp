@@ -0,0 +1,110 @@
+/** @file PluginLoader.cpp */
+#include <dlfcn.h>
+
+#include <stdexcept>
+#include <vector>
+
+// Local
+#include "GenericConverter.h"
+#include "PluginLoader.h"
+#include "ge_tools_path.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Directory holding libg2i, with a trailing slash; empty if unknown */
+std::string libraryDirectory()
+{
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&PluginLoader::isBuiltin), &info) == 0 || info.dli_fname == NULL) {
+        return "";
+    }
+    std::string path(info.dli_fname);
+    size_t slash = path.find_last_of('/');
+    return (slash == std::string::npos) ? "" : path.substr(0, slash + 1);
+}
+
+} // namespace
+
+bool PluginLoader::isBuiltin(const std::string& classname)
+{
+    return classname == "GenericConverter";
+}
+
+std::shared_ptr<SequenceConverter> PluginLoader::create(const std::string& libraryPath,
+                                                        const std::string& classname)
+{
+    if (libraryPath.size() == 0) {
+        if (classname == "GenericConverter") {
+            return std::make_shared<GenericConverter>();
+        }
+        throw std::runtime_error("Plugin class name: " + classname + " is not built in; a libraryPath is needed");
+    }
+
+    void* handle = openLibrary(libraryPath);
+
+    std::string makeName = "make_" + classname;
+    std::string destroyName = "destroy_" + classname;
+    MakeFunction make = reinterpret_cast<MakeFunction>(dlsym(handle, makeName.c_str()));
+    DestroyFunction destroy = reinterpret_cast<DestroyFunction>(dlsym(handle, destroyName.c_str()));
+    if (make == NULL || destroy == NULL) {
+        throw std::runtime_error("Plugin class name: " + classname + " not found in " + libraryPath);
+    }
+
+    SequenceConverter* converter = make();
+    if (converter == NULL) {
+        throw std::runtime_error("Failed to create " + classname + " from " + libraryPath);
+    }
+
+    // Freed by the library that allocated it; the library is never unloaded
+    return std::shared_ptr<SequenceConverter>(converter, destroy);
+}
+
+void* PluginLoader::openLibrary(const std::string& libraryPath)
+{
+    std::lock_guard<std::mutex> lock(mutex());
+
+    std::map<std::string, void*>::iterator cached = handles().find(libraryPath);
+    if (cached != handles().end()) {
+        return cached->second;
+    }
+
+    std::vector<std::string> candidates;
+    if (libraryPath.find('/') == std::string::npos) {
+        std::string here = libraryDirectory();
+        if (here.size() > 0) {
+            candidates.push_back(here + libraryPath);
+        }
+        candidates.push_back(get_ge_tools_home() + "lib/" + libraryPath);
+    }
+    candidates.push_back(libraryPath);
+
+    std::string errors;
+    for (size_t n = 0; n < candidates.size(); n++) {
+        void* handle = dlopen(candidates[n].c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle != NULL) {
+            handles()[libraryPath] = handle;
+            return handle;
+        }
+        const char* error = dlerror();
+        errors += "\n    ";
+        errors += (error != NULL) ? error : candidates[n];
+    }
+
+    throw std::runtime_error("Failed to load plugin library " + libraryPath + ":" + errors);
+}
+
+std::mutex& PluginLoader::mutex()
+{
+    static std::mutex loaderMutex;
+    return loaderMutex;
+}
+
+std::map<std::string, void*>& PluginLoader::handles()
+{
+    static std::map<std::string, void*> loaded;
+    return loaded;
+}
+
+} // namespace GEToIsmrmrd
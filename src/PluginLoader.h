@@ -0,0 +1,52 @@
+/** @file PluginLoader.h */
+#ifndef PLUGIN_LOADER_H
+#define PLUGIN_LOADER_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Local
+#include "SequenceConverter.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Creates sequence converters, either built into libg2i or exported from a
+ * plugin library with SEQUENCE_CONVERTER_FACTORY_DECLARE
+ *
+ * Plugin libraries are opened once per process and stay loaded, so a batch
+ * converting many inputs with the same plugin pays for dlopen() only once.
+ */
+class PluginLoader
+{
+public:
+    /**
+     * Creates a converter
+     *
+     * @param libraryPath Plugin library; empty for the converters built into
+     *        libg2i.  A bare file name is looked for next to libg2i, in the
+     *        GE tools lib directory, then on the dynamic linker search path.
+     * @param classname Converter class exported by the library
+     * @throws std::runtime_error if the library or class cannot be found
+     */
+    static std::shared_ptr<SequenceConverter> create(const std::string& libraryPath,
+                                                     const std::string& classname);
+
+    /** Whether classname is a converter built into libg2i */
+    static bool isBuiltin(const std::string& classname);
+
+private:
+    typedef SequenceConverter* (*MakeFunction)();
+    typedef void (*DestroyFunction)(SequenceConverter*);
+
+    static void* openLibrary(const std::string& libraryPath);
+
+    static std::mutex& mutex();
+    static std::map<std::string, void*>& handles();
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* PLUGIN_LOADER_H */
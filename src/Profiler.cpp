@@ -0,0 +1,187 @@
+/** @file Profiler.cpp */
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+// Local
+#include "Profiler.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Trace events kept at most, about 32 MiB */
+const size_t MAX_TRACE_EVENTS = 1 << 20;
+
+int64_t nanoseconds(Profiler::Clock::duration d)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+} // namespace
+
+Profiler& Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler()
+    : enabled_(false), trace_(false), droppedEvents_(0)
+{
+    reset();
+}
+
+void Profiler::enable(bool trace)
+{
+    reset();
+    trace_.store(trace);
+    enabled_.store(true);
+}
+
+void Profiler::reset()
+{
+    for (int n = 0; n < PROFILE_STAGE_COUNT; n++) {
+        stageNanoseconds_[n].store(0);
+        stageCalls_[n].store(0);
+    }
+    for (int n = 0; n < PROFILE_COUNTER_COUNT; n++) {
+        counters_[n].store(0);
+    }
+
+    std::lock_guard<std::mutex> lock(traceMutex_);
+    origin_ = Clock::now();
+    events_.clear();
+    threads_.clear();
+    droppedEvents_ = 0;
+}
+
+void Profiler::record(ProfileStage stage, Clock::time_point start, Clock::time_point end)
+{
+    stageNanoseconds_[stage].fetch_add(nanoseconds(end - start), std::memory_order_relaxed);
+    stageCalls_[stage].fetch_add(1, std::memory_order_relaxed);
+
+    if (!trace_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(traceMutex_);
+    if (events_.size() >= MAX_TRACE_EVENTS) {
+        droppedEvents_++;
+        return;
+    }
+
+    std::map<std::thread::id, unsigned int>::iterator thread =
+        threads_.insert(std::make_pair(std::this_thread::get_id(), (unsigned int)threads_.size())).first;
+
+    TraceEvent event;
+    event.stage    = stage;
+    event.thread   = thread->second;
+    event.start    = nanoseconds(start - origin_);
+    event.duration = nanoseconds(end - start);
+    events_.push_back(event);
+}
+
+double Profiler::wallSeconds() const
+{
+    std::lock_guard<std::mutex> lock(traceMutex_);
+    return nanoseconds(Clock::now() - origin_) * 1e-9;
+}
+
+const char* Profiler::stageName(ProfileStage stage)
+{
+    switch (stage) {
+    case PROFILE_ORCHESTRA:   return "orchestra";
+    case PROFILE_DECODE:      return "decode";
+    case PROFILE_HEADER:      return "header";
+    case PROFILE_GEOMETRY:    return "geometry";
+    case PROFILE_COPY:        return "copy";
+    case PROFILE_COMPRESSION: return "compression";
+    case PROFILE_ENCODE:      return "encode";
+    case PROFILE_HDF5:        return "hdf5";
+    default:                  return "unknown";
+    }
+}
+
+const char* Profiler::counterName(ProfileCounter counter)
+{
+    switch (counter) {
+    case PROFILE_PACKETS_READ:            return "packets_read";
+    case PROFILE_BASELINE_FRAMES_SKIPPED: return "baseline_frames_skipped";
+    case PROFILE_PACKETS_UNSELECTED:      return "packets_unselected";
+    case PROFILE_ACQUISITIONS_EMITTED:    return "acquisitions_emitted";
+    case PROFILE_BYTES_COPIED:            return "bytes_copied";
+    case PROFILE_BYTES_PREFETCHED:        return "bytes_prefetched";
+    case PROFILE_PEAK_BYTES_IN_FLIGHT:    return "peak_bytes_in_flight";
+    case PROFILE_PACKETS_RESUMED:         return "packets_resumed";
+    default:                              return "unknown";
+    }
+}
+
+void Profiler::writeSummary(std::ostream& out) const
+{
+    double wall = wallSeconds();
+
+    std::ios::fmtflags flags = out.flags();
+    out << std::left << std::setw(26) << "stage" << std::right << std::setw(12) << "calls"
+        << std::setw(14) << "seconds" << std::setw(10) << "% wall" << std::endl;
+    for (int n = 0; n < PROFILE_STAGE_COUNT; n++) {
+        ProfileStage stage = static_cast<ProfileStage>(n);
+        out << std::left << std::setw(26) << stageName(stage) << std::right << std::setw(12) << calls(stage)
+            << std::setw(14) << std::fixed << std::setprecision(4) << seconds(stage)
+            << std::setw(10) << std::setprecision(1) << (wall > 0 ? 100.0 * seconds(stage) / wall : 0.0)
+            << std::endl;
+    }
+    out << std::left << std::setw(26) << "wall" << std::right << std::setw(26) << std::setprecision(4)
+        << wall << std::endl;
+
+    out << std::endl << std::left << std::setw(26) << "counter" << std::right << std::setw(20) << "value" << std::endl;
+    for (int n = 0; n < PROFILE_COUNTER_COUNT; n++) {
+        ProfileCounter c = static_cast<ProfileCounter>(n);
+        out << std::left << std::setw(26) << counterName(c) << std::right << std::setw(20) << counter(c) << std::endl;
+    }
+    out.flags(flags);
+}
+
+void Profiler::writeTrace(const std::string& filename) const
+{
+    std::ofstream out(filename.c_str());
+    if (!out) {
+        throw std::runtime_error("Failed to open profile output " + filename);
+    }
+
+    double wall = wallSeconds();
+
+    out << "{\"traceEvents\": [";
+
+    std::lock_guard<std::mutex> lock(traceMutex_);
+    for (size_t n = 0; n < events_.size(); n++) {
+        const TraceEvent& event = events_[n];
+        char line[160];
+        snprintf(line, sizeof(line), "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                 (n > 0) ? "," : "", stageName(event.stage), event.thread,
+                 event.start * 1e-3, event.duration * 1e-3);
+        out << line;
+    }
+    out << "\n],\n\"displayTimeUnit\": \"ms\",\n\"otherData\": {";
+
+    out << "\n\"wall_seconds\": " << wall;
+    for (int n = 0; n < PROFILE_STAGE_COUNT; n++) {
+        ProfileStage stage = static_cast<ProfileStage>(n);
+        out << ",\n\"" << stageName(stage) << "_seconds\": " << seconds(stage)
+            << ",\n\"" << stageName(stage) << "_calls\": " << calls(stage);
+    }
+    for (int n = 0; n < PROFILE_COUNTER_COUNT; n++) {
+        ProfileCounter c = static_cast<ProfileCounter>(n);
+        out << ",\n\"" << counterName(c) << "\": " << counter(c);
+    }
+    out << ",\n\"dropped_trace_events\": " << droppedEvents_;
+    out << "\n}}" << std::endl;
+
+    if (!out) {
+        throw std::runtime_error("Failed to write profile output " + filename);
+    }
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,184 @@
+/** @file Profiler.h */
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace GEToIsmrmrd {
+
+/** Parts of a conversion timed by the profiler */
+enum ProfileStage
+{
+    PROFILE_ORCHESTRA,      /**< Orchestra SDK calls opening the raw file and reading its packets */
+    PROFILE_DECODE,         /**< Orchestra k-space decode of packets and P-file blocks */
+    PROFILE_HEADER,         /**< GE header document and XSLT */
+    PROFILE_GEOMETRY,       /**< Slice geometry and acquisition orientation */
+    PROFILE_COPY,           /**< k-space copies into the acquisitions */
+    PROFILE_COMPRESSION,    /**< Coil compression, learning and applying it */
+    PROFILE_ENCODE,         /**< Sample encoding of the output, other than inline */
+    PROFILE_HDF5,           /**< ISMRMRD / HDF5 output */
+    PROFILE_STAGE_COUNT
+};
+
+/** Events counted by the profiler */
+enum ProfileCounter
+{
+    PROFILE_PACKETS_READ,
+    PROFILE_BASELINE_FRAMES_SKIPPED,
+    PROFILE_PACKETS_UNSELECTED,
+    PROFILE_ACQUISITIONS_EMITTED,
+    PROFILE_BYTES_COPIED,
+    PROFILE_BYTES_PREFETCHED,
+    PROFILE_PEAK_BYTES_IN_FLIGHT,   /**< Gauge: most bytes held by a conversion pipeline */
+    PROFILE_PACKETS_RESUMED,        /**< Packets stepped over, as converted before a checkpoint */
+    PROFILE_COUNTER_COUNT
+};
+
+/**
+ * Process-wide stage timers and counters
+ *
+ * Disabled by default, in which case timers and counters cost one relaxed
+ * atomic load.  Once enabled, stage times and counters accumulate over every
+ * conversion of the process, from any thread; with tracing on, every timed
+ * scope is also kept as a trace event for writeTrace().
+ */
+class Profiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static Profiler& instance();
+
+    /**
+     * Starts collecting, clearing what was collected before
+     *
+     * @param trace Also keep every timed scope as a trace event
+     */
+    void enable(bool trace = false);
+
+    void disable() { enabled_.store(false, std::memory_order_relaxed); }
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    /** Clears all timers, counters and trace events */
+    void reset();
+
+    void count(ProfileCounter counter, uint64_t n = 1)
+    {
+        if (enabled()) {
+            counters_[counter].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    /** Raises a gauge counter to value, if it is below */
+    void peak(ProfileCounter counter, uint64_t value)
+    {
+        if (enabled()) {
+            uint64_t current = counters_[counter].load(std::memory_order_relaxed);
+            while (current < value &&
+                   !counters_[counter].compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+            }
+        }
+    }
+
+    /** Adds one timed scope of a stage */
+    void record(ProfileStage stage, Clock::time_point start, Clock::time_point end);
+
+    uint64_t counter(ProfileCounter counter) const { return counters_[counter].load(); }
+
+    /** Time spent in a stage, summed over all threads */
+    double seconds(ProfileStage stage) const { return stageNanoseconds_[stage].load() * 1e-9; }
+
+    uint64_t calls(ProfileStage stage) const { return stageCalls_[stage].load(); }
+
+    /** Time since the profiler was enabled or reset */
+    double wallSeconds() const;
+
+    static const char* stageName(ProfileStage stage);
+    static const char* counterName(ProfileCounter counter);
+
+    /** Prints a table of the stage times and counters */
+    void writeSummary(std::ostream& out) const;
+
+    /**
+     * Writes the stages, counters and trace events as a Chrome trace event
+     * JSON file (chrome://tracing, Perfetto)
+     *
+     * @throws std::runtime_error if the file cannot be written
+     */
+    void writeTrace(const std::string& filename) const;
+
+private:
+    Profiler();
+
+    // Non-copyable
+    Profiler(const Profiler& other);
+    Profiler& operator=(const Profiler& other);
+
+    struct TraceEvent
+    {
+        ProfileStage stage;
+        unsigned int thread;
+        int64_t      start;     // ns since origin_
+        int64_t      duration;  // ns
+    };
+
+    std::atomic<bool> enabled_;
+    std::atomic<bool> trace_;
+    std::atomic<int64_t> stageNanoseconds_[PROFILE_STAGE_COUNT];
+    std::atomic<uint64_t> stageCalls_[PROFILE_STAGE_COUNT];
+    std::atomic<uint64_t> counters_[PROFILE_COUNTER_COUNT];
+
+    Clock::time_point origin_;
+
+    mutable std::mutex traceMutex_;
+    std::vector<TraceEvent> events_;
+    std::map<std::thread::id, unsigned int> threads_;
+    uint64_t droppedEvents_;
+};
+
+/** Times the enclosing scope as one call of a stage */
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(ProfileStage stage)
+        : stage_(stage), active_(Profiler::instance().enabled())
+    {
+        if (active_) {
+            start_ = Profiler::Clock::now();
+        }
+    }
+
+    ~ScopedTimer() { stop(); }
+
+    /** Ends the timed scope early */
+    void stop()
+    {
+        if (active_) {
+            Profiler::instance().record(stage_, start_, Profiler::Clock::now());
+            active_ = false;
+        }
+    }
+
+private:
+    // Non-copyable
+    ScopedTimer(const ScopedTimer& other);
+    ScopedTimer& operator=(const ScopedTimer& other);
+
+    ProfileStage stage_;
+    bool active_;
+    Profiler::Clock::time_point start_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* PROFILER_H */
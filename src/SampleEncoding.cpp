@@ -0,0 +1,212 @@
+/** @file SampleEncoding.cpp */
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+// Local
+#include "SampleEncoding.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define G2I_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+uint32_t floatBits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+float bitsFloat(uint32_t bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/** Round to nearest even, as the F16C instructions do */
+uint16_t scalarHalf(float value)
+{
+    const uint32_t f16max      = (127 + 16) << 23;                  // 65536, first value rounding to infinity or beyond
+    const uint32_t denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+    uint32_t bits = floatBits(value);
+    uint32_t const sign = bits & 0x80000000u;
+    bits ^= sign;
+
+    uint16_t half;
+    if (bits >= f16max) {
+        half = (bits > 0x7f800000u) ? 0x7e00 : 0x7c00;             // NaN, or infinity
+    } else if (bits < (113u << 23)) {
+        // Zero or subnormal half: let the float adder do the rounding
+        half = static_cast<uint16_t>(floatBits(bitsFloat(bits) + bitsFloat(denormMagic)) - denormMagic);
+    } else {
+        uint32_t const mantissaOdd = (bits >> 13) & 1;
+        bits -= (127u - 15u) << 23;                                 // rebias the exponent
+        bits += 0xfff + mantissaOdd;
+        half = static_cast<uint16_t>(bits >> 13);
+    }
+    return half | static_cast<uint16_t>(sign >> 16);
+}
+
+float scalarFloat(uint16_t half)
+{
+    uint32_t const sign     = (uint32_t)(half & 0x8000) << 16;
+    uint32_t const exponent = (half >> 10) & 0x1f;
+    uint32_t const mantissa = half & 0x3ff;
+
+    if (exponent == 0) {
+        // Zero or subnormal: mantissa * 2^-24
+        return bitsFloat(floatBits(mantissa * 5.9604644775390625e-8f) | sign);
+    }
+    if (exponent == 31) {
+        return bitsFloat(sign | 0x7f800000u | (mantissa << 13));
+    }
+    return bitsFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+void scalarFloatToHalf(uint16_t* dst, const float* src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) dst[i] = scalarHalf(src[i]);
+}
+
+void scalarHalfToFloat(float* dst, const uint16_t* src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) dst[i] = scalarFloat(src[i]);
+}
+
+#ifdef G2I_X86_KERNELS
+
+__attribute__((target("avx,f16c")))
+void f16cFloatToHalf(uint16_t* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), half);
+    }
+    scalarFloatToHalf(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx,f16c")))
+void f16cHalfToFloat(float* dst, const uint16_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(half));
+    }
+    scalarHalfToFloat(dst + i, src + i, n - i);
+}
+
+#endif /* G2I_X86_KERNELS */
+
+struct HalfKernels
+{
+    void (*toHalf)(uint16_t*, const float*, size_t);
+    void (*toFloat)(float*, const uint16_t*, size_t);
+    const char* isa;
+};
+
+HalfKernels selectKernels()
+{
+#ifdef G2I_X86_KERNELS
+    // G2I_SAMPLE_ENCODING=scalar keeps the scalar conversions, for testing
+    const char* isa = getenv("G2I_SAMPLE_ENCODING");
+    bool const scalarOnly = (isa != NULL && strcmp(isa, "scalar") == 0);
+    __builtin_cpu_init();
+    if (!scalarOnly && __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c")) {
+        HalfKernels k = { f16cFloatToHalf, f16cHalfToFloat, "f16c" };
+        return k;
+    }
+#endif
+    HalfKernels k = { scalarFloatToHalf, scalarHalfToFloat, "scalar" };
+    return k;
+}
+
+const HalfKernels& kernels()
+{
+    static const HalfKernels selected = selectKernels();
+    return selected;
+}
+
+} // namespace
+
+const char* sampleEncodingName(SampleEncoding encoding)
+{
+    switch (encoding) {
+    case SAMPLES_INLINE:  return "inline";
+    case SAMPLES_FLOAT32: return "float32";
+    case SAMPLES_FLOAT16: return "float16";
+    case SAMPLES_INT16:   return "int16";
+    default:              return "unknown";
+    }
+}
+
+SampleEncoding parseSampleEncoding(const std::string& name)
+{
+    for (int n = SAMPLES_INLINE; n <= SAMPLES_INT16; n++) {
+        SampleEncoding encoding = static_cast<SampleEncoding>(n);
+        if (name == sampleEncodingName(encoding)) {
+            return encoding;
+        }
+    }
+    throw std::runtime_error("Unknown sample encoding: " + name);
+}
+
+size_t sampleEncodingBytes(SampleEncoding encoding)
+{
+    return (encoding == SAMPLES_FLOAT16 || encoding == SAMPLES_INT16) ? 2 : 4;
+}
+
+void floatToHalf(uint16_t* dst, const float* src, size_t n)
+{
+    kernels().toHalf(dst, src, n);
+}
+
+void halfToFloat(float* dst, const uint16_t* src, size_t n)
+{
+    kernels().toFloat(dst, src, n);
+}
+
+float int16Scale(const float* src, size_t n)
+{
+    float largest = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        float magnitude = std::fabs(src[i]);
+        largest = (magnitude > largest) ? magnitude : largest;
+    }
+    return (largest > 0.0f && std::isfinite(largest)) ? largest / 32767.0f : 1.0f;
+}
+
+void floatToInt16(int16_t* dst, const float* src, size_t n, float scale)
+{
+    float const inverse = 1.0f / scale;
+    for (size_t i = 0; i < n; i++) {
+        float value = std::nearbyint(src[i] * inverse);
+        value = (value == value) ? value : 0.0f;        // NaN
+        value = (value > 32767.0f) ? 32767.0f : value;
+        value = (value < -32767.0f) ? -32767.0f : value;
+        dst[i] = static_cast<int16_t>(value);
+    }
+}
+
+void int16ToFloat(float* dst, const int16_t* src, size_t n, float scale)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = src[i] * scale;
+    }
+}
+
+const char* sampleEncodingIsa()
+{
+    return kernels().isa;
+}
+
+} // namespace GEToIsmrmrd
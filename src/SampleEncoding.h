@@ -0,0 +1,72 @@
+/** @file SampleEncoding.h */
+#ifndef SAMPLE_ENCODING_H
+#define SAMPLE_ENCODING_H
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <string>
+
+namespace GEToIsmrmrd {
+
+/** How a DatasetWriter stores the k-space samples of its acquisitions */
+enum SampleEncoding
+{
+    SAMPLES_INLINE  = 0,    /**< ISMRMRD layout: 32 bit floats inside the acquisition records */
+    SAMPLES_FLOAT32 = 1,    /**< 32 bit floats in a separate, filterable data set (lossless) */
+    SAMPLES_FLOAT16 = 2,    /**< IEEE half precision floats in a separate data set */
+    SAMPLES_INT16   = 3     /**< 16 bit integers scaled per acquisition, in a separate data set */
+};
+
+/** Shape of the encoded samples of one acquisition, stored next to its record */
+struct SampleShape
+{
+    uint16_t number_of_samples;
+    uint16_t active_channels;
+    float    scale;             /**< int16 samples: sample = stored value * scale; 1 otherwise */
+};
+
+/** "inline", "float32", "float16" or "int16" */
+const char* sampleEncodingName(SampleEncoding encoding);
+
+/**
+ * @throws std::runtime_error if name is not that of an encoding
+ */
+SampleEncoding parseSampleEncoding(const std::string& name);
+
+/** Bytes stored per real sample value (two per complex sample) */
+size_t sampleEncodingBytes(SampleEncoding encoding);
+
+/**
+ * Converts n floats to IEEE half precision, rounding to nearest even;
+ * values beyond the half range become infinities
+ */
+void floatToHalf(uint16_t* dst, const float* src, size_t n);
+
+/** Converts n IEEE half precision values to floats, exactly */
+void halfToFloat(float* dst, const uint16_t* src, size_t n);
+
+/**
+ * Scale mapping the largest magnitude of n floats onto the int16 range;
+ * 1 if they are all zero
+ */
+float int16Scale(const float* src, size_t n);
+
+/** dst[i] = round(src[i] / scale), saturated to the int16 range */
+void floatToInt16(int16_t* dst, const float* src, size_t n, float scale);
+
+/** dst[i] = src[i] * scale */
+void int16ToFloat(float* dst, const int16_t* src, size_t n, float scale);
+
+/**
+ * Name of the instruction set the half precision conversions picked at
+ * runtime ("f16c" or "scalar")
+ *
+ * F16C is used if the CPU supports it, unless the environment variable
+ * G2I_SAMPLE_ENCODING is "scalar", so both can be run on the same machine.
+ */
+const char* sampleEncodingIsa();
+
+} // namespace GEToIsmrmrd
+
+#endif /* SAMPLE_ENCODING_H */
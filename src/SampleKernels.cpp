@@ -0,0 +1,229 @@
+/** @file SampleKernels.cpp */
+#include <stdint.h>
+
+#include <cstdlib>
+#include <cstring>
+
+// Local
+#include "SampleKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define G2I_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+typedef std::complex<float> Sample;
+
+/**
+ * Kernel set for one instruction set.  A complex<float> is one 64 bit lane
+ * to the vector code, which keeps reversing and gathering to lane shuffles.
+ */
+struct Kernels
+{
+    void (*copy)(Sample*, const Sample*, size_t, bool);
+    void (*reverseCopy)(Sample*, const Sample*, size_t, bool);
+    void (*gather)(Sample*, const Sample*, std::ptrdiff_t, size_t, bool);
+    const char* isa;
+};
+
+void scalarCopy(Sample* dst, const Sample* src, size_t n, bool negate)
+{
+    if (negate) {
+        for (size_t i = 0; i < n; i++) dst[i] = -src[i];
+    } else {
+        for (size_t i = 0; i < n; i++) dst[i] = src[i];
+    }
+}
+
+void scalarReverseCopy(Sample* dst, const Sample* src, size_t n, bool negate)
+{
+    const Sample* last = src + n - 1;
+    if (negate) {
+        for (size_t i = 0; i < n; i++) dst[i] = -last[-(std::ptrdiff_t)i];
+    } else {
+        for (size_t i = 0; i < n; i++) dst[i] = last[-(std::ptrdiff_t)i];
+    }
+}
+
+void scalarGather(Sample* dst, const Sample* src, std::ptrdiff_t stride, size_t n, bool negate)
+{
+    if (negate) {
+        for (size_t i = 0; i < n; i++) dst[i] = -src[(std::ptrdiff_t)i * stride];
+    } else {
+        for (size_t i = 0; i < n; i++) dst[i] = src[(std::ptrdiff_t)i * stride];
+    }
+}
+
+#ifdef G2I_X86_KERNELS
+
+__attribute__((target("avx2")))
+void avx2Copy(Sample* dst, const Sample* src, size_t n, bool negate)
+{
+    const __m256 mask = _mm256_set1_ps(negate ? -0.0f : 0.0f);
+    const float* in = reinterpret_cast<const float*>(src);
+    float* out = reinterpret_cast<float*>(dst);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_ps(out + 2 * i, _mm256_xor_ps(_mm256_loadu_ps(in + 2 * i), mask));
+    }
+    scalarCopy(dst + i, src + i, n - i, negate);
+}
+
+__attribute__((target("avx2")))
+void avx2ReverseCopy(Sample* dst, const Sample* src, size_t n, bool negate)
+{
+    const __m256d mask = _mm256_castps_pd(_mm256_set1_ps(negate ? -0.0f : 0.0f));
+    const double* in = reinterpret_cast<const double*>(src);
+    double* out = reinterpret_cast<double*>(dst);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd(in + n - i - 4);
+        v = _mm256_permute4x64_pd(v, _MM_SHUFFLE(0, 1, 2, 3));
+        _mm256_storeu_pd(out + i, _mm256_xor_pd(v, mask));
+    }
+    scalarReverseCopy(dst + i, src, n - i, negate);
+}
+
+__attribute__((target("avx2")))
+void avx2Gather(Sample* dst, const Sample* src, std::ptrdiff_t stride, size_t n, bool negate)
+{
+    const __m256d mask = _mm256_castps_pd(_mm256_set1_ps(negate ? -0.0f : 0.0f));
+    const __m256i index = _mm256_set_epi64x(3 * stride, 2 * stride, stride, 0);
+    const double* in = reinterpret_cast<const double*>(src);
+    double* out = reinterpret_cast<double*>(dst);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_i64gather_pd(in + (std::ptrdiff_t)i * stride, index, 8);
+        _mm256_storeu_pd(out + i, _mm256_xor_pd(v, mask));
+    }
+    scalarGather(dst + i, src + (std::ptrdiff_t)i * stride, stride, n - i, negate);
+}
+
+__attribute__((target("avx512f")))
+void avx512Copy(Sample* dst, const Sample* src, size_t n, bool negate)
+{
+    const __m512i mask = _mm512_set1_epi32(negate ? (int)0x80000000u : 0);
+    const float* in = reinterpret_cast<const float*>(src);
+    float* out = reinterpret_cast<float*>(dst);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i v = _mm512_castps_si512(_mm512_loadu_ps(in + 2 * i));
+        _mm512_storeu_ps(out + 2 * i, _mm512_castsi512_ps(_mm512_xor_si512(v, mask)));
+    }
+    scalarCopy(dst + i, src + i, n - i, negate);
+}
+
+__attribute__((target("avx512f")))
+void avx512ReverseCopy(Sample* dst, const Sample* src, size_t n, bool negate)
+{
+    const __m512i mask = _mm512_set1_epi32(negate ? (int)0x80000000u : 0);
+    const __m512i order = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    const double* in = reinterpret_cast<const double*>(src);
+    double* out = reinterpret_cast<double*>(dst);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        // The maskz_ forms start from zero rather than an undefined vector
+        __m512d v = _mm512_maskz_permutexvar_pd(0xff, order, _mm512_loadu_pd(in + n - i - 8));
+        _mm512_storeu_pd(out + i, _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(v), mask)));
+    }
+    scalarReverseCopy(dst + i, src, n - i, negate);
+}
+
+__attribute__((target("avx512f")))
+void avx512Gather(Sample* dst, const Sample* src, std::ptrdiff_t stride, size_t n, bool negate)
+{
+    const __m512i mask = _mm512_set1_epi32(negate ? (int)0x80000000u : 0);
+    const __m512i index = _mm512_set_epi64(7 * stride, 6 * stride, 5 * stride, 4 * stride,
+                                           3 * stride, 2 * stride, stride, 0);
+    const double* in = reinterpret_cast<const double*>(src);
+    double* out = reinterpret_cast<double*>(dst);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d v = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xff, index, in + (std::ptrdiff_t)i * stride, 8);
+        _mm512_storeu_pd(out + i, _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(v), mask)));
+    }
+    scalarGather(dst + i, src + (std::ptrdiff_t)i * stride, stride, n - i, negate);
+}
+
+#endif /* G2I_X86_KERNELS */
+
+/** Widest instruction set G2I_SAMPLE_KERNELS allows: 0 scalar, 1 avx2, 2 avx512f (the default) */
+int widestAllowed()
+{
+    const char* isa = getenv("G2I_SAMPLE_KERNELS");
+    if (isa != NULL && strcmp(isa, "scalar") == 0) {
+        return 0;
+    }
+    if (isa != NULL && strcmp(isa, "avx2") == 0) {
+        return 1;
+    }
+    return 2;
+}
+
+Kernels selectKernels()
+{
+#ifdef G2I_X86_KERNELS
+    __builtin_cpu_init();
+    int const widest = widestAllowed();
+    if (widest >= 2 && __builtin_cpu_supports("avx512f")) {
+        Kernels k = { avx512Copy, avx512ReverseCopy, avx512Gather, "avx512f" };
+        return k;
+    }
+    if (widest >= 1 && __builtin_cpu_supports("avx2")) {
+        Kernels k = { avx2Copy, avx2ReverseCopy, avx2Gather, "avx2" };
+        return k;
+    }
+#endif
+    Kernels k = { scalarCopy, scalarReverseCopy, scalarGather, "scalar" };
+    return k;
+}
+
+// Picked once; initialisation of a function local static is thread safe
+const Kernels& kernels()
+{
+    static const Kernels selected = selectKernels();
+    return selected;
+}
+
+} // namespace
+
+void copySamples(std::complex<float>* dst, const std::complex<float>* src, size_t n, bool negate)
+{
+    kernels().copy(dst, src, n, negate);
+}
+
+void reverseCopySamples(std::complex<float>* dst, const std::complex<float>* src, size_t n, bool negate)
+{
+    if (n > 0) {
+        kernels().reverseCopy(dst, src, n, negate);
+    }
+}
+
+void gatherSamples(std::complex<float>* dst, const std::complex<float>* src, std::ptrdiff_t stride,
+                   size_t n, bool negate)
+{
+    if (stride == 1) {
+        copySamples(dst, src, n, negate);
+    } else if (stride == -1) {
+        reverseCopySamples(dst, src - (std::ptrdiff_t)n + 1, n, negate);
+    } else {
+        kernels().gather(dst, src, stride, n, negate);
+    }
+}
+
+const char* sampleKernelsIsa()
+{
+    return kernels().isa;
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,53 @@
+/** @file SampleKernels.h */
+#ifndef SAMPLE_KERNELS_H
+#define SAMPLE_KERNELS_H
+
+#include <complex>
+#include <cstddef>
+
+namespace GEToIsmrmrd {
+
+/**
+ * Copies n complex samples into contiguous storage, optionally negating them
+ *
+ * dst[i] = (negate ? -1 : 1) * src[i]
+ *
+ * @param dst Destination, n samples
+ * @param src Source, n samples; must not overlap dst
+ * @param n Number of samples
+ * @param negate Flip the sign of every sample (chop / RF unchop)
+ */
+void copySamples(std::complex<float>* dst, const std::complex<float>* src, size_t n, bool negate);
+
+/**
+ * Copies n complex samples starting from the last one, optionally negating them
+ *
+ * dst[i] = (negate ? -1 : 1) * src[n - 1 - i]
+ */
+void reverseCopySamples(std::complex<float>* dst, const std::complex<float>* src, size_t n, bool negate);
+
+/**
+ * Gathers n strided complex samples into contiguous storage, optionally
+ * negating them.  Dispatches to copySamples() and reverseCopySamples() for
+ * strides of 1 and -1.
+ *
+ * dst[i] = (negate ? -1 : 1) * src[i * stride]
+ *
+ * @param stride Distance between source samples, in samples; may be negative
+ */
+void gatherSamples(std::complex<float>* dst, const std::complex<float>* src, std::ptrdiff_t stride,
+                   size_t n, bool negate);
+
+/**
+ * Name of the instruction set the kernels picked at runtime
+ * ("avx512f", "avx2" or "scalar")
+ *
+ * The widest set the CPU supports is used, unless the environment variable
+ * G2I_SAMPLE_KERNELS caps it at "avx2" or "scalar", so the kernels of each
+ * set can be run on the same machine.
+ */
+const char* sampleKernelsIsa();
+
+} // namespace GEToIsmrmrd
+
+#endif /* SAMPLE_KERNELS_H */
@@ -0,0 +1,318 @@
+/** @file ScanParameters.cpp */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+// Local
+#include "ScanParameters.h"
+#include "SequenceConverter.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/**
+ * Seconds since midnight of a DICOM TM value, HHMMSS.FFFFFF (or with the
+ * older HH:MM:SS separators); 0 if it cannot be parsed
+ */
+double parseDicomTime(const std::string& tm)
+{
+    std::string digits;
+    std::string::size_type n = 0;
+    for ( ; n < tm.size() && tm[n] != '.'; n++) {
+        if (tm[n] >= '0' && tm[n] <= '9') {
+            digits += tm[n];
+        } else if (tm[n] != ':' && tm[n] != ' ') {
+            return 0;
+        }
+    }
+    if (digits.size() < 6) {
+        return 0;
+    }
+
+    double seconds = atoi(digits.substr(0, 2).c_str()) * 3600 + atoi(digits.substr(2, 2).c_str()) * 60 +
+                     atoi(digits.substr(4, 2).c_str());
+    if (n < tm.size()) {
+        seconds += atof(tm.substr(n).c_str());
+    }
+    return seconds;
+}
+
+/** A value as the DICOM image formats it: a decimal string, without trailing zeros */
+std::string dicomNumber(double value)
+{
+    std::ostringstream out;
+    out << value;
+    return out.str();
+}
+
+double distance(const GERecon::Point& a, const GERecon::Point& b)
+{
+    double const dx = a.X_mm() - b.X_mm();
+    double const dy = a.Y_mm() - b.Y_mm();
+    double const dz = a.Z_mm() - b.Z_mm();
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+/**
+ * Builds the DICOM series and the image of the first slice, and keeps the
+ * strings the XML header reads from their modules
+ */
+void readDicomValues(GERecon::Legacy::LxDownloadDataPointer lxData, const GERecon::SliceInfoTable& sliceTable,
+                     ScanParameters::DicomValues& dicom)
+{
+    GERecon::Legacy::DicomSeries legacySeries(lxData);
+    GEDicom::SeriesPointer series = legacySeries.Series();
+
+    GEDicom::SeriesModulePointer seriesModule = series->GeneralModule();
+    dicom.series.uid            = seriesModule->UID();
+    dicom.series.description    = seriesModule->SeriesDescription();
+    dicom.series.laterality     = seriesModule->Laterality();
+    dicom.series.date           = seriesModule->Date();
+    dicom.series.time           = seriesModule->Time();
+    dicom.series.protocolName   = seriesModule->ProtocolName();
+    dicom.series.operatorName   = seriesModule->OperatorName();
+    dicom.series.ppsDescription = seriesModule->PpsDescription();
+
+    GEDicom::StudyPointer study = series->Study();
+    GEDicom::StudyModulePointer studyModule = study->GeneralModule();
+    dicom.study.uid                = studyModule->UID();
+    dicom.study.description        = studyModule->StudyDescription();
+    dicom.study.date               = studyModule->Date();
+    dicom.study.time               = studyModule->Time();
+    dicom.study.referringPhysician = studyModule->ReferringPhysician();
+    dicom.study.accessionNumber    = studyModule->AccessionNumber();
+    dicom.study.readingPhysician   = studyModule->ReadingPhysician();
+
+    GEDicom::PatientStudyModulePointer patientStudyModule = study->PatientStudyModule();
+    GEDicom::PatientModulePointer patientModule = study->Patient()->GeneralModule();
+    dicom.patient.name      = patientModule->Name();
+    dicom.patient.id        = patientModule->ID();
+    dicom.patient.birthdate = patientModule->Birthdate();
+    dicom.patient.gender    = patientModule->Gender();
+    dicom.patient.age       = patientStudyModule->Age();
+    dicom.patient.weight    = patientStudyModule->Weight();
+    dicom.patient.history   = patientStudyModule->History();
+
+    GEDicom::EquipmentModulePointer equipmentModule = series->Equipment()->GeneralModule();
+    dicom.equipment.manufacturer         = equipmentModule->Manufacturer();
+    dicom.equipment.institution          = equipmentModule->Institution();
+    dicom.equipment.station              = equipmentModule->Station();
+    dicom.equipment.manufacturerModel    = equipmentModule->ManufacturerModel();
+    dicom.equipment.deviceSerialNumber   = equipmentModule->DeviceSerialNumber();
+    dicom.equipment.softwareVersion      = equipmentModule->SoftwareVersion();
+    dicom.equipment.ppsPerformedStation  = equipmentModule->PpsPerformedStation();
+    dicom.equipment.ppsPerformedLocation = equipmentModule->PpsPerformedLocation();
+
+    // Only the modules of the image are read, not its pixels or pixel size,
+    // so it is built on a single pixel
+    auto imageCorners   = GERecon::ImageCorners(sliceTable.AcquiredSliceCorners(0), sliceTable.SliceOrientation(0));
+    auto grayscaleImage = GEDicom::GrayscaleImage(1, 1);
+    auto dicomImage     = GERecon::Legacy::DicomImage(grayscaleImage, 0, imageCorners, series, *lxData);
+
+    auto imageModule = dicomImage.ImageModule();
+    dicom.image.imageType            = imageModule->ImageType();
+    dicom.image.scanSequence         = imageModule->ScanSequence();
+    dicom.image.sequenceVariant      = imageModule->SequenceVariant();
+    dicom.image.scanOptions          = imageModule->ScanOptions();
+    dicom.image.acquisitionType      = static_cast<int>(imageModule->AcqType());
+    dicom.image.phaseEncodeDirection = static_cast<int>(imageModule->PhaseEncodeDirection());
+
+    auto imageModuleBase = dicomImage.ImageModuleBase();
+    dicom.image.acquisitionDate = imageModuleBase->AcquisitionDate();
+    dicom.image.acquisitionTime = imageModuleBase->AcquisitionTime();
+    dicom.image.imageDate       = imageModuleBase->ImageDate();
+    dicom.image.imageTime       = imageModuleBase->ImageTime();
+
+    auto imagePlaneModule = dicomImage.ImagePlaneModule();
+    dicom.image.imageOrientation = imagePlaneModule->ImageOrientation();
+    dicom.image.imagePosition    = imagePlaneModule->ImagePosition();
+    dicom.image.sliceLocation    = imagePlaneModule->SliceLocation();
+}
+
+} // namespace
+
+/** DICOM values shared by the copies of a ScanParameters, built once */
+struct ScanParameters::DicomCache
+{
+    DicomCache() : built(false) { }
+
+    std::mutex  mutex;
+    bool        built;
+    std::string error;          // why they could not be built, empty if they were
+    DicomValues values;
+};
+
+/**
+ * Reads all processing control values used by the converters and the XML
+ * header writer
+ *
+ * @param lxData Download data of the scan
+ * @param processingControl Legacy processing control created from lxData
+ */
+ScanParameters::ScanParameters(GERecon::Legacy::LxDownloadDataPointer lxData,
+                               GERecon::Control::ProcessingControlPointer processingControl)
+    : sliceTable(processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable")),
+      lxData_(lxData), dicom_(std::make_shared<DicomCache>())
+{
+    isEpi                 = lxData->IsEpi();
+
+    is3DAcquisition       = processingControl->Value<bool>("Is3DAcquisition");
+    isAssetCalibration    = processingControl->Value<bool>("AssetCalibration");
+    isPureCalibration     = processingControl->Value<bool>("PureCalibration");
+    isEpiRampsampled      = processingControl->Value<bool>("RampSamplingEnabled");
+    isCine                = processingControl->Value<bool>("CineData");
+    isShimData            = processingControl->Value<bool>("ShimData");
+    isGrassData           = processingControl->Value<bool>("GrassData");
+
+    numSlices             = processingControl->Value<int>("NumSlices");
+    numChannels           = processingControl->Value<int>("NumChannels");
+    numEchoes             = processingControl->Value<int>("NumEchoes");
+    numBaselineViews      = processingControl->Value<int>("NumBaselineViews");
+    numVolumes            = processingControl->Value<int>("NumVolumes");
+    numAcquisitions       = processingControl->Value<int>("NumAcquisitions");
+    acquiredXRes          = processingControl->Value<int>("AcquiredXRes");
+    acquiredYRes          = processingControl->Value<int>("AcquiredYRes");
+    acquiredZRes          = processingControl->Value<int>("AcquiredZRes");
+    transformXRes         = processingControl->Value<int>("TransformXRes");
+    transformYRes         = processingControl->Value<int>("TransformYRes");
+    transformZRes         = processingControl->Value<int>("TransformZRes");
+    imageXRes             = processingControl->Value<int>("ImageXRes");
+    imageYRes             = processingControl->Value<int>("ImageYRes");
+    dataSampleSize        = processingControl->Value<int>("DataSampleSize");
+    rawPassSize           = processingControl->Value<int>("RawPassSize");
+
+    evenEchoFrequencyFlip = processingControl->Value<bool>("EvenEchoFrequencyFlip");
+    oddEchoFrequencyFlip  = processingControl->Value<bool>("OddEchoFrequencyFlip");
+    evenEchoPhaseFlip     = processingControl->Value<bool>("EvenEchoPhaseFlip");
+    oddEchoPhaseFlip      = processingControl->Value<bool>("OddEchoPhaseFlip");
+    choppedData           = processingControl->Value<bool>("ChoppedData");
+    halfEcho              = processingControl->Value<bool>("HalfEcho");
+    rawNex                = processingControl->Value<unsigned int>("RawNex");
+    halfNex               = processingControl->Value<bool>("HalfNex");
+    threeQuarterNexData   = processingControl->Value<bool>("ThreeQuarterNexData");
+    noFrequencyWrapData   = processingControl->Value<bool>("NoFrequencyWrapData");
+    noPhaseWrapData       = processingControl->Value<bool>("NoPhaseWrapData");
+    overscanData          = processingControl->Value<bool>("OverscanData");
+    chopX                 = processingControl->Value<bool>("ChopX");
+    chopY                 = processingControl->Value<bool>("ChopY");
+    chopZ                 = processingControl->Value<bool>("ChopZ");
+
+    createMagnitudeImages = processingControl->Value<bool>("CreateMagnitudeImages");
+    createPhaseImages     = processingControl->Value<bool>("CreatePhaseImages");
+
+    seriesNumber          = processingControl->Value<int>("SeriesNumber");
+    examNumber            = processingControl->Value<int>("ExamNumber");
+    patientEntry          = processingControl->Value<int>("PatientEntry");
+    patientPosition       = processingControl->Value<int>("PatientPosition");
+    scanCenter            = processingControl->Value<float>("ScanCenter");
+    landmark              = processingControl->Value<float>("Landmark");
+    coilConfigUID         = processingControl->Value<unsigned int>("CoilConfigUID");
+
+    for (int n = 0; n < SCAN_PARAMETERS_USER_VALUES; n++)
+    {
+        std::ostringstream key;
+        key << "UserValue" << n;
+        userValues[n] = processingControl->Value<int>(key.str());
+    }
+
+    // The numeric image values are read from the legacy headers, as Orchestra's
+    // DICOM image would: the DICOM objects are only built for the strings
+    // that need them, see dicomValues()
+    const GERecon::Legacy::ImageHeaderStruct& imageHeader = lxData->ImageHeader();
+    image.echoTime              = dicomNumber(imageHeader.te);
+    image.repetitionTime        = dicomNumber(imageHeader.tr);
+    image.inversionTime         = dicomNumber(imageHeader.ti);
+    image.secondEcho            = dicomNumber(imageHeader.te2);
+    image.imagingFrequency      = dicomNumber(imageHeader.xmtfreq * 1e-7);      // 0.1 Hz units
+    image.magneticFieldStrength = dicomNumber(lxData->ExamHeader().magstrength * 1e-4);   // Gauss
+    image.sliceSpacing          = dicomNumber(imageHeader.slthick + imageHeader.scanspacing);
+    image.flipAngle             = dicomNumber(imageHeader.mr_flip);
+    image.echoTrainLength       = dicomNumber(imageHeader.echo_trn_len);
+    image.sliceThickness        = imageHeader.slthick;
+
+    // The field of view is spanned by the corners of the slice
+    GERecon::SliceCorners const corners = sliceTable.AcquiredSliceCorners(0);
+    image.pixelSizeX = distance(corners.UpperRight(), corners.UpperLeft()) / std::max(imageXRes, 1);
+    image.pixelSizeY = distance(corners.LowerLeft(), corners.UpperLeft()) / std::max(imageYRes, 1);
+
+    repetitionTimeUs = std::max(imageHeader.tr, 0);
+    echoTrainLength  = std::max(imageHeader.echo_trn_len, 1);
+
+    epi.isEpiRefScanIntegrated = false;
+    epi.multibandEnabled       = false;
+    epi.acquiredXRes           = acquiredXRes;
+    epi.acquiredYRes           = acquiredYRes;
+    epi.extraFramesTop         = 0;
+    epi.extraFramesBottom      = 0;
+
+    if (isEpi)
+    {
+        // The EPI control source exposes values the legacy one does not
+        boost::shared_ptr<GERecon::Epi::LxControlSource> const controlSource = boost::make_shared<GERecon::Epi::LxControlSource>(lxData);
+        GERecon::Control::ProcessingControlPointer               procCtrlEPI = controlSource->CreateOrchestraProcessingControl();
+
+        // and counts slices, channels and echoes as the EPI converter reads
+        // them, which may differ from the legacy ones for multiband and reference
+        // scans; the header and the selection follow the converter
+        numSlices                  = procCtrlEPI->Value<int>("NumSlices");
+        numChannels                = procCtrlEPI->Value<int>("NumChannels");
+        numEchoes                  = procCtrlEPI->Value<int>("NumEchoes");
+
+        epi.isEpiRefScanIntegrated = procCtrlEPI->Value<bool>("IntegratedReferenceScan");
+        epi.multibandEnabled       = procCtrlEPI->ValueStrict<bool>("MultibandEnabled");
+        epi.acquiredXRes           = procCtrlEPI->Value<int>("AcquiredXRes");
+        epi.acquiredYRes           = procCtrlEPI->Value<int>("AcquiredYRes");
+        epi.extraFramesTop         = procCtrlEPI->Value<int>("ExtraFramesTop");
+        epi.extraFramesBottom      = procCtrlEPI->Value<int>("ExtraFramesBottom");
+    }
+}
+
+/**
+ * Builds the DICOM series and image of the scan on the first call, once for
+ * all copies; a failure is kept and thrown again by later calls
+ */
+const ScanParameters::DicomValues& ScanParameters::dicomValues() const
+{
+    std::lock_guard<std::mutex> lock(dicom_->mutex);
+    if (!dicom_->built) {
+        dicom_->built = true;
+        try {
+            readDicomValues(lxData_, sliceTable, dicom_->values);
+        } catch (const std::exception& e) {
+            dicom_->error = e.what();
+        }
+    }
+    if (dicom_->error.size() > 0) {
+        throw std::runtime_error("DICOM series of the scan not available: " + dicom_->error);
+    }
+    return dicom_->values;
+}
+
+double ScanParameters::acquisitionStartSeconds() const
+{
+    try {
+        return parseDicomTime(dicomValues().image.acquisitionTime);
+    } catch (const std::runtime_error&) {
+        // The header reports the error; the time stamps start at 0
+        return 0;
+    }
+}
+
+ScanParameters makeScanParameters(GERecon::Legacy::PfilePointer &pfile)
+{
+    return ScanParameters(pfile->DownloadData(), pfile->CreateOrchestraProcessingControl());
+}
+
+ScanParameters makeScanParameters(GERecon::ScanArchivePointer &scanArchive)
+{
+    GERecon::Legacy::LxDownloadDataPointer lxData = boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(scanArchive->LoadDownloadData());
+    boost::shared_ptr<GERecon::Legacy::LxControlSource> const controlSource = boost::make_shared<GERecon::Legacy::LxControlSource>(lxData);
+
+    return ScanParameters(lxData, controlSource->CreateOrchestraProcessingControl());
+}
+
+} // namespace GEToIsmrmrd
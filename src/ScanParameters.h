@@ -0,0 +1,195 @@
+/** @file ScanParameters.h */
+#ifndef SCAN_PARAMETERS_H
+#define SCAN_PARAMETERS_H
+
+#include <memory>
+#include <string>
+
+// Orchestra
+#include <Orchestra/Common/ScanArchive.h>
+#include <Orchestra/Common/SliceInfoTable.h>
+
+#include <Orchestra/Control/ProcessingControl.h>
+
+#include <Orchestra/Legacy/Pfile.h>
+
+namespace GEToIsmrmrd {
+
+/** Number of rdb_hdr_user variables exported from the raw header */
+const int SCAN_PARAMETERS_USER_VALUES = 20;
+
+/**
+ * Typed snapshot of the Orchestra processing control values of a scan
+ *
+ * Filled once, when the raw file is opened, so that per-line conversion code
+ * and the XML header writer read plain fields instead of repeating
+ * string-keyed ProcessingControl lookups.  Only the DICOM values are left
+ * to dicomValues(), built when first asked for; copies share them.
+ */
+struct ScanParameters
+{
+    ScanParameters(GERecon::Legacy::LxDownloadDataPointer lxData,
+                   GERecon::Control::ProcessingControlPointer processingControl);
+
+    bool             isEpi;
+
+    // Acquisition type
+    bool             is3DAcquisition;
+    bool             isAssetCalibration;
+    bool             isPureCalibration;
+    bool             isEpiRampsampled;
+    bool             isCine;
+    bool             isShimData;
+    bool             isGrassData;
+
+    // Matrix and counts
+    int              numSlices;
+    int              numChannels;
+    int              numEchoes;
+    int              numBaselineViews;
+    int              numVolumes;
+    int              numAcquisitions;
+    int              acquiredXRes;
+    int              acquiredYRes;
+    int              acquiredZRes;
+    int              transformXRes;
+    int              transformYRes;
+    int              transformZRes;
+    int              imageXRes;
+    int              imageYRes;
+    int              dataSampleSize;       // in bytes
+    unsigned long long rawPassSize;
+
+    // Data layout
+    bool             evenEchoFrequencyFlip;
+    bool             oddEchoFrequencyFlip;
+    bool             evenEchoPhaseFlip;
+    bool             oddEchoPhaseFlip;
+    bool             choppedData;
+    bool             halfEcho;
+    unsigned int     rawNex;
+    bool             halfNex;
+    bool             threeQuarterNexData;
+    bool             noFrequencyWrapData;
+    bool             noPhaseWrapData;
+    bool             overscanData;
+    bool             chopX;
+    bool             chopY;
+    bool             chopZ;
+
+    // Reconstruction parameters
+    bool             createMagnitudeImages;
+    bool             createPhaseImages;
+
+    // Series / patient
+    int              seriesNumber;
+    int              examNumber;
+    int              patientEntry;
+    int              patientPosition;
+    float            scanCenter;
+    float            landmark;
+    unsigned int     coilConfigUID;
+
+    // Timing, from the legacy image header; 0 when not known
+    float            repetitionTimeUs;
+    unsigned int     echoTrainLength;           // lines per excitation, 1 when not known
+
+    int              userValues[SCAN_PARAMETERS_USER_VALUES];
+
+    /**
+     * Values of the DICOM image module read from the legacy image and exam
+     * headers, in the units of the DICOM image: times in microseconds, the
+     * frequency in MHz, the field in T, lengths in mm
+     */
+    struct ImageValues
+    {
+        std::string  echoTime, repetitionTime, inversionTime, secondEcho, imagingFrequency,
+                     magneticFieldStrength, sliceSpacing, flipAngle, echoTrainLength;
+        double       sliceThickness;
+        double       pixelSizeX;        // field of view of slice 0 over the image resolution
+        double       pixelSizeY;
+    } image;
+
+    /**
+     * Values of the DICOM series and image Orchestra derives from the scan,
+     * for the strings the raw headers do not carry: the DICOM objects are
+     * expensive to build
+     */
+    struct DicomValues
+    {
+        struct Series
+        {
+            std::string uid, description, laterality, date, time, protocolName, operatorName, ppsDescription;
+        } series;
+
+        struct Study
+        {
+            std::string uid, description, date, time, referringPhysician, accessionNumber, readingPhysician;
+        } study;
+
+        struct Patient
+        {
+            std::string name, id, birthdate, gender, age, weight, history;
+        } patient;
+
+        struct Equipment
+        {
+            std::string manufacturer, institution, station, manufacturerModel, deviceSerialNumber,
+                        softwareVersion, ppsPerformedStation, ppsPerformedLocation;
+        } equipment;
+
+        struct Image
+        {
+            Image() : acquisitionType(0), phaseEncodeDirection(0), sliceLocation(0) { }
+
+            std::string imageType, scanSequence, sequenceVariant, scanOptions, acquisitionDate,
+                        acquisitionTime, imageDate, imageTime, imageOrientation, imagePosition;
+            int          acquisitionType;
+            int          phaseEncodeDirection;
+            double       sliceLocation;
+        } image;
+    };
+
+    /**
+     * The DICOM values, built on the first call
+     *
+     * @throws std::runtime_error with Orchestra's error if they cannot be built
+     */
+    const DicomValues& dicomValues() const;
+
+    /** Acquisition start, in seconds since midnight, from the DICOM image; 0 when not known */
+    double acquisitionStartSeconds() const;
+
+    GERecon::SliceInfoTable sliceTable;
+
+    /** Values only available from the EPI control source (valid if isEpi) */
+    struct EpiParameters
+    {
+        bool         isEpiRefScanIntegrated;
+        bool         multibandEnabled;
+        int          acquiredXRes;
+        int          acquiredYRes;
+        int          extraFramesTop;
+        int          extraFramesBottom;
+    } epi;
+
+private:
+    struct DicomCache;
+
+    GERecon::Legacy::LxDownloadDataPointer lxData_;
+    std::shared_ptr<DicomCache>            dicom_;
+};
+
+/**
+ * Reads the scan parameters of a P-file
+ */
+ScanParameters makeScanParameters(GERecon::Legacy::PfilePointer &pfile);
+
+/**
+ * Reads the scan parameters of a ScanArchive
+ */
+ScanParameters makeScanParameters(GERecon::ScanArchivePointer &scanArchive);
+
+} // namespace GEToIsmrmrd
+
+#endif /* SCAN_PARAMETERS_H */
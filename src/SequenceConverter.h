@@ -58,13 +58,38 @@ using namespace GERecon::Epi;
 // ISMRMRD
 #include "ismrmrd/ismrmrd.h"
 
+// Local
+#include "AcquisitionSink.h"
+#include "ArchivePrefetcher.h"
+#include "ConversionCheckpoint.h"
+#include "ConversionOptions.h"
+#include "PacketIndex.h"
+#include "ScanParameters.h"
+
 namespace GEToIsmrmrd {
 
 class SequenceConverter
 {
 public:
     SequenceConverter() { }
-    ~SequenceConverter() { }
+    virtual ~SequenceConverter() { }
+
+    /**
+     * Converts a whole scan, handing each ISMRMRD acquisition to the sink as
+     * soon as it has been produced
+     *
+     * @param P-file or Orchestra file object
+     * @param params Processing control values of the scan, read once when it was opened
+     * @param sink Receiver of the converted acquisitions, in scan order
+     *
+     * Pure virtual function templates
+     */
+
+    virtual void convert(GERecon::Legacy::PfilePointer &pfile, const ScanParameters &params,
+                         AcquisitionSink &sink) = 0;
+
+    virtual void convert(GERecon::ScanArchivePointer &scanArchive, const ScanParameters &params,
+                         AcquisitionSink &sink) = 0;
 
     /**
      * Create the ISMRMRD acquisitions corresponding to a given view in memory
@@ -73,17 +98,95 @@ public:
      * @param view_num View number
      * @returns vector of ISMRMRD::Acquisitions
      *
-     * Pure virtual function templates
+     * Collects the output of convert() - prefer convert() for large scans.
+     */
+
+    std::vector<ISMRMRD::Acquisition> getAcquisitions(GERecon::Legacy::PfilePointer &pfile,
+                                                      unsigned int view_num)
+    {
+        std::vector<ISMRMRD::Acquisition> acqs;
+        VectorAcquisitionSink sink(acqs);
+        convert(pfile, makeScanParameters(pfile), sink);
+        return acqs;
+    }
+
+    std::vector<ISMRMRD::Acquisition> getAcquisitions(GERecon::ScanArchivePointer &scanArchive,
+                                                      unsigned int view_num)
+    {
+        std::vector<ISMRMRD::Acquisition> acqs;
+        VectorAcquisitionSink sink(acqs);
+        convert(scanArchive, makeScanParameters(scanArchive), sink);
+        return acqs;
+    }
+
+    /**
+     * Sets the threading and buffering options used by later conversions
      */
+    void setOptions(const ConversionOptions& options) { options_ = options; }
 
-    virtual std::vector<ISMRMRD::Acquisition> getAcquisitions(GERecon::Legacy::PfilePointer &pfile,
-                                                              unsigned int view_num) = 0;
+    const ConversionOptions& options() const { return options_; }
 
-    virtual std::vector<ISMRMRD::Acquisition> getAcquisitions(GERecon::ScanArchivePointer &scanArchive,
-                                                              unsigned int view_num) = 0;
+    /**
+     * Sets the packet index of the ScanArchive converted next
+     *
+     * A usable index lets the conversion skip straight past unselected
+     * packets; otherwise the conversion rebuilds it while reading.
+     */
+    void setPacketIndex(const std::shared_ptr<PacketIndex>& index) { packetIndex_ = index; }
+
+    /**
+     * Sets the prefetcher of the ScanArchive converted next, which the
+     * packet reader tells about its progress; none by default
+     */
+    void setPrefetcher(const std::shared_ptr<ArchivePrefetcher>& prefetcher) { prefetcher_ = prefetcher; }
+
+    /**
+     * Whether the ScanArchive conversion of the plugin honours a checkpoint:
+     * starts reading at its position and reports every packet written
+     */
+    virtual bool resumable() const { return false; }
+
+    /**
+     * Sets the checkpoint of the ScanArchive converted next; only used by
+     * resumable() converters, none by default
+     */
+    void setCheckpoint(const std::shared_ptr<ConversionCheckpoint>& checkpoint) { checkpoint_ = checkpoint; }
+
+protected:
+    /**
+     * Thread pool a conversion should decode packets on: the shared pool if
+     * one was given, a new pool if more than one thread was requested, and
+     * an empty pointer - convert sequentially - otherwise.
+     */
+    std::shared_ptr<ThreadPool> conversionPool() const
+    {
+        if (options_.threadPool) {
+            return options_.threadPool;
+        }
+        if (options_.threads > 1) {
+            return std::make_shared<ThreadPool>(options_.threads);
+        }
+        return std::shared_ptr<ThreadPool>();
+    }
+
+    ConversionOptions options_;
+    std::shared_ptr<PacketIndex> packetIndex_;
+    std::shared_ptr<ArchivePrefetcher> prefetcher_;
+    std::shared_ptr<ConversionCheckpoint> checkpoint_;
 };
 
 } // namespace GEToIsmrmrd
 
+/**
+ * Exports a converter from a plugin library
+ *
+ * Defines the make_<CLASSNAME>() and destroy_<CLASSNAME>() factories the
+ * PluginLoader looks up when a sequence mapping names CLASSNAME.  Use once
+ * per class, at global scope, in a source file of the plugin library.
+ */
+#define SEQUENCE_CONVERTER_FACTORY_DECLARE(CLASSNAME)                                          \
+    extern "C" GEToIsmrmrd::SequenceConverter* make_##CLASSNAME() { return new CLASSNAME(); }  \
+    extern "C" void destroy_##CLASSNAME(GEToIsmrmrd::SequenceConverter* converter) { delete converter; }
+
 #endif /* SEQUENCE_CONVERTER_H */
 
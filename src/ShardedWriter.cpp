@@ -0,0 +1,255 @@
+/** @file ShardedWriter.cpp */
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+// Local
+#include "ShardedWriter.h"
+#include "SidecarFile.h"
+#include "StringUtils.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Extension of the output name replaced by the shard suffix, with its dot; empty if none */
+std::string extension(const std::string& output)
+{
+    size_t const dot = output.find_last_of('.');
+    size_t const slash = output.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash) || dot == slash + 1) {
+        return "";
+    }
+    return output.substr(dot);
+}
+
+std::string stem(const std::string& output)
+{
+    return output.substr(0, output.size() - extension(output).size());
+}
+
+} // namespace
+
+const char* shardKeyName(ShardKey key)
+{
+    switch (key)
+    {
+    case SHARD_SLICE:      return "slice";
+    case SHARD_REPETITION: return "repetition";
+    case SHARD_CONTRAST:   return "contrast";
+    default:               return "none";
+    }
+}
+
+ShardKey parseShardKey(const std::string& name)
+{
+    ShardKey const keys[4] = { SHARD_NONE, SHARD_SLICE, SHARD_REPETITION, SHARD_CONTRAST };
+    for (size_t n = 0; n < 4; n++) {
+        if (name == shardKeyName(keys[n])) {
+            return keys[n];
+        }
+    }
+    throw std::runtime_error("Unknown shard key: " + name + " (none, slice, repetition or contrast)");
+}
+
+ShardedWriter::ShardedWriter(const std::string& output, const std::string& groupname, ShardKey key,
+                             const DatasetWriterOptions& options)
+    : output_(output), groupname_(groupname), key_(key), options_(options),
+      queueDepth_(std::max<size_t>(options.batchSize, 1)),
+      queueBytesLimit_(options.maxBatchBytes / 2), queuedBytes_(0),
+      batchBytesLimit_(options.maxBatchBytes - options.maxBatchBytes / 2), batchedBytes_(0),
+      count_(0), closed_(false)
+{
+    if (key_ == SHARD_NONE) {
+        throw std::runtime_error("A sharded output needs a shard key");
+    }
+    // The byte budget is enforced over all shards, by the shard threads
+    options_.maxBatchBytes = 0;
+}
+
+ShardedWriter::~ShardedWriter()
+{
+    // The shard writers close their files when destroyed
+    stop();
+}
+
+std::string ShardedWriter::shardPath(const std::string& output, ShardKey key, unsigned int value)
+{
+    std::ostringstream path;
+    path << stem(output) << "." << shardKeyName(key) << value << extension(output);
+    return path.str();
+}
+
+std::string ShardedWriter::manifestPath(const std::string& output)
+{
+    return stem(output) + ".shards.json";
+}
+
+void ShardedWriter::append(const ISMRMRD::Acquisition& acq)
+{
+    const ISMRMRD::EncodingCounters& idx = acq.idx();
+    unsigned int const value = (key_ == SHARD_SLICE)      ? idx.slice :
+                               (key_ == SHARD_REPETITION) ? idx.repetition : idx.contrast;
+    Shard& target = shard(value);
+    uint64_t const bytes = acq.getDataSize();
+
+    {
+        // An acquisition larger than the budget still goes, on its own
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_.wait(lock, [&] {
+            return target.error ||
+                   (target.queue.size() < queueDepth_ &&
+                    (queueBytesLimit_ == 0 || queuedBytes_ == 0 || queuedBytes_ + bytes <= queueBytesLimit_));
+        });
+        if (target.error) {
+            std::rethrow_exception(target.error);
+        }
+        target.queue.push_back(acq);
+        target.queuedBytes += bytes;
+        queuedBytes_ += bytes;
+    }
+    target.ready.notify_one();
+    count_++;
+}
+
+/** Shard of a key value, created with its file and thread on first use */
+ShardedWriter::Shard& ShardedWriter::shard(unsigned int value)
+{
+    std::map<unsigned int, std::unique_ptr<Shard> >::iterator it = shards_.find(value);
+    if (it != shards_.end()) {
+        return *it->second;
+    }
+    if (closed_) {
+        throw std::runtime_error("Sharded output " + output_ + " is closed");
+    }
+
+    std::unique_ptr<Shard> created(new Shard(shardPath(output_, key_, value), groupname_, options_));
+    created->writer.writeHeader(header_);
+    Shard& shard = *created;
+    shards_[value].swap(created);
+    shard.thread = std::thread(&ShardedWriter::drain, this, std::ref(shard));
+    return shard;
+}
+
+/**
+ * Shard thread: appends the queued acquisitions to the shard's writer, a
+ * queue at a time, then closes the file once stopped and drained.  The
+ * acquisitions taken off the queue stay charged to it until appended.
+ */
+void ShardedWriter::drain(Shard& shard)
+{
+    std::deque<ISMRMRD::Acquisition> acqs;
+    uint64_t acqsBytes = 0;
+    try {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                queuedBytes_ -= acqsBytes;
+                acqsBytes = 0;
+                space_.notify_one();
+
+                shard.ready.wait(lock, [&] { return shard.stopping || !shard.queue.empty(); });
+                if (shard.queue.empty()) {
+                    break;
+                }
+                acqs.swap(shard.queue);
+                acqsBytes = shard.queuedBytes;
+                shard.queuedBytes = 0;
+            }
+
+            for (size_t n = 0; n < acqs.size(); n++) {
+                shard.writer.append(acqs[n]);
+                chargeBatch(shard);
+            }
+            shard.written += acqs.size();
+            acqs.clear();
+        }
+        shard.writer.close();
+        batchedBytes_ -= shard.batchedBytes;
+        shard.batchedBytes = 0;
+    } catch (const std::exception&) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shard.error = std::current_exception();
+        queuedBytes_ -= acqsBytes + shard.queuedBytes;
+        shard.queuedBytes = 0;
+        shard.queue.clear();
+        batchedBytes_ -= shard.batchedBytes;
+        shard.batchedBytes = 0;
+    }
+    space_.notify_one();
+}
+
+/**
+ * Charges the write batch of a shard to the budget of all shards, flushing
+ * it if that takes the total over: the batches are never held above the
+ * budget by more than the last acquisition
+ */
+void ShardedWriter::chargeBatch(Shard& shard)
+{
+    uint64_t const batched = shard.writer.bufferedBytes();
+    uint64_t const total = (batchedBytes_ += batched - shard.batchedBytes);
+    shard.batchedBytes = batched;
+
+    if (batchBytesLimit_ > 0 && total > batchBytesLimit_) {
+        shard.writer.flush();
+        batchedBytes_ -= shard.batchedBytes;
+        shard.batchedBytes = 0;
+    }
+}
+
+/** Stops every shard thread once its queue is drained */
+void ShardedWriter::stop()
+{
+    for (std::map<unsigned int, std::unique_ptr<Shard> >::iterator it = shards_.begin(); it != shards_.end(); ++it) {
+        Shard& shard = *it->second;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shard.stopping = true;
+        }
+        shard.ready.notify_one();
+    }
+    for (std::map<unsigned int, std::unique_ptr<Shard> >::iterator it = shards_.begin(); it != shards_.end(); ++it) {
+        if (it->second->thread.joinable()) {
+            it->second->thread.join();
+        }
+    }
+    closed_ = true;
+}
+
+void ShardedWriter::close()
+{
+    if (closed_) {
+        return;
+    }
+    stop();
+
+    for (std::map<unsigned int, std::unique_ptr<Shard> >::iterator it = shards_.begin(); it != shards_.end(); ++it) {
+        if (it->second->error) {
+            std::rethrow_exception(it->second->error);
+        }
+    }
+    writeManifest();
+}
+
+/** Writes the manifest, aside and renamed, so a reader never sees a partial one */
+void ShardedWriter::writeManifest()
+{
+    saveSidecar(manifestPath(output_), "shard manifest", [this](std::ostream& out) {
+        out << "{" << std::endl;
+        out << "  \"key\": " << jsonString(shardKeyName(key_)) << "," << std::endl;
+        out << "  \"group\": " << jsonString(groupname_) << "," << std::endl;
+        out << "  \"acquisitions\": " << count_ << "," << std::endl;
+        out << "  \"shards\": [";
+        for (std::map<unsigned int, std::unique_ptr<Shard> >::const_iterator it = shards_.begin(); it != shards_.end(); ++it) {
+            out << (it == shards_.begin() ? "" : ",") << std::endl;
+            out << "    {\"file\": " << jsonString(baseName(it->second->path)) << ", "
+                << jsonString(shardKeyName(key_)) << ": " << it->first << ", "
+                << "\"acquisitions\": " << it->second->written << "}";
+        }
+        out << std::endl << "  ]" << std::endl << "}" << std::endl;
+    });
+}
+
+} // namespace GEToIsmrmrd
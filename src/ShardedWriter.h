@@ -0,0 +1,161 @@
+/** @file ShardedWriter.h */
+#ifndef SHARDED_WRITER_H
+#define SHARDED_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Local
+#include "DatasetWriter.h"
+
+namespace GEToIsmrmrd {
+
+/** Encoding counter the acquisitions of a sharded output are split by */
+enum ShardKey
+{
+    SHARD_NONE,         /**< A single output file */
+    SHARD_SLICE,        /**< One file per idx.slice */
+    SHARD_REPETITION,   /**< One file per idx.repetition */
+    SHARD_CONTRAST      /**< One file per idx.contrast (echo) */
+};
+
+/** Name of a shard key, as used in shard file names and the manifest */
+const char* shardKeyName(ShardKey key);
+
+/**
+ * Parses a shard key name: none, slice, repetition or contrast
+ *
+ * @throws std::runtime_error for any other name
+ */
+ShardKey parseShardKey(const std::string& name);
+
+/**
+ * Sink splitting the acquisitions of a conversion over several ISMRMRD files
+ *
+ * Every value of the shard key - every slice, say - goes to a file of its
+ * own, "<stem>.slice3.h5" for an output "<stem>.h5", created with the header
+ * when its first acquisition arrives.  Each file has a DatasetWriter and a
+ * thread of its own, fed through a short queue, so the batching and sample
+ * encoding of the shards overlap each other and the conversion; their HDF5
+ * calls still take hdf5Mutex() one at a time.  Within a shard the
+ * acquisitions keep their scan order.
+ *
+ * maxBatchBytes of the options, if set, bounds the shards together rather
+ * than each: half of it the bytes queued to all shards, half the write
+ * batches of all shards, a shard flushing its own batch once the total is
+ * over.  Closing the writer
+ * writes a JSON manifest, "<stem>.shards.json", listing the files with
+ * their key value and acquisition count, so shards can be picked up
+ * independently downstream.
+ *
+ * append() is called from one thread, as for any sink.
+ */
+class ShardedWriter : public AcquisitionSink
+{
+public:
+    /**
+     * @param output Output file name the shard and manifest names derive from
+     * @param groupname Group holding the header and acquisitions of every shard
+     * @param key Counter the acquisitions are split by; not SHARD_NONE
+     * @param options Settings of the writer of each shard; maxBatchBytes is
+     *                the budget of all shards together
+     */
+    ShardedWriter(const std::string& output, const std::string& groupname, ShardKey key,
+                  const DatasetWriterOptions& options = DatasetWriterOptions());
+
+    /** Stops the shard threads; close() should have been called */
+    ~ShardedWriter();
+
+    /** Sets the header every shard is created with; call before append() */
+    void writeHeader(const std::string& xml) { header_ = xml; }
+
+    /**
+     * Queues an acquisition to its shard, creating the shard first if needed
+     *
+     * @throws std::runtime_error, or the error of the shard's writer
+     */
+    void append(const ISMRMRD::Acquisition& acq);
+
+    /**
+     * Drains and closes every shard, then writes the manifest
+     *
+     * @throws the first error of a shard writer, or std::runtime_error if the
+     *         manifest cannot be written
+     */
+    void close();
+
+    /** Acquisitions appended */
+    size_t count() const { return count_; }
+
+    size_t shardCount() const { return shards_.size(); }
+
+    /** File of the shard holding key value 'value' */
+    static std::string shardPath(const std::string& output, ShardKey key, unsigned int value);
+
+    /** Manifest listing the shards of an output */
+    static std::string manifestPath(const std::string& output);
+
+private:
+    // Non-copyable
+    ShardedWriter(const ShardedWriter& other);
+    ShardedWriter& operator=(const ShardedWriter& other);
+
+    /** One output file and the thread writing it */
+    struct Shard
+    {
+        Shard(const std::string& file, const std::string& groupname, const DatasetWriterOptions& options)
+            : path(file), writer(file, groupname, options), queuedBytes(0), stopping(false), written(0),
+              batchedBytes(0) { }
+
+        std::string path;
+        DatasetWriter writer;
+
+        // Guarded by the mutex of the ShardedWriter
+        std::condition_variable ready;      // acquisitions queued, or stopping
+        std::deque<ISMRMRD::Acquisition> queue;
+        uint64_t queuedBytes;
+        bool stopping;
+        std::exception_ptr error;
+
+        // Shard thread only
+        size_t written;
+        uint64_t batchedBytes;              // last charged to the budget
+
+        std::thread thread;
+    };
+
+    Shard& shard(unsigned int value);
+    void drain(Shard& shard);
+    void chargeBatch(Shard& shard);
+    void stop();
+    void writeManifest();
+
+    std::string output_;
+    std::string groupname_;
+    ShardKey key_;
+    DatasetWriterOptions options_;
+    std::string header_;
+    size_t queueDepth_;
+
+    std::mutex mutex_;                  // queues of all shards
+    std::condition_variable space_;     // room in the queues, or a shard failed
+    uint64_t queueBytesLimit_;          // bytes queued to all shards, 0 for no limit
+    uint64_t queuedBytes_;
+    uint64_t batchBytesLimit_;          // bytes in the write batches of all shards, 0 for no limit
+    std::atomic<uint64_t> batchedBytes_;
+
+    std::map<unsigned int, std::unique_ptr<Shard> > shards_;
+    size_t count_;
+    bool closed_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* SHARDED_WRITER_H */
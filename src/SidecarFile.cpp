@@ -0,0 +1,73 @@
+/** @file SidecarFile.cpp */
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+// Local
+#include "SidecarFile.h"
+
+namespace GEToIsmrmrd {
+
+void writeSidecarString(std::ostream& out, const std::string& value)
+{
+    writeSidecarValue(out, static_cast<uint32_t>(value.size()));
+    out.write(value.data(), value.size());
+}
+
+bool readSidecarString(std::istream& in, std::string& value, uint32_t maxLength)
+{
+    uint32_t length = 0;
+    if (!readSidecarValue(in, length) || length > maxLength) {
+        return false;
+    }
+    value.assign(length, '\0');
+    return length == 0 || static_cast<bool>(in.read(&value[0], length));
+}
+
+void writeSidecarHeader(std::ostream& out, const char* magic, uint32_t version)
+{
+    out.write(magic, SIDECAR_MAGIC_LENGTH);
+    writeSidecarValue(out, version);
+}
+
+bool readSidecarHeader(std::istream& in, const char* magic, uint32_t version)
+{
+    char found[SIDECAR_MAGIC_LENGTH];
+    uint32_t foundVersion = 0;
+    return in.read(found, sizeof(found)) && memcmp(found, magic, sizeof(found)) == 0 &&
+           readSidecarValue(in, foundVersion) && foundVersion == version;
+}
+
+void saveSidecar(const std::string& path, const std::string& what,
+                 const std::function<void(std::ostream&)>& body)
+{
+    std::string partial = path + ".part";
+    {
+        std::ofstream out(partial.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Failed to open " + what + " " + partial);
+        }
+
+        body(out);
+
+        out.close();
+        if (!out) {
+            std::remove(partial.c_str());
+            throw std::runtime_error("Failed to write " + what + " " + partial);
+        }
+    }
+
+    if (std::rename(partial.c_str(), path.c_str()) != 0) {
+        std::remove(partial.c_str());
+        throw std::runtime_error("Failed to replace " + what + " " + path);
+    }
+}
+
+void removeSidecar(const std::string& path)
+{
+    std::remove(path.c_str());
+    std::remove((path + ".part").c_str());
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,63 @@
+/** @file SidecarFile.h */
+#ifndef SIDECAR_FILE_H
+#define SIDECAR_FILE_H
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace GEToIsmrmrd {
+
+/*
+ * I/O of the sidecar files kept next to archives and outputs: the packet
+ * index, the conversion checkpoint and the shard manifest.  The binary ones
+ * start with an 8 byte magic and a 32 bit version, then hold values in host
+ * byte order and strings prefixed by their 32 bit length.
+ */
+
+/** Length of the magic starting a sidecar */
+const size_t SIDECAR_MAGIC_LENGTH = 8;
+
+template <typename T>
+void writeSidecarValue(std::ostream& out, const T& value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/** @returns false on a short read */
+template <typename T>
+bool readSidecarValue(std::istream& in, T& value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+void writeSidecarString(std::ostream& out, const std::string& value);
+
+/** @returns false on a short read, or if the string is longer than maxLength */
+bool readSidecarString(std::istream& in, std::string& value, uint32_t maxLength);
+
+void writeSidecarHeader(std::ostream& out, const char* magic, uint32_t version);
+
+/** @returns false unless the sidecar starts with this magic and version */
+bool readSidecarHeader(std::istream& in, const char* magic, uint32_t version);
+
+/**
+ * Writes a sidecar aside, to path + ".part", then renames it over path, so
+ * a reader never sees a partial one and a crash never leaves one
+ *
+ * @param path Sidecar path
+ * @param what Name of the sidecar in errors, "packet index" say
+ * @param body Writes the contents, header included
+ * @throws std::runtime_error if it cannot be written or renamed
+ */
+void saveSidecar(const std::string& path, const std::string& what,
+                 const std::function<void(std::ostream&)>& body);
+
+/** Removes a sidecar and any partial one left aside */
+void removeSidecar(const std::string& path);
+
+} // namespace GEToIsmrmrd
+
+#endif /* SIDECAR_FILE_H */
@@ -0,0 +1,36 @@
+/** @file StringUtils.cpp */
+#include <cstdio>
+#include <sstream>
+
+// Local
+#include "StringUtils.h"
+
+namespace GEToIsmrmrd {
+
+std::string baseName(const std::string& path)
+{
+    size_t const slash = path.find_last_of('/');
+    return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+std::string jsonString(const std::string& s)
+{
+    std::ostringstream out;
+    out << '"';
+    for (size_t n = 0; n < s.size(); n++) {
+        char c = s[n];
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,17 @@
+/** @file StringUtils.h */
+#ifndef STRING_UTILS_H
+#define STRING_UTILS_H
+
+#include <string>
+
+namespace GEToIsmrmrd {
+
+/** Last component of a path: what follows its last '/' */
+std::string baseName(const std::string& path);
+
+/** s as a JSON string: quoted, with quotes, backslashes and control characters escaped */
+std::string jsonString(const std::string& s);
+
+} // namespace GEToIsmrmrd
+
+#endif /* STRING_UTILS_H */
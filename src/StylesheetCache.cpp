@@ -0,0 +1,65 @@
+/** @file StylesheetCache.cpp */
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <libxml/parser.h>
+#include <libxslt/xslt.h>
+#include <libxslt/xsltInternals.h>
+
+// Local
+#include "StylesheetCache.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+typedef std::unordered_map<std::string, std::shared_ptr<xsltStylesheet> > StylesheetMap;
+
+std::mutex g_cacheMutex;
+StylesheetMap g_stylesheets;
+std::once_flag g_parserSetup;
+
+void setupParser()
+{
+    xmlSubstituteEntitiesDefault(1);
+    xmlLoadExtDtdDefaultValue = 1;
+}
+
+} // namespace
+
+std::shared_ptr<xsltStylesheet> StylesheetCache::get(const std::string& sheet)
+{
+    std::call_once(g_parserSetup, setupParser);
+
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+
+    StylesheetMap::const_iterator cached = g_stylesheets.find(sheet);
+    if (cached != g_stylesheets.end()) {
+        return cached->second;
+    }
+
+    // Normal pointer here because the xsltStylesheet takes ownership
+    xmlDocPtr stylesheet_doc = xmlParseMemory(sheet.c_str(), sheet.size());
+    if (NULL == stylesheet_doc) {
+        throw std::runtime_error("Failed to parse stylesheet");
+    }
+
+    std::shared_ptr<xsltStylesheet> compiled = std::shared_ptr<xsltStylesheet>(
+            xsltParseStylesheetDoc(stylesheet_doc), xsltFreeStylesheet);
+    if (!compiled) {
+        xmlFreeDoc(stylesheet_doc);
+        throw std::runtime_error("Failed to parse stylesheet");
+    }
+
+    g_stylesheets[sheet] = compiled;
+    return compiled;
+}
+
+void StylesheetCache::clear()
+{
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    g_stylesheets.clear();
+}
+
+} // namespace GEToIsmrmrd
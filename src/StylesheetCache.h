@@ -0,0 +1,37 @@
+/** @file StylesheetCache.h */
+#ifndef STYLESHEET_CACHE_H
+#define STYLESHEET_CACHE_H
+
+#include <memory>
+#include <string>
+
+// Libxslt forward declaration
+struct _xsltStylesheet;
+
+namespace GEToIsmrmrd {
+
+/**
+ * Process-wide cache of compiled XSLT stylesheets
+ *
+ * Stylesheets are looked up by their content, so every converter using the
+ * same stylesheet - whichever file or string it came from - shares one
+ * compiled copy.  libxslt allows a compiled stylesheet to be applied by
+ * several threads at once.
+ */
+class StylesheetCache
+{
+public:
+    /**
+     * @param sheet Stylesheet contents
+     * @returns compiled stylesheet, compiled on first use
+     * @throws std::runtime_error if the stylesheet cannot be parsed
+     */
+    static std::shared_ptr<struct _xsltStylesheet> get(const std::string& sheet);
+
+    /** Drops all cached stylesheets not in use elsewhere */
+    static void clear();
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* STYLESHEET_CACHE_H */
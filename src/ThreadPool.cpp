@@ -0,0 +1,67 @@
+/** @file ThreadPool.cpp */
+#include "ThreadPool.h"
+
+namespace GEToIsmrmrd {
+
+ThreadPool::ThreadPool(unsigned int threads)
+    : stopping_(false)
+{
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    for (unsigned int n = 0; n < threads; n++) {
+        workers_.push_back(std::thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+
+    for (size_t n = 0; n < workers_.size(); n++) {
+        workers_[n].join();
+    }
+}
+
+void ThreadPool::submit(const std::function<void ()>& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(task);
+    }
+    cond_.notify_one();
+}
+
+unsigned int ThreadPool::hardwareThreads()
+{
+    unsigned int threads = std::thread::hardware_concurrency();
+    return (threads > 0) ? threads : 1;
+}
+
+void ThreadPool::work()
+{
+    while (true)
+    {
+        std::function<void ()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+
+            // Drain the queue before stopping so no submitted task is lost
+            if (tasks_.empty()) {
+                return;
+            }
+
+            task = tasks_.front();
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,50 @@
+/** @file ThreadPool.h */
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace GEToIsmrmrd {
+
+/**
+ * Fixed set of worker threads running queued tasks
+ *
+ * A single pool may be shared by several concurrent conversions.  Tasks must
+ * not block waiting on other tasks of the same pool.
+ */
+class ThreadPool
+{
+public:
+    ThreadPool(unsigned int threads);
+    ~ThreadPool();
+
+    /** Queues a task to be run by one of the workers */
+    void submit(const std::function<void ()>& task);
+
+    unsigned int size() const { return workers_.size(); }
+
+    /** Number of hardware threads, or 1 if that cannot be determined */
+    static unsigned int hardwareThreads();
+
+private:
+    // Non-copyable
+    ThreadPool(const ThreadPool& other);
+    ThreadPool& operator=(const ThreadPool& other);
+
+    void work();
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void ()> > tasks_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stopping_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,151 @@
+/** @file ViewLayout.h */
+#ifndef VIEW_LAYOUT_H
+#define VIEW_LAYOUT_H
+
+#include <complex>
+#include <cstddef>
+
+// Local
+#include "SampleKernels.h"
+
+namespace GEToIsmrmrd {
+
+/** Which lines (phase encoding views) of a scan change sign while being copied */
+enum ChopMode
+{
+    CHOP_NONE,          /**< No line is negated */
+    CHOP_ODD_LINES,     /**< Lines 1, 3, 5... are negated (un-chop of data not chopped in Y) */
+    CHOP_EVEN_LINES     /**< Lines 0, 2, 4... are negated (EPI RF unchop) */
+};
+
+/**
+ * Compile-time description of how a sequence lays out its views
+ *
+ * @tparam Chop Lines negated while copying
+ * @tparam RowFlip Views are reversed and/or negated per view, as recorded in
+ *                 the row flip tables of the ViewSource
+ * @tparam ReverseY Views are stored last to first (negative view skip)
+ */
+template <ChopMode Chop, bool RowFlip, bool ReverseY>
+struct LayoutTraits
+{
+    static const ChopMode chop     = Chop;
+    static const bool     rowFlip  = RowFlip;
+    static const bool     reverseY = ReverseY;
+};
+
+/** Runtime counterpart of LayoutTraits, from which selectViewCopy() picks the instantiation */
+struct SequenceLayout
+{
+    SequenceLayout() : chop(CHOP_NONE), rowFlip(false), reverseY(false) { }
+    SequenceLayout(ChopMode c, bool flip, bool reverse) : chop(c), rowFlip(flip), reverseY(reverse) { }
+
+    ChopMode chop;
+    bool     rowFlip;
+    bool     reverseY;
+};
+
+/**
+ * Views of a decoded packet or k-space matrix, addressed as
+ * data[x * sampleStride + channel * channelStride + view * viewStride]
+ */
+struct ViewSource
+{
+    ViewSource()
+        : data(NULL), sampleStride(1), channelStride(0), viewStride(0), samples(0), views(0),
+          firstLine(0), channels(NULL), channelCount(0), reverse(NULL), negate(NULL) { }
+
+    const std::complex<float>* data;    /**< Sample 0 of channel 0 of view 0 */
+    std::ptrdiff_t sampleStride;        /**< In samples, may be negative */
+    std::ptrdiff_t channelStride;       /**< In samples */
+    std::ptrdiff_t viewStride;          /**< In samples */
+    size_t         samples;             /**< Samples per view and channel */
+    int            views;               /**< Views to copy */
+    int            firstLine;           /**< Line number of view 0, for the chop parity */
+    const unsigned int* channels;       /**< Source channels to copy, in output order */
+    size_t         channelCount;
+    const char*    reverse;             /**< Row flip: view is reversed along x (RowFlip layouts only) */
+    const char*    negate;              /**< Row flip: view changes sign (RowFlip layouts only) */
+};
+
+/** Copies every view of a ViewSource into its acquisition */
+typedef void (*ViewCopyFunction)(const ViewSource& source, std::complex<float>* const* lines);
+
+/**
+ * Copies views into acquisition data, fully specialised for one layout
+ *
+ * The chop, row flip and Y order decisions are made at compile time, so the
+ * only per-view work left is locating the source view; the samples are moved
+ * by the vector kernels of SampleKernels.h.  lines[v] receives view v, one
+ * channel after the other (as in ISMRMRD::Acquisition::getDataPtr()).
+ */
+template <typename Traits>
+void copyViews(const ViewSource& source, std::complex<float>* const* lines)
+{
+    const size_t samples = source.samples;
+    const std::ptrdiff_t lastSample = static_cast<std::ptrdiff_t>(samples) - 1;
+
+    for (int view = 0; view < source.views; view++)
+    {
+        const int srcView = Traits::reverseY ? (source.views - 1 - view) : view;
+        const std::complex<float>* src = source.data + srcView * source.viewStride;
+        std::ptrdiff_t stride = source.sampleStride;
+
+        const int line = source.firstLine + view;
+        bool negate = (Traits::chop == CHOP_ODD_LINES)  ? (line % 2 == 1) :
+                      (Traits::chop == CHOP_EVEN_LINES) ? (line % 2 == 0) : false;
+
+        if (Traits::rowFlip)
+        {
+            // The flip tables describe the views in their output order
+            if (source.reverse[view]) {
+                src += lastSample * stride;
+                stride = -stride;
+            }
+            negate = (negate != (source.negate[view] != 0));
+        }
+
+        std::complex<float>* dst = lines[view];
+        for (size_t n = 0; n < source.channelCount; n++, dst += samples) {
+            gatherSamples(dst, src + source.channels[n] * source.channelStride, stride, samples, negate);
+        }
+    }
+}
+
+namespace detail {
+
+template <ChopMode Chop, bool RowFlip>
+ViewCopyFunction selectViewCopy(bool reverseY)
+{
+    return reverseY ? &copyViews<LayoutTraits<Chop, RowFlip, true> >
+                    : &copyViews<LayoutTraits<Chop, RowFlip, false> >;
+}
+
+template <ChopMode Chop>
+ViewCopyFunction selectViewCopy(bool rowFlip, bool reverseY)
+{
+    return rowFlip ? selectViewCopy<Chop, true>(reverseY) : selectViewCopy<Chop, false>(reverseY);
+}
+
+} // namespace detail
+
+/**
+ * Instantiation of copyViews() for a runtime layout; meant to be called once
+ * per scan (or once per layout variant of a scan), not per view
+ */
+inline ViewCopyFunction selectViewCopy(const SequenceLayout& layout)
+{
+    switch (layout.chop)
+    {
+    case CHOP_ODD_LINES:
+        return detail::selectViewCopy<CHOP_ODD_LINES>(layout.rowFlip, layout.reverseY);
+    case CHOP_EVEN_LINES:
+        return detail::selectViewCopy<CHOP_EVEN_LINES>(layout.rowFlip, layout.reverseY);
+    default:
+        return detail::selectViewCopy<CHOP_NONE>(layout.rowFlip, layout.reverseY);
+    }
+}
+
+} // namespace GEToIsmrmrd
+
+#endif /* VIEW_LAYOUT_H */
@@ -0,0 +1,253 @@
+/** @file WatchService.cpp */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local
+#include "WatchService.h"
+
+namespace GEToIsmrmrd {
+
+namespace {
+
+/** Events of a file that is complete: closed after writing, or renamed into the inbox */
+const uint32_t LANDED_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO;
+
+bool isRegularFile(const std::string& path)
+{
+   struct stat info;
+   return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+bool sameDirectory(const std::string& a, const std::string& b)
+{
+   struct stat infoA, infoB;
+   return stat(a.c_str(), &infoA) == 0 && stat(b.c_str(), &infoB) == 0 &&
+          infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+}
+
+} // namespace
+
+WatchService::WatchService(const std::string& inbox, const BatchOptions& options)
+   : inbox_(inbox), output_(options.grouped ? "" : options.output), jobs_(std::max(options.jobs, 1u)),
+     converter_(options), stopping_(false)
+{
+   if (pipe2(stopPipe_, O_CLOEXEC | O_NONBLOCK) != 0) {
+      throw std::runtime_error(std::string("Failed to create the stop pipe: ") + strerror(errno));
+   }
+}
+
+WatchService::~WatchService()
+{
+   close(stopPipe_[0]);
+   close(stopPipe_[1]);
+}
+
+void WatchService::stop()
+{
+   char byte = 0;
+   ssize_t written = write(stopPipe_[1], &byte, 1);
+   (void)written;   // a full pipe already holds a stop request
+}
+
+unsigned int WatchService::run()
+{
+   if (!BatchConverter::isDirectory(inbox_)) {
+      throw std::runtime_error("Inbox " + inbox_ + " is not a directory");
+   }
+   if (!converter_.prepareOutput()) {
+      throw std::runtime_error("Failed to prepare the output of the inbox conversions");
+   }
+   if (output_.size() > 0 && sameDirectory(output_, inbox_)) {
+      // Every output file landing would be taken for an input
+      throw std::runtime_error("The output directory must not be the inbox");
+   }
+
+   int watchFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+   if (watchFd < 0) {
+      throw std::runtime_error(std::string("Failed to initialise inotify: ") + strerror(errno));
+   }
+   // Watching before scanning, so a file landing in between is not missed
+   if (inotify_add_watch(watchFd, inbox_.c_str(), LANDED_EVENTS | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+      int error = errno;
+      close(watchFd);
+      throw std::runtime_error("Failed to watch " + inbox_ + ": " + strerror(error));
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      stopping_ = false;
+   }
+
+   std::vector<std::thread> workers;
+   for (unsigned int n = 0; n < jobs_; n++) {
+      workers.push_back(std::thread(&WatchService::convertQueued, this));
+   }
+
+   std::cout << "Watching " << inbox_ << " for raw files" << std::endl;
+   scanInbox();
+
+   std::string error;
+   while (true)
+   {
+      struct pollfd fds[2];
+      fds[0].fd = watchFd;
+      fds[0].events = POLLIN;
+      fds[1].fd = stopPipe_[0];
+      fds[1].events = POLLIN;
+
+      if (poll(fds, 2, -1) < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         error = std::string("Failed to poll inotify: ") + strerror(errno);
+         break;
+      }
+      if (fds[1].revents != 0) {
+         break;
+      }
+      if (fds[0].revents != 0) {
+         try {
+            readEvents(watchFd);
+         } catch (const std::exception& e) {
+            error = e.what();
+            break;
+         }
+      }
+   }
+   close(watchFd);
+
+   {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      stopping_ = true;
+      queue_.clear();
+      queued_.clear();
+   }
+   queueReady_.notify_all();
+   for (size_t n = 0; n < workers.size(); n++) {
+      workers[n].join();
+   }
+
+   char drained[64];
+   while (read(stopPipe_[0], drained, sizeof(drained)) > 0) {
+   }
+
+   if (error.size() > 0) {
+      throw std::runtime_error(error);
+   }
+   std::cout << "Stopped watching " << inbox_ << std::endl;
+   return converter_.failures();
+}
+
+/** Queues the files of the inbox, in name order, that were not converted before */
+void WatchService::scanInbox()
+{
+   std::vector<std::string> inputs;
+   try {
+      inputs = BatchConverter::collectInputs(std::vector<std::string>(1, inbox_), "");
+   } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return;
+   }
+
+   for (size_t n = 0; n < inputs.size(); n++) {
+      if (!converter_.converted(inputs[n])) {
+         enqueue(inputs[n].substr(inbox_.size() + 1));
+      }
+   }
+}
+
+/**
+ * Queues the files of the pending inotify events
+ *
+ * @throws std::runtime_error if the inbox itself went away
+ */
+void WatchService::readEvents(int watchFd)
+{
+   // Aligned for struct inotify_event, as inotify(7) advises
+   char buffer[64 * 1024] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+   while (true)
+   {
+      ssize_t length = read(watchFd, buffer, sizeof(buffer));
+      if (length <= 0) {
+         if (length < 0 && errno == EINTR) {
+            continue;
+         }
+         return;
+      }
+
+      for (char* p = buffer; p < buffer + length; )
+      {
+         const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+         p += sizeof(struct inotify_event) + event->len;
+
+         if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+            throw std::runtime_error("Inbox " + inbox_ + " was removed or moved");
+         }
+         if (event->mask & IN_Q_OVERFLOW) {
+            // Events were lost: look at everything again
+            scanInbox();
+            continue;
+         }
+         if ((event->mask & LANDED_EVENTS) && event->len > 0) {
+            enqueue(event->name);
+         }
+      }
+   }
+}
+
+void WatchService::enqueue(const std::string& name)
+{
+   if (name.empty() || name[0] == '.') {
+      return;
+   }
+
+   std::string path = inbox_ + "/" + name;
+   if (!isRegularFile(path)) {
+      return;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      if (!queued_.insert(path).second) {
+         return;
+      }
+      queue_.push_back(path);
+   }
+   queueReady_.notify_one();
+}
+
+/** Worker: converts queued inputs until the service stops */
+void WatchService::convertQueued()
+{
+   while (true)
+   {
+      std::string input;
+      {
+         std::unique_lock<std::mutex> lock(queueMutex_);
+         queueReady_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+         if (stopping_) {
+            return;
+         }
+         input = queue_.front();
+         queue_.pop_front();
+         // Landing again from here on converts it again
+         queued_.erase(input);
+      }
+
+      converter_.convert(input);
+   }
+}
+
+} // namespace GEToIsmrmrd
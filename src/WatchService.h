@@ -0,0 +1,76 @@
+/** @file WatchService.h */
+#ifndef WATCH_SERVICE_H
+#define WATCH_SERVICE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+
+// Local
+#include "BatchConverter.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Resident conversion service watching a drop directory
+ *
+ * Every raw file closed after writing in, or moved into, the inbox is
+ * converted as soon as it lands, by up to 'jobs' conversions at a time.  The
+ * process keeps the Orchestra SDK, the compiled stylesheets, the sequence
+ * plugins and the packet decoding pool warm between inputs, so a scan costs
+ * its conversion time only.  Files already in the inbox when the service
+ * starts are converted first, unless their output is up to date; names
+ * starting with '.' are ignored, so writers can land files by renaming a
+ * hidden temporary file.
+ */
+class WatchService
+{
+public:
+   /**
+    * @param inbox Directory watched for raw files
+    * @param options Output and conversion settings, as for a batch
+    */
+   WatchService(const std::string& inbox, const BatchOptions& options);
+   ~WatchService();
+
+   /**
+    * Watches the inbox and converts what lands in it until stop() is called;
+    * running conversions are finished, queued ones dropped
+    *
+    * @returns number of inputs that failed to convert
+    * @throws std::runtime_error if the inbox cannot be watched
+    */
+   unsigned int run();
+
+   /** Makes run() return; async-signal-safe, so it can be called from a signal handler */
+   void stop();
+
+private:
+   // Non-copyable
+   WatchService(const WatchService& other);
+   WatchService& operator=(const WatchService& other);
+
+   void scanInbox();
+   void readEvents(int watchFd);
+   void enqueue(const std::string& name);
+   void convertQueued();
+
+   std::string inbox_;
+   std::string output_;   // output directory, empty if grouped
+   unsigned int jobs_;
+   BatchConverter converter_;
+
+   int stopPipe_[2];   // stop() writes to [1], waking the event loop polling [0]
+
+   std::mutex queueMutex_;
+   std::condition_variable queueReady_;
+   std::deque<std::string> queue_;
+   std::set<std::string> queued_;   // paths in queue_, so repeated events convert once
+   bool stopping_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* WATCH_SERVICE_H */
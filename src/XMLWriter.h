@@ -2,89 +2,90 @@
 #ifndef XMLWriter_h
 #define XMLWriter_h
 
-extern "C" {
-#include <libxml/xmlwriter.h>
-}
+#include <libxml/parser.h>
+#include <libxml/tree.h>
 
+#include <cstdio>
+#include <memory>
 #include <string>
 #include <stdexcept>
-
+#include <vector>
+
+/**
+ * Builds an XML document in memory, element by element
+ *
+ * The document is kept as a libxml2 tree, so it can be handed to libxslt
+ * with getDocument() without being serialised and parsed again.
+ */
 class XMLWriter {
 public:
-    XMLWriter() {
-        int rc = 0;
-        xmlTextWriterPtr writer;
-        xmlBufferPtr buf;
-
+    XMLWriter() : doc_(NULL), current_(NULL) {
         /* initialize libxml and check for a version mismatch */
         LIBXML_TEST_VERSION;
-
-        /* create the XML buffer, to which the XML doc will be written */
-        buf = xmlBufferCreate();
-        if (buf == NULL) {
-            throw std::runtime_error("Error creating xml buffer");
-        }
-
-        /* create new XmlWriter with no compression */
-        writer = xmlNewTextWriterMemory(buf, 0);
-        if (writer == NULL) {
-            throw std::runtime_error("Error creating the xml writer");
-        }
-
-        /* turn on auto indentation (which is not guaranteed to work) */
-        rc = xmlTextWriterSetIndent(writer, 1);
-        if (rc < 0) {
-            throw std::runtime_error("Error enabling xml indentation");
-        }
-        rc = xmlTextWriterSetIndentString(writer, BAD_CAST "    ");
-        if (rc < 0) {
-            throw std::runtime_error("Error enabling xml indent string");
-        }
-
-        writer_ = writer;
-        buffer_ = buf;
     }
 
     ~XMLWriter() {
-        xmlFreeTextWriter(writer_);
-        xmlBufferFree(buffer_);
-        xmlCleanupParser();
+        if (doc_ != NULL) {
+            xmlFreeDoc(doc_);
+        }
     }
 
     void startDocument() {
-        /* start doc. version=1.0, encoding=default, standalone=default */
-        int rc = xmlTextWriterStartDocument(writer_, NULL, NULL, NULL);
-        if (rc < 0) {
+        if (doc_ != NULL) {
+            xmlFreeDoc(doc_);
+        }
+        doc_ = xmlNewDoc(BAD_CAST "1.0");
+        if (doc_ == NULL) {
             throw std::runtime_error("Error starting xml document");
         }
+        current_ = NULL;
     }
 
     void endDocument() {
-        int rc = xmlTextWriterEndDocument(writer_);
-        if (rc < 0) {
+        if (doc_ == NULL || current_ != NULL) {
             throw std::runtime_error("Error ending xml document");
         }
     }
 
     void startElement(const std::string& name) {
-        int rc = xmlTextWriterStartElement(writer_, BAD_CAST name.c_str());
-        if (rc < 0) {
+        xmlNodePtr node = NULL;
+        if (doc_ == NULL) {
             throw std::runtime_error("Error starting xml element" + name);
+        } else if (current_ == NULL) {
+            node = xmlNewDocNode(doc_, NULL, BAD_CAST name.c_str(), NULL);
+            if (node != NULL) {
+                xmlDocSetRootElement(doc_, node);
+            }
+        } else {
+            node = xmlNewChild(current_, NULL, BAD_CAST name.c_str(), NULL);
         }
+        if (node == NULL) {
+            throw std::runtime_error("Error starting xml element" + name);
+        }
+        current_ = node;
     }
 
     void endElement() {
-        int rc = xmlTextWriterEndElement(writer_);
-        if (rc < 0) {
+        if (current_ == NULL) {
             throw std::runtime_error("Error ending xml element");
         }
+        current_ = (current_->parent != NULL && current_->parent->type == XML_ELEMENT_NODE) ?
+                   current_->parent : NULL;
     }
 
     template <typename... Args>
     void formatElement(const std::string& name, const std::string& format, Args... args)
     {
-        int rc = xmlTextWriterWriteFormatElement(writer_, BAD_CAST name.c_str(), format.c_str(), args...);
-        if (rc < 0) {
+        int len = snprintf(NULL, 0, format.c_str(), args...);
+        if (len < 0) {
+            throw std::runtime_error("Error formatting xml element");
+        }
+        std::vector<char> text(len + 1);
+        snprintf(&text[0], text.size(), format.c_str(), args...);
+
+        // xmlNewTextChild escapes the content, as the text writer did
+        if (current_ == NULL ||
+            xmlNewTextChild(current_, NULL, BAD_CAST name.c_str(), BAD_CAST &text[0]) == NULL) {
             throw std::runtime_error("Error formatting xml element");
         }
     }
@@ -94,15 +95,32 @@ public:
     }
 
     std::string getXML() {
-        return std::string((char *) xmlBufferContent(buffer_));
+        xmlChar* buffer = NULL;
+        int size = 0;
+        xmlDocDumpFormatMemory(doc_, &buffer, &size, 1);
+        if (buffer == NULL) {
+            throw std::runtime_error("Error serialising xml document");
+        }
+        std::string xml((char *) buffer, size);
+        xmlFree(buffer);
+        return xml;
     }
 
-    //xmlTextWriterPtr getWriter(void) { return writer_; }
-    //xmlBufferPtr getBuffer(void) { return buffer_; }
+    /** Hands the document over to the caller; the writer is empty afterwards */
+    std::shared_ptr<xmlDoc> getDocument() {
+        std::shared_ptr<xmlDoc> doc(doc_, xmlFreeDoc);
+        doc_ = NULL;
+        current_ = NULL;
+        return doc;
+    }
 
 private:
-    xmlTextWriterPtr writer_;
-    xmlBufferPtr buffer_;
+    // Non-copyable
+    XMLWriter(const XMLWriter& other);
+    XMLWriter& operator=(const XMLWriter& other);
+
+    xmlDocPtr doc_;
+    xmlNodePtr current_;
 };
 
 #endif  // XMLWriter_h
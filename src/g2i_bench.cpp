@@ -0,0 +1,427 @@
+/** @file g2i_bench.cpp */
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// Boost
+#include <boost/program_options.hpp>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// GE
+#include "AcquisitionSink.h"
+#include "DatasetWriter.h"
+#include "GERawConverter.h"
+#include "Profiler.h"
+#include "SampleKernels.h"
+#include "StringUtils.h"
+#include "ThreadPool.h"
+
+namespace po = boost::program_options;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+   return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * Peak resident set size of the process so far, in KiB.  Every input is
+ * benchmarked in a process of its own, so this is the peak of that input.
+ */
+long peakRssKiB()
+{
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) != 0) {
+      return 0;
+   }
+   return usage.ru_maxrss;
+}
+
+/** Timings of one stage over all repetitions */
+struct StageTiming
+{
+   StageTiming() : best(0), total(0), runs(0) { }
+
+   void add(double seconds)
+   {
+      best = (runs == 0) ? seconds : std::min(best, seconds);
+      total += seconds;
+      runs++;
+   }
+
+   double best;
+   double total;
+   int    runs;
+};
+
+/** Everything measured for one input file */
+struct InputResult
+{
+   InputResult() : inputBytes(0), acquisitions(0), sampleBytes(0), peakRss(0)
+   {
+      std::fill(profileCounters, profileCounters + GEToIsmrmrd::PROFILE_COUNTER_COUNT, 0);
+   }
+
+   std::string file;
+   std::string plugin;
+   std::string error;
+   size_t      inputBytes;
+   size_t      acquisitions;
+   size_t      sampleBytes;
+   long        peakRss;
+
+   StageTiming endToEnd;
+   std::vector<std::pair<std::string, StageTiming> > stages;
+
+   // Profiler counters of the last conversion
+   uint64_t profileCounters[GEToIsmrmrd::PROFILE_COUNTER_COUNT];
+
+   StageTiming& stage(const std::string& name)
+   {
+      for (size_t n = 0; n < stages.size(); n++) {
+         if (stages[n].first == name) {
+            return stages[n].second;
+         }
+      }
+      stages.push_back(std::make_pair(name, StageTiming()));
+      return stages.back().second;
+   }
+};
+
+struct BenchOptions
+{
+   std::string stylesheet;
+   std::string config;
+   std::string outputDir;
+   int repetitions;
+   GEToIsmrmrd::ConversionOptions conversion;
+   GEToIsmrmrd::DatasetWriterOptions writer;
+};
+
+std::unique_ptr<GEToIsmrmrd::GERawConverter> openConverter(const InputResult& result, const BenchOptions& options)
+{
+   std::unique_ptr<GEToIsmrmrd::GERawConverter> converter(
+         new GEToIsmrmrd::GERawConverter(result.file, result.plugin, false, options.config));
+   converter->setConversionOptions(options.conversion);
+   if (options.stylesheet.size() > 0) {
+      converter->useStylesheetFilename(options.stylesheet);
+   }
+   return converter;
+}
+
+/** Forwards acquisitions to the writer, counting their sample bytes */
+class CountingSink : public GEToIsmrmrd::AcquisitionSink
+{
+public:
+   CountingSink(GEToIsmrmrd::AcquisitionSink& sink) : sink_(sink), sampleBytes_(0) { }
+
+   void append(const ISMRMRD::Acquisition& acq)
+   {
+      sampleBytes_ += acq.getDataSize();
+      sink_.append(acq);
+   }
+
+   void reserve(size_t count) { sink_.reserve(count); }
+
+   size_t sampleBytes() const { return sampleBytes_; }
+
+private:
+   GEToIsmrmrd::AcquisitionSink& sink_;
+   size_t sampleBytes_;
+};
+
+/**
+ * Converts the input the way ge2ismrmrd does: acquisitions streamed
+ * straight into the HDF5 writer.  Opening the converter is timed here, every
+ * other stage by the Profiler timers around the real decode, copy, geometry
+ * and write calls.
+ */
+void runConversion(InputResult& result, const BenchOptions& options, const std::string& outfile)
+{
+   std::remove(outfile.c_str());
+
+   GEToIsmrmrd::Profiler& profiler = GEToIsmrmrd::Profiler::instance();
+   profiler.enable();
+
+   Clock::time_point start = Clock::now();
+   std::unique_ptr<GEToIsmrmrd::GERawConverter> converter = openConverter(result, options);
+   double openSeconds = secondsSince(start);
+   std::string xml_header = converter->getIsmrmrdXMLHeader();
+
+   GEToIsmrmrd::DatasetWriter writer(outfile, "dataset", options.writer);
+   CountingSink sink(writer);
+   writer.writeHeader(xml_header);
+   converter->convert(sink);
+   writer.close();
+   result.endToEnd.add(secondsSince(start));
+
+   profiler.disable();
+   result.stage("open").add(openSeconds);
+   for (int n = 0; n < GEToIsmrmrd::PROFILE_STAGE_COUNT; n++) {
+      GEToIsmrmrd::ProfileStage stage = static_cast<GEToIsmrmrd::ProfileStage>(n);
+      result.stage(GEToIsmrmrd::Profiler::stageName(stage)).add(profiler.seconds(stage));
+   }
+   for (int n = 0; n < GEToIsmrmrd::PROFILE_COUNTER_COUNT; n++) {
+      result.profileCounters[n] = profiler.counter(static_cast<GEToIsmrmrd::ProfileCounter>(n));
+   }
+
+   result.acquisitions = writer.count();
+   result.sampleBytes = sink.sampleBytes();
+   std::remove(outfile.c_str());
+}
+
+void printTiming(std::ostream& out, const StageTiming& timing, size_t bytes, size_t acquisitions)
+{
+   out << "{\"seconds\": " << timing.best
+       << ", \"mean_seconds\": " << (timing.runs > 0 ? timing.total / timing.runs : 0.0)
+       << ", \"mb_per_s\": " << (timing.best > 0 ? bytes / timing.best / 1e6 : 0.0)
+       << ", \"acqs_per_s\": " << (timing.best > 0 ? acquisitions / timing.best : 0.0) << "}";
+}
+
+void printInput(std::ostream& out, const InputResult& r)
+{
+   out << "    {" << std::endl;
+   out << "      \"file\": " << GEToIsmrmrd::jsonString(GEToIsmrmrd::baseName(r.file)) << "," << std::endl;
+   out << "      \"plugin\": " << GEToIsmrmrd::jsonString(r.plugin) << "," << std::endl;
+   if (r.error.size() > 0) {
+      out << "      \"error\": " << GEToIsmrmrd::jsonString(r.error) << "," << std::endl;
+   }
+   out << "      \"input_bytes\": " << r.inputBytes << "," << std::endl;
+   out << "      \"acquisitions\": " << r.acquisitions << "," << std::endl;
+   out << "      \"sample_bytes\": " << r.sampleBytes << "," << std::endl;
+
+   // End to end throughput is of the raw input, stage throughput of the samples
+   out << "      \"end_to_end\": ";
+   printTiming(out, r.endToEnd, r.inputBytes, r.acquisitions);
+   out << "," << std::endl;
+
+   // Profiler stages are summed over threads, so may exceed the end to end time
+   out << "      \"stages\": {";
+   for (size_t s = 0; s < r.stages.size(); s++) {
+      out << (s > 0 ? "," : "") << std::endl << "        " << GEToIsmrmrd::jsonString(r.stages[s].first) << ": ";
+      printTiming(out, r.stages[s].second, r.sampleBytes, r.acquisitions);
+   }
+   out << std::endl << "      }," << std::endl;
+
+   out << "      \"counters\": {";
+   for (int c = 0; c < GEToIsmrmrd::PROFILE_COUNTER_COUNT; c++) {
+      GEToIsmrmrd::ProfileCounter counter = static_cast<GEToIsmrmrd::ProfileCounter>(c);
+      out << (c > 0 ? ", " : "") << "\"" << GEToIsmrmrd::Profiler::counterName(counter) << "\": "
+          << r.profileCounters[c];
+   }
+   out << "}," << std::endl;
+   out << "      \"peak_rss_kib\": " << r.peakRss << std::endl;
+   out << "    }";
+}
+
+/**
+ * Benchmarks one input in a child process, so that its peak RSS is its own
+ * and not that of the inputs before it.  The child sends its JSON object
+ * back through a pipe.
+ *
+ * @return true if every repetition converted
+ */
+bool benchmarkInput(InputResult& result, const BenchOptions& options, std::string& json)
+{
+   std::string outfile = options.outputDir + "/g2i_bench_" + GEToIsmrmrd::baseName(result.file) + ".h5";
+
+   int fds[2];
+   if (pipe(fds) != 0) {
+      throw std::runtime_error("Failed to create a pipe for " + result.file);
+   }
+
+   std::cout.flush();
+   std::cerr.flush();
+   pid_t pid = fork();
+   if (pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      throw std::runtime_error("Failed to fork for " + result.file);
+   }
+
+   if (pid == 0)
+   {
+      close(fds[0]);
+      bool ok = true;
+      try {
+         for (int rep = 0; rep < options.repetitions; rep++) {
+            runConversion(result, options, outfile);
+         }
+      } catch (const std::exception& e) {
+         std::cerr << "Failed to benchmark " << result.file << ": " << e.what() << std::endl;
+         result.error = e.what();
+         ok = false;
+      }
+      result.peakRss = peakRssKiB();
+
+      std::ostringstream out;
+      printInput(out, result);
+      std::string text = out.str();
+      for (size_t written = 0; written < text.size(); ) {
+         ssize_t n = write(fds[1], text.data() + written, text.size() - written);
+         if (n <= 0) {
+            _exit(EXIT_FAILURE);
+         }
+         written += n;
+      }
+      close(fds[1]);
+      _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+   }
+
+   close(fds[1]);
+   json.clear();
+   char buffer[4096];
+   ssize_t n;
+   while ((n = read(fds[0], buffer, sizeof(buffer))) != 0) {
+      if (n > 0) {
+         json.append(buffer, n);
+      } else if (errno != EINTR) {
+         break;
+      }
+   }
+   close(fds[0]);
+
+   int status = 0;
+   while (waitpid(pid, &status, 0) < 0 && errno == EINTR) { }
+
+   if (WIFEXITED(status) && json.size() > 0) {
+      return WEXITSTATUS(status) == EXIT_SUCCESS;
+   }
+
+   // The child died before reporting
+   std::ostringstream reason;
+   if (WIFSIGNALED(status)) {
+      reason << "benchmark process killed by signal " << WTERMSIG(status);
+   } else {
+      reason << "benchmark process exited with status " << WEXITSTATUS(status) << " without results";
+   }
+   std::cerr << "Failed to benchmark " << result.file << ": " << reason.str() << std::endl;
+   result.error = reason.str();
+   std::remove(outfile.c_str());
+
+   std::ostringstream out;
+   printInput(out, result);
+   json = out.str();
+   return false;
+}
+
+void printResults(std::ostream& out, const std::vector<std::string>& inputs, const BenchOptions& options)
+{
+   out << "{" << std::endl;
+   out << "  \"isa\": " << GEToIsmrmrd::jsonString(GEToIsmrmrd::sampleKernelsIsa()) << "," << std::endl;
+   out << "  \"threads\": " << options.conversion.threads << "," << std::endl;
+   out << "  \"repetitions\": " << options.repetitions << "," << std::endl;
+   out << "  \"inputs\": [" << std::endl;
+   for (size_t n = 0; n < inputs.size(); n++) {
+      out << inputs[n] << (n + 1 < inputs.size() ? "," : "") << std::endl;
+   }
+   out << "  ]" << std::endl;
+   out << "}" << std::endl;
+}
+
+} // namespace
+
+int main (int argc, char *argv[])
+{
+   std::string classname, jsonFile;
+   std::vector<std::string> inputs;
+   unsigned int threads;
+   BenchOptions options;
+
+   std::string usage = std::string(argv[0]) + " [options] <input P- or ScanArchive file[=plugin class]>...";
+
+   po::options_description visible_options("Options");
+   visible_options.add_options()
+      ("help,h", "print help message")
+      ("plugin,p", po::value<std::string>(&classname)->default_value("auto"), "class/sequence name used for inputs without one")
+      ("stylesheet,x", po::value<std::string>(&options.stylesheet), "XSL stylesheet file (default: the one of the sequence mapping)")
+      ("config,c", po::value<std::string>(&options.config), "conversion configuration (default: the installed one)")
+      ("output-dir,o", po::value<std::string>(&options.outputDir)->default_value("."), "directory for the temporary HDF5 files")
+      ("repetitions,r", po::value<int>(&options.repetitions)->default_value(3), "conversions of every input; the fastest is reported")
+      ("threads,t", po::value<unsigned int>(&threads)->default_value(1), "number of threads decoding ScanArchive packets (0: one per hardware thread)")
+      ("json", po::value<std::string>(&jsonFile), "write the results to this file instead of stdout")
+      ;
+
+   po::options_description all_options("Options");
+   all_options.add(visible_options).add_options()
+      ("input,i", po::value<std::vector<std::string> >(&inputs), "input file");
+
+   po::positional_options_description positionals;
+   positionals.add("input", -1);
+
+   po::variables_map vm;
+   try {
+      po::store(po::command_line_parser(argc, argv).options(all_options).positional(positionals).run(), vm);
+      po::notify(vm);
+   } catch (const po::error& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+      std::cerr << usage << std::endl << visible_options << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   if (vm.count("help") || inputs.size() == 0) {
+      std::cerr << usage << std::endl << visible_options << std::endl;
+      return vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   options.repetitions = std::max(1, options.repetitions);
+   options.conversion.threads = (threads > 0) ? threads : GEToIsmrmrd::ThreadPool::hardwareThreads();
+
+   std::vector<std::string> results;
+   int failures = 0;
+
+   for (size_t n = 0; n < inputs.size(); n++)
+   {
+      InputResult result;
+      size_t equals = inputs[n].find_last_of('=');
+      result.file   = (equals == std::string::npos) ? inputs[n] : inputs[n].substr(0, equals);
+      result.plugin = (equals == std::string::npos) ? classname : inputs[n].substr(equals + 1);
+
+      struct stat info;
+      if (stat(result.file.c_str(), &info) == 0) {
+         result.inputBytes = info.st_size;
+      }
+
+      std::cerr << "Benchmarking " << result.file << " (" << result.plugin << ")" << std::endl;
+      std::string json;
+      try {
+         if (!benchmarkInput(result, options, json)) {
+            failures++;
+         }
+      } catch (const std::exception& e) {
+         std::cerr << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+      results.push_back(json);
+   }
+
+   if (jsonFile.size() > 0) {
+      std::ofstream out(jsonFile.c_str());
+      if (!out) {
+         std::cerr << "Failed to open " << jsonFile << std::endl;
+         return EXIT_FAILURE;
+      }
+      printResults(out, results, options);
+   } else {
+      printResults(std::cout, results, options);
+   }
+
+   return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,104 @@
+/** @file g2i_unpack.cpp */
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// Boost
+#include <boost/program_options.hpp>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// GE
+#include "DatasetReader.h"
+#include "DatasetWriter.h"
+#include "SampleEncoding.h"
+
+namespace po = boost::program_options;
+
+/**
+ * Rewrites the acquisitions of an ISMRMRD file with another sample encoding:
+ * by default back to plain ISMRMRD, readable by any ISMRMRD tool
+ */
+int main (int argc, char *argv[])
+{
+   std::string input, outfile, group, encoding;
+   GEToIsmrmrd::DatasetWriterOptions writerOptions;
+
+   std::string usage = std::string(argv[0]) + " [options] <ISMRMRD file written by ge2ismrmrd>";
+
+   po::options_description visible_options("Options");
+   visible_options.add_options()
+      ("help,h", "print help message")
+      ("verbose,v", "print the encodings and number of acquisitions")
+      ("output,o", po::value<std::string>(&outfile)->default_value("unpacked_data.h5"), "output HDF5 file")
+      ("group,g", po::value<std::string>(&group)->default_value("dataset"), "group holding the header and acquisitions, in both files")
+      ("sample-encoding", po::value<std::string>(&encoding)->default_value("inline"), "sample storage of the output: inline, float32, float16 or int16")
+      ("deflate", po::value<int>(&writerOptions.deflateLevel)->default_value(writerOptions.deflateLevel), "gzip level (1-9) of the output data sets, 0 for none; with inline samples only the acquisition headers are compressed")
+      ("shuffle", "apply the HDF5 shuffle filter before deflate (acquisition headers only with inline samples)")
+      ;
+
+   po::options_description all_options("Options");
+   all_options.add(visible_options).add_options()
+      ("input,i", po::value<std::string>(&input), "input file");
+
+   po::positional_options_description positionals;
+   positionals.add("input", 1);
+
+   po::variables_map vm;
+   try {
+      po::store(po::command_line_parser(argc, argv).options(all_options).positional(positionals).run(), vm);
+      po::notify(vm);
+   } catch (const po::error& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+      std::cerr << usage << std::endl << visible_options << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   if (vm.count("help") || input.size() == 0) {
+      std::cerr << usage << std::endl << visible_options << std::endl;
+      return vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   if (input == outfile) {
+      std::cerr << "The output must be another file than the input" << std::endl;
+      return EXIT_FAILURE;
+   }
+   writerOptions.shuffle = vm.count("shuffle") > 0;
+
+   try {
+      writerOptions.encoding = GEToIsmrmrd::parseSampleEncoding(encoding);
+
+      GEToIsmrmrd::DatasetReader reader(input, group);
+      if (vm.count("verbose")) {
+         std::cerr << input << ": " << reader.count() << " acquisitions, "
+                   << GEToIsmrmrd::sampleEncodingName(reader.encoding()) << " samples" << std::endl;
+      }
+
+      // Never append to whatever the output held
+      std::remove(outfile.c_str());
+      GEToIsmrmrd::DatasetWriter writer(outfile, group, writerOptions);
+
+      std::string xml = reader.readHeader();
+      if (xml.size() > 0) {
+         writer.writeHeader(xml);
+      }
+
+      ISMRMRD::Acquisition acq;
+      while (reader.next(acq)) {
+         writer.append(acq);
+      }
+      writer.close();
+
+      if (vm.count("verbose")) {
+         std::cerr << outfile << ": " << writer.count() << " acquisitions, "
+                   << GEToIsmrmrd::sampleEncodingName(writerOptions.encoding) << " samples" << std::endl;
+      }
+   } catch (const std::exception& e) {
+      std::cerr << "Failed to unpack " << input << ": " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
@@ -1,5 +1,14 @@
 
+#include <algorithm>
+#include <csignal>
 #include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
 
 // Boost
 #include <boost/program_options.hpp>
@@ -10,44 +19,157 @@
 
 
 // GE
+#include "BatchConverter.h"
+#include "ConversionCheckpoint.h"
+#include "DatasetWriter.h"
+#include "GadgetronSink.h"
 #include "GERawConverter.h"
+#include "Profiler.h"
+#include "ShardedWriter.h"
+#include "WatchService.h"
 #include "ge_tools_path.h"
 
 namespace po = boost::program_options;
 
+/** Service stopped by SIGINT and SIGTERM, while watching an inbox */
+static GEToIsmrmrd::WatchService* watchService = NULL;
+
+static void stopWatching(int)
+{
+   if (watchService != NULL) {
+      watchService->stop();
+   }
+}
+
+/**
+ * Reports the profile of the conversion: the summary table through the
+ * verbose log, the trace events to profileFile if one was given
+ *
+ * @returns status, or EXIT_FAILURE if the profile could not be written
+ */
+static int finishProfile(int status, bool verbose, const std::string& profileFile)
+{
+   GEToIsmrmrd::Profiler& profiler = GEToIsmrmrd::Profiler::instance();
+   if (!profiler.enabled()) {
+      return status;
+   }
+   profiler.disable();
+
+   if (verbose) {
+      std::ostringstream summary;
+      profiler.writeSummary(summary);
+      GEToIsmrmrd::logstream log(verbose);
+      log << std::endl << summary.str();
+   }
+
+   if (profileFile.size() > 0) {
+      try {
+         profiler.writeTrace(profileFile);
+      } catch (const std::exception& e) {
+         std::cerr << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+   }
+   return status;
+}
+
+/**
+ * Splits the memory budget of one conversion: a quarter bounds the write
+ * batch (with --shard-by the queues and batches of all shards), the rest
+ * the acquisitions and packets in flight in the converter
+ *
+ * @param bytes Budget, 0 for none
+ */
+static void applyMemoryBudget(uint64_t bytes, GEToIsmrmrd::ConversionOptions& options,
+                              GEToIsmrmrd::DatasetWriterOptions& writerOptions)
+{
+   writerOptions.maxBatchBytes = bytes / 4;
+   options.maxMemoryBytes      = bytes - bytes / 4;
+}
+
 int main (int argc, char *argv[])
 {
-   std::string classname, stylesheet, rawFile, outfile;
+   std::string classname, stylesheet, configFile, rawFile, outfile, listFile, watchDir;
+   std::vector<std::string> inputs;
+   std::string fsync, sampleEncoding, shardBy, gadgetron, gadgetronConfig, gadgetronImages, profileFile;
+   std::string slices, echoes, repetitions, channels;
+   unsigned int threads, queueDepth, jobs, virtualChannels, compressionLines;
+   GEToIsmrmrd::DatasetWriterOptions writerOptions;
+   size_t chunkCacheMiB, prefetchMiB, maxMemoryMiB;
+   double checkpointSeconds;
 
    std::string thisProgram = argv[0];
    std::string validInputs = "input P- or ScanArchive File";
-   std::string usage = thisProgram + " [options] <" + validInputs + ">";
-   std::string stylesheet_default = get_ge_tools_home() + "share/ge-tools/config/default.xsl";
-   std::string sequence_class_default = "GenericConverter";
+   std::string usage = thisProgram + " [options] <" + validInputs + "(s) or directory>";
+   std::string config_default = get_ge_tools_home() + "share/ge-tools/config/default.xml";
+   std::string sequence_class_default = "auto";
 
    po::options_description basic("Basic Options");
    basic.add_options()
       ("help,h", "print help message")
       ("verbose,v", "enable verbose mode")
-      ("plugin,p", po::value<std::string>(&classname)->default_value(sequence_class_default), "class/sequence name in library used for conversion")
-      ("stylesheet,x", po::value<std::string>(&stylesheet)->default_value(stylesheet_default), "XSL stylesheet file mapping values provided by Orchestra to those needed by ISMRMRD")
-      ("output,o", po::value<std::string>(&outfile)->default_value("converted_data.h5"), "output HDF5 file")
-      ("string,s", "only print the HDF5 XML header")
+      ("plugin,p", po::value<std::string>(&classname)->default_value(sequence_class_default), "class/sequence name in library used for conversion (auto: mapped from the scan by the configuration)")
+      ("stylesheet,x", po::value<std::string>(&stylesheet), "XSL stylesheet file mapping values provided by Orchestra to those needed by ISMRMRD (default: the one of the sequence mapping)")
+      ("config,c", po::value<std::string>(&configFile), ("conversion configuration mapping scans to plugins (default: " + config_default + ")").c_str())
+      ("output,o", po::value<std::string>(&outfile)->default_value("converted_data.h5"), "output HDF5 file (batch mode: output directory, unless grouped)")
+      ("info", "only print the ISMRMRD XML header, reading the scan parameters but neither the plugin nor k-space")
+      ("string,s", "same as --info")
+      ("threads,t", po::value<unsigned int>(&threads)->default_value(1), "number of threads decoding ScanArchive packets and P-file blocks (0: one per hardware thread)")
+      ("queue-depth", po::value<unsigned int>(&queueDepth)->default_value(16), "number of packets in flight between reading and writing")
+      ("profile", po::value<std::string>(&profileFile), "write stage timings and counters as a trace event JSON file")
+      ("packet-index", "use the ScanArchive packet index <archive>.g2idx, building it on the first conversion")
+      ("prefetch", po::value<size_t>(&prefetchMiB)->default_value(GEToIsmrmrd::ConversionOptions().prefetchBytes >> 20), "MiB of a ScanArchive read ahead of the packets being decoded, 0 for none")
+      ("max-memory", po::value<size_t>(&maxMemoryMiB)->default_value(0), "MiB of acquisitions and packets held between reading and writing, shared by concurrent jobs; 0 for no limit")
+      ("checkpoint", po::value<double>(&checkpointSeconds)->default_value(0), "seconds between checkpoints of a ScanArchive conversion, recorded in <output>.g2ickpt; 0 for none (10 with --resume)")
+      ("resume", "resume the interrupted, checkpointed conversion of a ScanArchive into the output; fails without its checkpoint")
+      ;
+
+   po::options_description output("Output Options");
+   output.add_options()
+      ("batch-size", po::value<size_t>(&writerOptions.batchSize)->default_value(writerOptions.batchSize), "acquisitions buffered per HDF5 write")
+      ("chunk-size", po::value<size_t>(&writerOptions.chunkSize)->default_value(writerOptions.chunkSize), "acquisitions per HDF5 chunk")
+      ("chunk-cache", po::value<size_t>(&chunkCacheMiB)->default_value(writerOptions.chunkCacheBytes >> 20), "HDF5 chunk cache size in MiB")
+      ("deflate", po::value<int>(&writerOptions.deflateLevel)->default_value(writerOptions.deflateLevel), "gzip level (1-9) of the acquisition data set, 0 for none; with inline samples only the acquisition headers are compressed, as HDF5 keeps variable length samples outside the chunks")
+      ("shuffle", "apply the HDF5 shuffle filter before deflate (acquisition headers only with inline samples)")
+      ("sample-encoding", po::value<std::string>(&sampleEncoding)->default_value("inline"), "k-space sample storage: inline (ISMRMRD), or float32, float16 or int16 in a separate filtered data set read back by g2i_unpack; ISMRMRD readers then see acquisitions without samples")
+      ("coil-compression", po::value<unsigned int>(&virtualChannels)->default_value(0), "compress the (selected) channels to this many virtual channels by PCA, 0 for none")
+      ("compression-lines", po::value<unsigned int>(&compressionLines)->default_value(256), "acquisitions the coil compression is learnt from")
+      ("fsync", po::value<std::string>(&fsync)->default_value("never"), "fsync the output: never, close or batch")
+      ("shard-by", po::value<std::string>(&shardBy)->default_value("none"), "split the output into one file per slice, repetition or contrast, each written by its own thread, listed in <output stem>.shards.json")
+      ("gadgetron", po::value<std::string>(&gadgetron), "stream to the Gadgetron server at host:port instead of writing HDF5")
+      ("gadgetron-config", po::value<std::string>(&gadgetronConfig), "Gadgetron reconstruction configuration (default: chosen from the scan)")
+      ("gadgetron-images", po::value<std::string>(&gadgetronImages), "ISMRMRD file receiving the reconstructed images")
+      ;
+
+   po::options_description batch("Batch Options");
+   batch.add_options()
+      ("list,l", po::value<std::string>(&listFile), "file listing one input per line")
+      ("grouped,g", "write all inputs into the output file, one dataset group per series")
+      ("jobs,j", po::value<unsigned int>(&jobs)->default_value(1), "number of inputs converted at the same time")
+      ("watch,w", po::value<std::string>(&watchDir), "stay resident and convert every raw file landing in this directory, until interrupted")
+      ;
+
+   po::options_description select("Selection Options (lists of indices and ranges such as 0,2,5-9)");
+   select.add_options()
+      ("slices", po::value<std::string>(&slices), "convert only these geometric slices")
+      ("echoes", po::value<std::string>(&echoes), "convert only these echoes")
+      ("repetitions", po::value<std::string>(&repetitions), "convert only these repetitions")
+      ("channels", po::value<std::string>(&channels), "convert only these receiver channels")
       ;
 
    po::options_description input("Input Options");
    input.add_options()
-      ("input,i", po::value<std::string>(&rawFile), validInputs.c_str())
+      ("input,i", po::value<std::vector<std::string> >(&inputs), validInputs.c_str())
       ;
 
    po::options_description all_options("Options");
-   all_options.add(basic).add(input);
+   all_options.add(basic).add(output).add(select).add(batch).add(input);
 
    po::options_description visible_options("Options");
-   visible_options.add(basic);
+   visible_options.add(basic).add(output).add(select).add(batch);
 
    po::positional_options_description positionals;
-   positionals.add("input", 1);
+   positionals.add("input", -1);
 
    po::variables_map vm;
    try {
@@ -66,25 +188,157 @@ int main (int argc, char *argv[])
       return EXIT_SUCCESS;
    }
 
-   if (rawFile.size() == 0) {
+   if (inputs.size() == 0 && listFile.size() == 0 && watchDir.size() == 0) {
       std::cerr << usage << std::endl;
       return EXIT_FAILURE;
    }
+   if (watchDir.size() > 0 && (inputs.size() > 0 || listFile.size() > 0)) {
+      std::cerr << "An inbox is watched instead of converting inputs" << std::endl;
+      return EXIT_FAILURE;
+   }
 
    bool verbose = false;
    if (vm.count("verbose")) {
        verbose = true;
    }
 
+   // Stage timings are printed with the verbose output
+   if (verbose || profileFile.size() > 0) {
+      GEToIsmrmrd::Profiler::instance().enable(profileFile.size() > 0);
+   }
+
+   writerOptions.chunkCacheBytes = chunkCacheMiB << 20;
+   writerOptions.shuffle = vm.count("shuffle") > 0;
+   if (fsync == "never") {
+      writerOptions.fsync = GEToIsmrmrd::FSYNC_NEVER;
+   } else if (fsync == "close") {
+      writerOptions.fsync = GEToIsmrmrd::FSYNC_CLOSE;
+   } else if (fsync == "batch") {
+      writerOptions.fsync = GEToIsmrmrd::FSYNC_BATCH;
+   } else {
+      std::cerr << "Unknown fsync policy: " << fsync << std::endl;
+      return EXIT_FAILURE;
+   }
+   GEToIsmrmrd::ShardKey shardKey = GEToIsmrmrd::SHARD_NONE;
+   try {
+      writerOptions.encoding = GEToIsmrmrd::parseSampleEncoding(sampleEncoding);
+      shardKey = GEToIsmrmrd::parseShardKey(shardBy);
+   } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   GEToIsmrmrd::ConversionOptions options;
+   options.threads          = (threads > 0) ? threads : GEToIsmrmrd::ThreadPool::hardwareThreads();
+   options.queueDepth       = queueDepth;
+   options.packetIndex      = vm.count("packet-index") > 0;
+   options.prefetchBytes    = static_cast<uint64_t>(prefetchMiB) << 20;
+   options.virtualChannels  = virtualChannels;
+   options.compressionLines = compressionLines;
+   try {
+      options.selection.slices      = GEToIsmrmrd::IndexSelection(slices);
+      options.selection.echoes      = GEToIsmrmrd::IndexSelection(echoes);
+      options.selection.repetitions = GEToIsmrmrd::IndexSelection(repetitions);
+      options.selection.channels    = GEToIsmrmrd::IndexSelection(channels);
+   } catch (const std::exception& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   // Several inputs, a list, a directory or an inbox: convert them all in this process
+   bool const batchMode = watchDir.size() > 0 || inputs.size() > 1 || listFile.size() > 0 ||
+                          GEToIsmrmrd::BatchConverter::isDirectory(inputs[0]);
+
+   // Concurrent conversions of a batch share the budget
+   applyMemoryBudget((static_cast<uint64_t>(maxMemoryMiB) << 20) / (batchMode ? std::max(jobs, 1u) : 1),
+                     options, writerOptions);
+
+   // Cataloguing and routing only need the header: no plugin, no packets
+   bool const headerOnly = vm.count("info") > 0 || vm.count("string") > 0;
+
+   if (batchMode) {
+      if (headerOnly || gadgetron.size() > 0 || vm.count("resume") || shardKey != GEToIsmrmrd::SHARD_NONE) {
+         std::cerr << "Header printing, Gadgetron streaming, resuming and sharding take a single input" << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      GEToIsmrmrd::BatchOptions batchOptions;
+      batchOptions.classname  = classname;
+      batchOptions.config     = configFile;
+      batchOptions.grouped    = vm.count("grouped") > 0;
+      batchOptions.output     = (vm["output"].defaulted() && !batchOptions.grouped) ? "." : outfile;
+      batchOptions.jobs       = jobs;
+      batchOptions.verbose    = verbose;
+      batchOptions.conversion = options;
+      batchOptions.writer     = writerOptions;
+
+      std::vector<std::string> rawFiles;
+      try {
+         if (watchDir.size() == 0) {
+            rawFiles = GEToIsmrmrd::BatchConverter::collectInputs(inputs, listFile);
+         }
+
+         // Read an overriding stylesheet once for the whole batch
+         if (stylesheet.size() > 0) {
+            std::ifstream stream(stylesheet.c_str(), std::ios::binary);
+            if (!stream) {
+               throw std::runtime_error("Failed to open stylesheet " + stylesheet);
+            }
+            batchOptions.stylesheet.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+         }
+      } catch (const std::exception& e) {
+         std::cerr << "Failed to set up batch: " << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      if (watchDir.size() > 0) {
+         int status = EXIT_SUCCESS;
+         try {
+            GEToIsmrmrd::WatchService service(watchDir, batchOptions);
+            watchService = &service;
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = stopWatching;
+            sigaction(SIGINT, &action, NULL);
+            sigaction(SIGTERM, &action, NULL);
+
+            status = (service.run() == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            watchService = NULL;
+         } catch (const std::exception& e) {
+            watchService = NULL;
+            std::cerr << "Failed to watch " << watchDir << ": " << e.what() << std::endl;
+            status = EXIT_FAILURE;
+         }
+         return finishProfile(status, verbose, profileFile);
+      }
+
+      GEToIsmrmrd::BatchConverter batchConverter(batchOptions);
+      int status = (batchConverter.run(rawFiles) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+      return finishProfile(status, verbose, profileFile);
+   }
+
+   rawFile = inputs[0];
+
    // Create a new Converter and give it a plugin configuration
    std::shared_ptr<GEToIsmrmrd::GERawConverter> converter;
    try {
-      converter = std::make_shared<GEToIsmrmrd::GERawConverter>(rawFile, classname, verbose);
+      converter = std::make_shared<GEToIsmrmrd::GERawConverter>(rawFile, classname, verbose, configFile,
+                                                                headerOnly);
    } catch (const std::exception& e) {
       std::cerr << "Failed to instantiate converter: " << e.what() << std::endl;
       return EXIT_FAILURE;
    }
 
+   try {
+      converter->setConversionOptions(options);
+   } catch (const std::exception& e) {
+      std::cerr << "Failed to select acquisitions: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
    // Override stylesheet if specified
    if (stylesheet.size() > 0) {
       try {
@@ -110,28 +364,128 @@ int main (int argc, char *argv[])
    }
 
    // if the user requested only a dump of the XML header:
-   if (vm.count("string")) {
+   if (headerOnly) {
       std::cout << xml_header << std::endl;
-      return EXIT_SUCCESS;
+      return finishProfile(EXIT_SUCCESS, verbose, profileFile);
+   }
+
+   bool const resume = vm.count("resume") > 0;
+   if (shardKey != GEToIsmrmrd::SHARD_NONE && (gadgetron.size() > 0 || resume)) {
+      std::cerr << "Sharded output is written to HDF5, and cannot be resumed" << std::endl;
+      return EXIT_FAILURE;
+   }
+   if (resume && (gadgetron.size() > 0 || !converter->checkpointable())) {
+      std::cerr << "Only ScanArchive conversions to HDF5 without coil compression, by plugins supporting it, "
+                << "can be resumed" << std::endl;
+      return EXIT_FAILURE;
+   }
+   if (resume && vm["checkpoint"].defaulted()) {
+      // A resumed conversion goes on checkpointing, so it can be resumed again
+      checkpointSeconds = 10;
+   }
+
+   // stream the acquisitions of this raw file to a Gadgetron server
+   if (gadgetron.size() > 0) {
+      size_t colon = gadgetron.find_last_of(':');
+      if (colon == std::string::npos) {
+         std::cerr << "Gadgetron server must be given as host:port" << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      if (gadgetronConfig.size() == 0) {
+         gadgetronConfig = converter->getReconConfigName();
+      }
+      if (gadgetronConfig.size() == 0) {
+         // Configurations shipped in gtConfigs/
+         gadgetronConfig = converter->getScanParameters().isEpi ? "gtReconExampleGEEPI.xml" : "gtReconExampleGE2D.xml";
+      }
+
+      std::unique_ptr<GEToIsmrmrd::GadgetronSink> client;
+      try {
+         client.reset(new GEToIsmrmrd::GadgetronSink(gadgetron.substr(0, colon), gadgetron.substr(colon + 1),
+                                                     gadgetronConfig, xml_header, gadgetronImages));
+         converter->convert(*client);
+         client->close();
+      } catch (const std::exception& e) {
+         std::cerr << "Failed to stream acquisitions: " << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      std::cout << "Streamed " << client->count() << " acquisitions to " << gadgetron << " using "
+                << gadgetronConfig << ", received " << client->imageCount() << " images" << std::endl;
+      return finishProfile(EXIT_SUCCESS, verbose, profileFile);
    }
 
-   // create hdf5 file
-   ISMRMRD::Dataset d(outfile.c_str(), "dataset", true);
+   // split the acquisitions of this raw file over several hdf5 files
+   if (shardKey != GEToIsmrmrd::SHARD_NONE) {
+      std::unique_ptr<GEToIsmrmrd::ShardedWriter> shards;
+      try {
+         shards.reset(new GEToIsmrmrd::ShardedWriter(outfile, "dataset", shardKey, writerOptions));
+         shards->writeHeader(xml_header);
+         converter->convert(*shards);
+         shards->close();
+      } catch (const std::exception& e) {
+         std::cerr << "Failed to convert acquisitions: " << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      std::cout << "Number of acquisitions stored in " << shards->shardCount() << " HDF5 files is "
+                << shards->count() << ", listed in " << GEToIsmrmrd::ShardedWriter::manifestPath(outfile) << std::endl;
+      return finishProfile(EXIT_SUCCESS, verbose, profileFile);
+   }
+
+   // The settings a checkpoint was taken with, which its resumption must repeat
+   std::string const settings = "plugin=" + classname + " slices=" + slices + " echoes=" + echoes +
+                                " repetitions=" + repetitions + " channels=" + channels +
+                                " sample-encoding=" + sampleEncoding + " stylesheet=" + stylesheet +
+                                " config=" + (configFile.size() > 0 ? configFile : config_default);
 
-   // write the ISMRMRD header to the dataset
-   d.writeHeader(xml_header);
+   // stream the acquisitions of this raw file into the hdf5 dataset
+   std::unique_ptr<GEToIsmrmrd::DatasetWriter> writer;
+   std::shared_ptr<GEToIsmrmrd::ConversionCheckpoint> checkpoint;
+   uint64_t resumedAcquisitions = 0;
+   try {
+      writer.reset(new GEToIsmrmrd::DatasetWriter(outfile, "dataset", writerOptions));
+      writer->writeHeader(xml_header);
 
-   // get the first acquisition in this raw file
-   std::vector<ISMRMRD::Acquisition> acqs = converter->getAcquisitions(0);
+      if (converter->checkpointable() && (checkpointSeconds > 0 || resume)) {
+         checkpoint = std::make_shared<GEToIsmrmrd::ConversionCheckpoint>(outfile, rawFile, settings, *writer,
+                                                                          checkpointSeconds);
+         if (resume) {
+            // Converting from the start would append a second conversion
+            // after the partial one
+            if (!checkpoint->load()) {
+               std::cerr << "No checkpoint of this conversion in "
+                         << GEToIsmrmrd::ConversionCheckpoint::sidecarPath(outfile)
+                         << ": the archive, plugin, selection, sample encoding, stylesheet and configuration "
+                         << "must be those of the interrupted conversion" << std::endl;
+               return EXIT_FAILURE;
+            }
+            resumedAcquisitions = checkpoint->acquisitions();
+            std::cout << "Resuming after " << resumedAcquisitions << " acquisitions, at packet "
+                      << checkpoint->position().packets << std::endl;
+         }
+         checkpoint->begin();
+         converter->setCheckpoint(checkpoint);
+      }
 
-   std::cout << "Number of acquisitions stored in HDF5 file is " << acqs.size() << std::endl;
-   // add these acquisitions to the hdf5 dataset
-   for (int n = 0; n < acqs.size(); n++) {
-      d.appendAcquisition(acqs.at(n));
+      converter->convert(*writer);
+      writer->close();
+      if (checkpoint) {
+         checkpoint->finish();
+      }
+   } catch (const std::exception& e) {
+      std::cerr << "Failed to convert acquisitions: " << e.what() << std::endl;
+      if (checkpoint) {
+         std::cerr << "Run again with --resume to continue from the last checkpoint" << std::endl;
+      }
+      return EXIT_FAILURE;
    }
 
+   std::cout << "Number of acquisitions stored in HDF5 file is " << resumedAcquisitions + writer->count() << std::endl;
+
    std::cout << "Swedished!" << std::endl;
 
-   return EXIT_SUCCESS;
+   return finishProfile(EXIT_SUCCESS, verbose, profileFile);
 }
 
@@ -0,0 +1,113 @@
+/** @file AcquisitionSelectionTest.cpp */
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Local
+#include "AcquisitionSelection.h"
+
+using GEToIsmrmrd::IndexSelection;
+
+namespace {
+
+std::string join(const std::vector<unsigned int>& indices)
+{
+   std::string text;
+   for (size_t n = 0; n < indices.size(); n++) {
+      text += (n ? "," : "") + std::to_string(indices[n]);
+   }
+   return text;
+}
+
+/**
+ * Parses a selection that must be accepted
+ *
+ * @param expected Selected indices below 16, comma separated
+ * @returns true if the selection parses to them
+ */
+bool checkAccepted(const std::string& spec, const std::string& expected)
+{
+   try {
+      std::string const selected = join(IndexSelection(spec).indices(16));
+      if (selected != expected) {
+         std::cerr << "Selection '" << spec << "' selects " << selected << ", " << expected << " expected"
+                   << std::endl;
+         return false;
+      }
+   } catch (const std::exception& e) {
+      std::cerr << "Selection '" << spec << "' rejected: " << e.what() << std::endl;
+      return false;
+   }
+   return true;
+}
+
+/** @returns true if the selection throws std::runtime_error */
+bool checkRejected(const std::string& spec)
+{
+   try {
+      IndexSelection selection(spec);
+   } catch (const std::runtime_error&) {
+      return true;
+   }
+   std::cerr << "Selection '" << spec << "' accepted" << std::endl;
+   return false;
+}
+
+bool expect(bool condition, const char* what)
+{
+   if (!condition) {
+      std::cerr << what << std::endl;
+   }
+   return condition;
+}
+
+} // namespace
+
+/** Checks the IndexSelection parser and its queries */
+int main()
+{
+   size_t failures = 0;
+
+   // Every index
+   failures += checkAccepted("", "0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15") ? 0 : 1;
+   failures += checkAccepted("all", "0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15") ? 0 : 1;
+
+   // Single indices, ranges, overlaps and duplicates, in any order
+   failures += checkAccepted("3", "3") ? 0 : 1;
+   failures += checkAccepted("0,2,5-9", "0,2,5,6,7,8,9") ? 0 : 1;
+   failures += checkAccepted("7-7", "7") ? 0 : 1;
+   failures += checkAccepted("9,3-5,4,3", "3,4,5,9") ? 0 : 1;
+   failures += checkAccepted("14-20", "14,15") ? 0 : 1;
+   failures += checkAccepted("20", "") ? 0 : 1;
+   failures += checkAccepted("0-1048576", "0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15") ? 0 : 1;
+
+   // Empty items, a trailing comma, reversed ranges, beyond the largest index
+   char const* const rejected[] = {
+      ",", ",3", "3,", "3,,4", "1-2,", "-", "-3", "3-", "5-2", "1-2-3",
+      "ALL", "all,3", " 3", "3 ", "+3", "0x3", "3.0", "a",
+      "1048577", "0-1048577", "99999999999999999999"
+   };
+   for (size_t n = 0; n < sizeof(rejected) / sizeof(rejected[0]); n++) {
+      failures += checkRejected(rejected[n]) ? 0 : 1;
+   }
+
+   IndexSelection const every;
+   failures += expect(every.all() && every.contains(123456) && every.count(5) == 5,
+                      "A default selection selects every index") ? 0 : 1;
+
+   IndexSelection const some("1,4-6,30");
+   failures += expect(!some.all(), "A list is not every index") ? 0 : 1;
+   failures += expect(some.contains(1) && some.contains(5) && some.contains(30) && !some.contains(0) &&
+                      !some.contains(7) && !some.contains(31), "contains() tests the listed indices") ? 0 : 1;
+   failures += expect(some.count(0) == 0 && some.count(5) == 2 && some.count(6) == 3 && some.count(100) == 5,
+                      "count() counts the indices below the total") ? 0 : 1;
+   failures += expect(some.last() == 30, "last() is the largest index") ? 0 : 1;
+
+   if (failures > 0) {
+      std::cerr << failures << " selection checks failed" << std::endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
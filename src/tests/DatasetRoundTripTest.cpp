@@ -0,0 +1,172 @@
+/** @file DatasetRoundTripTest.cpp */
+#include <stdint.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Local
+#include "DatasetReader.h"
+#include "DatasetWriter.h"
+#include "SampleEncoding.h"
+
+namespace {
+
+/** Acquisitions written by each of the two writers */
+const size_t ACQUISITIONS = 555;
+
+const char* const GROUP = "dataset";
+
+const char* const HEADER = "<?xml version=\"1.0\"?><ismrmrdHeader/>";
+
+/**
+ * Acquisition n: a shape that changes from one acquisition to the next, and
+ * samples from zero to well beyond the half precision range
+ */
+ISMRMRD::Acquisition makeAcquisition(size_t n)
+{
+   ISMRMRD::Acquisition acq;
+   ISMRMRD::AcquisitionHeader head;
+   head.number_of_samples     = static_cast<uint16_t>(64 + n % 3);
+   head.active_channels       = static_cast<uint16_t>(1 + n % 4);
+   head.available_channels    = head.active_channels;
+   head.trajectory_dimensions = static_cast<uint16_t>(n % 2 ? 2 : 0);
+   head.scan_counter          = static_cast<uint32_t>(n);
+   head.idx.kspace_encode_step_1 = static_cast<uint16_t>(n % 128);
+   head.user_float[7]         = 42.0f;
+   acq.setHead(head);
+
+   complex_float_t* data = acq.getDataPtr();
+   size_t const samples = acq.getNumberOfDataElements();
+   float const magnitude = (n % 5 == 0) ? 0.0f : static_cast<float>(n % 7) * 1e3f * (n % 2 ? 100.0f : 1e-6f);
+   for (size_t k = 0; k < samples; k++) {
+      data[k] = complex_float_t(magnitude * static_cast<float>(k % 17) / 17.0f,
+                                -magnitude * static_cast<float>(k % 13) / 13.0f);
+   }
+   float* traj = acq.getTrajPtr();
+   for (size_t k = 0; k < static_cast<size_t>(head.number_of_samples) * head.trajectory_dimensions; k++) {
+      traj[k] = static_cast<float>(k) - 0.5f * static_cast<float>(n);
+   }
+   return acq;
+}
+
+/** The samples of an acquisition as they are after storing them encoded */
+std::vector<float> expectedSamples(const ISMRMRD::Acquisition& acq, GEToIsmrmrd::SampleEncoding encoding)
+{
+   const float* src = reinterpret_cast<const float*>(acq.getDataPtr());
+   size_t const count = 2 * acq.getNumberOfDataElements();
+   std::vector<float> samples(src, src + count);
+   if (encoding == GEToIsmrmrd::SAMPLES_FLOAT16) {
+      std::vector<uint16_t> halves(count);
+      GEToIsmrmrd::floatToHalf(halves.data(), src, count);
+      GEToIsmrmrd::halfToFloat(samples.data(), halves.data(), count);
+   } else if (encoding == GEToIsmrmrd::SAMPLES_INT16) {
+      float const scale = GEToIsmrmrd::int16Scale(src, count);
+      std::vector<int16_t> stored(count);
+      GEToIsmrmrd::floatToInt16(stored.data(), src, count, scale);
+      GEToIsmrmrd::int16ToFloat(samples.data(), stored.data(), count, scale);
+   }
+   return samples;
+}
+
+/**
+ * Writes acquisitions with one encoding - in two writers, the second
+ * appending to the file of the first - and reads them back
+ *
+ * @returns the number of acquisitions that differ from the ones written
+ */
+size_t checkEncoding(GEToIsmrmrd::SampleEncoding encoding)
+{
+   std::string const filename =
+      std::string("g2i_dataset_roundtrip_") + GEToIsmrmrd::sampleEncodingName(encoding) + ".h5";
+   std::remove(filename.c_str());
+
+   for (size_t pass = 0; pass < 2; pass++) {
+      GEToIsmrmrd::DatasetWriterOptions options;
+      options.batchSize = 100;
+      options.chunkSize = 64;
+      options.encoding  = encoding;
+      GEToIsmrmrd::DatasetWriter writer(filename, GROUP, options);
+      if (pass == 0) {
+         writer.writeHeader(HEADER);
+      }
+      for (size_t n = 0; n < ACQUISITIONS; n++) {
+         writer.append(makeAcquisition(pass * ACQUISITIONS + n));
+      }
+      writer.close();
+   }
+
+   size_t failures = 0;
+
+   // A block size that divides neither the batches nor the chunks
+   GEToIsmrmrd::DatasetReader reader(filename, GROUP, 77);
+   if (reader.count() != 2 * ACQUISITIONS || reader.encoding() != encoding || reader.readHeader() != HEADER) {
+      std::cerr << GEToIsmrmrd::sampleEncodingName(encoding) << ": " << reader.count() << " acquisitions, encoding "
+                << GEToIsmrmrd::sampleEncodingName(reader.encoding()) << std::endl;
+      failures++;
+   }
+
+   ISMRMRD::Acquisition acq;
+   size_t n = 0;
+   while (reader.next(acq)) {
+      ISMRMRD::Acquisition const written = makeAcquisition(n);
+      std::vector<float> const expected = expectedSamples(written, encoding);
+      const float* samples = reinterpret_cast<const float*>(acq.getDataPtr());
+      size_t const trajectory = static_cast<size_t>(written.getHead().number_of_samples) *
+                                written.getHead().trajectory_dimensions;
+
+      bool const same =
+         memcmp(&acq.getHead(), &written.getHead(), sizeof(ISMRMRD_AcquisitionHeader)) == 0 &&
+         acq.getNumberOfDataElements() == written.getNumberOfDataElements() &&
+         memcmp(samples, expected.data(), expected.size() * sizeof(float)) == 0 &&
+         (trajectory == 0 || memcmp(acq.getTrajPtr(), written.getTrajPtr(), trajectory * sizeof(float)) == 0);
+      if (!same && failures++ < 10) {
+         std::cerr << GEToIsmrmrd::sampleEncodingName(encoding) << ": acquisition " << n << " differs" << std::endl;
+      }
+      n++;
+   }
+   reader.close();
+
+   if (n != 2 * ACQUISITIONS) {
+      std::cerr << GEToIsmrmrd::sampleEncodingName(encoding) << ": " << n << " acquisitions read" << std::endl;
+      failures++;
+   }
+
+   std::remove(filename.c_str());
+   return failures;
+}
+
+} // namespace
+
+/**
+ * Writes and reads back ISMRMRD files with every sample encoding: headers
+ * and trajectories come back unchanged, and the samples exactly as the
+ * encoding stores them
+ */
+int main()
+{
+   GEToIsmrmrd::SampleEncoding const encodings[] = {
+      GEToIsmrmrd::SAMPLES_INLINE, GEToIsmrmrd::SAMPLES_FLOAT32,
+      GEToIsmrmrd::SAMPLES_FLOAT16, GEToIsmrmrd::SAMPLES_INT16
+   };
+
+   size_t failures = 0;
+   try {
+      for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+         failures += checkEncoding(encodings[e]);
+      }
+   } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   if (failures > 0) {
+      std::cerr << failures << " acquisitions differ" << std::endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
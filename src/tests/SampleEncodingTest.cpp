@@ -0,0 +1,304 @@
+/** @file SampleEncodingTest.cpp */
+#include <stdint.h>
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+// Local
+#include "SampleEncoding.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define G2I_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/** Largest finite half, as its bits */
+const uint16_t HALF_MAX_BITS = 0x7bff;
+
+const uint16_t HALF_INFINITY = 0x7c00;
+
+float bitsFloat(uint32_t bits)
+{
+   float value;
+   memcpy(&value, &bits, sizeof(value));
+   return value;
+}
+
+bool isHalfNan(uint16_t half)
+{
+   return (half & 0x7c00) == 0x7c00 && (half & 0x03ff) != 0;
+}
+
+/** Value of a half, computed from its fields */
+double referenceHalfValue(uint16_t half)
+{
+   int const exponent = (half >> 10) & 0x1f;
+   int const mantissa = half & 0x03ff;
+   double const sign = (half & 0x8000) ? -1.0 : 1.0;
+   if (exponent == 0x1f) {
+      return mantissa ? std::numeric_limits<double>::quiet_NaN() : sign * HUGE_VAL;
+   }
+   if (exponent == 0) {
+      return sign * std::ldexp(static_cast<double>(mantissa), -24);
+   }
+   return sign * std::ldexp(static_cast<double>(mantissa | 0x400), exponent - 25);
+}
+
+/**
+ * Half nearest to a float, ties to even, by a search over the finite halves;
+ * beyond the midpoint of the largest half and the next power of two it is
+ * an infinity
+ */
+uint16_t referenceHalf(float value)
+{
+   if (value != value) {
+      return 0x7e00;
+   }
+   uint16_t const sign = std::signbit(value) ? 0x8000 : 0;
+   double const magnitude = std::fabs(static_cast<double>(value));
+   if (magnitude >= 65520.0) {
+      return sign | HALF_INFINITY;
+   }
+
+   // Largest half not above the magnitude
+   uint16_t low = 0, high = HALF_MAX_BITS;
+   while (low < high) {
+      uint16_t const middle = static_cast<uint16_t>((low + high + 1) / 2);
+      if (referenceHalfValue(middle) <= magnitude) {
+         low = middle;
+      } else {
+         high = static_cast<uint16_t>(middle - 1);
+      }
+   }
+   if (low == HALF_MAX_BITS) {
+      return sign | low;
+   }
+   double const below = magnitude - referenceHalfValue(low);
+   double const above = referenceHalfValue(static_cast<uint16_t>(low + 1)) - magnitude;
+   bool const up = (above < below) || (above == below && (low & 1) != 0);
+   return sign | static_cast<uint16_t>(up ? low + 1 : low);
+}
+
+#ifdef G2I_X86_KERNELS
+__attribute__((target("f16c")))
+uint16_t f16cHalf(float value)
+{
+   return static_cast<uint16_t>(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+}
+
+__attribute__((target("f16c")))
+float f16cFloat(uint16_t half)
+{
+   return _cvtsh_ss(half);
+}
+
+bool hasF16c()
+{
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("f16c");
+}
+#else
+uint16_t f16cHalf(float) { return 0; }
+float f16cFloat(uint16_t) { return 0; }
+bool hasF16c() { return false; }
+#endif
+
+/** Whether two halves are the same value: equal bits, or both NaN */
+bool sameHalf(uint16_t a, uint16_t b)
+{
+   return a == b || (isHalfNan(a) && isHalfNan(b));
+}
+
+/** Whether two floats are the same value: equal bits, or both NaN */
+bool sameFloat(float a, float b)
+{
+   return memcmp(&a, &b, sizeof(a)) == 0 || (a != a && b != b);
+}
+
+/**
+ * Converts every half to a float, and back: both directions must be exact
+ * for every value a half holds
+ */
+size_t checkEveryHalf(bool f16c)
+{
+   std::vector<uint16_t> halves(0x10000);
+   for (size_t n = 0; n < halves.size(); n++) {
+      halves[n] = static_cast<uint16_t>(n);
+   }
+   std::vector<float> floats(halves.size());
+   GEToIsmrmrd::halfToFloat(floats.data(), halves.data(), halves.size());
+   std::vector<uint16_t> back(halves.size());
+   GEToIsmrmrd::floatToHalf(back.data(), floats.data(), floats.size());
+
+   size_t failures = 0;
+   for (size_t n = 0; n < halves.size() && failures < 10; n++) {
+      float const expected = static_cast<float>(referenceHalfValue(halves[n]));
+      if (!sameFloat(floats[n], expected) || (f16c && !sameFloat(floats[n], f16cFloat(halves[n])))) {
+         std::cerr << "halfToFloat(0x" << std::hex << halves[n] << std::dec << ") = " << floats[n] << std::endl;
+         failures++;
+      }
+      if (!sameHalf(back[n], halves[n])) {
+         std::cerr << "floatToHalf(halfToFloat(0x" << std::hex << halves[n] << ")) = 0x" << back[n]
+                   << std::dec << std::endl;
+         failures++;
+      }
+   }
+   return failures;
+}
+
+/**
+ * Rounds floats around every half - the halves themselves, their midpoints
+ * (the ties) and the floats next to both - and random bit patterns, and
+ * compares them with the search and, if the CPU has it, with F16C
+ */
+size_t checkRounding(bool f16c)
+{
+   std::vector<float> values;
+   for (uint16_t half = 0; half < HALF_MAX_BITS; half++) {
+      float const value = static_cast<float>(referenceHalfValue(half));
+      float const midpoint = static_cast<float>(
+         (referenceHalfValue(half) + referenceHalfValue(static_cast<uint16_t>(half + 1))) / 2);
+      float const points[2] = { value, midpoint };
+      for (size_t p = 0; p < 2; p++) {
+         values.push_back(points[p]);
+         values.push_back(std::nextafter(points[p], 0.0f));
+         values.push_back(std::nextafter(points[p], HUGE_VALF));
+      }
+   }
+   float const specials[] = { 65504.0f, 65519.99f, 65520.0f, 65536.0f, FLT_MAX, FLT_MIN, bitsFloat(1),
+                              HUGE_VALF, std::numeric_limits<float>::quiet_NaN(), 1e-8f, 2.98e-8f, 2.99e-8f };
+   values.insert(values.end(), specials, specials + sizeof(specials) / sizeof(specials[0]));
+
+   uint32_t state = 12345;
+   for (size_t n = 0; n < (1 << 20); n++) {
+      state = state * 1664525u + 1013904223u;
+      values.push_back(bitsFloat(state));
+   }
+
+   size_t const count = values.size();
+   for (size_t n = 0; n < count; n++) {
+      values.push_back(-values[n]);
+   }
+
+   std::vector<uint16_t> halves(values.size());
+   GEToIsmrmrd::floatToHalf(halves.data(), values.data(), values.size());
+
+   size_t failures = 0;
+   for (size_t n = 0; n < values.size() && failures < 10; n++) {
+      uint16_t const expected = referenceHalf(values[n]);
+      if (!sameHalf(halves[n], expected) || (f16c && !sameHalf(halves[n], f16cHalf(values[n])))) {
+         std::cerr << "floatToHalf(" << values[n] << ") = 0x" << std::hex << halves[n] << ", 0x" << expected
+                   << " expected" << std::dec << std::endl;
+         failures++;
+      }
+   }
+
+   // Lengths around the vector width reach the scalar tail at every offset
+   for (size_t n = 0; n <= 17; n++) {
+      std::vector<uint16_t> part(n + 1, 0xabcd);
+      GEToIsmrmrd::floatToHalf(part.data(), values.data() + 3, n);
+      for (size_t i = 0; i < n; i++) {
+         failures += sameHalf(part[i], halves[3 + i]) ? 0 : 1;
+      }
+      failures += (part[n] == 0xabcd) ? 0 : 1;
+   }
+   return failures;
+}
+
+size_t expect(bool condition, const char* what)
+{
+   if (!condition) {
+      std::cerr << what << std::endl;
+      return 1;
+   }
+   return 0;
+}
+
+/** int16 scale, rounding and saturation */
+size_t checkInt16()
+{
+   size_t failures = 0;
+
+   float const values[] = { 3.0f, -7.0f, 2.0f };
+   float const scale = GEToIsmrmrd::int16Scale(values, 3);
+   failures += expect(scale == 7.0f / 32767.0f, "int16Scale maps the largest magnitude onto 32767");
+
+   float const zeros[] = { 0.0f, -0.0f };
+   failures += expect(GEToIsmrmrd::int16Scale(zeros, 2) == 1.0f, "int16Scale of zeros is 1");
+   failures += expect(GEToIsmrmrd::int16Scale(zeros, 0) == 1.0f, "int16Scale of nothing is 1");
+   float const infinite[] = { 1.0f, HUGE_VALF };
+   failures += expect(GEToIsmrmrd::int16Scale(infinite, 2) == 1.0f, "int16Scale of an infinity is 1");
+
+   int16_t stored[3];
+   GEToIsmrmrd::floatToInt16(stored, values, 3, scale);
+   failures += expect(stored[0] == 14043 && stored[1] == -32767 && stored[2] == 9362,
+                      "floatToInt16 rounds onto the scaled range");
+
+   // Ties to even, symmetric saturation, NaN as 0
+   float const edges[] = { 0.5f, 1.5f, -2.5f, 40000.0f, -40000.0f, 32767.4f, -32767.6f,
+                           HUGE_VALF, -HUGE_VALF, std::numeric_limits<float>::quiet_NaN() };
+   int16_t const expected[] = { 0, 2, -2, 32767, -32767, 32767, -32767, 32767, -32767, 0 };
+   size_t const n = sizeof(edges) / sizeof(edges[0]);
+   int16_t saturated[n];
+   GEToIsmrmrd::floatToInt16(saturated, edges, n, 1.0f);
+   for (size_t i = 0; i < n; i++) {
+      if (saturated[i] != expected[i]) {
+         std::cerr << "floatToInt16(" << edges[i] << ") = " << saturated[i] << ", " << expected[i]
+                   << " expected" << std::endl;
+         failures++;
+      }
+   }
+
+   // Decoding is off by at most half a step
+   std::vector<float> samples(4096);
+   uint32_t state = 777;
+   for (size_t i = 0; i < samples.size(); i++) {
+      state = state * 1664525u + 1013904223u;
+      samples[i] = (static_cast<int32_t>(state) / 2147483648.0f) * 1e-3f;
+   }
+   float const samplesScale = GEToIsmrmrd::int16Scale(samples.data(), samples.size());
+   std::vector<int16_t> encoded(samples.size());
+   GEToIsmrmrd::floatToInt16(encoded.data(), samples.data(), samples.size(), samplesScale);
+   std::vector<float> decoded(samples.size());
+   GEToIsmrmrd::int16ToFloat(decoded.data(), encoded.data(), encoded.size(), samplesScale);
+   for (size_t i = 0; i < samples.size(); i++) {
+      if (std::fabs(decoded[i] - samples[i]) > samplesScale * 0.5f * (1.0f + 1e-5f)) {
+         std::cerr << "int16 round trip of " << samples[i] << " gives " << decoded[i] << std::endl;
+         failures++;
+         break;
+      }
+   }
+   return failures;
+}
+
+} // namespace
+
+/**
+ * Checks the half precision conversions picked for this CPU against a
+ * reference rounding and against F16C, and the int16 encoding.  Run under
+ * G2I_SAMPLE_ENCODING=scalar to test the scalar conversions.
+ */
+int main()
+{
+   bool const f16c = hasF16c();
+   std::cout << "Sample encoding: " << GEToIsmrmrd::sampleEncodingIsa()
+             << (f16c ? ", compared with F16C" : ", F16C not available") << std::endl;
+
+   size_t failures = 0;
+   failures += checkEveryHalf(f16c);
+   failures += checkRounding(f16c);
+   failures += checkInt16();
+
+   if (failures > 0) {
+      std::cerr << failures << " sample encoding results differ" << std::endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+/** @file SampleKernelsTest.cpp */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Local
+#include "SampleKernels.h"
+
+typedef std::complex<float> Sample;
+
+namespace {
+
+/** Samples past the end of a destination, which no kernel may touch */
+const size_t GUARD = 16;
+
+const Sample GUARD_VALUE(12345.0f, -54321.0f);
+
+/**
+ * Gathers n samples with gatherSamples() and checks them, bit for bit,
+ * against the plain loop the kernels replace
+ *
+ * @returns true if they match and nothing past dst[n - 1] was written
+ */
+bool checkGather(size_t n, std::ptrdiff_t stride, bool negate)
+{
+   size_t const span = (n == 0) ? 1 : (n - 1) * static_cast<size_t>(std::labs(stride)) + 1;
+   std::vector<Sample> source(span);
+   for (size_t k = 0; k < span; k++) {
+      // Signed zeros and both signs, so a negation cannot be mistaken for abs()
+      source[k] = Sample((k % 7 == 0) ? -0.0f : 0.25f * k - 3.0f, (k % 5 == 0) ? 0.0f : 7.5f - 0.5f * k);
+   }
+   const Sample* src = (stride < 0) ? &source[span - 1] : &source[0];
+
+   std::vector<Sample> expected(n + GUARD, GUARD_VALUE);
+   for (size_t i = 0; i < n; i++) {
+      Sample const value = src[static_cast<std::ptrdiff_t>(i) * stride];
+      expected[i] = negate ? -value : value;
+   }
+
+   std::vector<Sample> actual(n + GUARD, GUARD_VALUE);
+   GEToIsmrmrd::gatherSamples(actual.data(), src, stride, n, negate);
+
+   if (memcmp(actual.data(), expected.data(), actual.size() * sizeof(Sample)) != 0) {
+      std::cerr << "gatherSamples(n=" << n << ", stride=" << stride << ", negate=" << negate
+                << ") differs from the scalar result" << std::endl;
+      return false;
+   }
+   return true;
+}
+
+} // namespace
+
+/**
+ * Compares the sample kernels picked for this CPU with plain loops, over the
+ * lengths around every vector width and the strides the view copies use.
+ * Run under G2I_SAMPLE_KERNELS=scalar|avx2|avx512f to test each set.
+ */
+int main()
+{
+   std::cout << "Sample kernels: " << GEToIsmrmrd::sampleKernelsIsa() << std::endl;
+
+   std::ptrdiff_t const strides[] = { 1, -1, 2, -2, 3, -5, 16, -64 };
+   std::vector<size_t> lengths;
+   for (size_t n = 0; n <= 40; n++) {
+      lengths.push_back(n);
+   }
+   lengths.push_back(255);
+   lengths.push_back(1024);
+   lengths.push_back(1031);
+
+   size_t failures = 0;
+   for (size_t s = 0; s < sizeof(strides) / sizeof(strides[0]); s++) {
+      for (size_t l = 0; l < lengths.size(); l++) {
+         failures += checkGather(lengths[l], strides[s], false) ? 0 : 1;
+         failures += checkGather(lengths[l], strides[s], true) ? 0 : 1;
+      }
+   }
+
+   if (failures > 0) {
+      std::cerr << failures << " kernel results differ" << std::endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}